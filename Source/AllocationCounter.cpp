@@ -0,0 +1,154 @@
+/*
+  ==============================================================================
+
+    AllocationCounter.cpp
+    Replacements of the global operator new and operator delete that count
+    the allocations of the whole process.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "AllocationCounter.h"
+#include "RealtimeChecker.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// Replacing the global operators costs every allocation of the process, so release builds only
+// count for soak tests, built with BRT_COUNT_ALLOCATIONS=1, or with the real-time checks, which use them
+#ifndef BRT_COUNT_ALLOCATIONS
+ #if JUCE_DEBUG || BRT_REALTIME_CHECKS
+  #define BRT_COUNT_ALLOCATIONS 1
+ #else
+  #define BRT_COUNT_ALLOCATIONS 0
+ #endif
+#endif
+
+#if BRT_COUNT_ALLOCATIONS
+
+namespace
+{
+    std::atomic<juce::int64> allocations{ 0 };
+    std::atomic<juce::int64> deallocations{ 0 };
+    std::atomic<juce::int64> bytesAllocated{ 0 };
+
+    /// Where the C library is not interposed, allocations in real-time code are checked here
+    void checkRealtime(const char* call) noexcept
+    {
+       #if BRT_REALTIME_CHECKS && ! BRT_REALTIME_CHECKS_INTERCEPT_LIBC
+        RealtimeChecker::check(call);
+       #else
+        juce::ignoreUnused(call);
+       #endif
+    }
+
+    void* allocate(std::size_t size) noexcept
+    {
+        checkRealtime("operator new");
+        void* p = std::malloc(size > 0 ? size : 1);
+        if (p != nullptr)
+        {
+            allocations.fetch_add(1, std::memory_order_relaxed);
+            bytesAllocated.fetch_add((juce::int64) size, std::memory_order_relaxed);
+        }
+        return p;
+    }
+
+    void* allocateAligned(std::size_t size, std::align_val_t alignment) noexcept
+    {
+        checkRealtime("operator new");
+        const auto align = juce::jmax((std::size_t) alignment, sizeof(void*));
+       #if JUCE_WINDOWS
+        void* p = _aligned_malloc(size > 0 ? size : 1, align);
+       #else
+        void* p = nullptr;
+        if (posix_memalign(&p, align, size > 0 ? size : 1) != 0)
+            p = nullptr;
+       #endif
+        if (p != nullptr)
+        {
+            allocations.fetch_add(1, std::memory_order_relaxed);
+            bytesAllocated.fetch_add((juce::int64) size, std::memory_order_relaxed);
+        }
+        return p;
+    }
+
+    void release(void* p) noexcept
+    {
+        if (p == nullptr)
+            return;
+        checkRealtime("operator delete");
+        deallocations.fetch_add(1, std::memory_order_relaxed);
+        std::free(p);
+    }
+
+    void releaseAligned(void* p) noexcept
+    {
+        if (p == nullptr)
+            return;
+        checkRealtime("operator delete");
+        deallocations.fetch_add(1, std::memory_order_relaxed);
+       #if JUCE_WINDOWS
+        _aligned_free(p);
+       #else
+        std::free(p);
+       #endif
+    }
+
+    void* allocateOrThrow(std::size_t size)
+    {
+        if (void* p = allocate(size))
+            return p;
+        throw std::bad_alloc();
+    }
+
+    void* allocateAlignedOrThrow(std::size_t size, std::align_val_t alignment)
+    {
+        if (void* p = allocateAligned(size, alignment))
+            return p;
+        throw std::bad_alloc();
+    }
+}
+
+//==============================================================================
+void* operator new(std::size_t size)                                                   { return allocateOrThrow(size); }
+void* operator new[](std::size_t size)                                                 { return allocateOrThrow(size); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept                   { return allocate(size); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept                 { return allocate(size); }
+void* operator new(std::size_t size, std::align_val_t a)                               { return allocateAlignedOrThrow(size, a); }
+void* operator new[](std::size_t size, std::align_val_t a)                             { return allocateAlignedOrThrow(size, a); }
+void* operator new(std::size_t size, std::align_val_t a, const std::nothrow_t&) noexcept   { return allocateAligned(size, a); }
+void* operator new[](std::size_t size, std::align_val_t a, const std::nothrow_t&) noexcept { return allocateAligned(size, a); }
+
+void operator delete(void* p) noexcept                                                 { release(p); }
+void operator delete[](void* p) noexcept                                               { release(p); }
+void operator delete(void* p, std::size_t) noexcept                                    { release(p); }
+void operator delete[](void* p, std::size_t) noexcept                                  { release(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept                          { release(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept                        { release(p); }
+void operator delete(void* p, std::align_val_t) noexcept                               { releaseAligned(p); }
+void operator delete[](void* p, std::align_val_t) noexcept                             { releaseAligned(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept                  { releaseAligned(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept                { releaseAligned(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept        { releaseAligned(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept      { releaseAligned(p); }
+
+AllocationCounter::Counts AllocationCounter::get() noexcept
+{
+    Counts counts;
+    counts.allocations = allocations.load(std::memory_order_relaxed);
+    counts.deallocations = deallocations.load(std::memory_order_relaxed);
+    counts.bytesAllocated = bytesAllocated.load(std::memory_order_relaxed);
+    return counts;
+}
+
+bool AllocationCounter::isEnabled() noexcept    { return true; }
+
+#else
+
+AllocationCounter::Counts AllocationCounter::get() noexcept    { return {}; }
+bool AllocationCounter::isEnabled() noexcept                   { return false; }
+
+#endif
@@ -0,0 +1,39 @@
+/*
+  ==============================================================================
+
+    AllocationCounter.h
+    Process-wide count of heap allocations made through operator new, for
+    soak tests and leak hunting.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+//==============================================================================
+/**
+    Counts of the calls to the global operator new and operator delete, which are
+    replaced in AllocationCounter.cpp. Every thread updates the counts with relaxed
+    atomic increments, so they cost a few nanoseconds per allocation.
+
+    The replacement is compiled in debug builds and with the real-time checks. Release
+    builds meant for soak tests define BRT_COUNT_ALLOCATIONS to 1.
+    Memory allocated with malloc directly, as C libraries do, is not counted.
+*/
+namespace AllocationCounter
+{
+    struct Counts
+    {
+        juce::int64 allocations = 0;
+        juce::int64 deallocations = 0;
+        juce::int64 bytesAllocated = 0;     // Total requested, not freed, since the start
+
+        juce::int64 getLiveAllocations() const noexcept { return allocations - deallocations; }
+    };
+
+    /// Counts since the start of the process
+    Counts get() noexcept;
+
+    /// False if the counting operators are not compiled in, then all the counts are 0
+    bool isEnabled() noexcept;
+}
@@ -0,0 +1,419 @@
+/*
+  ==============================================================================
+
+    BRIREnvironment.h
+    Room reverberation of a shared send through a binaural room impulse
+    response without its direct sound, with the first partitions convolved on
+    the audio thread and the rest on background threads.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include "SofaMeasurements.h"
+#include "HRTFBundle.h"
+#include "RealtimeChecker.h"
+
+//==============================================================================
+/**
+    Uniformly partitioned overlap-save convolution of a mono send with a stereo BRIR,
+    split between the audio thread and a set of tail workers.
+
+    The BRIR is cut into partitions of one block, transformed once when the convolver
+    is built. The send is collected into whole blocks, so the device may deliver blocks
+    of any size, at the cost of one block of latency that is taken off the silent start
+    of the BRIR when there is one. Partitions before the first sound are skipped.
+    Every block the audio thread transforms the send, stores the spectrum in
+    a frequency-domain delay line and convolves the first EARLY_PARTITIONS partitions
+    itself. The contribution of partition p >= EARLY_PARTITIONS to the output of block m
+    only needs the send up to block m - p, so the whole tail of output block
+    m + EARLY_PARTITIONS can be computed as soon as block m has been received: the
+    workers have EARLY_PARTITIONS - 1 block periods to deliver it. The tail partitions
+    are split evenly between the workers, each of which accumulates its share of the
+    spectra, transforms it back and leaves the result in a slot the audio thread adds
+    to the output, tagged with the block it belongs to. The audio thread wakes the workers
+    once a block is published, and they sleep in between. A worker that misses its
+    deadline skips ahead to the newest block and the audio thread, which never waits,
+    counts the missing contribution as late.
+
+    Everything is allocated in the constructor. The send spectra and the filter are
+    written before the block counter is published and never modified while a worker
+    may read them.
+*/
+class PartitionedBRIRConvolver
+{
+public:
+    static constexpr int EARLY_PARTITIONS = 4;
+
+    /// leftIR and rightIR are the BRIR at the device sample rate
+    PartitionedBRIRConvolver(const std::vector<float>& leftIR, const std::vector<float>& rightIR, int blockSize, int numWorkers)
+        : block(blockSize),
+          spectrumSize(4 * blockSize),
+          latencyShift(juce::jmin((size_t) blockSize, leadingZeros(leftIR, rightIR))),
+          numPartitions(juce::jmax(1, (int) ((juce::jmax(leftIR.size(), rightIR.size()) - latencyShift + (size_t) blockSize - 1) / (size_t) blockSize))),
+          firstPartition(juce::jmin(numPartitions - 1, (int) ((leadingZeros(leftIR, rightIR) - latencyShift) / (size_t) blockSize))),
+          numEarly(juce::jmin(EARLY_PARTITIONS, numPartitions)),
+          delayLineSize(numPartitions + EARLY_PARTITIONS + 2)
+    {
+        // Filter spectra, partition by partition, zero padded to twice the block. The BRIR starts
+        // latencyShift samples late, to make up for the block collected before it is convolved.
+        CMonoBuffer<float> padded((size_t) (2 * block));
+        for (int ear = 0; ear < 2; ++ear)
+        {
+            const auto& ir = ear == 0 ? leftIR : rightIR;
+            filter[ear].resize((size_t) numPartitions);
+            for (int p = 0; p < numPartitions; ++p)
+            {
+                std::fill(padded.begin(), padded.end(), 0.f);
+                const size_t start = latencyShift + (size_t) p * (size_t) block;
+                if (start < ir.size())
+                    std::copy(ir.begin() + (ptrdiff_t) start, ir.begin() + (ptrdiff_t) juce::jmin(ir.size(), start + (size_t) block), padded.begin());
+                Common::CFprocessor::CalculateFFT(padded, filter[ear][(size_t) p]);
+            }
+        }
+        for (auto& samples : pending)
+            samples.assign((size_t) block, 0.f);
+
+        sendHistory.assign((size_t) (2 * block), 0.f);
+        sendSpectra.resize((size_t) delayLineSize);
+        for (auto& spectrum : sendSpectra)
+            spectrum.assign((size_t) spectrumSize, 0.f);
+        for (auto& spectrum : earlyAccumulator)
+            spectrum.assign((size_t) spectrumSize, 0.f);
+        for (auto& ear : earlyOutput)
+            ear.assign((size_t) (2 * block), 0.f);
+
+        // Tail partitions split evenly between the workers, from the first one with sound
+        const int firstTail = juce::jmax(numEarly, firstPartition);
+        const int numTail = numPartitions - firstTail;
+        const int workersNeeded = numTail > 0 ? juce::jlimit(1, juce::jmax(1, numWorkers), numTail) : 0;
+        for (int w = 0; w < workersNeeded; ++w)
+        {
+            const int first = firstTail + numTail * w / workersNeeded;
+            const int last = firstTail + numTail * (w + 1) / workersNeeded;
+            workers.add(new TailWorker(*this, w, first, last));
+        }
+        for (auto* worker : workers)
+            worker->startThread(juce::Thread::Priority::high);
+    }
+
+    ~PartitionedBRIRConvolver()
+    {
+        workers.clear();    // Each worker stops its thread
+    }
+
+    //==========================================================================
+    /// Convolve the send and add the result to the left and right outputs. Audio thread, blocks of
+    /// any size: the send is collected into blocks of the size the convolver was built for, and each
+    /// one is convolved when complete, its result played during the next one.
+    void process(const float* send, float* left, float* right, int numSamples) noexcept
+    {
+        for (int done = 0; done < numSamples;)
+        {
+            const int n = juce::jmin(numSamples - done, block - pendingSamples);
+            std::copy(send + done, send + done + n, pending[0].begin() + pendingSamples);
+            juce::FloatVectorOperations::add(left + done, pending[1].data() + pendingSamples, n);
+            juce::FloatVectorOperations::add(right + done, pending[2].data() + pendingSamples, n);
+            pendingSamples += n;
+            done += n;
+            if (pendingSamples == block)
+            {
+                processBlock(pending[0].data(), pending[1].data(), pending[2].data());
+                pendingSamples = 0;
+            }
+        }
+    }
+
+    int getNumPartitions() const noexcept          { return numPartitions; }
+    int getNumEarlyPartitions() const noexcept     { return numEarly; }
+    int getNumWorkers() const noexcept             { return workers.size(); }
+    int getBlockSize() const noexcept              { return block; }
+
+    /// Tail contributions that were not ready in time, summed over the workers
+    juce::int64 getLateTailBlocks() const noexcept { return lateTailBlocks.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr int OUTPUT_SLOTS = EARLY_PARTITIONS + 2;
+
+    /// Samples before the first one that is not zero, in either ear
+    static size_t leadingZeros(const std::vector<float>& leftIR, const std::vector<float>& rightIR) noexcept
+    {
+        size_t n = 0;
+        while ((n >= leftIR.size() || leftIR[n] == 0.f) && (n >= rightIR.size() || rightIR[n] == 0.f)
+               && n < juce::jmax(leftIR.size(), rightIR.size()))
+            ++n;
+        return n;
+    }
+
+    /// Convolve a whole block of the send into the left and right result of the block
+    void processBlock(const float* send, float* left, float* right) noexcept
+    {
+        // Overlap-save input: previous block and current block
+        std::copy(sendHistory.begin() + block, sendHistory.end(), sendHistory.begin());
+        std::copy(send, send + block, sendHistory.begin() + block);
+        const juce::int64 m = blocksWritten.load(std::memory_order_relaxed);
+        auto& spectrum = sendSpectra[(size_t) (m % delayLineSize)];
+        Common::CFprocessor::CalculateFFT(sendHistory, spectrum);
+        blocksWritten.store(m + 1, std::memory_order_release);
+        {
+            // Signalling takes the mutex of each worker's event, which a worker only holds to start waiting
+            const RealtimeChecker::ScopedDisable wakingTheWorkers;
+            for (auto* worker : workers)
+                worker->notify();
+        }
+
+        // Early partitions, unless the BRIR is silent for all of them
+        std::fill(left, left + block, 0.f);
+        std::fill(right, right + block, 0.f);
+        if (firstPartition < numEarly)
+        {
+            for (int ear = 0; ear < 2; ++ear)
+            {
+                auto& accumulator = earlyAccumulator[ear];
+                std::fill(accumulator.begin(), accumulator.end(), 0.f);
+                for (int p = firstPartition; p < numEarly && p <= m; ++p)
+                    multiplyAdd(sendSpectra[(size_t) ((m - p) % delayLineSize)], filter[ear][(size_t) p], accumulator);
+                Common::CFprocessor::CalculateIFFT(accumulator, earlyOutput[ear]);
+                std::copy(earlyOutput[ear].begin() + block, earlyOutput[ear].begin() + 2 * block, ear == 0 ? left : right);
+            }
+        }
+
+        // Tail computed by the workers from the send of EARLY_PARTITIONS blocks ago
+        const juce::int64 job = m - EARLY_PARTITIONS;
+        if (job < 0)
+            return;
+        for (auto* worker : workers)
+        {
+            const auto slotIndex = (size_t) (m % OUTPUT_SLOTS);
+            if (worker->outputJob[slotIndex].load(std::memory_order_acquire) == job)
+            {
+                const auto& slot = worker->output[slotIndex];
+                juce::FloatVectorOperations::add(left, slot[0].data(), block);
+                juce::FloatVectorOperations::add(right, slot[1].data(), block);
+            }
+            else
+            {
+                lateTailBlocks.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /// accumulator += a * b, interleaved complex spectra
+    static void multiplyAdd(const CMonoBuffer<float>& a, const CMonoBuffer<float>& b, CMonoBuffer<float>& accumulator) noexcept
+    {
+        const size_t n = juce::jmin(a.size(), b.size(), accumulator.size());
+        for (size_t i = 0; i + 1 < n; i += 2)
+        {
+            accumulator[i] += a[i] * b[i] - a[i + 1] * b[i + 1];
+            accumulator[i + 1] += a[i] * b[i + 1] + a[i + 1] * b[i];
+        }
+    }
+
+    //==========================================================================
+    class TailWorker : public juce::Thread
+    {
+    public:
+        TailWorker(PartitionedBRIRConvolver& c, int index, int firstPartition, int lastPartition)
+            : juce::Thread("BRIR tail " + juce::String(index)), owner(c), first(firstPartition), last(lastPartition)
+        {
+            for (auto& slot : output)
+                for (auto& ear : slot)
+                    ear.assign((size_t) owner.block, 0.f);
+            for (auto& job : outputJob)
+                job.store(-1);
+            for (auto& spectrum : accumulator)
+                spectrum.assign((size_t) owner.spectrumSize, 0.f);
+            for (auto& ear : timeDomain)
+                ear.assign((size_t) (2 * owner.block), 0.f);
+        }
+
+        ~TailWorker() override { stopThread(2000); }
+
+        void run() override
+        {
+            juce::int64 next = 0;
+            while (! threadShouldExit())
+            {
+                // A block published after this check has signalled the event already
+                const juce::int64 available = owner.blocksWritten.load(std::memory_order_acquire);
+                if (available <= next)
+                {
+                    wait(-1);
+                    continue;
+                }
+
+                // Skip the jobs whose output is already due, the audio thread has counted them as late
+                next = juce::jmax(next, available - 1);
+                const auto slotIndex = (size_t) ((next + EARLY_PARTITIONS) % OUTPUT_SLOTS);
+                outputJob[slotIndex].store(-1, std::memory_order_release);
+                compute(next, output[slotIndex]);
+                outputJob[slotIndex].store(next, std::memory_order_release);
+                ++next;
+            }
+        }
+
+        std::array<std::array<CMonoBuffer<float>, 2>, OUTPUT_SLOTS> output;
+        std::array<std::atomic<juce::int64>, OUTPUT_SLOTS> outputJob;     // Job whose tail is in each slot, -1 while written
+
+    private:
+        /// Tail of output block job + EARLY_PARTITIONS from this worker's partitions
+        void compute(juce::int64 job, std::array<CMonoBuffer<float>, 2>& slot)
+        {
+            const juce::int64 target = job + EARLY_PARTITIONS;
+            for (int ear = 0; ear < 2; ++ear)
+            {
+                std::fill(accumulator[ear].begin(), accumulator[ear].end(), 0.f);
+                for (int p = first; p < last && target - p >= 0; ++p)
+                    multiplyAdd(owner.sendSpectra[(size_t) ((target - p) % owner.delayLineSize)], owner.filter[ear][(size_t) p], accumulator[ear]);
+                Common::CFprocessor::CalculateIFFT(accumulator[ear], timeDomain[ear]);
+                std::copy(timeDomain[ear].begin() + owner.block, timeDomain[ear].begin() + 2 * owner.block, slot[(size_t) ear].begin());
+            }
+        }
+
+        PartitionedBRIRConvolver& owner;
+        const int first, last;
+        std::array<CMonoBuffer<float>, 2> accumulator, timeDomain;
+    };
+
+    //==========================================================================
+    const int block;
+    const int spectrumSize;                             // Floats in a spectrum of two blocks, interleaved complex
+    const size_t latencyShift;                          // Samples of silence taken off the start of the BRIR
+    const int numPartitions;
+    const int firstPartition;                           // First partition with sound
+    const int numEarly;
+    const int delayLineSize;
+
+    std::array<std::vector<CMonoBuffer<float>>, 2> filter;     // Partition spectra of each ear
+    std::vector<CMonoBuffer<float>> sendSpectra;                // Frequency-domain delay line of the send
+    std::atomic<juce::int64> blocksWritten{ 0 };
+
+    // Audio thread only
+    CMonoBuffer<float> sendHistory;
+    std::array<CMonoBuffer<float>, 2> earlyAccumulator, earlyOutput;
+    std::array<std::vector<float>, 3> pending;          // Send being collected, and the left and right result being played
+    int pendingSamples = 0;
+    std::atomic<juce::int64> lateTailBlocks{ 0 };
+
+    juce::OwnedArray<TailWorker> workers;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(PartitionedBRIRConvolver)
+};
+
+//==============================================================================
+/**
+    The room of the listener: a BRIR loaded from a SOFA file and the convolver built
+    from it for the current device configuration.
+
+    Sources contribute to a mono send, and the room response of the send is added to
+    the binaural output of the HRTF listener. Of the measurements in the file, the one
+    closest to straight ahead of the listener is used. The HRTF listener already renders
+    the direct sound of every source from its own direction, so the direct sound of the
+    BRIR is windowed out, up to DIRECT_SOUND_SECONDS after its onset and with a short
+    fade, and the convolver skips the silence before it. The early reflections stay, in
+    the early partitions the audio thread convolves, and the late reverberation follows
+    on the tail workers. The BRIR is kept at its measured
+    rate and resampled when a convolver is built for another one, which happens off
+    the audio thread; the component swaps convolvers under the audio callback lock.
+    Loading is done on the message thread.
+*/
+class BRIREnvironment
+{
+public:
+    /// Read the frontal BRIR of a SOFA file. Returns an error message, empty on success.
+    juce::String load(const juce::File& file)
+    {
+        SofaMeasurements all;
+        const auto error = SofaMeasurements::load(file, all, true);
+        if (error.isNotEmpty())
+            return error;
+        if (all.directions.empty() || all.sampleRate <= 0.0)
+            return file.getFileName() + " has no impulse responses";
+
+        // Straight ahead is azimuth 0, elevation 0
+        size_t front = 0;
+        double bestCosine = -2.0;
+        for (size_t m = 0; m < all.directions.size(); ++m)
+        {
+            const double cosine = std::cos(juce::degreesToRadians((double) all.directions[m].elevation))
+                                * std::cos(juce::degreesToRadians((double) all.directions[m].azimuth));
+            if (cosine > bestCosine)
+            {
+                bestCosine = cosine;
+                front = m;
+            }
+        }
+
+        // One measurement, with its onset delays written into the responses
+        SofaMeasurements brir;
+        brir.directions = { all.directions[front] };
+        brir.distances = { all.distances[front] };
+        brir.sampleRate = all.sampleRate;
+        const int leftDelay = juce::roundToInt(juce::jmax(0.f, all.leftDelay[front]));
+        const int rightDelay = juce::roundToInt(juce::jmax(0.f, all.rightDelay[front]));
+        brir.irLength = all.irLength + juce::jmax(leftDelay, rightDelay);
+        brir.leftIR.assign((size_t) brir.irLength, 0.f);
+        brir.rightIR.assign((size_t) brir.irLength, 0.f);
+        std::copy(all.getIR((int) front, true), all.getIR((int) front, true) + all.irLength, brir.leftIR.begin() + leftDelay);
+        std::copy(all.getIR((int) front, false), all.getIR((int) front, false) + all.irLength, brir.rightIR.begin() + rightDelay);
+        brir.leftDelay = { 0.f };
+        brir.rightDelay = { 0.f };
+
+        // Onset of the direct sound, 20 dB below the peak, then the reflections from the end of the direct sound
+        float peak = 0.f;
+        for (const auto* ir : { &brir.leftIR, &brir.rightIR })
+            for (const float sample : *ir)
+                peak = juce::jmax(peak, std::abs(sample));
+        int onset = 0;
+        while (onset < brir.irLength && std::abs(brir.leftIR[(size_t) onset]) < 0.1f * peak && std::abs(brir.rightIR[(size_t) onset]) < 0.1f * peak)
+            ++onset;
+        const int reflectionsStart = onset + juce::roundToInt(DIRECT_SOUND_SECONDS * brir.sampleRate);
+        const int fade = juce::roundToInt(DIRECT_SOUND_FADE_SECONDS * brir.sampleRate);
+        if (reflectionsStart + fade >= brir.irLength)
+            return file.getFileName() + " has no room response after the direct sound";
+        for (auto* ir : { &brir.leftIR, &brir.rightIR })
+        {
+            std::fill(ir->begin(), ir->begin() + reflectionsStart, 0.f);
+            for (int n = 0; n < fade; ++n)
+                (*ir)[(size_t) (reflectionsStart + n)] *= 0.5f - 0.5f * std::cos(juce::MathConstants<float>::pi * (float) n / (float) fade);
+        }
+
+        measured = std::make_shared<const SofaMeasurements>(std::move(brir));
+        file_ = file;
+        return {};
+    }
+
+    bool isLoaded() const noexcept                      { return measured != nullptr; }
+    const juce::File& getFile() const noexcept          { return file_; }
+    double getLengthSeconds() const noexcept            { return measured != nullptr ? measured->irLength / measured->sampleRate : 0.0; }
+
+    /// The frontal BRIR at its measured rate, kept alive by the pointer if another file is loaded
+    std::shared_ptr<const SofaMeasurements> getBRIR() const     { return measured; }
+
+    /// Build a convolver of a BRIR for a device configuration, resampling it if needed. Any thread.
+    static std::unique_ptr<PartitionedBRIRConvolver> makeConvolver(std::shared_ptr<const SofaMeasurements> brir,
+                                                                   double sampleRate, int blockSize)
+    {
+        if (brir == nullptr || blockSize <= 0)
+            return nullptr;
+        if (juce::roundToInt(brir->sampleRate) != juce::roundToInt(sampleRate))
+            brir = std::make_shared<const SofaMeasurements>(HRTFBundle::resample(*brir, sampleRate));
+        const std::vector<float> left(brir->getIR(0, true), brir->getIR(0, true) + brir->irLength);
+        const std::vector<float> right(brir->getIR(0, false), brir->getIR(0, false) + brir->irLength);
+        const int numWorkers = juce::jlimit(1, MAX_TAIL_WORKERS, juce::SystemStats::getNumCpus() - 1);
+        return std::make_unique<PartitionedBRIRConvolver>(left, right, blockSize, numWorkers);
+    }
+
+private:
+    static constexpr int MAX_TAIL_WORKERS = 4;
+    static constexpr double DIRECT_SOUND_SECONDS = 0.0025;  // After the onset, the HRIR's main peak, before the first reflections of most rooms
+    static constexpr double DIRECT_SOUND_FADE_SECONDS = 0.001;  // Raised cosine into the reflections
+
+    std::shared_ptr<const SofaMeasurements> measured;   // Frontal BRIR at its measured rate
+    juce::File file_;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(BRIREnvironment)
+};
@@ -0,0 +1,111 @@
+/*
+  ==============================================================================
+
+    BRTBufferBinding.h
+    Binds JUCE audio buffers to the buffers BRT sources read from and the
+    listener writes to, without per-sample copy loops or allocations.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+//==============================================================================
+/**
+    Input of one BRT source, exposed as a JUCE buffer.
+
+    The samples live in the CMonoBuffer that is handed to the source, and getChannelInfo()
+    returns a juce::AudioBuffer that refers to that memory, so an AudioSource renders
+    straight into the source input. Storage is reserved in prepare() and never grows
+    on the audio thread.
+*/
+class SourceInputBinding
+{
+public:
+    /// Reserve storage for the largest block. Call from prepareToPlay.
+    void prepare(int maximumBlockSize)
+    {
+        samples.assign((size_t) maximumBlockSize, 0.f);
+    }
+
+    /// Buffer to render the next block into. Audio thread.
+    juce::AudioSourceChannelInfo getChannelInfo(int numSamples) noexcept
+    {
+        jassert((size_t) numSamples <= samples.capacity());
+        samples.resize((size_t) numSamples);    // Within the reserved capacity, does not allocate
+        float* channels[] = { samples.data() };
+        view.setDataToReferTo(channels, 1, numSamples);
+        return juce::AudioSourceChannelInfo(&view, 0, numSamples);
+    }
+
+    /// Take the next block from a device channel, one vectorised copy. Audio thread.
+    void copyFrom(const float* source, int numSamples) noexcept
+    {
+        jassert((size_t) numSamples <= samples.capacity());
+        samples.resize((size_t) numSamples);
+        juce::FloatVectorOperations::copy(samples.data(), source, numSamples);
+    }
+
+    /// Silence for the next block. Audio thread.
+    void clear(int numSamples) noexcept
+    {
+        jassert((size_t) numSamples <= samples.capacity());
+        samples.assign((size_t) numSamples, 0.f);
+    }
+
+    /// Scale the block in place
+    void applyGain(float gain) noexcept
+    {
+        if (gain != 1.f)
+            juce::FloatVectorOperations::multiply(samples.data(), gain, (int) samples.size());
+    }
+
+    /// Hand the block to a BRT source
+    void submit(BRTSourceModel::CSourceSimpleModel& source)    { source.SetBuffer(samples); }
+
+    CMonoBuffer<float>& getBuffer() noexcept                   { return samples; }
+
+private:
+    CMonoBuffer<float> samples;
+    juce::AudioBuffer<float> view;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SourceInputBinding)
+};
+
+//==============================================================================
+/**
+    Output of a BRT listener, written into a region of a JUCE output buffer.
+
+    BRT hands out the ear signals by filling caller-owned CMonoBuffers, so the ears are
+    received into buffers reserved in prepare() and moved to the output channels with one
+    vectorised copy each, starting at the sample offset the device asked for.
+*/
+class ListenerOutputBinding
+{
+public:
+    void prepare(int maximumBlockSize)
+    {
+        ears.left.reserve((size_t) maximumBlockSize);
+        ears.right.reserve((size_t) maximumBlockSize);
+    }
+
+    /// Write the ear signals of the last processed block to channels 0 (left) and 1 (right)
+    /// of the destination, from startSample. Audio thread.
+    void render(BRTListenerModel::CListenerHRTFbasedModel& listener, const juce::AudioSourceChannelInfo& destination) noexcept
+    {
+        listener.GetBuffers(ears.left, ears.right);
+        const int numSamples = juce::jmin(destination.numSamples, (int) ears.left.size(), (int) ears.right.size());
+        juce::FloatVectorOperations::copy(destination.buffer->getWritePointer(0, destination.startSample), ears.left.data(), numSamples);
+        juce::FloatVectorOperations::copy(destination.buffer->getWritePointer(1, destination.startSample), ears.right.data(), numSamples);
+        if (numSamples < destination.numSamples)
+        {
+            destination.buffer->clear(0, destination.startSample + numSamples, destination.numSamples - numSamples);
+            destination.buffer->clear(1, destination.startSample + numSamples, destination.numSamples - numSamples);
+        }
+    }
+
+private:
+    Common::CEarPair<CMonoBuffer<float>> ears;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ListenerOutputBinding)
+};
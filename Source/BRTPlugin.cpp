@@ -0,0 +1,23 @@
+/*
+  ==============================================================================
+
+    BRTPlugin.cpp
+    Entry point of the plug-in target.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "BRTPlugin.h"
+
+juce::AudioProcessorEditor* BRTPluginProcessor::createEditor()
+{
+    return new BRTPluginEditor(*this);
+}
+
+//==============================================================================
+/// Called by the plug-in wrappers to create each new instance
+juce::AudioProcessor* JUCE_CALLTYPE createPluginFilter()
+{
+    return new BRTPluginProcessor();
+}
@@ -0,0 +1,553 @@
+/*
+  ==============================================================================
+
+    BRTPlugin.h
+    The binaural renderer as an audio plug-in: one BRT source at a position
+    set by the host, rendered with an HRTF shared by all the instances.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <limits>
+#include <mutex>
+#include <JuceHeader.h>
+#include <BRTLibrary.h>
+#include "SceneKernels.h"
+#include "BRTBufferBinding.h"
+#include "ProcessHRTFCache.h"
+
+//==============================================================================
+/**
+    Renders a mono track (stereo tracks are mixed down) to a binaural stereo signal,
+    with the source at the azimuth, elevation and distance of its parameters.
+
+    Everything an instance needs is built in prepareToPlay: its BRT manager, listener and
+    source, the buffers BRT reads from and writes to, and the HRTF, which comes from the
+    ProcessHRTFCache so that all the instances rendering with the same SOFA file at the
+    same rate share one copy. What an instance owns is a few blocks of samples and BRT's
+    per-source state, so an additional instance costs next to no memory; the HRTF, which
+    is megabytes, is paid once per process.
+
+    BRT processes blocks of one size and at one sample rate, set in its global parameters,
+    and those parameters are shared by the whole process. The first instance prepared sets
+    them, every instance renders in blocks of BLOCK_SIZE whatever the host's block size is,
+    and an instance the host prepares at another sample rate while instances at the first
+    one are prepared is rejected: it plays silence and its editor says why.
+
+    BRT passes its intermediate buffers by value and allocates while it renders, so it does
+    not run on the audio thread. processBlock collects the host's samples into blocks of
+    BLOCK_SIZE and hands each one to the instance's render thread, which renders it while
+    the next one is collected; processBlock then plays it during the block after, so the
+    latency reported to the host is two blocks. processBlock only copies samples into and
+    out of buffers allocated in prepareToPlay, and never waits in real time: a block the
+    render thread has not finished in time plays as silence and is counted as late. When
+    the host renders offline, processBlock waits for each block instead.
+*/
+class BRTPluginProcessor : public juce::AudioProcessor
+{
+public:
+    static constexpr int BLOCK_SIZE = 512;             // Samples, BRT's block for every instance in the process
+
+    BRTPluginProcessor()
+        : AudioProcessor(BusesProperties().withInput("Input", juce::AudioChannelSet::mono(), true)
+                                          .withOutput("Output", juce::AudioChannelSet::stereo(), true))
+    {
+        addParameter(azimuth = new juce::AudioParameterFloat(juce::ParameterID{ "azimuth", 1 }, "Azimuth",
+                                                             juce::NormalisableRange<float>(-180.f, 180.f), 0.f));
+        addParameter(elevation = new juce::AudioParameterFloat(juce::ParameterID{ "elevation", 1 }, "Elevation",
+                                                               juce::NormalisableRange<float>(-90.f, 90.f), 0.f));
+        addParameter(distance = new juce::AudioParameterFloat(juce::ParameterID{ "distance", 1 }, "Distance",
+                                                              juce::NormalisableRange<float>(0.1f, 10.f, 0.f, 0.5f), 1.f));
+        addParameter(nearField = new juce::AudioParameterBool(juce::ParameterID{ "nearField", 1 }, "Near-field correction", false));
+        setLatencySamples(2 * BLOCK_SIZE);
+    }
+
+    ~BRTPluginProcessor() override
+    {
+        releaseResources();
+    }
+
+    //==========================================================================
+    const juce::String getName() const override                     { return "BRT Binaural Renderer"; }
+    bool acceptsMidi() const override                               { return false; }
+    bool producesMidi() const override                              { return false; }
+    double getTailLengthSeconds() const override                    { return 0.0; }
+
+    int getNumPrograms() override                                   { return 1; }
+    int getCurrentProgram() override                                { return 0; }
+    void setCurrentProgram(int) override                            {}
+    const juce::String getProgramName(int) override                 { return {}; }
+    void changeProgramName(int, const juce::String&) override       {}
+
+    bool isBusesLayoutSupported(const BusesLayout& layouts) const override
+    {
+        const auto input = layouts.getMainInputChannelSet();
+        return layouts.getMainOutputChannelSet() == juce::AudioChannelSet::stereo()
+               && (input == juce::AudioChannelSet::mono() || input == juce::AudioChannelSet::stereo());
+    }
+
+    //==========================================================================
+    /// Build the BRT instance, fetch the HRTF for the sample rate and start the render thread.
+    /// Called by the host with the audio callback stopped.
+    void prepareToPlay(double sampleRate, int) override
+    {
+        releaseResources();
+        if (! claimProcessSampleRate(sampleRate))
+        {
+            lastError = "The host runs this instance at " + juce::String(sampleRate) + " Hz and other instances at "
+                        + juce::String(getProcessSampleRate().sampleRate) + " Hz. It is silent until they run at the same rate.";
+            rateRejected.store(true);
+            return;
+        }
+        rateRejected.store(false);
+
+        if (listener == nullptr || ! juce::approximatelyEqual(preparedSampleRate, sampleRate))
+        {
+            hrtf.reset();
+            source.reset();
+            listener.reset();
+            brtManager = std::make_unique<BRTBase::CBRTManager>();
+            brtManager->BeginSetup();
+            listener = brtManager->CreateListener<BRTListenerModel::CListenerHRTFbasedModel>("listener");
+            source = brtManager->CreateSoundSource<BRTSourceModel::CSourceSimpleModel>("input");
+            listener->ConnectSoundSource(source);
+            brtManager->EndSetup();
+            listener->SetListenerTransform(Common::CTransform());
+            nearFieldApplied = false;
+            appliedPosition = {};
+            preparedSampleRate = sampleRate;
+        }
+
+        sourceInput.prepare(BLOCK_SIZE);
+        sourceInput.clear(BLOCK_SIZE);
+        listenerOutput.prepare(BLOCK_SIZE);
+        collectedBlocks.setSize(BLOCK_SLOTS, BLOCK_SIZE);
+        collectedBlocks.clear();
+        for (int slot = 0; slot < BLOCK_SLOTS; ++slot)
+        {
+            renderedBlocks[(size_t) slot].setSize(2, BLOCK_SIZE);
+            renderedBlocks[(size_t) slot].clear();
+            renderedBlock[(size_t) slot].store(-1);
+        }
+        blocksCollected.store(0);
+        blocksRendered.store(0);
+        playing = nullptr;
+        filled = 0;
+
+        if (sofaFile != juce::File() && (! hrtf.isValid() || ! juce::approximatelyEqual(hrtfSampleRate, sampleRate)))
+            loadHRTF(sofaFile);
+
+        renderThread = std::make_unique<RenderThread>(*this);
+        renderThread->startThread(juce::Thread::Priority::high);
+    }
+
+    /// Stop the render thread and give up the process sample rate
+    void releaseResources() override
+    {
+        renderThread.reset();
+        releaseProcessSampleRate();
+    }
+
+    //==========================================================================
+    void processBlock(juce::AudioBuffer<float>& buffer, juce::MidiBuffer&) override
+    {
+        juce::ScopedNoDenormals noDenormals;
+        const int numSamples = buffer.getNumSamples();
+        const int inputChannels = getTotalNumInputChannels();
+
+        if (renderThread == nullptr || buffer.getNumChannels() < 2)
+        {
+            buffer.clear();
+            return;
+        }
+
+        for (int done = 0; done < numSamples;)
+        {
+            const juce::int64 block = blocksCollected.load(std::memory_order_relaxed);
+            if (filled == 0)
+                playing = takeRenderedBlock(block - 2);
+            const int count = juce::jmin(numSamples - done, BLOCK_SIZE - filled);
+
+            // Take the input before the output overwrites it, the buffer is shared
+            float* input = collectedBlocks.getWritePointer((int) (block % BLOCK_SLOTS), filled);
+            juce::FloatVectorOperations::copy(input, buffer.getReadPointer(0, done), count);
+            if (inputChannels > 1)
+            {
+                juce::FloatVectorOperations::add(input, buffer.getReadPointer(1, done), count);
+                juce::FloatVectorOperations::multiply(input, 0.5f, count);
+            }
+            for (int c = 0; c < 2; ++c)
+            {
+                if (playing != nullptr)
+                    buffer.copyFrom(c, done, *playing, c, filled, count);
+                else
+                    buffer.clear(c, done, count);
+            }
+
+            filled += count;
+            done += count;
+            if (filled == BLOCK_SIZE)
+            {
+                // Offline, the previous block is rendered before this one is handed over, so none is skipped
+                if (isNonRealtime())
+                    while (blocksRendered.load(std::memory_order_acquire) < block && renderThread->isThreadRunning())
+                        blockRendered.wait(100);
+                // Signalling takes the mutex of the render thread's event, which it only holds to start waiting
+                blocksCollected.store(block + 1, std::memory_order_release);
+                renderThread->notify();
+                filled = 0;
+            }
+        }
+        for (int c = 2; c < buffer.getNumChannels(); ++c)
+            buffer.clear(c, 0, numSamples);
+    }
+
+    //==========================================================================
+    bool hasEditor() const override                                 { return true; }
+    juce::AudioProcessorEditor* createEditor() override;
+
+    void getStateInformation(juce::MemoryBlock& destData) override
+    {
+        juce::XmlElement state("BRTPluginState");
+        state.setAttribute("sofaFile", sofaFile.getFullPathName());
+        for (auto* parameter : getParameters())
+            if (auto* withID = dynamic_cast<juce::AudioProcessorParameterWithID*>(parameter))
+                state.setAttribute(withID->paramID, (double) parameter->getValue());
+        copyXmlToBinary(state, destData);
+    }
+
+    void setStateInformation(const void* data, int sizeInBytes) override
+    {
+        const auto state = getXmlFromBinary(data, sizeInBytes);
+        if (state == nullptr || ! state->hasTagName("BRTPluginState"))
+            return;
+        for (auto* parameter : getParameters())
+            if (auto* withID = dynamic_cast<juce::AudioProcessorParameterWithID*>(parameter))
+                if (state->hasAttribute(withID->paramID))
+                    parameter->setValueNotifyingHost((float) state->getDoubleAttribute(withID->paramID));
+
+        const juce::File file(state->getStringAttribute("sofaFile"));
+        if (file != sofaFile && file.existsAsFile())
+            setSOFAFile(file);
+    }
+
+    //==========================================================================
+    /// Use another SOFA file. If the plug-in is prepared, its HRTF is taken from the process cache
+    /// now, which reads the file only if no other instance uses it. Message thread.
+    juce::String setSOFAFile(const juce::File& file)
+    {
+        sofaFile = file;
+        if (listener == nullptr || rateRejected.load())
+            return {};          // Loaded in prepareToPlay, once the sample rate is known and accepted
+        return loadHRTF(file);
+    }
+
+    const juce::File& getSOFAFile() const noexcept                  { return sofaFile; }
+    bool hasHRTF() const noexcept                                   { return hrtf.isValid(); }
+    const juce::String& getLastError() const noexcept               { return lastError; }
+
+    /// True if the host prepared this instance at a sample rate other than the one of the process
+    bool isRateRejected() const noexcept                            { return rateRejected.load(); }
+
+    /// Blocks played as silence because the render thread had not finished them in time
+    juce::int64 getLateBlocks() const noexcept                      { return lateBlocks.load(std::memory_order_relaxed); }
+
+    /// Instances of the plug-in sharing the HRTF of this one, this one included
+    int getNumInstancesSharingHRTF() const
+    {
+        return hrtf.getNumUsers();
+    }
+
+private:
+    static constexpr int BLOCK_SLOTS = 3;              // Blocks collected and rendered in flight: playing, rendering, collecting
+
+    struct Position
+    {
+        float azimuth = std::numeric_limits<float>::quiet_NaN(), elevation = 0.f, distance = 0.f;
+
+        bool operator!=(const Position& other) const noexcept
+        {
+            return azimuth != other.azimuth || elevation != other.elevation || distance != other.distance;
+        }
+    };
+
+    //==========================================================================
+    /// The sample rate BRT's global parameters are set to, and the instances prepared at it
+    struct ProcessSampleRate
+    {
+        std::mutex lock;
+        double sampleRate = 0.0;
+        int instances = 0;
+    };
+
+    static ProcessSampleRate& getProcessSampleRate()
+    {
+        static ProcessSampleRate processSampleRate;
+        return processSampleRate;
+    }
+
+    /// Prepare this instance at the sample rate of the process, or set it if no instance is
+    /// prepared. BRT's global parameters are only written then, while no instance renders.
+    bool claimProcessSampleRate(double sampleRate)
+    {
+        auto& process = getProcessSampleRate();
+        const std::lock_guard<std::mutex> lock(process.lock);
+        if (process.instances > 0 && ! juce::approximatelyEqual(process.sampleRate, sampleRate))
+            return false;
+        if (process.instances == 0)
+        {
+            process.sampleRate = sampleRate;
+            globalParameters.SetSampleRate((int) sampleRate);
+            globalParameters.SetBufferSize(BLOCK_SIZE);
+        }
+        ++process.instances;
+        holdsProcessSampleRate = true;
+        return true;
+    }
+
+    void releaseProcessSampleRate()
+    {
+        if (! holdsProcessSampleRate)
+            return;
+        auto& process = getProcessSampleRate();
+        const std::lock_guard<std::mutex> lock(process.lock);
+        --process.instances;
+        holdsProcessSampleRate = false;
+    }
+
+    //==========================================================================
+    /// Renders the collected blocks with BRT, off the audio thread. Like the BRIR tail workers,
+    /// it sleeps until a block is handed over, and skips ahead to the newest one if it falls
+    /// behind; the blocks it skips are counted as late by the audio thread.
+    class RenderThread : public juce::Thread
+    {
+    public:
+        explicit RenderThread(BRTPluginProcessor& p) : juce::Thread("BRT plug-in render"), owner(p) {}
+        ~RenderThread() override { stopThread(2000); }
+
+        void run() override
+        {
+            juce::int64 next = 0;
+            while (! threadShouldExit())
+            {
+                // A block handed over after this check has signalled the event already
+                const juce::int64 available = owner.blocksCollected.load(std::memory_order_acquire);
+                if (available <= next)
+                {
+                    wait(-1);
+                    continue;
+                }
+                next = juce::jmax(next, available - 1);
+                owner.renderBlock(next);
+                owner.blocksRendered.store(next + 1, std::memory_order_release);
+                owner.blockRendered.signal();
+                ++next;
+            }
+        }
+
+    private:
+        BRTPluginProcessor& owner;
+    };
+
+    /// The rendered block to play while the next one is collected, or nullptr if it is not ready.
+    /// Audio thread.
+    const juce::AudioBuffer<float>* takeRenderedBlock(juce::int64 block) noexcept
+    {
+        if (block < 0)
+            return nullptr;
+        const auto slot = (size_t) (block % BLOCK_SLOTS);
+        if (renderedBlock[slot].load(std::memory_order_acquire) == block)
+            return &renderedBlocks[slot];
+        lateBlocks.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    /// Render a collected block into its slot. Render thread.
+    void renderBlock(juce::int64 block)
+    {
+        const auto slot = (size_t) (block % BLOCK_SLOTS);
+        juce::FloatVectorOperations::copy(sourceInput.getBuffer().data(), collectedBlocks.getReadPointer((int) slot), BLOCK_SIZE);
+        if (blocksCollected.load(std::memory_order_acquire) >= block + BLOCK_SLOTS)
+            return;     // The audio thread is collecting into the slot again, this block is too late to play
+
+        auto& output = renderedBlocks[slot];
+        renderedBlock[slot].store(-1, std::memory_order_release);
+        {
+            const juce::ScopedLock lock(renderLock);
+            if (! hrtf.isValid())
+            {
+                output.clear();
+            }
+            else
+            {
+                const Position position{ azimuth->get(), elevation->get(), distance->get() };
+                if (position != appliedPosition)
+                {
+                    float x, y, z;
+                    SceneKernels::toCartesian(juce::degreesToRadians(position.azimuth), juce::degreesToRadians(position.elevation),
+                                              position.distance, 0.f, 0.f, 0.f, x, y, z);
+                    Common::CTransform sourceTransform;
+                    sourceTransform.SetPosition(Common::CVector3(x, y, z));
+                    source->SetSourceTransform(sourceTransform);
+                    appliedPosition = position;
+                }
+
+                const bool nearFieldOn = nearField->get();
+                if (nearFieldOn != nearFieldApplied)
+                {
+                    if (nearFieldOn)
+                        listener->EnableNearFieldEffect();
+                    else
+                        listener->DisableNearFieldEffect();
+                    nearFieldApplied = nearFieldOn;
+                }
+
+                sourceInput.submit(*source);
+                brtManager->ProcessAll();
+                listenerOutput.render(*listener, juce::AudioSourceChannelInfo(&output, 0, BLOCK_SIZE));
+            }
+        }
+        renderedBlock[slot].store(block, std::memory_order_release);
+    }
+
+    /// Take the HRTF of a file for the prepared sample rate from the process cache and give it to the
+    /// listener. The previous one is released after the swap, outside the render lock.
+    juce::String loadHRTF(const juce::File& file)
+    {
+        auto handle = ProcessHRTFCache::getInstance().getHRTF(file, preparedSampleRate, BLOCK_SIZE, lastError);
+        if (! handle.isValid())
+            return lastError;
+        lastError = {};
+        {
+            const juce::ScopedLock lock(renderLock);
+            listener->SetHRTF(handle.hrtf);
+            if (auto nearFieldTable = handle.hrtf->getNearFieldTable())
+                listener->SetNearFieldCompensationFilters(nearFieldTable);
+            std::swap(hrtf, handle);
+            hrtfSampleRate = preparedSampleRate;
+        }
+        return {};
+    }
+
+    Common::CGlobalParameters globalParameters;
+    bool holdsProcessSampleRate = false;
+    std::atomic<bool> rateRejected{ false };
+    std::unique_ptr<BRTBase::CBRTManager> brtManager;
+    std::shared_ptr<BRTListenerModel::CListenerHRTFbasedModel> listener;
+    std::shared_ptr<BRTSourceModel::CSourceSimpleModel> source;
+    double preparedSampleRate = 0.0;
+
+    juce::File sofaFile;
+    ProcessHRTFCache::Handle hrtf;
+    double hrtfSampleRate = 0.0;
+    juce::String lastError;
+    juce::CriticalSection renderLock;               // Held by the render thread while BRT renders a block
+
+    juce::AudioParameterFloat* azimuth = nullptr;
+    juce::AudioParameterFloat* elevation = nullptr;
+    juce::AudioParameterFloat* distance = nullptr;
+    juce::AudioParameterBool* nearField = nullptr;
+
+    // Render thread only
+    Position appliedPosition;
+    bool nearFieldApplied = false;
+    SourceInputBinding sourceInput;
+    ListenerOutputBinding listenerOutput;
+
+    // Blocks handed from the audio thread to the render thread and back, a slot per block modulo BLOCK_SLOTS
+    juce::AudioBuffer<float> collectedBlocks;                               // One channel per slot
+    std::array<juce::AudioBuffer<float>, BLOCK_SLOTS> renderedBlocks;
+    std::array<std::atomic<juce::int64>, BLOCK_SLOTS> renderedBlock;        // Block in each rendered slot, -1 while written
+    std::atomic<juce::int64> blocksCollected{ 0 };
+    std::atomic<juce::int64> blocksRendered{ 0 };
+    std::atomic<juce::int64> lateBlocks{ 0 };
+    juce::WaitableEvent blockRendered;
+
+    // Audio thread only
+    const juce::AudioBuffer<float>* playing = nullptr;     // Rendered block played while the current one is collected
+    int filled = 0;
+
+    std::unique_ptr<RenderThread> renderThread;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(BRTPluginProcessor)
+};
+
+//==============================================================================
+/**
+    Editor of the plug-in: a button to choose the SOFA file, the state of the shared HRTF,
+    and the host's generic controls for the parameters.
+*/
+class BRTPluginEditor : public juce::AudioProcessorEditor,
+                        private juce::Timer
+{
+public:
+    explicit BRTPluginEditor(BRTPluginProcessor& p)
+        : AudioProcessorEditor(p), plugin(p), parameters(p)
+    {
+        addAndMakeVisible(openSOFAButton);
+        openSOFAButton.setButtonText("Open SOFA file...");
+        openSOFAButton.onClick = [this] { openSOFAButtonClicked(); };
+
+        addAndMakeVisible(hrtfLabel);
+        addAndMakeVisible(parameters);
+
+        setSize(400, 90 + parameters.getHeight());
+        updateHRTFLabel();
+        startTimer(500);
+    }
+
+    void resized() override
+    {
+        openSOFAButton.setBounds(10, 10, getWidth() - 20, 20);
+        hrtfLabel.setBounds(10, 40, getWidth() - 20, 40);
+        parameters.setBounds(0, 90, getWidth(), getHeight() - 90);
+    }
+
+private:
+    void timerCallback() override                   { updateHRTFLabel(); }
+
+    void openSOFAButtonClicked()
+    {
+        chooser = std::make_unique<juce::FileChooser>("Select a SOFA file to load...", juce::File{}, "*.sofa");
+        auto chooserFlags = juce::FileBrowserComponent::openMode | juce::FileBrowserComponent::canSelectFiles;
+        chooser->launchAsync(chooserFlags, [this](const juce::FileChooser& fc)
+        {
+            auto file = fc.getResult();
+            if (file == juce::File{})
+                return;
+            const auto error = plugin.setSOFAFile(file);
+            if (error.isNotEmpty())
+                juce::AlertWindow::showMessageBoxAsync(juce::AlertWindow::WarningIcon, "Error", "Error loading SOFA file: " + error);
+            updateHRTFLabel();
+        });
+    }
+
+    void updateHRTFLabel()
+    {
+        juce::String text;
+        if (plugin.isRateRejected())
+            text = plugin.getLastError();
+        else if (plugin.getSOFAFile() == juce::File())
+            text = "No SOFA file";
+        else if (! plugin.hasHRTF())
+            text = plugin.getSOFAFile().getFileName() + (plugin.getLastError().isNotEmpty() ? ": " + plugin.getLastError()
+                                                                                                 : juce::String(" (waiting for the host)"));
+        else
+            text = plugin.getSOFAFile().getFileName() + "\nShared by " + juce::String(plugin.getNumInstancesSharingHRTF())
+                   + " instance(s), " + juce::String(ProcessHRTFCache::getInstance().getNumFilesInUse()) + " SOFA file(s) in the process, "
+                   + juce::String(plugin.getLateBlocks()) + " late block(s)";
+        hrtfLabel.setText(text, juce::dontSendNotification);
+    }
+
+    BRTPluginProcessor& plugin;
+    juce::TextButton openSOFAButton;
+    juce::Label hrtfLabel;
+    juce::GenericAudioProcessorEditor parameters;
+    std::unique_ptr<juce::FileChooser> chooser;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(BRTPluginEditor)
+};
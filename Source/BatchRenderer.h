@@ -0,0 +1,321 @@
+/*
+  ==============================================================================
+
+    BatchRenderer.h
+    Offline render of a mono stimulus through every HRTF of a job at a grid of
+    positions, one independent task per HRTF and position, on all cores.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <atomic>
+#include "SceneKernels.h"
+#include "HRTFSettings.h"
+
+//==============================================================================
+/**
+    Batch stimulus generation.
+
+    A job is a JSON file:
+
+        {
+          "stimulus":       "noise.wav",                        mono, at the sample rate of the SOFA files
+          "hrtfs":          [ "a.sofa", "b.sofa" ],
+          "azimuths":       { "from": 0, "to": 330, "step": 30 },   degrees, or a list [0, 90, ...]
+          "elevations":     [ -30, 0, 30 ],                     degrees
+          "distance":       1.0,                                metres
+          "output":         "renders",                          directory, relative to the job file
+          "format":         "wav",                              or "flac"
+          "blockSize":      512,
+          "resamplingStep": 15,
+          "tail":           0.5,                                seconds rendered after the stimulus ends
+          "threads":        0                                   0 uses every core
+        }
+
+    Every HRTF and position becomes a task with its own CBRTManager, listener and source.
+    The HRTFs and the stimulus are loaded once and shared read-only by all the tasks.
+    Each task streams its output block by block to a ".partial" file that is renamed
+    when it is complete, so a job that is interrupted can be run again and only the
+    missing renders are produced.
+*/
+namespace BatchRenderer
+{
+    struct Job
+    {
+        juce::File stimulus;
+        juce::Array<juce::File> hrtfFiles;
+        std::vector<float> azimuths, elevations;    // Degrees
+        float distance = 1.f;
+        juce::File outputDirectory;
+        juce::String format = "wav";
+        int blockSize = 512;
+        int resamplingStep = 15;
+        double tailSeconds = 0.5;
+        int numThreads = 0;
+    };
+
+    /// Angles from either a list or a { from, to, step } range
+    inline bool parseAngles(const juce::var& value, std::vector<float>& angles)
+    {
+        angles.clear();
+        if (auto* list = value.getArray())
+        {
+            for (const auto& angle : *list)
+                angles.push_back((float) angle);
+        }
+        else if (value.isObject())
+        {
+            const float from = value["from"], to = value["to"], step = value.getProperty("step", 1.0);
+            if (step <= 0.f)
+                return false;
+            for (float angle = from; angle <= to + 1.0e-3f; angle += step)
+                angles.push_back(angle);
+        }
+        else if (! value.isVoid())
+        {
+            angles.push_back((float) value);
+        }
+        return ! angles.empty();
+    }
+
+    /// Read a job file. Returns an error message, empty on success.
+    inline juce::String parseJob(const juce::File& jobFile, Job& job)
+    {
+        const auto json = juce::JSON::parse(jobFile);
+        if (! json.isObject())
+            return "Cannot parse " + jobFile.getFullPathName();
+
+        const auto base = jobFile.getParentDirectory();
+        job.stimulus = base.getChildFile(json["stimulus"].toString());
+        if (auto* hrtfs = json["hrtfs"].getArray())
+            for (const auto& hrtf : *hrtfs)
+                job.hrtfFiles.add(base.getChildFile(hrtf.toString()));
+        if (job.hrtfFiles.isEmpty())
+            return "The job has no HRTFs";
+        if (! parseAngles(json["azimuths"], job.azimuths) || ! parseAngles(json["elevations"], job.elevations))
+            return "The job needs azimuths and elevations";
+
+        job.distance = (float) json.getProperty("distance", 1.0);
+        job.outputDirectory = base.getChildFile(json.getProperty("output", "renders").toString());
+        job.format = json.getProperty("format", "wav").toString().toLowerCase();
+        job.blockSize = json.getProperty("blockSize", 512);
+        job.resamplingStep = json.getProperty("resamplingStep", 15);
+        job.tailSeconds = json.getProperty("tail", 0.5);
+        job.numThreads = json.getProperty("threads", 0);
+        if (job.format != "wav" && job.format != "flac")
+            return "Unknown output format " + job.format;
+        return {};
+    }
+
+    //==========================================================================
+    /// Data shared read-only by all the tasks of a job
+    struct SharedData
+    {
+        Job job;
+        double sampleRate = 0.0;
+        juce::AudioBuffer<float> stimulus;
+        std::vector<std::shared_ptr<BRTServices::CHRTF>> hrtfs;
+        juce::StringArray hrtfNames;
+        std::atomic<int> completed{ 0 }, failed{ 0 };
+        std::atomic<juce::int64> renderedSamples{ 0 };
+    };
+
+    /// Render of one HRTF at one position into its own file
+    class RenderTask : public juce::ThreadPoolJob
+    {
+    public:
+        RenderTask(SharedData& sharedData, int hrtf, float azimuthDegrees, float elevationDegrees, const juce::File& output)
+            : juce::ThreadPoolJob(output.getFileName()), shared(sharedData), hrtfIndex(hrtf),
+              azimuth(azimuthDegrees), elevation(elevationDegrees), outputFile(output)
+        {
+        }
+
+        JobStatus runJob() override
+        {
+            if (render())
+                shared.completed.fetch_add(1);
+            else
+                shared.failed.fetch_add(1);
+            return jobHasFinished;
+        }
+
+    private:
+        bool render()
+        {
+            const auto& job = shared.job;
+
+            // Independent BRT instance for this task, sharing only the HRTF
+            BRTBase::CBRTManager manager;
+            manager.BeginSetup();
+            auto listener = manager.CreateListener<BRTListenerModel::CListenerHRTFbasedModel>("listener");
+            auto source = manager.CreateSoundSource<BRTSourceModel::CSourceSimpleModel>("stimulus");
+            listener->ConnectSoundSource(source);
+            manager.EndSetup();
+            listener->SetHRTF(shared.hrtfs[(size_t) hrtfIndex]);
+            listener->SetListenerTransform(Common::CTransform());
+
+            float x, y, z;
+            SceneKernels::toCartesian(juce::degreesToRadians(azimuth), juce::degreesToRadians(elevation), job.distance, 0.f, 0.f, 0.f, x, y, z);
+            Common::CTransform sourceTransform;
+            sourceTransform.SetPosition(Common::CVector3(x, y, z));
+            source->SetSourceTransform(sourceTransform);
+
+            // Stream the output to a partial file, renamed once complete
+            const auto partialFile = outputFile.withFileExtension(outputFile.getFileExtension() + ".partial");
+            partialFile.deleteFile();
+            std::unique_ptr<juce::AudioFormat> format;
+            if (job.format == "flac")
+                format = std::make_unique<juce::FlacAudioFormat>();
+            else
+                format = std::make_unique<juce::WavAudioFormat>();
+            auto stream = partialFile.createOutputStream();
+            if (stream == nullptr)
+                return false;
+            std::unique_ptr<juce::AudioFormatWriter> writer(format->createWriterFor(stream.get(), shared.sampleRate, 2, 24, {}, 0));
+            if (writer == nullptr)
+                return false;
+            stream.release();
+
+            const int stimulusLength = shared.stimulus.getNumSamples();
+            const int totalLength = stimulusLength + (int) (job.tailSeconds * shared.sampleRate);
+            CMonoBuffer<float> input((size_t) job.blockSize);
+            Common::CEarPair<CMonoBuffer<float>> ears;
+            juce::AudioBuffer<float> output(2, job.blockSize);
+
+            for (int position = 0; position < totalLength; position += job.blockSize)
+            {
+                if (shouldExit())
+                    return false;   // The partial file is left behind and rendered again next time
+
+                std::fill(input.begin(), input.end(), 0.f);
+                const int available = juce::jlimit(0, job.blockSize, stimulusLength - position);
+                if (available > 0)
+                    std::copy_n(shared.stimulus.getReadPointer(0, position), available, input.begin());
+
+                source->SetBuffer(input);
+                manager.ProcessAll();
+                listener->GetBuffers(ears.left, ears.right);
+
+                const int numSamples = juce::jmin(job.blockSize, totalLength - position);
+                output.copyFrom(0, 0, ears.left.data(), numSamples);
+                output.copyFrom(1, 0, ears.right.data(), numSamples);
+                if (! writer->writeFromAudioSampleBuffer(output, 0, numSamples))
+                    return false;
+                shared.renderedSamples.fetch_add(numSamples, std::memory_order_relaxed);
+            }
+
+            writer.reset();     // Flush and close before publishing the file
+            return partialFile.moveFileTo(outputFile);
+        }
+
+        SharedData& shared;
+        const int hrtfIndex;
+        const float azimuth, elevation;
+        const juce::File outputFile;
+    };
+
+    //==========================================================================
+    /// Load the shared data of a job. Returns an error message, empty on success.
+    inline juce::String load(SharedData& shared)
+    {
+        const auto& job = shared.job;
+        BRTReaders::CSOFAReader sofaReader;
+        for (const auto& file : job.hrtfFiles)
+        {
+            const int sofaSampleRate = sofaReader.GetSampleRateFromSofa(file.getFullPathName().toStdString());
+            if (sofaSampleRate <= 0)
+                return file.getFileName() + " does not contain a valid sample rate";
+            if (shared.sampleRate == 0.0)
+                shared.sampleRate = sofaSampleRate;
+            else if (sofaSampleRate != (int) shared.sampleRate)
+                return "All the SOFA files of a job must have the same sample rate";
+        }
+
+        // BRT global parameters apply to every instance, so they are set once for the whole job
+        Common::CGlobalParameters globalParameters;
+        globalParameters.SetSampleRate((int) shared.sampleRate);
+        globalParameters.SetBufferSize(job.blockSize);
+
+        for (const auto& file : job.hrtfFiles)
+        {
+            auto hrtf = std::make_shared<BRTServices::CHRTF>();
+            if (! sofaReader.ReadHRTFFromSofa(file.getFullPathName().toStdString(), hrtf, job.resamplingStep, HRTFEXTRAPOLATIONMETHOD))
+                return "Error loading " + file.getFileName();
+            shared.hrtfs.push_back(hrtf);
+            shared.hrtfNames.add(file.getFileNameWithoutExtension());
+        }
+
+        juce::AudioFormatManager formatManager;
+        formatManager.registerBasicFormats();
+        std::unique_ptr<juce::AudioFormatReader> reader(formatManager.createReaderFor(job.stimulus));
+        if (reader == nullptr)
+            return "Cannot read the stimulus " + job.stimulus.getFullPathName();
+        if (reader->numChannels != 1 || (int) reader->sampleRate != (int) shared.sampleRate)
+            return "The stimulus must be mono and at " + juce::String((int) shared.sampleRate) + " Hz";
+        shared.stimulus.setSize(1, (int) reader->lengthInSamples);
+        reader->read(&shared.stimulus, 0, (int) reader->lengthInSamples, 0, true, false);
+        return {};
+    }
+
+    /// Output of an HRTF at a grid position. The name carries the indices of the position in the grid,
+    /// which tell apart angles that round to the same tenth of a degree, and the rounded angles to read.
+    inline juce::File getOutputFile(const Job& job, const juce::String& hrtfName, int azimuthIndex, int elevationIndex)
+    {
+        const float azimuth = job.azimuths[(size_t) azimuthIndex], elevation = job.elevations[(size_t) elevationIndex];
+        return job.outputDirectory.getChildFile(hrtfName + "_" + juce::String(elevationIndex) + "-" + juce::String(azimuthIndex)
+                                                + "_az" + juce::String(azimuth, 1) + "_el" + juce::String(elevation, 1) + "." + job.format);
+    }
+
+    /// Run a job, printing progress to the console. Returns the report.
+    inline juce::String run(const juce::File& jobFile)
+    {
+        SharedData shared;
+        auto error = parseJob(jobFile, shared.job);
+        if (error.isEmpty())
+            error = load(shared);
+        if (error.isNotEmpty())
+            return "Batch render failed: " + error;
+
+        const auto& job = shared.job;
+        if (! job.outputDirectory.createDirectory())
+            return "Batch render failed: cannot create " + job.outputDirectory.getFullPathName();
+
+        const int numThreads = job.numThreads > 0 ? job.numThreads : juce::SystemStats::getNumCpus();
+        juce::ThreadPool pool(numThreads);
+        int numTasks = 0, skipped = 0;
+        for (int h = 0; h < (int) shared.hrtfs.size(); ++h)
+            for (int e = 0; e < (int) job.elevations.size(); ++e)
+                for (int a = 0; a < (int) job.azimuths.size(); ++a)
+                {
+                    const float azimuth = job.azimuths[(size_t) a], elevation = job.elevations[(size_t) e];
+                    const auto output = getOutputFile(job, shared.hrtfNames[h], a, e);
+                    if (output.existsAsFile())
+                    {
+                        ++skipped;      // Rendered by a previous run
+                        continue;
+                    }
+                    pool.addJob(new RenderTask(shared, h, azimuth, elevation, output), true);
+                    ++numTasks;
+                }
+
+        const double startMs = juce::Time::getMillisecondCounterHiRes();
+        while (pool.getNumJobs() > 0)
+        {
+            juce::Thread::sleep(500);
+            std::cout << "\r" << shared.completed.load() + shared.failed.load() << "/" << numTasks << " renders" << std::flush;
+        }
+        const double seconds = (juce::Time::getMillisecondCounterHiRes() - startMs) * 0.001;
+        std::cout << std::endl;
+
+        juce::String report;
+        report << "Batch render of " << jobFile.getFileName() << " on " << numThreads << " threads\n"
+               << "  " << shared.completed.load() << " rendered, " << shared.failed.load() << " failed, "
+               << skipped << " already done\n"
+               << "  " << juce::String(seconds, 1) << " s, "
+               << juce::String(shared.renderedSamples.load() / shared.sampleRate / juce::jmax(1.0e-3, seconds), 1) << "x real time\n"
+               << "  Output in " << job.outputDirectory.getFullPathName();
+        return report;
+    }
+}
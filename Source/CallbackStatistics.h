@@ -0,0 +1,135 @@
+/*
+  ==============================================================================
+
+    CallbackStatistics.h
+    Lock-free histogram of the duration of the audio callbacks, with deadline
+    misses, read periodically from the message thread.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cmath>
+
+//==============================================================================
+/**
+    Distribution of the time spent in the audio callback.
+
+    The audio thread adds every callback duration to a histogram with logarithmic
+    buckets, 16 per octave from 1 us to about 1 s, so percentiles are resolved to
+    about 4% without storing individual durations. A callback that takes longer than
+    the block period is counted as a deadline miss: with a real device it would have
+    caused a dropout. The message thread takes the counts and resets them, giving the
+    distribution over the interval since the previous read.
+*/
+class CallbackStatistics
+{
+public:
+    struct Snapshot
+    {
+        juce::int64 callbacks = 0;
+        juce::int64 deadlineMisses = 0;
+        double deadlineUs = 0.0;    // Block period
+        double meanUs = 0.0;
+        double p50Us = 0.0;
+        double p99Us = 0.0;
+        double p999Us = 0.0;
+        double maxUs = 0.0;
+    };
+
+    /// Measures the scope it lives in, normally the whole audio callback
+    class ScopedMeasurement
+    {
+    public:
+        explicit ScopedMeasurement(CallbackStatistics& s) noexcept
+            : statistics(s), startTicks(juce::Time::getHighResolutionTicks()) {}
+
+        ~ScopedMeasurement()
+        {
+            statistics.record(juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - startTicks) * 1.0e6);
+        }
+
+    private:
+        CallbackStatistics& statistics;
+        const juce::int64 startTicks;
+
+        JUCE_DECLARE_NON_COPYABLE(ScopedMeasurement)
+    };
+
+    //==========================================================================
+    /// Set the deadline from the block period. Called before the callbacks start.
+    void prepare(double sampleRate, int blockSize) noexcept
+    {
+        deadlineUs.store(sampleRate > 0.0 ? 1.0e6 * blockSize / sampleRate : 0.0);
+    }
+
+    /// Add the duration of one callback. Audio thread, lock-free.
+    void record(double microseconds) noexcept
+    {
+        const int bucket = microseconds <= 1.0 ? 0
+                         : juce::jmin(NUM_BUCKETS - 1, 1 + (int) (std::log2(microseconds) * BUCKETS_PER_OCTAVE));
+        counts[(size_t) bucket].fetch_add(1, std::memory_order_relaxed);
+        totalNs.fetch_add((juce::int64) (microseconds * 1000.0), std::memory_order_relaxed);
+
+        const double deadline = deadlineUs.load(std::memory_order_relaxed);
+        if (deadline > 0.0 && microseconds > deadline)
+            misses.fetch_add(1, std::memory_order_relaxed);
+
+        auto previousMax = maxNs.load(std::memory_order_relaxed);
+        const auto ns = (juce::int64) (microseconds * 1000.0);
+        while (ns > previousMax && ! maxNs.compare_exchange_weak(previousMax, ns, std::memory_order_relaxed)) {}
+    }
+
+    /// Distribution of the callbacks since the previous call. Message thread.
+    Snapshot getAndReset() noexcept
+    {
+        std::array<juce::int64, NUM_BUCKETS> taken;
+        Snapshot snapshot;
+        for (size_t b = 0; b < taken.size(); ++b)
+        {
+            taken[b] = counts[b].exchange(0, std::memory_order_relaxed);
+            snapshot.callbacks += taken[b];
+        }
+        snapshot.deadlineMisses = misses.exchange(0, std::memory_order_relaxed);
+        snapshot.deadlineUs = deadlineUs.load();
+        snapshot.maxUs = (double) maxNs.exchange(0, std::memory_order_relaxed) / 1000.0;
+        const auto sumNs = totalNs.exchange(0, std::memory_order_relaxed);
+        if (snapshot.callbacks == 0)
+            return snapshot;
+
+        snapshot.meanUs = (double) sumNs / 1000.0 / (double) snapshot.callbacks;
+        snapshot.p50Us = percentile(taken, snapshot.callbacks, 0.5);
+        snapshot.p99Us = percentile(taken, snapshot.callbacks, 0.99);
+        snapshot.p999Us = percentile(taken, snapshot.callbacks, 0.999);
+        return snapshot;
+    }
+
+private:
+    static constexpr int BUCKETS_PER_OCTAVE = 16;
+    static constexpr int NUM_BUCKETS = 2 + 20 * BUCKETS_PER_OCTAVE;
+
+    /// Upper edge of the bucket holding the given fraction of the callbacks
+    static double percentile(const std::array<juce::int64, NUM_BUCKETS>& taken, juce::int64 total, double fraction)
+    {
+        const auto rank = (juce::int64) std::ceil(fraction * (double) total);
+        juce::int64 seen = 0;
+        for (int b = 0; b < NUM_BUCKETS; ++b)
+        {
+            seen += taken[(size_t) b];
+            if (seen >= rank)
+                return std::exp2((double) b / BUCKETS_PER_OCTAVE);
+        }
+        return std::exp2((double) (NUM_BUCKETS - 1) / BUCKETS_PER_OCTAVE);
+    }
+
+    std::array<std::atomic<juce::int64>, NUM_BUCKETS> counts{};
+    std::atomic<juce::int64> totalNs{ 0 };
+    std::atomic<juce::int64> maxNs{ 0 };
+    std::atomic<juce::int64> misses{ 0 };
+    std::atomic<double> deadlineUs{ 0.0 };
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(CallbackStatistics)
+};
@@ -0,0 +1,310 @@
+/*
+  ==============================================================================
+
+    DecodedAudioCache.h
+    Audio files decoded to PCM on background threads, kept in RAM or in a spill
+    file under a memory budget, and an audio source that plays them.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <memory>
+
+//==============================================================================
+/**
+    The PCM samples of one audio file, filled in by a decoding thread.
+
+    The samples are planar float, channel after channel, either in a heap block or in a
+    temporary file mapped into memory. The length is known from the file header, so the
+    storage is sized before decoding, and the decoder publishes how many frames are
+    ready; readers may play the beginning of a file while the rest is being decoded.
+*/
+class DecodedAudio
+{
+public:
+    DecodedAudio(const juce::File& sourceFile, int channels, juce::int64 frames, double rate, bool inMemory)
+        : file(sourceFile), numChannels(channels), length(frames), sampleRate(rate)
+    {
+        const size_t bytes = getSizeInBytes();
+        if (inMemory)
+        {
+            memory.allocate((size_t) numChannels * (size_t) length, true);
+            data = memory.get();
+        }
+        else
+        {
+            spillFile = juce::File::createTempFile(".pcm");
+            {
+                juce::FileOutputStream out(spillFile);
+                if (out.openedOk() && bytes > 0)
+                {
+                    out.setPosition((juce::int64) bytes - 1);
+                    out.writeByte(0);
+                }
+            }
+            mapped = std::make_unique<juce::MemoryMappedFile>(spillFile, juce::MemoryMappedFile::readWrite);
+            if (mapped->getData() != nullptr && mapped->getSize() >= bytes)
+                data = static_cast<float*>(mapped->getData());
+        }
+    }
+
+    ~DecodedAudio()
+    {
+        mapped.reset();
+        if (spillFile != juce::File())
+            spillFile.deleteFile();
+    }
+
+    bool isValid() const noexcept                       { return data != nullptr; }
+    bool isInMemory() const noexcept                    { return mapped == nullptr; }
+    size_t getSizeInBytes() const noexcept              { return (size_t) numChannels * (size_t) length * sizeof(float); }
+
+    const float* getChannel(int channel) const noexcept { return data + (size_t) channel * (size_t) length; }
+    float* getChannelForDecoding(int channel) noexcept  { return data + (size_t) channel * (size_t) length; }
+
+    /// Frames decoded so far, which may be read from any thread
+    juce::int64 getNumDecoded() const noexcept          { return decoded.load(std::memory_order_acquire); }
+    bool isComplete() const noexcept                    { return getNumDecoded() >= length || failed.load(); }
+
+    /// True if the file could not be decoded to the end. The frames decoded before stay playable.
+    bool hasFailed() const noexcept                     { return failed.load(); }
+
+    /// Decoding speed, in seconds of audio per second of decoding
+    double getRealtimeFactor() const noexcept
+    {
+        const double seconds = decodeSeconds.load();
+        return seconds > 0.0 ? (double) getNumDecoded() / sampleRate / seconds : 0.0;
+    }
+
+    /// Decoding throughput, in megabytes of PCM per second
+    double getMegabytesPerSecond() const noexcept
+    {
+        const double seconds = decodeSeconds.load();
+        return seconds > 0.0 ? (double) getNumDecoded() * numChannels * sizeof(float) / (1024.0 * 1024.0) / seconds : 0.0;
+    }
+
+    const juce::File file;
+    const int numChannels;
+    const juce::int64 length;
+    const double sampleRate;
+
+private:
+    friend class DecodedAudioCache;
+
+    juce::HeapBlock<float> memory;
+    juce::File spillFile;
+    std::unique_ptr<juce::MemoryMappedFile> mapped;
+    float* data = nullptr;
+
+    std::atomic<juce::int64> decoded{ 0 };
+    std::atomic<double> decodeSeconds{ 0.0 };
+    std::atomic<bool> failed{ false };
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(DecodedAudio)
+};
+
+//==============================================================================
+/**
+    Decodes audio files on a pool of background threads and keeps the result while it is
+    in use.
+
+    A request for a file that is already decoded, or being decoded, returns the same
+    samples. New files are decoded into RAM while the decoded files held in RAM fit in
+    the memory budget, and into a spill file mapped into memory beyond it, which the
+    operating system pages in as it is played. Entries are held by the sources that play
+    them and freed with the last one; their names are pruned from the index as requests
+    come in. A file whose decoding failed is decoded again the next time it is requested.
+*/
+class DecodedAudioCache
+{
+public:
+    static constexpr size_t DEFAULT_MEMORY_BUDGET = (size_t) 512 * 1024 * 1024;
+
+    DecodedAudioCache(juce::AudioFormatManager& formatManager, size_t memoryBudgetBytes = DEFAULT_MEMORY_BUDGET)
+        : formats(formatManager), budget(memoryBudgetBytes),
+          decoders(juce::jlimit(1, MAX_DECODING_THREADS, juce::SystemStats::getNumCpus() - 1))
+    {
+    }
+
+    ~DecodedAudioCache()
+    {
+        decoders.removeAllJobs(true, 10000);
+    }
+
+    /// The decoded samples of a file, decoding it in the background if needed. Returns nullptr if
+    /// the file cannot be read, or if requiredChannels is not 0 and the file has another number of
+    /// channels, which is checked before anything is decoded. Message thread.
+    std::shared_ptr<DecodedAudio> request(const juce::File& file, juce::String& error, int requiredChannels = 0)
+    {
+        // Forget the files no longer played, whenever the index has doubled since the last time
+        if (entries.size() >= juce::jmax((size_t) MIN_ENTRIES_TO_PRUNE, 2 * entriesAfterPrune))
+        {
+            for (auto it = entries.begin(); it != entries.end();)
+                it = it->second.expired() ? entries.erase(it) : std::next(it);
+            entriesAfterPrune = entries.size();
+        }
+
+        auto& cached = entries[file.getFullPathName()];
+        if (auto existing = cached.lock(); existing != nullptr && ! existing->hasFailed())
+        {
+            if (! hasChannels(existing->numChannels, requiredChannels, file, error))
+                return nullptr;
+            return existing;
+        }
+
+        // Shared with the decoding job, which frees it when it ends or when it is dropped unrun
+        std::shared_ptr<juce::AudioFormatReader> reader(formats.createReaderFor(file));
+        if (reader == nullptr || reader->lengthInSamples <= 0)
+        {
+            error = "Could not read " + file.getFileName();
+            return nullptr;
+        }
+        if (! hasChannels((int) reader->numChannels, requiredChannels, file, error))
+            return nullptr;
+
+        const size_t bytes = (size_t) reader->numChannels * (size_t) reader->lengthInSamples * sizeof(float);
+        const bool inMemory = getMemoryUsage() + bytes <= budget;
+        auto entry = std::shared_ptr<DecodedAudio>(new DecodedAudio(file, (int) reader->numChannels, reader->lengthInSamples,
+                                                                    reader->sampleRate, inMemory),
+                                                   [this](DecodedAudio* decodedAudio)
+                                                   {
+                                                       if (decodedAudio->isInMemory())
+                                                           memoryInUse.fetch_sub(decodedAudio->getSizeInBytes());
+                                                       delete decodedAudio;
+                                                   });
+        if (inMemory)
+            memoryInUse.fetch_add(bytes);
+        if (! entry->isValid())
+        {
+            error = "No memory or disk space to decode " + file.getFileName();
+            return nullptr;
+        }
+
+        decoders.addJob([entry, reader]
+        {
+            decode(*entry, *reader);
+        });
+        cached = entry;
+        return entry;
+    }
+
+    /// Bytes of decoded audio held in RAM
+    size_t getMemoryUsage() const noexcept              { return memoryInUse.load(); }
+    size_t getMemoryBudget() const noexcept             { return budget; }
+
+private:
+    static constexpr int MAX_DECODING_THREADS = 4;
+    static constexpr int DECODE_CHUNK_FRAMES = 65536;
+    static constexpr int MIN_ENTRIES_TO_PRUNE = 16;
+
+    /// Check the number of channels of a file against the one required, if any
+    static bool hasChannels(int numChannels, int requiredChannels, const juce::File& file, juce::String& error)
+    {
+        if (requiredChannels == 0 || numChannels == requiredChannels)
+            return true;
+        error = requiredChannels == 1 ? file.getFileName() + " must be mono"
+                                      : file.getFileName() + " must have " + juce::String(requiredChannels) + " channels";
+        return false;
+    }
+
+    /// Decode the whole file, chunk by chunk, publishing the frames ready after each chunk
+    static void decode(DecodedAudio& entry, juce::AudioFormatReader& reader)
+    {
+        const double start = juce::Time::getMillisecondCounterHiRes();
+        juce::AudioBuffer<float> chunk(entry.numChannels, DECODE_CHUNK_FRAMES);
+        for (juce::int64 position = 0; position < entry.length; position += DECODE_CHUNK_FRAMES)
+        {
+            if (auto* job = juce::ThreadPoolJob::getCurrentThreadPoolJob(); job != nullptr && job->shouldExit())
+                return;
+            const int frames = (int) juce::jmin((juce::int64) DECODE_CHUNK_FRAMES, entry.length - position);
+            if (! reader.read(&chunk, 0, frames, position, true, true))
+            {
+                entry.failed.store(true);
+                return;
+            }
+            for (int c = 0; c < entry.numChannels; ++c)
+                juce::FloatVectorOperations::copy(entry.getChannelForDecoding(c) + position, chunk.getReadPointer(c), frames);
+            entry.decoded.store(position + frames, std::memory_order_release);
+            entry.decodeSeconds.store((juce::Time::getMillisecondCounterHiRes() - start) * 0.001);
+        }
+    }
+
+    juce::AudioFormatManager& formats;
+    const size_t budget;
+    std::atomic<size_t> memoryInUse{ 0 };
+    std::map<juce::String, std::weak_ptr<DecodedAudio>> entries;      // Message thread only
+    size_t entriesAfterPrune = 0;
+    juce::ThreadPool decoders;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(DecodedAudioCache)
+};
+
+//==============================================================================
+/**
+    Plays decoded samples from a DecodedAudioCache entry. Reading is a copy from memory;
+    frames that have not been decoded yet play as silence and are counted.
+*/
+class DecodedAudioSource : public juce::PositionableAudioSource
+{
+public:
+    explicit DecodedAudioSource(std::shared_ptr<DecodedAudio> decodedAudio) : audio(std::move(decodedAudio)) {}
+
+    void prepareToPlay(int, double) override    {}
+    void releaseResources() override            {}
+
+    void getNextAudioBlock(const juce::AudioSourceChannelInfo& info) override
+    {
+        auto& buffer = *info.buffer;
+        const juce::int64 ready = audio->getNumDecoded();
+        int done = 0;
+        while (done < info.numSamples)
+        {
+            juce::int64 position = readPosition.load(std::memory_order_relaxed);
+            if (position >= audio->length)
+            {
+                if (! looping || audio->length == 0)
+                    break;
+                position = 0;
+            }
+            const int count = (int) juce::jmin((juce::int64) (info.numSamples - done), audio->length - position);
+            const int available = (int) juce::jlimit((juce::int64) 0, (juce::int64) count, ready - position);
+            for (int c = 0; c < buffer.getNumChannels(); ++c)
+            {
+                const int sourceChannel = juce::jmin(c, audio->numChannels - 1);
+                if (available > 0)
+                    buffer.copyFrom(c, info.startSample + done, audio->getChannel(sourceChannel) + position, available);
+                if (available < count)
+                    buffer.clear(c, info.startSample + done + available, count - available);
+            }
+            if (available < count)
+                missingFrames.fetch_add(count - available, std::memory_order_relaxed);
+            readPosition.store(position + count, std::memory_order_relaxed);
+            done += count;
+        }
+        if (done < info.numSamples)
+            buffer.clear(info.startSample + done, info.numSamples - done);
+    }
+
+    void setNextReadPosition(juce::int64 newPosition) override  { readPosition.store(newPosition); }
+    juce::int64 getNextReadPosition() const override            { return readPosition.load(); }
+    juce::int64 getTotalLength() const override                 { return audio->length; }
+    bool isLooping() const override                             { return looping; }
+    void setLooping(bool shouldLoop) override                   { looping = shouldLoop; }
+
+    const DecodedAudio& getDecodedAudio() const noexcept        { return *audio; }
+
+    /// Frames played as silence because they were not decoded in time
+    juce::int64 getMissingFrames() const noexcept               { return missingFrames.load(std::memory_order_relaxed); }
+
+private:
+    std::shared_ptr<DecodedAudio> audio;
+    std::atomic<juce::int64> readPosition{ 0 };
+    std::atomic<juce::int64> missingFrames{ 0 };
+    bool looping = false;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(DecodedAudioSource)
+};
@@ -0,0 +1,345 @@
+/*
+  ==============================================================================
+
+    HRIRCache.h
+    Bounded, lock-free cache of interpolated HRIR partitions keyed by quantized
+    direction, and a CHRTF that consults it before interpolating.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cmath>
+#include <vector>
+#include "HRTFSpatialIndex.h"
+#include "LazyHRTFGrid.h"
+#include "NearFieldTable.h"
+
+//==============================================================================
+/**
+    Fixed-capacity cache of partitioned HRIRs. Each slot is protected by a sequence
+    counter (seqlock): writers claim a slot with a single compare-exchange and readers
+    retry nothing, a torn or busy slot is simply reported as a miss. No call blocks.
+    insert() never allocates; lookup() copies into the caller's vector and only allocates
+    when that vector is not already sized for the partitions, so a caller that keeps its
+    vector across lookups does not allocate either.
+*/
+class HRIRCache
+{
+public:
+    /// Quantized direction. Azimuth and elevation are in degrees, as used by BRTServices::CHRTF.
+    struct Key
+    {
+        int azimuth = 0;
+        int elevation = 0;
+        int distance = 0;
+        int ear = 0;
+
+        juce::uint64 pack() const noexcept
+        {
+            return ((juce::uint64) (juce::uint16) azimuth << 48) | ((juce::uint64) (juce::uint16) elevation << 32)
+                 | ((juce::uint64) (juce::uint16) distance << 16) | (juce::uint64) (juce::uint16) ear;
+        }
+    };
+
+    struct Statistics
+    {
+        juce::int64 hits = 0;
+        juce::int64 misses = 0;
+        juce::int64 inserts = 0;
+        juce::int64 evictions = 0;
+
+        float getHitRate() const noexcept { return hits + misses > 0 ? (float) hits / (float) (hits + misses) : 0.f; }
+    };
+
+    HRIRCache() = default;
+
+    //==========================================================================
+    /// Allocate the slots. Not real-time safe, call before the cache is used by the audio thread.
+    void prepare(int numberOfPartitions, int partitionLength, size_t memoryBudgetBytes, float angleStepDegrees = DEFAULT_ANGLE_STEP)
+    {
+        numPartitions = numberOfPartitions;
+        partitionSize = partitionLength;
+        angleStep = angleStepDegrees;
+
+        const size_t entryBytes = (size_t) juce::jmax(1, numPartitions * partitionSize) * sizeof(float);
+        const auto maxEntries = juce::jmax((size_t) MIN_ENTRIES, memoryBudgetBytes / entryBytes);
+        capacity = (int) juce::nextPowerOfTwo((int) maxEntries);
+        if ((size_t) capacity > maxEntries && capacity > MIN_ENTRIES)
+            capacity /= 2;      // Stay within the budget
+
+        slots = std::vector<Slot>((size_t) capacity);
+        data.assign((size_t) capacity * (size_t) numPartitions * (size_t) partitionSize, 0.f);
+        resetStatistics();
+    }
+
+    bool isPrepared() const noexcept { return capacity > 0; }
+
+    /// Snap a direction (degrees) and distance (metres) to the cache grid
+    Key quantize(float azimuth, float elevation, float distance, int ear) const noexcept
+    {
+        const int cells = juce::roundToInt(360.f / angleStep);
+        auto wrap = [cells](int i) { return ((i % cells) + cells) % cells; };
+        Key key;
+        key.azimuth = wrap(juce::roundToInt(azimuth / angleStep));
+        key.elevation = wrap(juce::roundToInt(elevation / angleStep));
+        // Distance in logarithmic steps of ~10%, 0 when the caller does not depend on distance
+        key.distance = distance > 0.f ? 1 + juce::jmax(0, juce::roundToInt(std::log(distance / MIN_DISTANCE) / std::log(1.1f))) : 0;
+        key.ear = ear;
+        return key;
+    }
+
+    /// Centre of the cell of a key, in degrees
+    float getCellAzimuth(const Key& key) const noexcept     { return key.azimuth * angleStep; }
+    float getCellElevation(const Key& key) const noexcept   { return key.elevation * angleStep; }
+
+    //==========================================================================
+    /// Copy the partitions stored for a key into the output, reusing its storage. Returns false on a miss.
+    bool lookup(const Key& key, std::vector<CMonoBuffer<float>>& partitions) const
+    {
+        if (! isPrepared())
+            return false;
+
+        const auto packed = key.pack();
+        for (int probe = 0; probe < PROBES; ++probe)
+        {
+            const auto index = getSlotIndex(packed, probe);
+            auto& slot = slots[index];
+
+            const auto before = slot.sequence.load(std::memory_order_acquire);
+            if ((before & 1) != 0 || slot.key.load(std::memory_order_relaxed) != packed)
+                continue;
+
+            copyOut(index, partitions);
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.sequence.load(std::memory_order_relaxed) == before)
+            {
+                hits.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    /// Store the partitions for a key. If the target slot is being written by another thread the
+    /// entry is dropped, the next request for the same direction will try again.
+    void insert(const Key& key, const std::vector<CMonoBuffer<float>>& partitions) noexcept
+    {
+        if (! isPrepared() || (int) partitions.size() != numPartitions)
+            return;
+
+        const auto packed = key.pack();
+        // Use a free slot among the probes if there is one, otherwise evict the first probe
+        auto index = getSlotIndex(packed, 0);
+        for (int probe = 0; probe < PROBES; ++probe)
+        {
+            const auto candidate = getSlotIndex(packed, probe);
+            if (slots[candidate].key.load(std::memory_order_relaxed) == EMPTY_KEY)
+            {
+                index = candidate;
+                break;
+            }
+        }
+
+        auto& slot = slots[index];
+        auto sequence = slot.sequence.load(std::memory_order_relaxed);
+        if ((sequence & 1) != 0 || ! slot.sequence.compare_exchange_strong(sequence, sequence + 1, std::memory_order_acquire))
+            return;
+
+        if (slot.key.load(std::memory_order_relaxed) != EMPTY_KEY)
+            evictions.fetch_add(1, std::memory_order_relaxed);
+
+        slot.key.store(packed, std::memory_order_relaxed);
+        float* dest = data.data() + index * (size_t) numPartitions * (size_t) partitionSize;
+        for (int p = 0; p < numPartitions; ++p)
+        {
+            const auto& partition = partitions[(size_t) p];
+            const int n = juce::jmin(partitionSize, (int) partition.size());
+            std::copy(partition.begin(), partition.begin() + n, dest + p * partitionSize);
+        }
+
+        slot.sequence.store(sequence + 2, std::memory_order_release);
+        inserts.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    //==========================================================================
+    Statistics getStatistics() const noexcept
+    {
+        return { hits.load(), misses.load(), inserts.load(), evictions.load() };
+    }
+
+    void resetStatistics() noexcept
+    {
+        hits.store(0); misses.store(0); inserts.store(0); evictions.store(0);
+    }
+
+    int getCapacity() const noexcept         { return capacity; }
+    size_t getMemoryUsage() const noexcept   { return data.size() * sizeof(float) + slots.size() * sizeof(Slot); }
+
+    static constexpr float DEFAULT_ANGLE_STEP = 1.f;        // degrees
+    static constexpr size_t DEFAULT_MEMORY_BUDGET = 16 * 1024 * 1024;
+
+private:
+    static constexpr juce::uint64 EMPTY_KEY = ~(juce::uint64) 0;
+    static constexpr int PROBES = 4;
+    static constexpr int MIN_ENTRIES = 64;
+    static constexpr float MIN_DISTANCE = 0.05f;
+
+    struct Slot
+    {
+        std::atomic<juce::uint32> sequence{ 0 };
+        std::atomic<juce::uint64> key{ EMPTY_KEY };
+    };
+
+    size_t getSlotIndex(juce::uint64 packed, int probe) const noexcept
+    {
+        // 64-bit mix (splitmix finaliser), then linear probing
+        auto h = packed ^ (packed >> 33);
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        return (size_t) ((h + (juce::uint64) probe) & (juce::uint64) (capacity - 1));
+    }
+
+    void copyOut(size_t index, std::vector<CMonoBuffer<float>>& partitions) const
+    {
+        const float* src = data.data() + index * (size_t) numPartitions * (size_t) partitionSize;
+        partitions.resize((size_t) numPartitions);
+        for (int p = 0; p < numPartitions; ++p)
+            partitions[(size_t) p].assign(src + p * partitionSize, src + (p + 1) * partitionSize);
+    }
+
+    int numPartitions = 0;
+    int partitionSize = 0;
+    int capacity = 0;
+    float angleStep = DEFAULT_ANGLE_STEP;
+
+    mutable std::vector<Slot> slots;
+    std::vector<float> data;
+
+    mutable std::atomic<juce::int64> hits{ 0 };
+    mutable std::atomic<juce::int64> misses{ 0 };
+    std::atomic<juce::int64> inserts{ 0 };
+    std::atomic<juce::int64> evictions{ 0 };
+
+    JUCE_DECLARE_NON_COPYABLE(HRIRCache)
+};
+
+//==============================================================================
+/**
+    HRTF whose interpolated partitions are served from an HRIRCache.
+
+    The listener asks the HRTF for the partitioned HRIR of every ear each time a source
+    moves. With runtime interpolation enabled, the request is snapped to the centre of
+    its cache cell, so repeated directions (slider drags, head tracking) cost a hash
+    lookup instead of a barycentric interpolation. Without interpolation BRT already
+    does a table lookup and the cache is bypassed. BRT takes the HRIR by value, so a hit
+    still allocates the returned vector, as BRT's own path does; what it saves is the
+    interpolation. The returned HRIR does not depend
+    on the source distance once the listener has projected the direction onto the
+    measurement sphere, so distance is not part of the key here.
+
+    In lazy mode the HRIRs and delays come from a LazyHRTFGrid instead, and BRT only
+    holds a coarse grid that is used until the first cells are ready.
+*/
+class CachedHRTF : public BRTServices::CHRTF
+{
+public:
+    CachedHRTF() = default;
+
+    /// Size the cache from the partition layout of the loaded HRTF. Call after the SOFA file is read.
+    void prepareCache(size_t memoryBudgetBytes = HRIRCache::DEFAULT_MEMORY_BUDGET)
+    {
+        const auto partitions = BRTServices::CHRTF::GetHRIR_partitioned(Common::T_ear::LEFT, 0.f, 0.f, false, Common::CTransform());
+        if (partitions.empty())
+            return;
+        cache.prepare((int) partitions.size(), (int) partitions.front().size(), memoryBudgetBytes);
+    }
+
+    const std::vector<CMonoBuffer<float>> GetHRIR_partitioned(Common::T_ear ear, float _azimuth, float _elevation,
+                                                              bool runTimeInterpolation, const Common::CTransform& _listenerLocation) const override
+    {
+        if (lazyGrid != nullptr)
+        {
+            std::vector<CMonoBuffer<float>> partitions;
+            if (lazyGrid->getPartitions(ear, _azimuth, _elevation, partitions))
+                return partitions;
+            return BRTServices::CHRTF::GetHRIR_partitioned(ear, _azimuth, _elevation, runTimeInterpolation, _listenerLocation);
+        }
+
+        if (! runTimeInterpolation || ! cache.isPrepared())
+            return BRTServices::CHRTF::GetHRIR_partitioned(ear, _azimuth, _elevation, runTimeInterpolation, _listenerLocation);
+
+        const auto key = cache.quantize(_azimuth, _elevation, 0.f, (int) ear);
+        std::vector<CMonoBuffer<float>> partitions;
+        if (cache.lookup(key, partitions))
+            return partitions;
+
+        partitions = BRTServices::CHRTF::GetHRIR_partitioned(ear, cache.getCellAzimuth(key), cache.getCellElevation(key),
+                                                             runTimeInterpolation, _listenerLocation);
+        cache.insert(key, partitions);
+        return partitions;
+    }
+
+    const float GetHRIRDelay(Common::T_ear ear, float _azimuthCenter, float _elevationCenter,
+                             bool runTimeInterpolation, const Common::CTransform& _listenerLocation) override
+    {
+        if (lazyGrid != nullptr)
+            return lazyGrid->getDelay(ear, _azimuthCenter, _elevationCenter);
+        return BRTServices::CHRTF::GetHRIRDelay(ear, _azimuthCenter, _elevationCenter, runTimeInterpolation, _listenerLocation);
+    }
+
+    const HRIRCache& getCache() const noexcept { return cache; }
+
+    /// Triangulate the measured directions for nearest-point and barycentric lookups. Built once,
+    /// after loading, and read-only from then on.
+    bool buildSpatialIndex(const std::vector<HRTFSpatialIndex::Direction>& measuredDirections)
+    {
+        return spatialIndex.build(measuredDirections);
+    }
+
+    const HRTFSpatialIndex& getSpatialIndex() const noexcept { return spatialIndex; }
+
+    /// Serve HRIRs from a grid resampled on demand instead of the one BRT built at load time.
+    /// Needs the spatial index and the measured impulse responses. Returns false, leaving the HRTF
+    /// unchanged, if the lazily computed partitions would not match BRT's layout.
+    bool enableLazyResampling(SofaMeasurements&& measurements, int gridStep, int bufferSize)
+    {
+        if (! spatialIndex.isBuilt())
+            return false;
+
+        const auto partitions = BRTServices::CHRTF::GetHRIR_partitioned(Common::T_ear::LEFT, 0.f, 0.f, false, Common::CTransform());
+        if (partitions.empty())
+            return false;
+
+        auto grid = std::make_unique<LazyHRTFGrid>(std::move(measurements), spatialIndex, gridStep, bufferSize);
+        if (! grid->matchesLayout(partitions.size(), partitions.front().size()))
+            return false;
+        lazyGrid = std::move(grid);
+        return true;
+    }
+
+    const LazyHRTFGrid* getLazyGrid() const noexcept { return lazyGrid.get(); }
+
+    /// Precompute the near-field correction filters for the sample rate of the measurements, relative
+    /// to the mean distance they were measured at
+    void buildNearFieldTable(const SofaMeasurements& measurements)
+    {
+        float referenceDistance = 0.f;
+        for (const float distance : measurements.distances)
+            referenceDistance += distance / (float) measurements.distances.size();
+        nearFieldTable = NearFieldTable::build(measurements.sampleRate, referenceDistance);
+    }
+
+    /// Near-field filters for the listener, nullptr if not built
+    std::shared_ptr<NearFieldTable> getNearFieldTable() const noexcept { return nearFieldTable; }
+
+private:
+    mutable HRIRCache cache;
+    HRTFSpatialIndex spatialIndex;
+    std::unique_ptr<LazyHRTFGrid> lazyGrid;         // Declared after the index it refers to
+    std::shared_ptr<NearFieldTable> nearFieldTable;
+};
@@ -0,0 +1,244 @@
+/*
+  ==============================================================================
+
+    HRTFBundle.h
+    The measurements of a SOFA file together with the HRTFs prepared from them
+    for each device sample rate and block size.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "HRIRCache.h"
+#include "SharedHRTFStore.h"
+
+//==============================================================================
+/**
+    A loaded HRTF, independent of the device configuration.
+
+    BRT prepares an HRTF for one sample rate and, through the partitioning of the
+    impulse responses, one block size, so a loaded HRTF is no longer valid after the
+    device changes either. The bundle keeps the measured impulse responses and delays
+    of the SOFA file and a small table of variants, one BRT HRTF per configuration.
+    Switching to a configuration that has been prepared before is a lookup in that
+    table; a missing variant is built from the measurements, resampled with a windowed
+    sinc if the rates differ, without reading the SOFA file again. The variants of
+    configurations the device has left are evicted, so the table does not grow with
+    every block size the device goes through.
+
+    The table is guarded by a spin lock and may be used from any thread. Building a
+    variant does not modify the bundle, so it can run on a background thread.
+*/
+class HRTFBundle
+{
+public:
+    /// brtGridStep is the resampling step of the grid BRT builds, lazyGridStep the step of the lazily
+    /// resampled grid, or 0 to use BRT's grid directly
+    HRTFBundle(const juce::File& sofaFile, SofaMeasurements&& measured, int brtGridStep, int lazyGridStep,
+               const std::string& extrapolationMethod)
+        : file(sofaFile),
+          measurements(std::make_shared<const SofaMeasurements>(std::move(measured))),
+          brtStep(brtGridStep), lazyStep(lazyGridStep), extrapolation(extrapolationMethod)
+    {
+    }
+
+    const juce::File& getFile() const noexcept          { return file; }
+    double getMeasuredSampleRate() const noexcept       { return measurements->sampleRate; }
+
+    //==========================================================================
+    /// The HRTF prepared for a configuration, or nullptr if there is none yet
+    std::shared_ptr<CachedHRTF> findVariant(double sampleRate, int blockSize) const
+    {
+        const juce::SpinLock::ScopedLockType lock(variantsLock);
+        for (const auto& variant : variants)
+        {
+            if (variant.matches(sampleRate, blockSize))
+                return variant.hrtf;
+        }
+        return nullptr;
+    }
+
+    void addVariant(double sampleRate, int blockSize, std::shared_ptr<CachedHRTF> hrtf)
+    {
+        const juce::SpinLock::ScopedLockType lock(variantsLock);
+        for (auto& variant : variants)
+        {
+            if (variant.matches(sampleRate, blockSize))
+            {
+                variant.hrtf = std::move(hrtf);
+                return;
+            }
+        }
+        variants.push_back({ sampleRate, blockSize, std::move(hrtf) });
+    }
+
+    /// Take out the variants of every other configuration and return them, so the caller chooses
+    /// where they are released. With keepOtherRates the variants of the same block size stay, the
+    /// sample rates prepared in advance.
+    std::vector<std::shared_ptr<CachedHRTF>> evictVariants(double sampleRate, int blockSize, bool keepOtherRates)
+    {
+        std::vector<std::shared_ptr<CachedHRTF>> evicted;
+        const juce::SpinLock::ScopedLockType lock(variantsLock);
+        for (auto it = variants.begin(); it != variants.end();)
+        {
+            if (it->matches(sampleRate, blockSize) || (keepOtherRates && it->blockSize == blockSize))
+            {
+                ++it;
+                continue;
+            }
+            evicted.push_back(std::move(it->hrtf));
+            it = variants.erase(it);
+        }
+        return evicted;
+    }
+
+    int getNumVariants() const
+    {
+        const juce::SpinLock::ScopedLockType lock(variantsLock);
+        return (int) variants.size();
+    }
+
+    //==========================================================================
+    /// Finish an HRTF that BRT has read from the SOFA file at the measured sample rate: size its
+    /// HRIR cache and, in lazy mode, build its spatial index and its lazy grid. Returns a warning,
+    /// empty if everything was enabled.
+    juce::String completeVariant(CachedHRTF& hrtf, int blockSize) const
+    {
+        return complete(hrtf, makeView(), blockSize);
+    }
+
+    /// Build the HRTF for a configuration from the measurements, resampled to the sample rate if
+    /// needed. BRT partitions the impulse responses with the block size of its global parameters,
+    /// which must be blockSize. Returns nullptr if BRT rejects the data.
+    std::shared_ptr<CachedHRTF> buildVariant(double sampleRate, int blockSize, juce::String& warning) const
+    {
+        auto source = juce::roundToInt(sampleRate) == juce::roundToInt(measurements->sampleRate)
+                          ? makeView() : resample(*measurements, sampleRate);
+        auto hrtf = std::make_shared<CachedHRTF>();
+        if (! SharedHRTFStore::buildHRTF(source, brtStep, extrapolation, *hrtf))
+            return nullptr;
+        warning = complete(*hrtf, std::move(source), blockSize);
+        return hrtf;
+    }
+
+    //==========================================================================
+    /// Resample impulse responses and delays to another sample rate. A windowed sinc with its cutoff
+    /// at the lower of the two Nyquist frequencies, scaled so that the frequency response is kept.
+    static SofaMeasurements resample(const SofaMeasurements& in, double targetRate)
+    {
+        const double ratio = targetRate / in.sampleRate;
+        const size_t numMeasurements = in.directions.size();
+
+        SofaMeasurements out;
+        out.directions = in.directions;
+        out.distances = in.distances;
+        out.sampleRate = targetRate;
+        out.irLength = juce::jmax(1, (int) std::ceil(in.irLength * ratio));
+        out.leftDelay.resize(numMeasurements);
+        out.rightDelay.resize(numMeasurements);
+        for (size_t m = 0; m < numMeasurements; ++m)
+        {
+            out.leftDelay[m] = (float) (in.leftDelay[m] * ratio);
+            out.rightDelay[m] = (float) (in.rightDelay[m] * ratio);
+        }
+
+        // The kernel of each output sample is the same for all the measurements, compute it once
+        const double cutoff = juce::jmin(1.0, ratio);
+        const int halfWidth = (int) std::ceil(SINC_ZERO_CROSSINGS / cutoff);
+        const int taps = 2 * halfWidth;
+        std::vector<float> kernel((size_t) (out.irLength * taps));
+        std::vector<int> firstTap((size_t) out.irLength);
+        for (int n = 0; n < out.irLength; ++n)
+        {
+            const double position = n / ratio;
+            firstTap[(size_t) n] = (int) std::floor(position) - halfWidth + 1;
+            for (int t = 0; t < taps; ++t)
+            {
+                const double x = position - (firstTap[(size_t) n] + t);
+                const double u = x / halfWidth;
+                const double window = std::abs(u) < 1.0 ? 0.42 + 0.5 * std::cos(juce::MathConstants<double>::pi * u)
+                                                               + 0.08 * std::cos(juce::MathConstants<double>::twoPi * u)
+                                                        : 0.0;
+                const double arg = juce::MathConstants<double>::pi * cutoff * x;
+                const double sinc = std::abs(arg) < 1.0e-9 ? 1.0 : std::sin(arg) / arg;
+                kernel[(size_t) (n * taps + t)] = (float) (cutoff * sinc * window / ratio);
+            }
+        }
+
+        out.leftIR.assign(numMeasurements * (size_t) out.irLength, 0.f);
+        out.rightIR.assign(numMeasurements * (size_t) out.irLength, 0.f);
+        for (size_t m = 0; m < numMeasurements; ++m)
+        {
+            for (const bool left : { true, false })
+            {
+                const float* input = in.getIR((int) m, left);
+                float* output = (left ? out.leftIR : out.rightIR).data() + m * (size_t) out.irLength;
+                for (int n = 0; n < out.irLength; ++n)
+                {
+                    const float* weights = kernel.data() + n * taps;
+                    const int first = firstTap[(size_t) n];
+                    float sum = 0.f;
+                    for (int t = juce::jmax(0, -first); t < taps && first + t < in.irLength; ++t)
+                        sum += weights[t] * input[first + t];
+                    output[n] = sum;
+                }
+            }
+        }
+        return out;
+    }
+
+private:
+    static constexpr int SINC_ZERO_CROSSINGS = 16;     // Each side of the kernel, at the cutoff frequency
+
+    struct Variant
+    {
+        double sampleRate;
+        int blockSize;
+        std::shared_ptr<CachedHRTF> hrtf;
+
+        bool matches(double rate, int size) const noexcept
+        {
+            return juce::roundToInt(sampleRate) == juce::roundToInt(rate) && blockSize == size;
+        }
+    };
+
+    /// The measurements without copying the impulse responses, which stay alive with the view
+    SofaMeasurements makeView() const
+    {
+        SofaMeasurements view;
+        view.directions = measurements->directions;
+        view.distances = measurements->distances;
+        view.irLength = measurements->irLength;
+        view.sampleRate = measurements->sampleRate;
+        view.leftDelay = measurements->leftDelay;
+        view.rightDelay = measurements->rightDelay;
+        view.externalLeftIR = measurements->getIR(0, true);
+        view.externalRightIR = measurements->getIR(0, false);
+        view.storage = measurements;
+        return view;
+    }
+
+    juce::String complete(CachedHRTF& hrtf, SofaMeasurements&& source, int blockSize) const
+    {
+        hrtf.prepareCache();
+        hrtf.buildNearFieldTable(source);
+        if (lazyStep <= 0)
+            return {};      // The spatial index only serves the lazy grid
+        if (! hrtf.buildSpatialIndex(source.directions))
+            return "No spatial index for " + file.getFileName();
+        if (! hrtf.enableLazyResampling(std::move(source), lazyStep, blockSize))
+            return "Lazy resampling is not available for this SOFA file, using a coarse grid";
+        return {};
+    }
+
+    const juce::File file;
+    const std::shared_ptr<const SofaMeasurements> measurements;     // With impulse responses
+    const int brtStep, lazyStep;
+    const std::string extrapolation;
+
+    mutable juce::SpinLock variantsLock;
+    std::vector<Variant> variants;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(HRTFBundle)
+};
@@ -0,0 +1,19 @@
+/*
+  ==============================================================================
+
+    HRTFSettings.h
+    How HRTFs are read from SOFA files, shared by the application, the plug-in
+    and the command-line tools.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "QualityGovernor.h"
+
+//==============================================================================
+constexpr const char* HRTFEXTRAPOLATIONMETHOD = "NearestPoint";
+constexpr int HRTFRESAMPLINGSTEP = QUALITY_TIERS[0].hrtfResamplingStep;  // Degrees, the grid of the full quality tier
+constexpr int HRTF_LAZY_BASE_RESAMPLING_STEP = 90;  // Coarse grid BRT builds at load time in lazy mode
+constexpr double HRTF_PREPARED_SAMPLE_RATES[] = { 44100.0, 48000.0, 96000.0 };  // Prepared in the background when enabled
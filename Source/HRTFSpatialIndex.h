@@ -0,0 +1,580 @@
+/*
+  ==============================================================================
+
+    HRTFSpatialIndex.h
+    Spherical triangulation of the measurement directions of an HRTF, with an
+    O(1) direction-to-triangle map for nearest-point and barycentric lookups.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+//==============================================================================
+/**
+    Spatial index over the measurement directions of one HRTF.
+
+    The directions are triangulated once by building their convex hull, which for
+    points on a sphere is the spherical Delaunay triangulation. The sphere is then
+    covered by a cube map: each cell stores, in one flat array, the triangles that
+    may contain a direction in that cell. Because the gnomonic projection onto a cube
+    face maps great circles to straight lines, the candidate sets are exact up to the
+    bounding box of the projected triangle.
+
+    A query projects the direction to its cell and tests a handful of candidates with
+    three dot products each. Nearest-point queries start from the best vertex of the
+    containing triangle and walk the Delaunay graph, which always ends at the exact
+    nearest measurement and in practice takes zero or one step.
+
+    Angles are in degrees, using the SOFA / BRT convention: azimuth anticlockwise from
+    the front, elevation upwards from the horizontal plane.
+*/
+class HRTFSpatialIndex
+{
+public:
+    struct Direction
+    {
+        float azimuth;
+        float elevation;
+    };
+
+    /// Result of a barycentric query: three measurement indices and weights that sum to one
+    struct Barycentric
+    {
+        std::array<int, 3> index{ { -1, -1, -1 } };
+        std::array<float, 3> weight{ { 0.f, 0.f, 0.f } };
+    };
+
+    HRTFSpatialIndex() = default;
+
+    //==========================================================================
+    /// Build the index. Directions that coincide (e.g. the same direction measured at several
+    /// distances) are merged and the first measurement index is reported for them.
+    /// Returns false if there are not enough distinct directions to enclose the sphere.
+    bool build(const std::vector<Direction>& measurements)
+    {
+        clear();
+
+        // Merge duplicated directions
+        std::unordered_map<int64_t, int> seen;
+        std::vector<Vec3> points;
+        for (int i = 0; i < (int) measurements.size(); ++i)
+        {
+            const auto p = toCartesian(measurements[(size_t) i].azimuth, measurements[(size_t) i].elevation);
+            if (seen.emplace(quantizedKey(p), (int) points.size()).second)
+            {
+                points.push_back(p);
+                vertexMeasurement.push_back(i);
+            }
+        }
+        if (points.size() < 4)
+        {
+            clear();
+            return false;
+        }
+
+        if (! buildHull(points))
+        {
+            clear();
+            return false;
+        }
+
+        vertices.resize(points.size() * 3);
+        for (size_t v = 0; v < points.size(); ++v)
+        {
+            vertices[v * 3 + 0] = (float) points[v].x;
+            vertices[v * 3 + 1] = (float) points[v].y;
+            vertices[v * 3 + 2] = (float) points[v].z;
+        }
+        buildAdjacency();
+        buildCellMap(points);
+        return true;
+    }
+
+    void clear()
+    {
+        vertexMeasurement.clear();
+        vertices.clear();
+        triangles.clear();
+        adjacencyStart.clear();
+        adjacency.clear();
+        vertexTriangleStart.clear();
+        vertexTriangles.clear();
+        cellStart.clear();
+        cellTriangles.clear();
+        cellsPerSide = 0;
+        maxCandidatesPerCell = 0;
+    }
+
+    bool isBuilt() const noexcept { return ! triangles.empty(); }
+
+    //==========================================================================
+    /// Index of the nearest measurement, or -1 if the index is not built
+    int findNearest(float azimuth, float elevation) const noexcept
+    {
+        if (! isBuilt())
+            return -1;
+
+        const auto d = toCartesian(azimuth, elevation);
+        const auto& t = triangles[(size_t) findTriangle(d)];
+
+        // Best vertex of the containing triangle, then greedy walk on the Delaunay graph
+        int best = t.vertex[0];
+        for (int k = 1; k < 3; ++k)
+            if (dotWithVertex(t.vertex[k], d) > dotWithVertex(best, d))
+                best = t.vertex[k];
+        return vertexMeasurement[(size_t) walkToNearest(best, d)];
+    }
+
+    /// Triangle containing the direction and the barycentric weights of its vertices
+    bool findBarycentric(float azimuth, float elevation, Barycentric& result) const noexcept
+    {
+        if (! isBuilt())
+            return false;
+
+        const auto d = toCartesian(azimuth, elevation);
+        const auto& t = triangles[(size_t) findTriangle(d)];
+
+        // Weight of each vertex is the signed volume opposite to it, clamped for directions
+        // that fall marginally outside due to rounding
+        float w[3];
+        float sum = 0.f;
+        for (int k = 0; k < 3; ++k)
+        {
+            w[k] = std::max(0.f, edgeDot(t, (k + 1) % 3, d));
+            sum += w[k];
+        }
+        for (int k = 0; k < 3; ++k)
+        {
+            result.index[(size_t) k] = vertexMeasurement[(size_t) t.vertex[k]];
+            result.weight[(size_t) k] = sum > 0.f ? w[k] / sum : 1.f / 3.f;
+        }
+        return true;
+    }
+
+    //==========================================================================
+    int getNumVertices() const noexcept             { return (int) vertexMeasurement.size(); }
+    int getNumTriangles() const noexcept            { return (int) triangles.size(); }
+    int getMaxCandidatesPerCell() const noexcept    { return maxCandidatesPerCell; }
+
+    size_t getMemoryUsage() const noexcept
+    {
+        return vertexMeasurement.size() * sizeof(int) + vertices.size() * sizeof(float) + triangles.size() * sizeof(Triangle)
+             + (adjacencyStart.size() + adjacency.size() + vertexTriangleStart.size() + vertexTriangles.size()
+                + cellStart.size() + cellTriangles.size()) * sizeof(int);
+    }
+
+private:
+    struct Vec3
+    {
+        double x, y, z;
+
+        Vec3 operator- (const Vec3& o) const noexcept   { return { x - o.x, y - o.y, z - o.z }; }
+        double dot(const Vec3& o) const noexcept        { return x * o.x + y * o.y + z * o.z; }
+        Vec3 cross(const Vec3& o) const noexcept        { return { y * o.z - z * o.y, z * o.x - x * o.z, x * o.y - y * o.x }; }
+        double get(int axis) const noexcept             { return axis == 0 ? x : (axis == 1 ? y : z); }
+    };
+
+    /// Triangle with its vertices in anticlockwise order seen from outside and the normals of the
+    /// planes through the origin and each edge, so that containment costs three dot products
+    struct Triangle
+    {
+        int vertex[3];
+        float edgeNormal[3][3];     // edgeNormal[k] = v[k] x v[k+1]
+    };
+
+    static constexpr double DEG_TO_RAD = 3.14159265358979323846 / 180.0;
+    static constexpr float CONTAINMENT_TOLERANCE = -1.0e-6f;
+    static constexpr int TARGET_TRIANGLES_PER_CELL = 2;
+
+    static Vec3 toCartesian(float azimuth, float elevation) noexcept
+    {
+        const double az = azimuth * DEG_TO_RAD, el = elevation * DEG_TO_RAD;
+        return { std::cos(el) * std::cos(az), std::cos(el) * std::sin(az), std::sin(el) };
+    }
+
+    static int64_t quantizedKey(const Vec3& p) noexcept
+    {
+        // About 0.01 degrees, coarse enough to merge directions stored with float rounding
+        auto q = [](double c) { return (int64_t) std::llround(c * 5000.0) + 8192; };
+        return (q(p.x) << 28) | (q(p.y) << 14) | q(p.z);
+    }
+
+    float dotWithVertex(int v, const Vec3& d) const noexcept
+    {
+        const float* p = &vertices[(size_t) v * 3];
+        return (float) (p[0] * d.x + p[1] * d.y + p[2] * d.z);
+    }
+
+    static float edgeDot(const Triangle& t, int edge, const Vec3& d) noexcept
+    {
+        const float* n = t.edgeNormal[edge];
+        return (float) (n[0] * d.x + n[1] * d.y + n[2] * d.z);
+    }
+
+    //==========================================================================
+    /// Incremental convex hull. The points are nudged tangentially by a tiny random amount
+    /// first: regular measurement grids are full of co-circular points (every elevation ring),
+    /// which would otherwise produce coplanar faces.
+    bool buildHull(const std::vector<Vec3>& original)
+    {
+        std::vector<Vec3> p = original;
+        std::mt19937 random(1234);
+        std::uniform_real_distribution<double> jitter(-1.0e-7, 1.0e-7);
+        for (auto& v : p)
+        {
+            v = { v.x + jitter(random), v.y + jitter(random), v.z + jitter(random) };
+            const double len = std::sqrt(v.dot(v));
+            v = { v.x / len, v.y / len, v.z / len };
+        }
+
+        // Initial tetrahedron from four well separated points
+        const int n = (int) p.size();
+        int i0 = 0, i1 = -1, i2 = -1, i3 = -1;
+        double best = -1.0;
+        for (int i = 0; i < n; ++i)
+        {
+            const double d = (p[(size_t) i] - p[(size_t) i0]).dot(p[(size_t) i] - p[(size_t) i0]);
+            if (d > best) { best = d; i1 = i; }
+        }
+        best = -1.0;
+        for (int i = 0; i < n; ++i)
+        {
+            const auto c = (p[(size_t) i1] - p[(size_t) i0]).cross(p[(size_t) i] - p[(size_t) i0]);
+            const double d = c.dot(c);
+            if (d > best) { best = d; i2 = i; }
+        }
+        best = -1.0;
+        const auto baseNormal = (p[(size_t) i1] - p[(size_t) i0]).cross(p[(size_t) i2] - p[(size_t) i0]);
+        for (int i = 0; i < n; ++i)
+        {
+            const double d = std::abs(baseNormal.dot(p[(size_t) i] - p[(size_t) i0]));
+            if (d > best) { best = d; i3 = i; }
+        }
+        if (best < 1.0e-12)
+            return false;       // All directions on one great circle
+
+        if (baseNormal.dot(p[(size_t) i3] - p[(size_t) i0]) > 0.0)
+            std::swap(i1, i2);  // Keep i3 behind the base so all faces point outwards
+
+        std::vector<HullFace> faces;
+        std::unordered_map<uint64_t, int> edgeToFace;
+        auto addFace = [&](int a, int b, int c)
+        {
+            HullFace f;
+            f.v[0] = a; f.v[1] = b; f.v[2] = c;
+            f.normal = (p[(size_t) b] - p[(size_t) a]).cross(p[(size_t) c] - p[(size_t) a]);
+            f.offset = f.normal.dot(p[(size_t) a]);
+            const int id = (int) faces.size();
+            faces.push_back(f);
+            edgeToFace[edgeKey(a, b)] = id;
+            edgeToFace[edgeKey(b, c)] = id;
+            edgeToFace[edgeKey(c, a)] = id;
+        };
+        addFace(i0, i1, i2);
+        addFace(i0, i3, i1);
+        addFace(i1, i3, i2);
+        addFace(i2, i3, i0);
+
+        // Insert the rest in an order that keeps consecutive points close to each other, so the
+        // search for a visible face, which starts from the newest faces, ends quickly
+        std::vector<int> order;
+        for (int i = 0; i < n; ++i)
+            if (i != i0 && i != i1 && i != i2 && i != i3)
+                order.push_back(i);
+        std::sort(order.begin(), order.end(), [&p](int a, int b)
+        {
+            const int bandA = (int) std::floor(std::asin(std::clamp(p[(size_t) a].z, -1.0, 1.0)) * 20.0);
+            const int bandB = (int) std::floor(std::asin(std::clamp(p[(size_t) b].z, -1.0, 1.0)) * 20.0);
+            if (bandA != bandB)
+                return bandA < bandB;
+            return std::atan2(p[(size_t) a].y, p[(size_t) a].x) < std::atan2(p[(size_t) b].y, p[(size_t) b].x);
+        });
+
+        std::vector<int> visible, stack;
+        std::vector<int> visitedStamp;
+        std::vector<std::pair<int, int>> horizon;
+        int stamp = 0;
+        for (const int pi : order)
+        {
+            const auto& point = p[(size_t) pi];
+            auto isVisible = [&](int f) { return faces[(size_t) f].normal.dot(point) - faces[(size_t) f].offset > 0.0; };
+
+            int seed = -1;
+            for (int f = (int) faces.size() - 1; f >= 0; --f)
+            {
+                if (! faces[(size_t) f].dead && isVisible(f)) { seed = f; break; }
+            }
+            if (seed < 0)
+                continue;   // Inside the hull, only possible for nearly duplicated directions
+
+            // Flood fill the visible region and collect its boundary
+            ++stamp;
+            visitedStamp.resize(faces.size(), 0);
+            visible.clear(); horizon.clear(); stack.assign(1, seed);
+            visitedStamp[(size_t) seed] = stamp;
+            while (! stack.empty())
+            {
+                const int f = stack.back();
+                stack.pop_back();
+                visible.push_back(f);
+                for (int e = 0; e < 3; ++e)
+                {
+                    const int a = faces[(size_t) f].v[e], b = faces[(size_t) f].v[(e + 1) % 3];
+                    const auto it = edgeToFace.find(edgeKey(b, a));
+                    const int neighbour = it != edgeToFace.end() ? it->second : -1;
+                    if (neighbour >= 0 && isVisible(neighbour))
+                    {
+                        if (visitedStamp[(size_t) neighbour] != stamp)
+                        {
+                            visitedStamp[(size_t) neighbour] = stamp;
+                            stack.push_back(neighbour);
+                        }
+                    }
+                    else
+                    {
+                        horizon.emplace_back(a, b);
+                    }
+                }
+            }
+
+            for (const int f : visible)
+            {
+                auto& face = faces[(size_t) f];
+                face.dead = true;
+                for (int e = 0; e < 3; ++e)
+                {
+                    const auto it = edgeToFace.find(edgeKey(face.v[e], face.v[(e + 1) % 3]));
+                    if (it != edgeToFace.end() && it->second == f)
+                        edgeToFace.erase(it);
+                }
+            }
+            for (const auto& edge : horizon)
+                addFace(edge.first, edge.second, pi);
+        }
+
+        for (const auto& f : faces)
+        {
+            if (f.dead)
+                continue;
+            Triangle t;
+            for (int k = 0; k < 3; ++k)
+            {
+                t.vertex[k] = f.v[k];
+                const auto& a = original[(size_t) f.v[k]];
+                const auto& b = original[(size_t) f.v[(k + 1) % 3]];
+                const auto c = a.cross(b);
+                t.edgeNormal[k][0] = (float) c.x;
+                t.edgeNormal[k][1] = (float) c.y;
+                t.edgeNormal[k][2] = (float) c.z;
+            }
+            triangles.push_back(t);
+        }
+        return ! triangles.empty();
+    }
+
+    struct HullFace
+    {
+        int v[3];
+        Vec3 normal;
+        double offset;
+        bool dead = false;
+    };
+
+    static uint64_t edgeKey(int a, int b) noexcept { return ((uint64_t) (uint32_t) a << 32) | (uint32_t) b; }
+
+    //==========================================================================
+    void buildAdjacency()
+    {
+        const size_t numVertices = vertexMeasurement.size();
+        std::vector<std::vector<int>> neighbours(numVertices);
+        for (const auto& t : triangles)
+        {
+            for (int k = 0; k < 3; ++k)
+            {
+                neighbours[(size_t) t.vertex[k]].push_back(t.vertex[(k + 1) % 3]);
+                neighbours[(size_t) t.vertex[k]].push_back(t.vertex[(k + 2) % 3]);
+            }
+        }
+        adjacencyStart.assign(numVertices + 1, 0);
+        for (size_t v = 0; v < numVertices; ++v)
+        {
+            auto& list = neighbours[v];
+            std::sort(list.begin(), list.end());
+            list.erase(std::unique(list.begin(), list.end()), list.end());
+            adjacencyStart[v + 1] = adjacencyStart[v] + (int) list.size();
+            adjacency.insert(adjacency.end(), list.begin(), list.end());
+        }
+
+        // Triangles around each vertex, for the directions whose cell holds no candidate
+        std::vector<std::vector<int>> around(numVertices);
+        for (size_t ti = 0; ti < triangles.size(); ++ti)
+            for (int k = 0; k < 3; ++k)
+                around[(size_t) triangles[ti].vertex[k]].push_back((int) ti);
+        vertexTriangleStart.assign(numVertices + 1, 0);
+        for (size_t v = 0; v < numVertices; ++v)
+        {
+            vertexTriangleStart[v + 1] = vertexTriangleStart[v] + (int) around[v].size();
+            vertexTriangles.insert(vertexTriangles.end(), around[v].begin(), around[v].end());
+        }
+    }
+
+    /// Greedy walk on the Delaunay graph from a vertex to the one nearest to a direction
+    int walkToNearest(int start, const Vec3& d) const noexcept
+    {
+        int best = start;
+        float bestDot = dotWithVertex(best, d);
+        for (bool improved = true; improved;)
+        {
+            improved = false;
+            for (int a = adjacencyStart[(size_t) best]; a < adjacencyStart[(size_t) best + 1]; ++a)
+            {
+                const int n = adjacency[(size_t) a];
+                const float dot = dotWithVertex(n, d);
+                if (dot > bestDot) { best = n; bestDot = dot; improved = true; }
+            }
+        }
+        return best;
+    }
+
+    /// Cube face and cell of a direction
+    int getCell(const Vec3& d) const noexcept
+    {
+        const double ax = std::abs(d.x), ay = std::abs(d.y), az = std::abs(d.z);
+        int axis = 0;
+        if (ay > ax && ay >= az) axis = 1;
+        else if (az > ax && az > ay) axis = 2;
+        const double major = d.get(axis);
+        const int face = axis * 2 + (major < 0.0 ? 1 : 0);
+        const double u = d.get((axis + 1) % 3) / std::abs(major);
+        const double v = d.get((axis + 2) % 3) / std::abs(major);
+        return face * cellsPerSide * cellsPerSide + toCellCoordinate(v) * cellsPerSide + toCellCoordinate(u);
+    }
+
+    int toCellCoordinate(double c) const noexcept
+    {
+        return std::clamp((int) ((c + 1.0) * 0.5 * cellsPerSide), 0, cellsPerSide - 1);
+    }
+
+    void buildCellMap(const std::vector<Vec3>& points)
+    {
+        const int numTriangles = (int) triangles.size();
+        cellsPerSide = std::clamp((int) std::ceil(std::sqrt((double) numTriangles / (6.0 * TARGET_TRIANGLES_PER_CELL))), 1, 256);
+        const int cellsPerFace = cellsPerSide * cellsPerSide;
+        std::vector<std::vector<int>> cells((size_t) (6 * cellsPerFace));
+
+        // Directions that map to a cube face are within acos(1/sqrt(3)) of its axis
+        const double frustumAngle = std::acos(1.0 / std::sqrt(3.0));
+
+        for (int ti = 0; ti < numTriangles; ++ti)
+        {
+            const auto& t = triangles[(size_t) ti];
+
+            // Bounding cap of the triangle, to skip the faces it cannot reach
+            const auto& a = points[(size_t) t.vertex[0]];
+            const auto& b = points[(size_t) t.vertex[1]];
+            const auto& c = points[(size_t) t.vertex[2]];
+            Vec3 centre{ a.x + b.x + c.x, a.y + b.y + c.y, a.z + b.z + c.z };
+            const double centreLength = std::sqrt(centre.dot(centre));
+            if (centreLength > 1.0e-12)
+                centre = { centre.x / centreLength, centre.y / centreLength, centre.z / centreLength };
+            const double capRadius = std::acos(std::clamp(std::min({ centre.dot(a), centre.dot(b), centre.dot(c) }), -1.0, 1.0));
+
+            for (int face = 0; face < 6; ++face)
+            {
+                const int axis = face / 2;
+                const double sign = (face % 2) == 0 ? 1.0 : -1.0;
+                const double centreAngle = std::acos(std::clamp(centre.get(axis) * sign, -1.0, 1.0));
+                if (centreLength > 1.0e-12 && centreAngle - capRadius > frustumAngle)
+                    continue;
+                double minU = 2.0, maxU = -2.0, minV = 2.0, maxV = -2.0;
+                int inFront = 0;
+                for (int k = 0; k < 3; ++k)
+                {
+                    const auto& q = points[(size_t) t.vertex[k]];
+                    const double major = q.get(axis) * sign;
+                    if (major <= 1.0e-9)
+                        continue;
+                    ++inFront;
+                    const double u = q.get((axis + 1) % 3) / major, v = q.get((axis + 2) % 3) / major;
+                    minU = std::min(minU, u); maxU = std::max(maxU, u);
+                    minV = std::min(minV, v); maxV = std::max(maxV, v);
+                }
+                if (inFront == 0)
+                    continue;
+                if (inFront < 3)
+                {
+                    // Triangle spans more than a hemisphere from this face: be conservative
+                    minU = minV = -1.0;
+                    maxU = maxV = 1.0;
+                }
+                if (maxU < -1.0 || minU > 1.0 || maxV < -1.0 || minV > 1.0)
+                    continue;
+                for (int cv = toCellCoordinate(minV); cv <= toCellCoordinate(maxV); ++cv)
+                    for (int cu = toCellCoordinate(minU); cu <= toCellCoordinate(maxU); ++cu)
+                        cells[(size_t) (face * cellsPerFace + cv * cellsPerSide + cu)].push_back(ti);
+            }
+        }
+
+        cellStart.assign(cells.size() + 1, 0);
+        for (size_t c = 0; c < cells.size(); ++c)
+        {
+            cellStart[c + 1] = cellStart[c] + (int) cells[c].size();
+            maxCandidatesPerCell = std::max(maxCandidatesPerCell, (int) cells[c].size());
+            cellTriangles.insert(cellTriangles.end(), cells[c].begin(), cells[c].end());
+        }
+    }
+
+    /// Triangle containing a direction. If rounding leaves the direction outside all candidates,
+    /// the candidate it is least outside of is returned.
+    int findTriangle(const Vec3& d) const noexcept
+    {
+        const int cell = getCell(d);
+        int first = cellStart[(size_t) cell], last = cellStart[(size_t) cell + 1];
+        const int* candidates = cellTriangles.data();
+
+        // A cell no triangle reaches, e.g. under a grid with no measurements below the horizon:
+        // the candidates are the triangles around the nearest vertex
+        if (first == last)
+        {
+            const int nearest = walkToNearest(0, d);
+            first = vertexTriangleStart[(size_t) nearest];
+            last = vertexTriangleStart[(size_t) nearest + 1];
+            candidates = vertexTriangles.data();
+        }
+
+        int best = candidates[first];
+        float bestMargin = -1.0e30f;
+        for (int c = first; c < last; ++c)
+        {
+            const int ti = candidates[c];
+            const auto& t = triangles[(size_t) ti];
+            const float margin = std::min({ edgeDot(t, 0, d), edgeDot(t, 1, d), edgeDot(t, 2, d) });
+            if (margin >= CONTAINMENT_TOLERANCE)
+                return ti;
+            if (margin > bestMargin) { bestMargin = margin; best = ti; }
+        }
+        return best;
+    }
+
+    //==========================================================================
+    std::vector<int> vertexMeasurement;     // Vertex -> measurement index
+    std::vector<float> vertices;            // Unit vectors, xyz interleaved
+    std::vector<Triangle> triangles;
+    std::vector<int> adjacencyStart;        // CSR Delaunay graph
+    std::vector<int> adjacency;
+    std::vector<int> vertexTriangleStart;   // CSR vertex -> triangles around it
+    std::vector<int> vertexTriangles;
+    std::vector<int> cellStart;             // CSR cube map cell -> candidate triangles
+    std::vector<int> cellTriangles;
+    int cellsPerSide = 0;
+    int maxCandidatesPerCell = 0;
+};
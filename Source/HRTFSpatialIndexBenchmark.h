@@ -0,0 +1,246 @@
+/*
+  ==============================================================================
+
+    HRTFSpatialIndexBenchmark.h
+    Microbenchmark of HRTFSpatialIndex against brute-force search, the libmysofa
+    kd-tree lookup and BRT's own HRIR lookup. Run the app with
+    --benchmark-hrtf-index [files].
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "SofaMeasurements.h"
+#include "SharedHRTFStore.h"
+#include "HRTFSettings.h"
+
+//==============================================================================
+namespace HRTFSpatialIndexBenchmark
+{
+    constexpr int NUM_QUERIES = 200000;
+
+    /// Random query directions over the whole sphere, uniform in solid angle
+    inline std::vector<HRTFSpatialIndex::Direction> makeQueries(int count)
+    {
+        juce::Random random(42);
+        std::vector<HRTFSpatialIndex::Direction> queries((size_t) count);
+        for (auto& q : queries)
+        {
+            q.azimuth = random.nextFloat() * 360.f;
+            q.elevation = juce::radiansToDegrees(std::asin(random.nextFloat() * 2.f - 1.f));
+        }
+        return queries;
+    }
+
+    inline void toCartesian(const HRTFSpatialIndex::Direction& d, float* xyz)
+    {
+        const float az = juce::degreesToRadians(d.azimuth), el = juce::degreesToRadians(d.elevation);
+        xyz[0] = std::cos(el) * std::cos(az);
+        xyz[1] = std::cos(el) * std::sin(az);
+        xyz[2] = std::sin(el);
+    }
+
+    /// Time a lookup over all queries, in nanoseconds per query
+    template <typename Lookup>
+    double timeQueries(const std::vector<HRTFSpatialIndex::Direction>& queries, Lookup&& lookup, int& checksum)
+    {
+        const auto start = juce::Time::getHighResolutionTicks();
+        for (const auto& q : queries)
+            checksum += lookup(q);
+        const auto seconds = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - start);
+        return seconds * 1.0e9 / (double) queries.size();
+    }
+
+    /// BRT's lookup of the partitioned HRIR of a direction, on an HRTF built from the measurements like
+    /// the application builds it: barycentric interpolation between the points of the resampled grid,
+    /// and the nearest point without runtime interpolation. It returns the HRIR, so it includes copying it.
+    inline juce::String timeBRTLookups(const SofaMeasurements& measurements, const std::vector<HRTFSpatialIndex::Direction>& queries,
+                                       int& checksum)
+    {
+        Common::CGlobalParameters globalParameters;
+        globalParameters.SetSampleRate((int) measurements.sampleRate);
+        globalParameters.SetBufferSize(BLOCK_SIZE);
+
+        BRTServices::CHRTF hrtf;
+        if (! SharedHRTFStore::buildHRTF(measurements, HRTFRESAMPLINGSTEP, HRTFEXTRAPOLATIONMETHOD, hrtf))
+            return "  BRT rejected the HRTF" + juce::String(juce::newLine);
+
+        juce::String report;
+        for (const bool interpolate : { true, false })
+        {
+            const auto ns = timeQueries(queries, [&hrtf, interpolate](const HRTFSpatialIndex::Direction& q)
+            {
+                return (int) hrtf.GetHRIR_partitioned(Common::T_ear::LEFT, q.azimuth, q.elevation, interpolate, Common::CTransform()).size();
+            }, checksum);
+            report << (interpolate ? "  BRT GetHRIR_partitioned, interpolated " : "  BRT GetHRIR_partitioned, nearest      ")
+                   << juce::String(ns, 1) << " ns/query" << juce::newLine;
+        }
+        return report;
+    }
+
+    /// Benchmark one measurement grid. The kd-tree and BRT lookups are only timed for a SOFA file,
+    /// BRT's when its impulse responses are given.
+    inline juce::String runGrid(const juce::String& name, const std::vector<HRTFSpatialIndex::Direction>& grid, const juce::File& sofaFile = {},
+                                const SofaMeasurements* measurements = nullptr)
+    {
+        juce::String report;
+        report << name << ": " << (int) grid.size() << " directions" << juce::newLine;
+
+        HRTFSpatialIndex index;
+        const auto buildStart = juce::Time::getHighResolutionTicks();
+        if (! index.build(grid))
+            return report + "  could not build the index" + juce::newLine;
+        const auto buildMs = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - buildStart) * 1000.0;
+        report << "  index build " << juce::String(buildMs, 1) << " ms, " << index.getNumTriangles() << " triangles, "
+               << juce::String(index.getMemoryUsage() / 1024.0, 1) << " KiB, max " << index.getMaxCandidatesPerCell() << " candidates per cell" << juce::newLine;
+
+        const auto queries = makeQueries(NUM_QUERIES);
+        int checksum = 0;
+
+        // Brute force: what a linear search over the table costs
+        std::vector<float> gridXYZ(grid.size() * 3);
+        for (size_t i = 0; i < grid.size(); ++i)
+            toCartesian(grid[i], &gridXYZ[i * 3]);
+        const int bruteQueries = juce::jmin(NUM_QUERIES, 20000);
+        const std::vector<HRTFSpatialIndex::Direction> bruteSet(queries.begin(), queries.begin() + bruteQueries);
+        const auto bruteNs = timeQueries(bruteSet, [&gridXYZ](const HRTFSpatialIndex::Direction& q)
+        {
+            float xyz[3];
+            toCartesian(q, xyz);
+            int best = 0;
+            float bestDot = -2.f;
+            for (size_t i = 0; i < gridXYZ.size() / 3; ++i)
+            {
+                const float dot = gridXYZ[i * 3] * xyz[0] + gridXYZ[i * 3 + 1] * xyz[1] + gridXYZ[i * 3 + 2] * xyz[2];
+                if (dot > bestDot) { bestDot = dot; best = (int) i; }
+            }
+            return best;
+        }, checksum);
+        report << "  brute-force nearest   " << juce::String(bruteNs, 1) << " ns/query" << juce::newLine;
+
+        // libmysofa kd-tree
+        if (sofaFile.existsAsFile())
+        {
+            int err = MYSOFA_OK;
+            struct MYSOFA_HRTF* hrtf = mysofa_load(sofaFile.getFullPathName().toRawUTF8(), &err);
+            if (hrtf != nullptr && err == MYSOFA_OK)
+            {
+                mysofa_tocartesian(hrtf);
+                if (struct MYSOFA_LOOKUP* lookup = mysofa_lookup_init(hrtf))
+                {
+                    const auto kdNs = timeQueries(queries, [lookup](const HRTFSpatialIndex::Direction& q)
+                    {
+                        // The kd-tree works on the measured positions, so scale to their radius
+                        float xyz[3];
+                        toCartesian(q, xyz);
+                        const float radius = 0.5f * (lookup->radius_min + lookup->radius_max);
+                        for (auto& c : xyz) c *= radius;
+                        return mysofa_lookup(lookup, xyz);
+                    }, checksum);
+                    report << "  mysofa_lookup kd-tree " << juce::String(kdNs, 1) << " ns/query" << juce::newLine;
+
+                    if (struct MYSOFA_NEIGHBORHOOD* neighborhood = mysofa_neighborhood_init(hrtf, lookup))
+                    {
+                        const auto neighbourNs = timeQueries(queries, [lookup, neighborhood](const HRTFSpatialIndex::Direction& q)
+                        {
+                            float xyz[3];
+                            toCartesian(q, xyz);
+                            const float radius = 0.5f * (lookup->radius_min + lookup->radius_max);
+                            for (auto& c : xyz) c *= radius;
+                            const int nearest = mysofa_lookup(lookup, xyz);
+                            const int* neighbours = mysofa_neighborhood(neighborhood, nearest);
+                            return neighbours != nullptr ? neighbours[0] : nearest;
+                        }, checksum);
+                        report << "  mysofa lookup + neighborhood " << juce::String(neighbourNs, 1) << " ns/query" << juce::newLine;
+                        mysofa_neighborhood_free(neighborhood);
+                    }
+                    mysofa_lookup_free(lookup);
+                }
+            }
+            if (hrtf != nullptr)
+                mysofa_free(hrtf);
+        }
+
+        const auto nearestNs = timeQueries(queries, [&index](const HRTFSpatialIndex::Direction& q)
+        {
+            return index.findNearest(q.azimuth, q.elevation);
+        }, checksum);
+        report << "  index nearest         " << juce::String(nearestNs, 1) << " ns/query" << juce::newLine;
+
+        const auto barycentricNs = timeQueries(queries, [&index](const HRTFSpatialIndex::Direction& q)
+        {
+            HRTFSpatialIndex::Barycentric b;
+            index.findBarycentric(q.azimuth, q.elevation, b);
+            return b.index[0];
+        }, checksum);
+        report << "  index barycentric     " << juce::String(barycentricNs, 1) << " ns/query" << juce::newLine;
+
+        if (measurements != nullptr)
+            report << timeBRTLookups(*measurements, bruteSet, checksum);
+
+        // Check the index against brute force on a subset
+        int mismatches = 0;
+        for (int i = 0; i < juce::jmin(bruteQueries, 2000); ++i)
+        {
+            float xyz[3];
+            toCartesian(queries[(size_t) i], xyz);
+            float bruteBest = -2.f;
+            for (size_t g = 0; g < grid.size(); ++g)
+                bruteBest = juce::jmax(bruteBest, gridXYZ[g * 3] * xyz[0] + gridXYZ[g * 3 + 1] * xyz[1] + gridXYZ[g * 3 + 2] * xyz[2]);
+            const int found = index.findNearest(queries[(size_t) i].azimuth, queries[(size_t) i].elevation);
+            const float foundDot = gridXYZ[(size_t) found * 3] * xyz[0] + gridXYZ[(size_t) found * 3 + 1] * xyz[1] + gridXYZ[(size_t) found * 3 + 2] * xyz[2];
+            if (foundDot < bruteBest - 1.0e-5f)
+                ++mismatches;
+        }
+        report << "  nearest mismatches vs brute force: " << mismatches << " (checksum " << checksum << ")" << juce::newLine;
+        return report;
+    }
+
+    /// Regular azimuth/elevation grid, as produced by most measurement rigs
+    inline std::vector<HRTFSpatialIndex::Direction> makeRegularGrid(float step)
+    {
+        std::vector<HRTFSpatialIndex::Direction> grid;
+        for (float el = -90.f; el <= 90.f + 1.0e-3f; el += step)
+            for (float az = 0.f; az < 360.f - 1.0e-3f; az += step)
+                grid.push_back({ az, el });
+        return grid;
+    }
+
+    /// Near-uniform Fibonacci sphere
+    inline std::vector<HRTFSpatialIndex::Direction> makeFibonacciGrid(int count)
+    {
+        std::vector<HRTFSpatialIndex::Direction> grid((size_t) count);
+        const double goldenAngle = juce::MathConstants<double>::pi * (3.0 - std::sqrt(5.0));
+        for (int i = 0; i < count; ++i)
+        {
+            const double z = 1.0 - 2.0 * (i + 0.5) / count;
+            grid[(size_t) i] = { (float) std::fmod(juce::radiansToDegrees(i * goldenAngle), 360.0),
+                                 (float) juce::radiansToDegrees(std::asin(z)) };
+        }
+        return grid;
+    }
+
+    /// Run on synthetic dense grids and on every SOFA file given. Returns the report.
+    inline juce::String run(const juce::StringArray& sofaFiles)
+    {
+        juce::String report;
+        report << "HRTF spatial index benchmark, " << NUM_QUERIES << " random directions" << juce::newLine << juce::newLine;
+        report << runGrid("Regular 5 deg grid", makeRegularGrid(5.f)) << juce::newLine;
+        report << runGrid("Regular 2 deg grid", makeRegularGrid(2.f)) << juce::newLine;
+        report << runGrid("Fibonacci 11950", makeFibonacciGrid(11950)) << juce::newLine;
+        report << runGrid("Fibonacci 50000", makeFibonacciGrid(50000)) << juce::newLine;
+
+        for (const auto& path : sofaFiles)
+        {
+            const juce::File file(path);
+            SofaMeasurements measurements;
+            const auto error = SofaMeasurements::load(file, measurements, true);
+            if (error.isNotEmpty())
+                report << error << juce::newLine;
+            else
+                report << runGrid(file.getFileName(), measurements.directions, file, &measurements) << juce::newLine;
+        }
+        return report;
+    }
+}
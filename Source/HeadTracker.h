@@ -0,0 +1,358 @@
+/*
+  ==============================================================================
+
+    HeadTracker.h
+    Head-tracking input: orientation samples from a UDP/OSC receiver or from a
+    replayed recording are passed through a lock-free ring to the audio thread,
+    which applies the latest or extrapolated pose to the listener once per block.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include "OSCDecoder.h"
+
+//==============================================================================
+/// One orientation sample. Angles in radians, BRT convention.
+struct HeadPose
+{
+    double timeMs = 0.0;        // Millisecond counter (juce::Time::getMillisecondCounterHiRes) when received
+    float yaw = 0.f;
+    float pitch = 0.f;
+    float roll = 0.f;
+};
+
+//==============================================================================
+/**
+    Receives head orientation samples from any thread and applies them to a listener on
+    the audio thread.
+
+    Producers call push(). The audio thread calls applyToListener() once per block: it
+    drains the ring, keeps the two most recent samples and sets the listener orientation
+    to the pose extrapolated to the time the block will be heard, limited to a short
+    horizon so that a stalled tracker does not keep the head spinning.
+
+    Motion-to-sound latency is measured as the time from the arrival of a sample to the
+    moment the block that first uses it reaches the output, i.e. the time until the next
+    callback starts plus the block length and the output latency of the device.
+*/
+class HeadTracker
+{
+public:
+    struct LatencyStatistics
+    {
+        int samplesApplied = 0;
+        float meanMs = 0.f;
+        float maxMs = 0.f;
+        float updateRateHz = 0.f;
+    };
+
+    HeadTracker() = default;
+
+    //==========================================================================
+    /// Queue a new sample. Lock-free, single producer at a time. Returns false if the ring is full.
+    bool push(const HeadPose& pose) noexcept
+    {
+        const auto scope = ring.write(1);
+        if (scope.blockSize1 == 0)
+        {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        ringBuffer[(size_t) scope.startIndex1] = pose;
+        received.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    /// Output latency of the device and block size, used for the latency measurement and to
+    /// choose the extrapolation target. Call from prepareToPlay.
+    void prepare(double newSampleRate, int blockSize, int outputLatencySamples)
+    {
+        blockMs = 1000.0 * blockSize / newSampleRate;
+        outputLatencyMs = 1000.0 * outputLatencySamples / newSampleRate;
+    }
+
+    void setExtrapolation(bool shouldExtrapolate) noexcept      { extrapolate.store(shouldExtrapolate); }
+
+    //==========================================================================
+    /// Apply the newest pose to the listener. Audio thread, once per block, before processing.
+    /// Does nothing until the first sample arrives.
+    void applyToListener(BRTListenerModel::CListenerHRTFbasedModel& listener) noexcept
+    {
+        const double nowMs = juce::Time::getMillisecondCounterHiRes();
+        int newSamples = 0;
+        const auto scope = ring.read(ring.getNumReady());
+        auto take = [&](const HeadPose& pose)
+        {
+            previous = latest;
+            latest = pose;
+            ++newSamples;
+            ++posesSeen;
+        };
+        for (int i = 0; i < scope.blockSize1; ++i) take(ringBuffer[(size_t) (scope.startIndex1 + i)]);
+        for (int i = 0; i < scope.blockSize2; ++i) take(ringBuffer[(size_t) (scope.startIndex2 + i)]);
+
+        if (posesSeen == 0)
+            return;
+
+        if (newSamples > 0)
+        {
+            // The newest sample will be heard once this block has been played out
+            recordLatency(nowMs - latest.timeMs + blockMs + outputLatencyMs);
+        }
+
+        HeadPose pose = latest;
+        if (extrapolate.load(std::memory_order_relaxed) && posesSeen > 1 && latest.timeMs > previous.timeMs)
+        {
+            const double targetMs = nowMs + blockMs * 0.5 + outputLatencyMs;
+            const double horizon = juce::jlimit(0.0, MAX_EXTRAPOLATION_MS, targetMs - latest.timeMs);
+            const double dt = latest.timeMs - previous.timeMs;
+            auto project = [horizon, dt](float from, float to)
+            {
+                const float delta = std::remainder(to - from, juce::MathConstants<float>::twoPi);
+                return to + (float) (delta / dt * horizon);
+            };
+            pose.yaw = project(previous.yaw, latest.yaw);
+            pose.pitch = project(previous.pitch, latest.pitch);
+            pose.roll = project(previous.roll, latest.roll);
+        }
+
+        Common::CTransform transform = listener.GetListenerTransform();
+        transform.SetOrientation(Common::CQuaternion::FromYawPitchRoll(pose.yaw, pose.pitch, pose.roll));
+        listener.SetListenerTransform(transform);
+    }
+
+    //==========================================================================
+    /// Latency statistics since the last call, which resets them. Message thread.
+    LatencyStatistics getAndResetStatistics() noexcept
+    {
+        LatencyStatistics stats;
+        const double nowMs = juce::Time::getMillisecondCounterHiRes();
+        const int count = latencyCount.exchange(0);
+        const double sum = latencySumMs.exchange(0.0);
+        stats.samplesApplied = count;
+        stats.meanMs = count > 0 ? (float) (sum / count) : 0.f;
+        stats.maxMs = latencyMaxMs.exchange(0.f);
+        const int total = received.exchange(0);
+        stats.updateRateHz = lastStatisticsMs > 0.0 ? (float) (total * 1000.0 / (nowMs - lastStatisticsMs)) : 0.f;
+        lastStatisticsMs = nowMs;
+        return stats;
+    }
+
+    int getDroppedSamples() const noexcept { return dropped.load(); }
+
+private:
+    static constexpr int RING_SIZE = 1024;                  // About one second at 1 kHz
+    static constexpr double MAX_EXTRAPOLATION_MS = 50.0;
+
+    void recordLatency(double ms) noexcept
+    {
+        latencyCount.fetch_add(1, std::memory_order_relaxed);
+        // std::atomic<double>::fetch_add is C++20, so accumulate with a compare-exchange loop
+        auto sum = latencySumMs.load(std::memory_order_relaxed);
+        while (! latencySumMs.compare_exchange_weak(sum, sum + ms, std::memory_order_relaxed)) {}
+        if ((float) ms > latencyMaxMs.load(std::memory_order_relaxed))
+            latencyMaxMs.store((float) ms, std::memory_order_relaxed);
+    }
+
+    juce::AbstractFifo ring{ RING_SIZE };
+    std::array<HeadPose, RING_SIZE> ringBuffer;
+
+    // Audio thread only
+    HeadPose latest, previous;
+    juce::int64 posesSeen = 0;
+    double blockMs = 0.0;
+    double outputLatencyMs = 0.0;
+
+    std::atomic<bool> extrapolate{ true };
+    std::atomic<int> received{ 0 };
+    std::atomic<int> dropped{ 0 };
+    std::atomic<int> latencyCount{ 0 };
+    std::atomic<double> latencySumMs{ 0.0 };
+    std::atomic<float> latencyMaxMs{ 0.f };
+    double lastStatisticsMs = 0.0;      // Message thread only
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(HeadTracker)
+};
+
+//==============================================================================
+/**
+    Receives head orientation over OSC on a local UDP port, on its own thread.
+
+    Accepted messages (angles in degrees):
+        /head/ypr   yaw pitch roll
+        /head/quat  w x y z
+*/
+class HeadTrackerUDPReceiver : private juce::Thread
+{
+public:
+    explicit HeadTrackerUDPReceiver(HeadTracker& target) : juce::Thread("Head tracker UDP"), tracker(target) {}
+
+    ~HeadTrackerUDPReceiver() override { stop(); }
+
+    /// Bind to the port on the loopback interface and start receiving. Returns false if the port is in use.
+    bool start(int port)
+    {
+        stop();
+        socket = std::make_unique<juce::DatagramSocket>(false);
+        if (! socket->bindToPort(port, "127.0.0.1"))
+        {
+            socket.reset();
+            return false;
+        }
+        startThread(juce::Thread::Priority::high);
+        return true;
+    }
+
+    void stop()
+    {
+        signalThreadShouldExit();
+        if (socket != nullptr)
+            socket->shutdown();
+        stopThread(1000);
+        socket.reset();
+    }
+
+    bool isReceiving() const { return isThreadRunning(); }
+
+private:
+    void run() override
+    {
+        char packet[1536];
+        while (! threadShouldExit())
+        {
+            if (socket->waitUntilReady(true, 100) <= 0)
+                continue;
+            const int size = socket->read(packet, (int) sizeof(packet), false);
+            if (size <= 0)
+                continue;
+
+            const double arrivalMs = juce::Time::getMillisecondCounterHiRes();
+            OSCDecoder::parse(packet, size, [this, arrivalMs](const OSCDecoder::Message& m)
+            {
+                HeadPose pose;
+                pose.timeMs = arrivalMs;
+                if (m.addressIs("/head/ypr") && m.getNumArguments() >= 3)
+                {
+                    pose.yaw = juce::degreesToRadians(m.getFloat(0));
+                    pose.pitch = juce::degreesToRadians(m.getFloat(1));
+                    pose.roll = juce::degreesToRadians(m.getFloat(2));
+                }
+                else if (m.addressIs("/head/quat") && m.getNumArguments() >= 4)
+                {
+                    fromQuaternion(m.getFloat(0), m.getFloat(1), m.getFloat(2), m.getFloat(3), pose);
+                }
+                else
+                {
+                    return;
+                }
+                tracker.push(pose);
+            });
+        }
+    }
+
+    static void fromQuaternion(float w, float x, float y, float z, HeadPose& pose) noexcept
+    {
+        pose.yaw = std::atan2(2.f * (w * z + x * y), 1.f - 2.f * (y * y + z * z));
+        pose.pitch = std::asin(juce::jlimit(-1.f, 1.f, 2.f * (w * y - z * x)));
+        pose.roll = std::atan2(2.f * (w * x + y * z), 1.f - 2.f * (x * x + y * y));
+    }
+
+    HeadTracker& tracker;
+    std::unique_ptr<juce::DatagramSocket> socket;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(HeadTrackerUDPReceiver)
+};
+
+//==============================================================================
+/**
+    Replays a recorded head-tracking session with its original timing, as a stand-in
+    for a tracker when testing. The file has one sample per line:
+        time_seconds, yaw_degrees, pitch_degrees, roll_degrees
+    Lines starting with '#' are ignored.
+*/
+class HeadTrackerFileReplay : private juce::Thread
+{
+public:
+    explicit HeadTrackerFileReplay(HeadTracker& target) : juce::Thread("Head tracker replay"), tracker(target) {}
+
+    ~HeadTrackerFileReplay() override { stopThread(1000); }
+
+    /// Load the recording and start replaying it. Returns the number of samples loaded.
+    int start(const juce::File& file, bool shouldLoop)
+    {
+        stopThread(1000);
+        samples.clear();
+        juce::StringArray lines;
+        file.readLines(lines);
+        for (const auto& line : lines)
+        {
+            if (line.trimStart().startsWithChar('#'))
+                continue;
+            const auto fields = juce::StringArray::fromTokens(line, ",; \t", "");
+            juce::StringArray values;
+            for (const auto& f : fields)
+                if (f.isNotEmpty())
+                    values.add(f);
+            if (values.size() < 4)
+                continue;
+            samples.push_back({ values[0].getDoubleValue(),
+                                juce::degreesToRadians(values[1].getFloatValue()),
+                                juce::degreesToRadians(values[2].getFloatValue()),
+                                juce::degreesToRadians(values[3].getFloatValue()) });
+        }
+        loop = shouldLoop;
+        if (! samples.empty())
+            startThread(juce::Thread::Priority::high);
+        return (int) samples.size();
+    }
+
+    void stop() { stopThread(1000); }
+
+private:
+    struct Sample
+    {
+        double timeSeconds;
+        float yaw, pitch, roll;
+    };
+
+    static constexpr double SINGLE_POSE_PERIOD_MS = 10.0;   // Loop period of a file whose samples share one time
+
+    void run() override
+    {
+        // A pass lasts the span of the file plus one mean sample interval, so the last pose is held
+        // for an interval before the first one comes round again, and a looping pass never takes zero time
+        const double firstTime = samples.front().timeSeconds;
+        const double spanMs = (samples.back().timeSeconds - firstTime) * 1000.0;
+        const double periodMs = spanMs > 0.0 ? spanMs * (double) samples.size() / (double) (samples.size() - 1)
+                                             : SINGLE_POSE_PERIOD_MS;
+        double startMs = juce::Time::getMillisecondCounterHiRes();
+        do
+        {
+            for (const auto& s : samples)
+            {
+                const double dueMs = startMs + (s.timeSeconds - firstTime) * 1000.0;
+                for (double now = juce::Time::getMillisecondCounterHiRes(); now < dueMs; now = juce::Time::getMillisecondCounterHiRes())
+                {
+                    if (threadShouldExit())
+                        return;
+                    if (dueMs - now > 2.0)
+                        wait((int) (dueMs - now) - 1);
+                    else
+                        juce::Thread::yield();
+                }
+                tracker.push({ juce::Time::getMillisecondCounterHiRes(), s.yaw, s.pitch, s.roll });
+            }
+            startMs += periodMs;
+        } while (loop && ! threadShouldExit());
+    }
+
+    HeadTracker& tracker;
+    std::vector<Sample> samples;
+    bool loop = false;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(HeadTrackerFileReplay)
+};
@@ -0,0 +1,392 @@
+/*
+  ==============================================================================
+
+    LazyHRTFGrid.h
+    On-demand resampling of an HRTF grid. Grid cells are interpolated from the
+    measured impulse responses on a helper thread, shared by all the grids, the
+    first time a direction in the cell is requested, with the nearest measurement
+    used until then.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <memory>
+#include "HRTFSpatialIndex.h"
+#include "SofaMeasurements.h"
+
+//==============================================================================
+/**
+    Bounded queue of small values with any number of producers and one consumer. Each
+    element carries a sequence number that tells producers whether it is free and
+    the consumer whether it has been written, so neither blocks: a producer that
+    finds the queue full is told so, and the consumer that finds it empty likewise.
+*/
+template <typename Type, int Capacity>
+class MultiProducerQueue
+{
+public:
+    static_assert((Capacity & (Capacity - 1)) == 0, "The capacity must be a power of two");
+
+    MultiProducerQueue()
+    {
+        for (juce::uint32 i = 0; i < (juce::uint32) Capacity; ++i)
+            elements[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    /// Any thread. Returns false if the queue is full.
+    bool push(const Type& value) noexcept
+    {
+        auto position = writePosition.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            auto& element = elements[position & (Capacity - 1)];
+            const auto difference = (juce::int32) (element.sequence.load(std::memory_order_acquire) - position);
+            if (difference == 0)
+            {
+                if (writePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    element.value = value;
+                    element.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (difference < 0)
+                return false;
+            else
+                position = writePosition.load(std::memory_order_relaxed);
+        }
+    }
+
+    /// Consumer thread only. Returns false if there is nothing to read.
+    bool pop(Type& value) noexcept
+    {
+        auto& element = elements[readPosition & (Capacity - 1)];
+        if ((juce::int32) (element.sequence.load(std::memory_order_acquire) - (readPosition + 1)) < 0)
+            return false;
+        value = element.value;
+        element.sequence.store(readPosition + Capacity, std::memory_order_release);
+        ++readPosition;
+        return true;
+    }
+
+private:
+    struct Element
+    {
+        std::atomic<juce::uint32> sequence{ 0 };
+        Type value{};
+    };
+
+    std::array<Element, Capacity> elements;
+    std::atomic<juce::uint32> writePosition{ 0 };
+    juce::uint32 readPosition = 0;
+
+    JUCE_DECLARE_NON_COPYABLE(MultiProducerQueue)
+};
+
+class LazyHRTFGrid;
+
+//==============================================================================
+/**
+    The helper thread that computes the cells of every LazyHRTFGrid. There is one for
+    all the grids alive, held through a juce::SharedResourcePointer, so loading more
+    HRTFs or preparing them for more configurations does not add threads.
+
+    Requests carry the grid they are for. A grid registers itself on construction and
+    unregisters on destruction; the thread holds the registration lock while it computes
+    a cell, so a grid is never destroyed under it, and skips the requests left over from
+    grids that are gone. The audio thread only pushes requests, which never locks.
+*/
+class LazyHRTFWorker : private juce::Thread
+{
+public:
+    LazyHRTFWorker() : juce::Thread("Lazy HRTF resampling")
+    {
+        startThread();
+    }
+
+    ~LazyHRTFWorker() override
+    {
+        stopThread(2000);
+    }
+
+    void add(LazyHRTFGrid* grid)
+    {
+        const juce::ScopedLock lock(gridsLock);
+        grids.push_back(grid);
+    }
+
+    /// Returns once the thread has finished any cell of the grid it was computing
+    void remove(LazyHRTFGrid* grid)
+    {
+        const juce::ScopedLock lock(gridsLock);
+        grids.erase(std::remove(grids.begin(), grids.end(), grid), grids.end());
+    }
+
+    /// Queue a slot of a grid. Any thread. Returns false if the queue is full.
+    bool request(LazyHRTFGrid* grid, int slot) noexcept
+    {
+        if (! requests.push({ grid, slot }))
+            return false;
+        notify();
+        return true;
+    }
+
+private:
+    struct Request
+    {
+        LazyHRTFGrid* grid;
+        int slot;
+    };
+
+    static constexpr int REQUEST_QUEUE_SIZE = 4096;
+
+    void run() override;
+
+    juce::CriticalSection gridsLock;
+    std::vector<LazyHRTFGrid*> grids;
+    MultiProducerQueue<Request, REQUEST_QUEUE_SIZE> requests;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(LazyHRTFWorker)
+};
+
+//==============================================================================
+/**
+    Resampled HRTF grid whose cells are computed lazily.
+
+    getPartitions() is called from the audio thread. It never computes anything
+    itself: if the cell of the requested direction is not ready it queues it for
+    the helper thread and answers with the partitions of the nearest measurement,
+    which are queued and computed the same way. Only the cells that are actually
+    requested are ever interpolated, partitioned and stored. Several threads may render
+    with the same grid, the batch renderer's for instance, so requests go through a
+    queue with many producers, and the helper thread, a LazyHRTFWorker shared by all
+    the grids, sleeps until one arrives.
+
+    Cells are computed like BRT's own offline resampling: barycentric interpolation
+    of the measured impulse responses of the enclosing triangle, then partitioned
+    into blocks of the BRT buffer size and transformed to the frequency domain.
+*/
+class LazyHRTFGrid
+{
+public:
+    LazyHRTFGrid(SofaMeasurements&& measured, const HRTFSpatialIndex& index, int gridStepDegrees, int bufferSize)
+        : measurements(std::move(measured)),
+          spatialIndex(index),
+          step(juce::jmax(1, gridStepDegrees)),
+          partitionLength(bufferSize),
+          azimuthCells(360 / step),
+          elevationCells(180 / step + 1),
+          numCells(azimuthCells * elevationCells),
+          numMeasurements((int) measurements.directions.size()),
+          entries(new std::atomic<Entry*>[(size_t) (numCells + numMeasurements)]),
+          states(new std::atomic<int>[(size_t) (numCells + numMeasurements)])
+    {
+        for (int i = 0; i < numCells + numMeasurements; ++i)
+        {
+            entries[(size_t) i].store(nullptr);
+            states[(size_t) i].store(Empty);
+        }
+        numPartitions = (measurements.irLength + partitionLength - 1) / partitionLength;
+        worker->add(this);
+    }
+
+    ~LazyHRTFGrid()
+    {
+        worker->remove(this);
+    }
+
+    //==========================================================================
+    /// Partitions for a direction (degrees, BRT convention). Returns false only if neither the
+    /// cell nor the nearest measurement are ready yet, in which case the caller should fall back.
+    bool getPartitions(Common::T_ear ear, float azimuth, float elevation, std::vector<CMonoBuffer<float>>& partitions) noexcept
+    {
+        const int cell = getCellIndex(azimuth, elevation);
+        if (const auto* entry = acquire(cell))
+        {
+            partitions = ear == Common::T_ear::LEFT ? entry->left : entry->right;
+            return true;
+        }
+
+        const int nearest = spatialIndex.findNearest(azimuth, normaliseElevation(elevation));
+        if (nearest >= 0)
+        {
+            if (const auto* entry = acquire(numCells + nearest))
+            {
+                partitions = ear == Common::T_ear::LEFT ? entry->left : entry->right;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /// Interaural delay (samples) interpolated from the measured delays in bounded time
+    float getDelay(Common::T_ear ear, float azimuth, float elevation) const noexcept
+    {
+        HRTFSpatialIndex::Barycentric b;
+        if (! spatialIndex.findBarycentric(azimuth, normaliseElevation(elevation), b))
+            return 0.f;
+        const auto& delays = ear == Common::T_ear::LEFT ? measurements.leftDelay : measurements.rightDelay;
+        float delay = 0.f;
+        for (size_t k = 0; k < 3; ++k)
+            delay += b.weight[k] * delays[(size_t) b.index[k]];
+        return delay;
+    }
+
+    /// Check that the partitions computed here have the layout of the ones BRT produced for the
+    /// same HRTF. Call once before the grid is used.
+    bool matchesLayout(size_t expectedPartitions, size_t expectedPartitionSize) const
+    {
+        if (numMeasurements == 0 || measurements.irLength == 0)
+            return false;
+        std::vector<float> ir(measurements.getIR(0, true), measurements.getIR(0, true) + measurements.irLength);
+        std::vector<CMonoBuffer<float>> partitions;
+        partition(ir, partitions);
+        return partitions.size() == expectedPartitions && ! partitions.empty() && partitions.front().size() == expectedPartitionSize;
+    }
+
+    //==========================================================================
+    int getNumComputedCells() const noexcept        { return computedCells.load(); }
+    int getNumCells() const noexcept                { return numCells; }
+    size_t getMemoryUsage() const noexcept          { return computedBytes.load(); }
+
+private:
+    friend class LazyHRTFWorker;
+
+    enum State { Empty = 0, Queued, Ready };
+
+    struct Entry
+    {
+        std::vector<CMonoBuffer<float>> left, right;
+    };
+
+    static float normaliseElevation(float elevation) noexcept
+    {
+        // BRT stores elevations below the horizon as 270..360
+        return elevation > 180.f ? elevation - 360.f : elevation;
+    }
+
+    int getCellIndex(float azimuth, float elevation) const noexcept
+    {
+        const int a = ((juce::roundToInt(azimuth / (float) step) % azimuthCells) + azimuthCells) % azimuthCells;
+        const int e = juce::jlimit(0, elevationCells - 1, juce::roundToInt((normaliseElevation(elevation) + 90.f) / (float) step));
+        return e * azimuthCells + a;
+    }
+
+    /// Ready entry for a cell or measurement, queueing its computation if needed
+    const Entry* acquire(int slot) noexcept
+    {
+        if (states[(size_t) slot].load(std::memory_order_acquire) == Ready)
+            return entries[(size_t) slot].load(std::memory_order_acquire);
+
+        int expected = Empty;
+        if (states[(size_t) slot].compare_exchange_strong(expected, Queued))
+        {
+            if (! worker->request(this, slot))
+                states[(size_t) slot].store(Empty);    // Queue full, ask again next time
+        }
+        return nullptr;
+    }
+
+    //==========================================================================
+    /// Compute a queued slot. Worker thread, with the grid registered.
+    void compute(int slot, std::vector<float> (&interpolated)[2])
+    {
+        if (! juce::isPositiveAndBelow(slot, numCells + numMeasurements) || states[(size_t) slot].load() != Queued)
+            return;
+
+        auto entry = std::make_unique<Entry>();
+        for (int ear = 0; ear < 2; ++ear)
+        {
+            const bool left = ear == 0;
+            interpolated[ear].assign((size_t) measurements.irLength, 0.f);
+            if (slot >= numCells)
+            {
+                const float* ir = measurements.getIR(slot - numCells, left);
+                std::copy(ir, ir + measurements.irLength, interpolated[ear].begin());
+            }
+            else
+            {
+                const float azimuth = (float) ((slot % azimuthCells) * step);
+                const float elevation = (float) ((slot / azimuthCells) * step - 90);
+                HRTFSpatialIndex::Barycentric b;
+                spatialIndex.findBarycentric(azimuth, elevation, b);
+                for (size_t k = 0; k < 3; ++k)
+                    juce::FloatVectorOperations::addWithMultiply(interpolated[ear].data(), measurements.getIR(b.index[k], left),
+                                                                 b.weight[k], measurements.irLength);
+            }
+            partition(interpolated[ear], left ? entry->left : entry->right);
+        }
+
+        computedBytes.fetch_add((size_t) (2 * numPartitions) * (entry->left.empty() ? 0 : entry->left.front().size()) * sizeof(float));
+        entries[(size_t) slot].store(entry.get(), std::memory_order_release);
+        states[(size_t) slot].store(Ready, std::memory_order_release);
+        owned.push_back(std::move(entry));
+        if (slot < numCells)
+            computedCells.fetch_add(1);
+    }
+
+    /// Split an impulse response into buffer-size subfilters and transform each one, zero padded
+    /// to twice its length, with the same FFT BRT uses for its own partitioned HRIRs
+    void partition(const std::vector<float>& ir, std::vector<CMonoBuffer<float>>& result) const
+    {
+        result.resize((size_t) numPartitions);
+        CMonoBuffer<float> padded((size_t) (2 * partitionLength));
+        for (int p = 0; p < numPartitions; ++p)
+        {
+            std::fill(padded.begin(), padded.end(), 0.f);
+            const int start = p * partitionLength;
+            const int count = juce::jmin(partitionLength, measurements.irLength - start);
+            std::copy(ir.begin() + start, ir.begin() + start + count, padded.begin());
+            Common::CFprocessor::CalculateFFT(padded, result[(size_t) p]);
+        }
+    }
+
+    //==========================================================================
+    const SofaMeasurements measurements;
+    const HRTFSpatialIndex& spatialIndex;
+    const int step;
+    const int partitionLength;
+    const int azimuthCells;
+    const int elevationCells;
+    const int numCells;
+    const int numMeasurements;
+    int numPartitions = 0;
+
+    // Cells first, then one slot per measurement for the nearest-measurement fallback
+    std::unique_ptr<std::atomic<Entry*>[]> entries;
+    std::unique_ptr<std::atomic<int>[]> states;
+    std::vector<std::unique_ptr<Entry>> owned;      // Worker thread only
+
+    juce::SharedResourcePointer<LazyHRTFWorker> worker;
+
+    std::atomic<int> computedCells{ 0 };
+    std::atomic<size_t> computedBytes{ 0 };
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(LazyHRTFGrid)
+};
+
+//==============================================================================
+inline void LazyHRTFWorker::run()
+{
+    std::vector<float> interpolated[2];
+    while (! threadShouldExit())
+    {
+        // A request pushed after the queue was found empty has signalled the event already
+        Request request;
+        if (! requests.pop(request))
+        {
+            wait(-1);
+            continue;
+        }
+
+        // Requests of a grid destroyed since are skipped
+        const juce::ScopedLock lock(gridsLock);
+        if (std::find(grids.begin(), grids.end(), request.grid) != grids.end())
+            request.grid->compute(request.slot, interpolated);
+    }
+}
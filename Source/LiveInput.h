@@ -0,0 +1,240 @@
+/*
+  ==============================================================================
+
+    LiveInput.h
+    Device input channels spatialized as BRT sources in the same callback, and
+    a loopback measurement of the latency from an input to the ears.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "BRTBufferBinding.h"
+#include "SceneState.h"
+
+//==============================================================================
+/**
+    Live inputs of the duplex mode, one BRT source per device input channel.
+
+    Each block, every input channel is copied with one vector copy into the input buffer
+    of its source, in the callback that received it, so the only latency added to the
+    device's is the algorithmic latency of the listener (the onset of the HRIRs; the
+    convolution partitions have the block size and add none). The sources are scene
+    entries, moved like any other source. Each channel has its own scene entry, so the
+    sources of inputs opened later may come after sources of other kinds.
+*/
+class LiveInputBank
+{
+public:
+    static constexpr int MAX_CHANNELS = 16;
+
+    /// Reserve storage for the largest block. Call from prepareToPlay.
+    void prepare(int maximumBlockSize)
+    {
+        for (auto& input : inputs)
+            input.prepare(maximumBlockSize);
+    }
+
+    /// Feed input channel c to the scene entry sceneIndices[c], for channels 0 to numChannels - 1,
+    /// or stop with numChannels = 0. Message thread, under the audio callback lock.
+    void bind(const int* sceneIndices, int numChannels) noexcept
+    {
+        for (int c = 0; c < numBound.load(std::memory_order_relaxed); ++c)
+            channelOfEntry[(size_t) sceneIndexOfChannel[(size_t) c]] = -1;
+        const int n = juce::jlimit(0, MAX_CHANNELS, numChannels);
+        for (int c = 0; c < n; ++c)
+        {
+            jassert(juce::isPositiveAndBelow(sceneIndices[c], SceneState::MAX_SOURCES));
+            sceneIndexOfChannel[(size_t) c] = sceneIndices[c];
+            channelOfEntry[(size_t) sceneIndices[c]] = (juce::int8) c;
+        }
+        numBound.store(n, std::memory_order_release);
+    }
+
+    int getNumBound() const noexcept                    { return numBound.load(std::memory_order_acquire); }
+
+    /// Copy the input channels of the device buffer into the source inputs. Must be called
+    /// before the output is written into the same buffer. Audio thread.
+    void capture(const juce::AudioSourceChannelInfo& device, int numDeviceInputs) noexcept
+    {
+        const int n = juce::jmin(getNumBound(), numDeviceInputs, device.buffer->getNumChannels());
+        for (int c = 0; c < n; ++c)
+            inputs[(size_t) c].copyFrom(device.buffer->getReadPointer(c, device.startSample), device.numSamples);
+        for (int c = n; c < getNumBound(); ++c)
+            inputs[(size_t) c].clear(device.numSamples);
+    }
+
+    /// Captured input of the source of a scene entry, or nullptr if the entry is not a live input.
+    /// Audio thread.
+    SourceInputBinding* getInput(int sceneIndex) noexcept
+    {
+        const int channel = juce::isPositiveAndBelow(sceneIndex, SceneState::MAX_SOURCES) ? channelOfEntry[(size_t) sceneIndex] : -1;
+        return channel >= 0 ? &inputs[(size_t) channel] : nullptr;
+    }
+
+    /// Input buffer of the source of a channel, valid after capture()
+    CMonoBuffer<float>& getBuffer(int channel) noexcept { return inputs[(size_t) channel].getBuffer(); }
+
+private:
+    std::array<SourceInputBinding, MAX_CHANNELS> inputs;
+    std::array<int, MAX_CHANNELS> sceneIndexOfChannel{};
+    std::array<juce::int8, SceneState::MAX_SOURCES> channelOfEntry = makeUnbound();    // Channel of each scene entry, or -1
+    std::atomic<int> numBound{ 0 };
+
+    static std::array<juce::int8, SceneState::MAX_SOURCES> makeUnbound() noexcept
+    {
+        std::array<juce::int8, SceneState::MAX_SOURCES> unbound;
+        unbound.fill(-1);
+        return unbound;
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(LiveInputBank)
+};
+
+//==============================================================================
+/**
+    Loopback measurement of the end-to-end latency of the live input path.
+
+    With output 1 (left ear) cabled to input 1, the meter replaces the signal of the
+    first live source with an impulse every half second. The impulse goes through the
+    listener, the device output, the cable and the device input, and the meter looks
+    for its onset in input 1: the time between the two is what a microphone signal
+    takes to reach the ears, device latencies and listener latency included. The onset
+    is the first sample above a threshold set well over the noise measured just
+    before each impulse. Input 1 is not spatialized while the meter runs, so the
+    loopback does not feed back.
+*/
+class LoopbackLatencyMeter
+{
+public:
+    struct Result
+    {
+        int measurements = 0;
+        int missed = 0;                 // Impulses not found within the period
+        double lastMs = 0.0;
+        double minMs = 0.0;
+        double maxMs = 0.0;
+    };
+
+    void prepare(double newSampleRate) noexcept
+    {
+        sampleRate = newSampleRate;
+        periodSamples = juce::roundToInt(newSampleRate * PERIOD_SECONDS);
+        running = false;
+    }
+
+    void setEnabled(bool shouldBeEnabled) noexcept      { enabled.store(shouldBeEnabled); }
+    bool isEnabled() const noexcept                     { return enabled.load(); }
+
+    /// Look for the impulse in the loopback input, then write the next impulse, if one is due,
+    /// into the source input in place of the live signal. Audio thread.
+    void process(const float* loopbackInput, CMonoBuffer<float>& sourceInput, int numSamples) noexcept
+    {
+        if (! enabled.load(std::memory_order_relaxed) || periodSamples <= 0)
+        {
+            running = false;
+            return;
+        }
+        if (! running)
+        {
+            restart();
+            running = true;
+        }
+
+        for (int i = 0; i < numSamples; ++i)
+        {
+            const float x = std::abs(loopbackInput[i]);
+            const juce::int64 sinceImpulse = clock + i - emittedAt;
+            if (waiting && sinceImpulse >= 0 && x > threshold)
+            {
+                waiting = false;
+                record((double) sinceImpulse);
+            }
+            else if (sinceImpulse > periodSamples - NOISE_WINDOW)
+            {
+                noiseEnergy += x * x;   // Noise floor just before the next impulse
+                ++noiseSamples;
+            }
+        }
+
+        std::fill(sourceInput.begin(), sourceInput.begin() + numSamples, 0.f);
+        const juce::int64 due = emittedAt + periodSamples;
+        if (due < clock + numSamples)
+        {
+            if (waiting)
+                missed.fetch_add(1, std::memory_order_relaxed);
+            const float noiseRms = noiseSamples > 0 ? std::sqrt(noiseEnergy / (float) noiseSamples) : 0.f;
+            threshold = juce::jmax(MIN_THRESHOLD, 10.f * noiseRms);
+            noiseEnergy = 0.f;
+            noiseSamples = 0;
+
+            const int offset = (int) juce::jmax((juce::int64) 0, due - clock);
+            sourceInput[(size_t) offset] = IMPULSE_AMPLITUDE;
+            emittedAt = clock + offset;
+            waiting = true;
+        }
+        clock += numSamples;
+    }
+
+    /// Measurements since the meter was last enabled. Any thread.
+    Result getResult() const noexcept
+    {
+        Result result;
+        result.measurements = count.load(std::memory_order_relaxed);
+        result.missed = missed.load(std::memory_order_relaxed);
+        const double toMs = sampleRate > 0.0 ? 1000.0 / sampleRate : 0.0;
+        result.lastMs = lastSamples.load(std::memory_order_relaxed) * toMs;
+        result.minMs = minSamples.load(std::memory_order_relaxed) * toMs;
+        result.maxMs = maxSamples.load(std::memory_order_relaxed) * toMs;
+        return result;
+    }
+
+private:
+    static constexpr double PERIOD_SECONDS = 0.5;
+    static constexpr int NOISE_WINDOW = 2048;
+    static constexpr float IMPULSE_AMPLITUDE = 0.5f;
+    static constexpr float MIN_THRESHOLD = 0.005f;     // About -46 dBFS
+
+    void record(double samples) noexcept
+    {
+        lastSamples.store(samples, std::memory_order_relaxed);
+        if (count.load(std::memory_order_relaxed) == 0 || samples < minSamples.load(std::memory_order_relaxed))
+            minSamples.store(samples, std::memory_order_relaxed);
+        if (samples > maxSamples.load(std::memory_order_relaxed))
+            maxSamples.store(samples, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_release);
+    }
+
+    void restart() noexcept
+    {
+        clock = 0;
+        emittedAt = -periodSamples;   // First impulse at the start of the next block
+        waiting = false;
+        threshold = MIN_THRESHOLD;
+        noiseEnergy = 0.f;
+        noiseSamples = 0;
+        count.store(0);
+        missed.store(0);
+        lastSamples.store(0.0);
+        minSamples.store(0.0);
+        maxSamples.store(0.0);
+    }
+
+    std::atomic<bool> enabled{ false };
+    double sampleRate = 0.0;
+    int periodSamples = 0;
+
+    // Audio thread only
+    bool running = false;
+    juce::int64 clock = 0, emittedAt = 0;
+    bool waiting = false;
+    float threshold = MIN_THRESHOLD;
+    float noiseEnergy = 0.f;
+    int noiseSamples = 0;
+
+    std::atomic<int> count{ 0 }, missed{ 0 };
+    std::atomic<double> lastSamples{ 0.0 }, minSamples{ 0.0 }, maxSamples{ 0.0 };
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(LoopbackLatencyMeter)
+};
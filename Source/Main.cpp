@@ -8,6 +8,15 @@
 
 #include <JuceHeader.h>
 #include "brt-juce-basic.h"
+#include "HRTFSpatialIndexBenchmark.h"
+#include "OSCControlBenchmark.h"
+#include "SceneSnapshotBenchmark.h"
+#include "BatchRenderer.h"
+#include "RenderDaemon.h"
+#include "VirtualAudioDevice.h"
+#include "SoakTest.h"
+#include "RealtimeChecker.h"
+#include "TestFixtures.h"
 
 class Application    : public juce::JUCEApplication
 {
@@ -18,12 +27,208 @@ public:
     const juce::String getApplicationName() override       { return "PlayingSoundFilesTutorial"; }
     const juce::String getApplicationVersion() override    { return "1.0.0"; }
 
-    void initialise (const juce::String&) override
+    void initialise (const juce::String& commandLine) override
     {
+        auto arguments = juce::StringArray::fromTokens (commandLine, true);
+        for (auto& argument : arguments)
+            argument = argument.unquoted();
+
+        // Command line tools that run without a window
+        if (arguments.contains ("--benchmark-hrtf-index"))
+        {
+            arguments.removeString ("--benchmark-hrtf-index");
+            std::cout << HRTFSpatialIndexBenchmark::run (arguments) << std::endl;
+            quit();
+            return;
+        }
+
+        if (arguments.contains ("--benchmark-osc-control"))
+        {
+            std::cout << OSCControlBenchmark::run() << std::endl;
+            quit();
+            return;
+        }
+
+        if (arguments.contains ("--benchmark-scene-load"))
+        {
+            bool succeeded = false;
+            std::cout << SceneSnapshotBenchmark::run (succeeded) << std::endl;
+            setApplicationReturnValue (succeeded ? 0 : 1);
+            quit();
+            return;
+        }
+
+        if (const int index = arguments.indexOf ("--batch-render"); index >= 0)
+        {
+            std::cout << BatchRenderer::run (juce::File::getCurrentWorkingDirectory().getChildFile (arguments[index + 1])) << std::endl;
+            quit();
+            return;
+        }
+
+       #if JUCE_LINUX || JUCE_MAC || JUCE_BSD
+        // Headless render daemon, runs until the process is asked to quit
+        if (const int index = arguments.indexOf ("--daemon"); index >= 0)
+        {
+            auto option = [&arguments] (const char* name, int defaultValue)
+            {
+                const int i = arguments.indexOf (name);
+                return i >= 0 ? arguments[i + 1].getIntValue() : defaultValue;
+            };
+            const auto socketPath = arguments[index + 1].startsWith ("--") || arguments[index + 1].isEmpty()
+                                        ? juce::String ("/tmp/brt-render.sock") : arguments[index + 1];
+            renderDaemon = std::make_unique<RenderDaemon::Server> (socketPath,
+                                                                   option ("--workers", juce::SystemStats::getNumCpus()),
+                                                                   option ("--block-size", 512),
+                                                                   (double) option ("--sample-rate", 48000));
+            const auto error = renderDaemon->start();
+            if (error.isNotEmpty())
+            {
+                std::cerr << error << std::endl;
+                renderDaemon = nullptr;
+                setApplicationReturnValue (1);
+                quit();
+                return;
+            }
+            renderDaemon->setReportInterval (10.0);
+            std::cout << "Render daemon listening on " << socketPath << std::endl;
+            return;
+        }
+
+        if (const int index = arguments.indexOf ("--daemon-load-test"); index >= 0)
+        {
+            std::cout << RenderDaemon::runLoadTest (arguments[index + 1], arguments[index + 2],
+                                                    juce::jmax (1, arguments[index + 3].getIntValue()),
+                                                    juce::jmax (1, arguments[index + 4].getIntValue()),
+                                                    arguments[index + 5].isNotEmpty() ? arguments[index + 5].getDoubleValue() : 10.0)
+                      << std::endl;
+            quit();
+            return;
+        }
+       #endif
+
+        // Virtual audio device options, for testing without audio hardware
+        auto& virtualDevice = VirtualAudioDeviceSettings::get();
+        if (const int index = arguments.indexOf ("--virtual-device"); index >= 0)
+        {
+            virtualDevice.useByDefault = true;
+            virtualDevice.realTime = arguments[index + 1] != "fast";
+        }
+        virtualDevice.loopback = arguments.contains ("--virtual-loopback");
+        auto numberAfter = [&arguments] (const char* name, double defaultValue)
+        {
+            const int i = arguments.indexOf (name);
+            return i >= 0 ? arguments[i + 1].getDoubleValue() : defaultValue;
+        };
+        virtualDevice.sampleRate = numberAfter ("--sample-rate", 0.0);
+        virtualDevice.blockSize = (int) numberAfter ("--block-size", 0.0);
+        virtualDevice.jitterMs = numberAfter ("--jitter-ms", 0.0);
+        virtualDevice.stallProbability = numberAfter ("--stall-probability", 0.0);
+        virtualDevice.stallMs = numberAfter ("--stall-ms", 0.0);
+
+        // The jitter and stalls are random, the seed is printed so that a failing run can be repeated
+        if (const int index = arguments.indexOf ("--seed"); index >= 0)
+            virtualDevice.seed = arguments[index + 1].getLargeIntValue();
+        else
+            virtualDevice.seed = juce::Random::getSystemRandom().nextInt64();
+        if (virtualDevice.jitterMs > 0.0 || virtualDevice.stallProbability > 0.0)
+            std::cout << "Virtual device jitter and stalls with --seed " << virtualDevice.seed << std::endl;
+
+        // Soak test of the whole application, without a window. The real-time self-check drives the
+        // application in the same way, for seconds instead of hours, with the real-time checks on.
+        const int soakIndex = arguments.indexOf ("--soak");
+        const int realtimeCheckIndex = arguments.indexOf ("--rt-check");
+        if (soakIndex >= 0 || realtimeCheckIndex >= 0)
+        {
+            SoakTest::Options options;
+            for (const auto& argument : arguments)
+            {
+                const auto file = juce::File::getCurrentWorkingDirectory().getChildFile (argument);
+                if (file.hasFileExtension (".sofa"))
+                    options.sofaFiles.add (file);
+                else if (file.hasFileExtension (".wav"))
+                    options.audioFile = file;
+            }
+
+            const bool realtimeCheck = realtimeCheckIndex >= 0;
+            if (realtimeCheck)
+            {
+                if (! RealtimeChecker::isCompiledIn())
+                {
+                    std::cerr << "Real-time checks are not compiled in, build with BRT_REALTIME_CHECKS=1" << std::endl;
+                    setApplicationReturnValue (1);
+                    quit();
+                    return;
+                }
+                RealtimeChecker::setMode (arguments[realtimeCheckIndex + 1] == "abort" ? RealtimeChecker::Mode::abort
+                                                                                       : RealtimeChecker::Mode::log);
+                options.hours = numberAfter ("--rt-check-seconds", 20.0) / 3600.0;
+                options.sampleIntervalSeconds = 1.0;
+                options.hrtfSwitchSeconds = 0.25;
+                options.reloadSeconds = 1.0;
+
+                // Without files the check makes up its own, so it runs unattended, e.g. in CI
+                const auto fixtures = juce::File::getSpecialLocation (juce::File::tempDirectory).getChildFile ("brt-rt-check");
+                if (options.sofaFiles.isEmpty())
+                {
+                    options.sofaFiles.add (fixtures.getChildFile ("synthetic-head.sofa"));
+                    options.syntheticHRTF = true;
+                }
+                if (options.audioFile == juce::File() && fixtures.createDirectory().wasOk()
+                    && TestFixtures::writeTestSignal (fixtures.getChildFile ("noise-bursts.wav")))
+                    options.audioFile = fixtures.getChildFile ("noise-bursts.wav");
+            }
+            else
+            {
+                options.hours = arguments[soakIndex + 1].getDoubleValue();
+                options.sampleIntervalSeconds = numberAfter ("--soak-interval", options.sampleIntervalSeconds);
+            }
+            if (const int i = arguments.indexOf ("--report"); i >= 0)
+                options.reportFile = juce::File::getCurrentWorkingDirectory().getChildFile (arguments[i + 1]);
+
+            soakComponent = std::make_unique<MainContentComponent> (false);
+            soakComponent->setShowAlerts (false);
+            soakTest = std::make_unique<SoakTest> (*soakComponent, options, [this, realtimeCheck] (const juce::String& report, bool passed)
+            {
+                if (realtimeCheck)
+                {
+                    RealtimeChecker::setMode (RealtimeChecker::Mode::off);
+                    std::cout << std::endl << RealtimeChecker::getReport() << std::endl;
+                    passed = RealtimeChecker::getNumViolations() == 0;
+                }
+                else
+                {
+                    std::cout << std::endl << report << std::endl;
+                }
+                setApplicationReturnValue (passed ? 0 : 1);
+                quit();
+            });
+
+            // Files can only be loaded once the audio engine has started in the background
+            soakComponent->onEngineReady = [this] (const juce::String& engineError)
+            {
+                const auto error = engineError.isNotEmpty() ? engineError : soakTest->start();
+                if (error.isNotEmpty())
+                {
+                    std::cerr << error << std::endl;
+                    setApplicationReturnValue (1);
+                    quit();
+                }
+            };
+            return;
+        }
+
         mainWindow.reset (new MainWindow ("PlayingSoundFilesTutorial", new MainContentComponent, *this));
     }
 
-    void shutdown() override                         { mainWindow = nullptr; }
+    void shutdown() override
+    {
+        mainWindow = nullptr;
+        soakTest = nullptr;
+        soakComponent = nullptr;
+       #if JUCE_LINUX || JUCE_MAC || JUCE_BSD
+        renderDaemon = nullptr;
+       #endif
+    }
 
 private:
     class MainWindow    : public juce::DocumentWindow
@@ -62,6 +267,11 @@ private:
     };
 
     std::unique_ptr<MainWindow> mainWindow;
+    std::unique_ptr<MainContentComponent> soakComponent;
+    std::unique_ptr<SoakTest> soakTest;
+   #if JUCE_LINUX || JUCE_MAC || JUCE_BSD
+    std::unique_ptr<RenderDaemon::Server> renderDaemon;
+   #endif
 };
 
 //==============================================================================
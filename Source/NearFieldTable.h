@@ -0,0 +1,208 @@
+/*
+  ==============================================================================
+
+    NearFieldTable.h
+    Near-field correction filters of the spherical head model, precomputed over
+    distance and interaural azimuth, and served to BRT as its SOS filters.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <cmath>
+#include <complex>
+#include <memory>
+#include <vector>
+
+//==============================================================================
+/**
+    Dense table of near-field correction filters for one sample rate.
+
+    Closer than the distance at which the HRTF was measured, the head shadow changes
+    with distance: the ear facing the source gets louder at low frequencies, the other
+    one duller. The correction for a source at distance r is the ratio between the
+    responses of a rigid sphere (Duda and Martens' series) for a source at r and at
+    the measurement distance. Each ratio is fitted with a first-order shelving filter,
+    matching its gain at low and high frequencies and the frequency halfway between
+    them, and the shelf is stored as three coefficients (b0, b1, a1).
+
+    The sphere is symmetric about the interaural axis, so the response only depends on
+    the interaural azimuth of the source, and the right ear at azimuth a is the left
+    ear at -a: the table holds the left ear only, over NUM_DISTANCES log-spaced
+    distances from MIN_DISTANCE to the measurement distance and NUM_AZIMUTHS interaural
+    azimuths. A lookup interpolates the coefficients of the four nearest entries.
+    Convex combinations of stable first-order sections are stable, and the coefficients
+    change continuously with the position, so a source that moves only gets small
+    filter changes from one block to the next.
+
+    The table is immutable once built and may be read from any thread. It replaces the
+    lookup of BRT's CSOSFilters, which the listener's near-field processor asks for the
+    coefficients of every source once per block.
+*/
+class NearFieldTable : public BRTServices::CSOSFilters
+{
+public:
+    static constexpr float MIN_DISTANCE = 0.1f;        // Metres, the closest position of the distance dial
+    static constexpr float HEAD_RADIUS = 0.0875f;      // Metres, BRT's default listener head radius
+    static constexpr int NUM_DISTANCES = 48;
+    static constexpr int NUM_AZIMUTHS = 91;            // Every 2 degrees from -90 (right) to 90 (left)
+    static constexpr float DEFAULT_REFERENCE_DISTANCE = 1.95f;  // For files without measurement distances
+
+    /// Build the table for a sample rate and the distance the HRTF was measured at. Any thread.
+    static std::shared_ptr<NearFieldTable> build(double sampleRate, float referenceDistance)
+    {
+        const double start = juce::Time::getMillisecondCounterHiRes();
+        if (referenceDistance <= 0.f)
+            referenceDistance = DEFAULT_REFERENCE_DISTANCE;
+        auto table = std::shared_ptr<NearFieldTable>(new NearFieldTable(sampleRate, juce::jmax(2.f * MIN_DISTANCE, referenceDistance)));
+        table->buildMs = juce::Time::getMillisecondCounterHiRes() - start;
+        return table;
+    }
+
+    /// Coefficients of an ear for a source, in BRT's layout: two biquads of (b0, b1, b2, a1, a2), of
+    /// which the second is a pass-through. interauralAzimuth is in degrees, positive to the left.
+    const std::vector<float> GetSOSFilterCoefficients(Common::T_ear ear, float distance, float interauralAzimuth) const override
+    {
+        const float azimuth = ear == Common::T_ear::RIGHT ? -interauralAzimuth : interauralAzimuth;
+        const float d = juce::jlimit(0.f, (float) (NUM_DISTANCES - 1),
+                                     std::log(juce::jmax(distance, MIN_DISTANCE) / MIN_DISTANCE) / logDistanceStep);
+        const float a = juce::jlimit(0.f, (float) (NUM_AZIMUTHS - 1), (azimuth + 90.f) / AZIMUTH_STEP);
+        const int d0 = juce::jmin((int) d, NUM_DISTANCES - 2), a0 = juce::jmin((int) a, NUM_AZIMUTHS - 2);
+        const float fd = d - (float) d0, fa = a - (float) a0;
+
+        const float* c00 = entry(d0, a0);
+        const float* c01 = entry(d0, a0 + 1);
+        const float* c10 = entry(d0 + 1, a0);
+        const float* c11 = entry(d0 + 1, a0 + 1);
+        float c[COEFFICIENTS];
+        for (int k = 0; k < COEFFICIENTS; ++k)
+        {
+            const float closer = c00[k] + fa * (c01[k] - c00[k]);
+            const float farther = c10[k] + fa * (c11[k] - c10[k]);
+            c[k] = closer + fd * (farther - closer);
+        }
+        return { c[0], c[1], 0.f, c[2], 0.f,
+                 1.f, 0.f, 0.f, 0.f, 0.f };
+    }
+
+    double getSampleRate() const noexcept           { return sampleRate; }
+    float getReferenceDistance() const noexcept     { return referenceDistance; }
+    double getBuildMs() const noexcept              { return buildMs; }
+    size_t getMemoryUsage() const noexcept          { return coefficients.size() * sizeof(float); }
+
+private:
+    static constexpr int COEFFICIENTS = 3;             // b0, b1, a1 of the shelf
+    static constexpr float AZIMUTH_STEP = 180.f / (NUM_AZIMUTHS - 1);
+    static constexpr int NUM_FREQUENCIES = 24;         // Log-spaced, where the responses are compared
+    static constexpr double LOWEST_FREQUENCY = 50.0;
+    static constexpr double HIGHEST_FREQUENCY = 16000.0;
+    static constexpr double SPEED_OF_SOUND = 343.0;
+
+    NearFieldTable(double rate, float reference)
+        : sampleRate(rate), referenceDistance(reference),
+          logDistanceStep(std::log(reference / MIN_DISTANCE) / (NUM_DISTANCES - 1)),
+          coefficients((size_t) (NUM_DISTANCES * NUM_AZIMUTHS * COEFFICIENTS))
+    {
+        const double highest = juce::jmin(HIGHEST_FREQUENCY, 0.45 * sampleRate);
+        std::vector<double> frequencies(NUM_FREQUENCIES), referenceDb(NUM_FREQUENCIES), ratioDb(NUM_FREQUENCIES);
+        for (int f = 0; f < NUM_FREQUENCIES; ++f)
+            frequencies[(size_t) f] = LOWEST_FREQUENCY * std::pow(highest / LOWEST_FREQUENCY, (double) f / (NUM_FREQUENCIES - 1));
+
+        for (int a = 0; a < NUM_AZIMUTHS; ++a)
+        {
+            // Angle between the source and the left ear
+            const double incidence = juce::degreesToRadians(90.0 - (a * (double) AZIMUTH_STEP - 90.0));
+            for (int f = 0; f < NUM_FREQUENCIES; ++f)
+                referenceDb[(size_t) f] = sphereResponseDb(reference, incidence, frequencies[(size_t) f]);
+
+            for (int d = 0; d < NUM_DISTANCES; ++d)
+            {
+                const double distance = MIN_DISTANCE * std::exp(d * (double) logDistanceStep);
+                for (int f = 0; f < NUM_FREQUENCIES; ++f)
+                    ratioDb[(size_t) f] = sphereResponseDb(distance, incidence, frequencies[(size_t) f]) - referenceDb[(size_t) f];
+                fitShelf(frequencies, ratioDb, entry(d, a));
+            }
+        }
+    }
+
+    float* entry(int d, int a) noexcept             { return coefficients.data() + (size_t) ((d * NUM_AZIMUTHS + a) * COEFFICIENTS); }
+    const float* entry(int d, int a) const noexcept { return coefficients.data() + (size_t) ((d * NUM_AZIMUTHS + a) * COEFFICIENTS); }
+
+    /// Level of the pressure on a rigid sphere relative to the free field, in dB, for a point source at
+    /// a distance from the centre and an angle from the ear. Duda and Martens (1998), summed until the
+    /// terms are negligible.
+    static double sphereResponseDb(double distance, double incidence, double frequency)
+    {
+        using complex = std::complex<double>;
+        const double mu = juce::MathConstants<double>::twoPi * frequency * HEAD_RADIUS / SPEED_OF_SOUND;
+        const double rho = distance / HEAD_RADIUS;
+        const double x = std::cos(incidence);
+        const complex i(0.0, 1.0);
+        const complex zr = 1.0 / (i * mu * rho), za = 1.0 / (i * mu);
+
+        complex qr2 = zr, qr1 = zr * (1.0 - zr);
+        complex qa2 = za, qa1 = za * (1.0 - za);
+        double p2 = 1.0, p1 = x;
+        complex sum = zr / (za * (za - 1.0));
+        complex term = (3.0 * x * zr * (zr - 1.0)) / (za * (2.0 * za * za - 2.0 * za + 1.0));
+        sum += term;
+        double oldRatio = 1.0, newRatio = std::abs(term) / std::abs(sum);
+        for (int m = 2; (oldRatio > SERIES_TOLERANCE || newRatio > SERIES_TOLERANCE) && m < MAX_SERIES_TERMS; ++m)
+        {
+            const complex qr = -(2.0 * m - 1.0) * zr * qr1 + qr2;
+            const complex qa = -(2.0 * m - 1.0) * za * qa1 + qa2;
+            const double p = ((2.0 * m - 1.0) * x * p1 - (m - 1.0) * p2) / m;
+            term = ((2.0 * m + 1.0) * p * qr) / ((m + 1.0) * za * qa - qa1);
+            sum += term;
+            qr2 = qr1; qr1 = qr;
+            qa2 = qa1; qa1 = qa;
+            p2 = p1; p1 = p;
+            oldRatio = newRatio;
+            newRatio = std::abs(term) / std::abs(sum);
+        }
+        return 20.0 * std::log10(juce::jmax(1.0e-9, std::abs(rho * sum / mu)));
+    }
+
+    /// First-order shelf with the low- and high-frequency gains of a response and its corner where the
+    /// response crosses halfway between them, by the bilinear transform
+    void fitShelf(const std::vector<double>& frequencies, const std::vector<double>& responseDb, float* shelf) const
+    {
+        const size_t n = frequencies.size();
+        const double lowDb = responseDb.front();
+        double highDb = 0.0;
+        for (size_t f = n - n / 4; f < n; ++f)
+            highDb += responseDb[f] / (double) (n / 4);     // Averaged over the bright spot ripple
+
+        double corner = 1000.0;
+        const double halfwayDb = 0.5 * (lowDb + highDb);
+        for (size_t f = 1; f < n; ++f)
+        {
+            const double before = responseDb[f - 1] - halfwayDb, after = responseDb[f] - halfwayDb;
+            if ((before <= 0.0) != (after <= 0.0))
+            {
+                const double t = before / (before - after);
+                corner = frequencies[f - 1] * std::pow(frequencies[f] / frequencies[f - 1], t);
+                break;
+            }
+        }
+
+        const double g0 = juce::Decibels::decibelsToGain(lowDb, -200.0);
+        const double gInf = juce::Decibels::decibelsToGain(highDb, -200.0);
+        const double k = std::tan(juce::MathConstants<double>::pi * juce::jmin(corner, 0.45 * sampleRate) / sampleRate);
+        shelf[0] = (float) ((gInf + g0 * k) / (1.0 + k));
+        shelf[1] = (float) ((g0 * k - gInf) / (1.0 + k));
+        shelf[2] = (float) ((k - 1.0) / (1.0 + k));
+    }
+
+    static constexpr double SERIES_TOLERANCE = 1.0e-6;
+    static constexpr int MAX_SERIES_TERMS = 1000;
+
+    const double sampleRate;
+    const float referenceDistance;
+    const float logDistanceStep;
+    std::vector<float> coefficients;                // NUM_DISTANCES x NUM_AZIMUTHS shelves of the left ear
+    double buildMs = 0.0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(NearFieldTable)
+};
@@ -0,0 +1,172 @@
+/*
+  ==============================================================================
+
+    OSCControlBenchmark.h
+    Throughput and latency of the OSC control surface, measured over the
+    loopback interface with a simulated audio thread.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "OSCControlSurface.h"
+
+//==============================================================================
+namespace OSCControlBenchmark
+{
+    constexpr int PORT = 9101;
+    constexpr int BLOCK_SIZE = 256;
+    constexpr double SAMPLE_RATE = 48000.0;
+
+    /// OSC encoding, just enough to build the test packets
+    struct PacketWriter
+    {
+        juce::MemoryBlock data;
+        size_t size = 0;
+
+        void clear() { size = 0; }
+
+        void appendInt(juce::uint32 v)
+        {
+            const char bytes[4] = { (char) (v >> 24), (char) (v >> 16), (char) (v >> 8), (char) v };
+            append(bytes, 4);
+        }
+
+        void appendFloat(float f)
+        {
+            juce::uint32 bits;
+            std::memcpy(&bits, &f, 4);
+            appendInt(bits);
+        }
+
+        void appendString(const char* s)
+        {
+            const auto length = std::strlen(s);
+            append(s, length);
+            const char zeros[4] = {};
+            append(zeros, 4 - length % 4);
+        }
+
+        void append(const void* p, size_t n)
+        {
+            data.ensureSize(size + n);
+            std::memcpy(static_cast<char*>(data.getData()) + size, p, n);
+            size += n;
+        }
+
+        void beginBundle()
+        {
+            clear();
+            append("#bundle", 8);
+            appendInt(0);
+            appendInt(1);
+        }
+
+        void addPosition(int source, float azimuth, float elevation, float distance)
+        {
+            appendInt(44);      // Element size: 20 address + 8 types + 16 arguments
+            appendString("/source/position");
+            appendString(",ifff");
+            appendInt((juce::uint32) source);
+            appendFloat(azimuth);
+            appendFloat(elevation);
+            appendFloat(distance);
+        }
+    };
+
+    /// Calls SceneState::update() once per block period, like the audio callback would
+    class AudioThreadSimulation : public juce::Thread
+    {
+    public:
+        explicit AudioThreadSimulation(SceneState& s) : juce::Thread("Simulated audio"), scene(s) {}
+
+        void run() override
+        {
+            const double blockMs = 1000.0 * BLOCK_SIZE / SAMPLE_RATE;
+            double next = juce::Time::getMillisecondCounterHiRes();
+            while (! threadShouldExit())
+            {
+                scene.update(Common::CVector3(0.f, 0.f, 0.f));
+                next += blockMs;
+                const double wait = next - juce::Time::getMillisecondCounterHiRes();
+                if (wait > 1.0)
+                    juce::Thread::sleep((int) wait);
+            }
+        }
+
+    private:
+        SceneState& scene;
+    };
+
+    /// Send one bundle updating every source per frame, at the given frame rate or as fast as
+    /// possible (frameRate 0), for the given time
+    inline juce::String runCase(int numSources, double frameRate, double seconds)
+    {
+        SceneState scene;
+        for (int i = 0; i < numSources; ++i)
+            scene.addSource(nullptr, 0.f, 0.f, 1.f);
+
+        OSCControlSurface surface(scene);
+        if (! surface.start(PORT))
+            return "Could not open UDP port " + juce::String(PORT) + "\n";
+        AudioThreadSimulation audio(scene);
+        audio.startThread(juce::Thread::Priority::highest);
+
+        juce::DatagramSocket sender;
+        PacketWriter packet;
+        juce::int64 sentMessages = 0;
+        int frames = 0;
+        surface.getAndResetStatistics();
+        const double startMs = juce::Time::getMillisecondCounterHiRes();
+        for (double now = startMs; now - startMs < seconds * 1000.0; now = juce::Time::getMillisecondCounterHiRes())
+        {
+            packet.beginBundle();
+            const float azimuth = (float) std::fmod(frames * 0.01, juce::MathConstants<double>::twoPi);
+            for (int i = 0; i < numSources; ++i)
+                packet.addPosition(i, azimuth, 0.1f, 1.f + 0.001f * (float) i);
+            if (sender.write("127.0.0.1", PORT, packet.data.getData(), (int) packet.size) > 0)
+                sentMessages += numSources;
+            ++frames;
+
+            if (frameRate > 0.0)
+            {
+                const double wait = startMs + frames * 1000.0 / frameRate - juce::Time::getMillisecondCounterHiRes();
+                if (wait > 1.0)
+                    juce::Thread::sleep((int) wait);
+            }
+        }
+        const double elapsed = (juce::Time::getMillisecondCounterHiRes() - startMs) * 0.001;
+        juce::Thread::sleep(50);    // Let the last packets through
+        audio.stopThread(1000);
+        const auto stats = surface.getAndResetStatistics();
+        surface.stop();
+
+        const double received = stats.messagesPerSecond * (elapsed + 0.05);
+        juce::String line;
+        line << juce::String(numSources).paddedLeft(' ', 6) << " sources  "
+             << (frameRate > 0.0 ? juce::String(frameRate, 0) + " fps" : juce::String("max")).paddedLeft(' ', 7)
+             << juce::String(sentMessages / elapsed / 1000.0, 1).paddedLeft(' ', 10) << " k msg/s sent"
+             << juce::String(stats.messagesPerSecond / 1000.0, 1).paddedLeft(' ', 10) << " k msg/s received"
+             << juce::String(sentMessages > 0 ? juce::jmax(0.0, 100.0 * (1.0 - received / (double) sentMessages)) : 0.0, 1).paddedLeft(' ', 7) << "% lost"
+             << juce::String(stats.decodeNsPerMessage, 0).paddedLeft(' ', 7) << " ns/msg"
+             << "  latency " << juce::String(stats.latency.meanMs, 2) << " ms mean, " << juce::String(stats.latency.maxMs, 2) << " ms max"
+             << "  (" << stats.latency.updatesApplied << " applied)\n";
+        return line;
+    }
+
+    inline juce::String run()
+    {
+        juce::String report;
+        report << "OSC control surface: position bundles over UDP loopback, scene updated every "
+               << BLOCK_SIZE << " samples at " << juce::String(SAMPLE_RATE, 0) << " Hz\n"
+               << "Latency is from packet arrival to the block that applies it; received counts every message\n"
+               << "decoded, applied counts the values that reached the audio thread (newer values replace older ones).\n\n";
+        for (int numSources : { 64, 256, 1024 })
+        {
+            report << runCase(numSources, 60.0, 2.0);
+            report << runCase(numSources, 0.0, 2.0);
+        }
+        return report;
+    }
+}
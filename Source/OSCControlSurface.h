@@ -0,0 +1,190 @@
+/*
+  ==============================================================================
+
+    OSCControlSurface.h
+    Local OSC/UDP listener that lets an external application (e.g. a game
+    engine) drive the scene at high message rates.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <atomic>
+#include "OSCDecoder.h"
+#include "SceneState.h"
+#include "SampleBank.h"
+
+//==============================================================================
+/**
+    Receives scene updates over OSC on a dedicated network thread.
+
+    Packets are decoded in place, without allocation, and the values are stored in the
+    latest-value-wins mailboxes of SceneState, so a burst of updates to the same source
+    costs the audio thread a single update. Send many updates per datagram as OSC bundles.
+
+    Accepted messages (radians and metres, like the rest of the scene):
+        /source/position   i:source f:azimuth f:elevation f:distance
+        /source/gain       i:source f:gain
+        /source/positions  i:firstSource b:blob    big-endian float32 azimuth, elevation,
+                                                   distance triplets for consecutive sources
+        /hrtf              i:index                 select one of the loaded HRTFs
+        /sample/trigger    i:sample f:azimuth f:elevation f:distance [f:gain]
+                                                   play a sample of the sample bank once
+*/
+class OSCControlSurface : private juce::Thread
+{
+public:
+    struct Statistics
+    {
+        float packetsPerSecond = 0.f;
+        float messagesPerSecond = 0.f;
+        float decodeNsPerMessage = 0.f;     // Receive thread time per message, decode and store
+        int rejectedMessages = 0;           // Unknown address, wrong arguments or source out of range
+        SceneState::ControlLatency latency; // Receive to audio thread
+    };
+
+    explicit OSCControlSurface(SceneState& sceneToControl) : juce::Thread("OSC control surface"), scene(sceneToControl) {}
+
+    ~OSCControlSurface() override { stop(); }
+
+    /// Bind to the port on the loopback interface and start receiving. Returns false if the port is in use.
+    bool start(int port)
+    {
+        stop();
+        socket = std::make_unique<juce::DatagramSocket>(false);
+        if (! socket->bindToPort(port, "127.0.0.1"))
+        {
+            socket.reset();
+            return false;
+        }
+        lastStatisticsMs = juce::Time::getMillisecondCounterHiRes();
+        startThread(juce::Thread::Priority::high);
+        return true;
+    }
+
+    void stop()
+    {
+        signalThreadShouldExit();
+        if (socket != nullptr)
+            socket->shutdown();
+        stopThread(1000);
+        socket.reset();
+    }
+
+    bool isReceiving() const { return isThreadRunning(); }
+
+    /// Voices played by /sample/trigger, or nullptr to reject it. Before start().
+    void setSampleVoices(SampleVoicePool* pool) noexcept { sampleVoices = pool; }
+
+    //==========================================================================
+    /// HRTF selected remotely since the last call, or -1. Audio thread.
+    int takeHRTFRequest() noexcept { return hrtfRequest.exchange(-1, std::memory_order_acquire); }
+
+    /// Throughput since the last call, which resets it. Message thread.
+    Statistics getAndResetStatistics() noexcept
+    {
+        Statistics stats;
+        const double nowMs = juce::Time::getMillisecondCounterHiRes();
+        const double seconds = juce::jmax(1.0e-3, (nowMs - lastStatisticsMs) * 0.001);
+        lastStatisticsMs = nowMs;
+
+        const int packets = packetCount.exchange(0);
+        const int messages = messageCount.exchange(0);
+        const auto decodeNs = decodeTimeNs.exchange(0);
+        stats.packetsPerSecond = (float) (packets / seconds);
+        stats.messagesPerSecond = (float) (messages / seconds);
+        stats.decodeNsPerMessage = messages > 0 ? (float) ((double) decodeNs / messages) : 0.f;
+        stats.rejectedMessages = rejectedCount.exchange(0);
+        stats.latency = scene.getAndResetControlLatency();
+        return stats;
+    }
+
+private:
+    static constexpr int MAX_PACKET_SIZE = 65536;
+
+    void run() override
+    {
+        while (! threadShouldExit())
+        {
+            if (socket->waitUntilReady(true, 100) <= 0)
+                continue;
+            const int size = socket->read(packet.data(), MAX_PACKET_SIZE, false);
+            if (size <= 0)
+                continue;
+
+            const double arrivalMs = juce::Time::getMillisecondCounterHiRes();
+            int rejected = 0;
+            const int messages = OSCDecoder::parse(packet.data(), size, [this, arrivalMs, &rejected](const OSCDecoder::Message& m)
+            {
+                if (! apply(m, arrivalMs))
+                    ++rejected;
+            });
+
+            decodeTimeNs.fetch_add((juce::int64) ((juce::Time::getMillisecondCounterHiRes() - arrivalMs) * 1.0e6), std::memory_order_relaxed);
+            packetCount.fetch_add(1, std::memory_order_relaxed);
+            messageCount.fetch_add(messages, std::memory_order_relaxed);
+            rejectedCount.fetch_add(rejected, std::memory_order_relaxed);
+        }
+    }
+
+    bool apply(const OSCDecoder::Message& m, double timeMs) noexcept
+    {
+        if (m.addressIs("/source/position") && m.getNumArguments() >= 4)
+            return scene.storePosition(m.getInt(0), m.getFloat(1), m.getFloat(2), m.getFloat(3), timeMs);
+
+        if (m.addressIs("/source/gain") && m.getNumArguments() >= 2)
+            return scene.storeGain(m.getInt(0), m.getFloat(1), timeMs);
+
+        if (m.addressIs("/source/positions") && m.getNumArguments() >= 2 && m.getType(1) == 'b')
+        {
+            int size = 0;
+            const char* blob = m.getBlob(1, size);
+            const int first = m.getInt(0);
+            const int count = size / 12;
+            // first comes from the network, so it is bounded before any arithmetic on it
+            if (count == 0 || first < 0 || first >= SceneState::MAX_SOURCES || count > SceneState::MAX_SOURCES - first)
+                return false;
+            for (int i = 0; i < count; ++i)
+            {
+                const char* p = blob + i * 12;
+                scene.storePosition(first + i, readFloat(p), readFloat(p + 4), readFloat(p + 8), timeMs);
+            }
+            return true;
+        }
+
+        if (m.addressIs("/sample/trigger") && m.getNumArguments() >= 4 && sampleVoices != nullptr)
+            return sampleVoices->trigger(m.getInt(0), m.getFloat(1), m.getFloat(2), m.getFloat(3),
+                                         m.getNumArguments() >= 5 ? m.getFloat(4) : 1.f);
+
+        if (m.addressIs("/hrtf") && m.getNumArguments() >= 1 && m.getInt(0) >= 0)
+        {
+            hrtfRequest.store(m.getInt(0), std::memory_order_release);
+            return true;
+        }
+        return false;
+    }
+
+    static float readFloat(const char* p) noexcept
+    {
+        const auto bits = OSCDecoder::Message::readBigEndian32(p);
+        float f;
+        std::memcpy(&f, &bits, 4);
+        return f;
+    }
+
+    //==========================================================================
+    SceneState& scene;
+    SampleVoicePool* sampleVoices = nullptr;
+    std::unique_ptr<juce::DatagramSocket> socket;
+    std::array<char, MAX_PACKET_SIZE> packet;       // Receive thread only
+
+    std::atomic<int> hrtfRequest{ -1 };
+    std::atomic<int> packetCount{ 0 };
+    std::atomic<int> messageCount{ 0 };
+    std::atomic<int> rejectedCount{ 0 };
+    std::atomic<juce::int64> decodeTimeNs{ 0 };
+    double lastStatisticsMs = 0.0;                  // Message thread only
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(OSCControlSurface)
+};
@@ -0,0 +1,179 @@
+/*
+  ==============================================================================
+
+    OSCDecoder.h
+    Minimal, allocation-free decoder for OSC 1.0 packets (messages and bundles)
+    received on a UDP socket.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+//==============================================================================
+namespace OSCDecoder
+{
+    /// View of one message inside a packet. Valid only during the callback that receives it.
+    class Message
+    {
+    public:
+        static constexpr int MAX_ARGUMENTS = 32;
+
+        const char* getAddress() const noexcept     { return address; }
+        int getNumArguments() const noexcept        { return numArguments; }
+        char getType(int i) const noexcept          { return types[i]; }
+        juce::uint64 getTimeTag() const noexcept    { return timeTag; }
+
+        bool addressIs(const char* pattern) const noexcept { return std::strcmp(address, pattern) == 0; }
+
+        /// Numeric argument as float, converting ints and doubles. Zero if not numeric.
+        float getFloat(int i) const noexcept
+        {
+            switch (types[i])
+            {
+                case 'f': { const auto bits = readBigEndian32(arguments[i]); float f; std::memcpy(&f, &bits, 4); return f; }
+                case 'i': return (float) (int32_t) readBigEndian32(arguments[i]);
+                case 'd': { const auto bits = readBigEndian64(arguments[i]); double d; std::memcpy(&d, &bits, 8); return (float) d; }
+                case 'h': return (float) (int64_t) readBigEndian64(arguments[i]);
+                default:  return 0.f;
+            }
+        }
+
+        int getInt(int i) const noexcept
+        {
+            switch (types[i])
+            {
+                case 'i': return (int) (int32_t) readBigEndian32(arguments[i]);
+                case 'h': return (int) (int64_t) readBigEndian64(arguments[i]);
+                case 'f': return (int) getFloat(i);
+                default:  return 0;
+            }
+        }
+
+        /// String argument, null terminated inside the packet
+        const char* getString(int i) const noexcept { return types[i] == 's' ? arguments[i] : ""; }
+
+        /// Blob argument as pointer and size
+        const char* getBlob(int i, int& size) const noexcept
+        {
+            if (types[i] != 'b') { size = 0; return nullptr; }
+            size = (int) readBigEndian32(arguments[i]);
+            return arguments[i] + 4;
+        }
+
+        static juce::uint32 readBigEndian32(const char* p) noexcept
+        {
+            const auto* u = reinterpret_cast<const unsigned char*>(p);
+            return ((juce::uint32) u[0] << 24) | ((juce::uint32) u[1] << 16) | ((juce::uint32) u[2] << 8) | (juce::uint32) u[3];
+        }
+
+        static juce::uint64 readBigEndian64(const char* p) noexcept
+        {
+            return ((juce::uint64) readBigEndian32(p) << 32) | readBigEndian32(p + 4);
+        }
+
+    private:
+        friend bool parseMessage(const char*, int, juce::uint64, Message&) noexcept;
+
+        const char* address = "";
+        const char* types = "";
+        const char* arguments[MAX_ARGUMENTS] = {};
+        int numArguments = 0;
+        juce::uint64 timeTag = 1;   // "Immediately"
+    };
+
+    /// Length of an OSC string including its padding, or -1 if it is not terminated within size
+    inline int paddedStringLength(const char* data, int size) noexcept
+    {
+        for (int i = 0; i < size; ++i)
+            if (data[i] == 0)
+                return ((i + 4) / 4) * 4 <= size ? ((i + 4) / 4) * 4 : -1;
+        return -1;
+    }
+
+    inline bool parseMessage(const char* data, int size, juce::uint64 timeTag, Message& message) noexcept
+    {
+        const int addressLength = paddedStringLength(data, size);
+        if (addressLength <= 0 || data[0] != '/')
+            return false;
+        message.address = data;
+        message.timeTag = timeTag;
+        message.numArguments = 0;
+
+        int offset = addressLength;
+        if (offset >= size || data[offset] != ',')
+        {
+            message.types = "";
+            return true;    // No type tag string: message without arguments
+        }
+        const int typesLength = paddedStringLength(data + offset, size - offset);
+        if (typesLength <= 0)
+            return false;
+        message.types = data + offset + 1;
+        offset += typesLength;
+
+        for (const char* t = message.types; *t != 0; ++t)
+        {
+            const int index = (int) (t - message.types);
+            if (index >= Message::MAX_ARGUMENTS)
+                return false;
+            message.arguments[index] = data + offset;
+            int argumentSize = 0;
+            switch (*t)
+            {
+                case 'i': case 'f': case 'c': case 'r': case 'm': argumentSize = 4; break;
+                case 'h': case 'd': case 't':                     argumentSize = 8; break;
+                case 's': case 'S': argumentSize = paddedStringLength(data + offset, size - offset); break;
+                case 'b':
+                {
+                    if (4 > size - offset) return false;
+                    const auto blobSize = (((juce::uint64) Message::readBigEndian32(data + offset) + 3) / 4) * 4;
+                    if (blobSize > (juce::uint64) (size - offset - 4)) return false;
+                    argumentSize = 4 + (int) blobSize;
+                    break;
+                }
+                case 'T': case 'F': case 'N': case 'I':           argumentSize = 0; break;
+                default: return false;
+            }
+            if (argumentSize < 0 || argumentSize > size - offset)
+                return false;
+            offset += argumentSize;
+            message.numArguments = index + 1;
+        }
+        return true;
+    }
+
+    /// Decode a packet, calling onMessage(const Message&) for every message it contains, including
+    /// the ones nested in bundles. Returns the number of messages decoded.
+    template <typename Callback>
+    int parse(const char* data, int size, Callback&& onMessage, juce::uint64 timeTag = 1, int depth = 0) noexcept
+    {
+        if (size < 4 || depth > 8)
+            return 0;
+
+        if (size >= 16 && std::memcmp(data, "#bundle", 8) == 0)
+        {
+            const auto bundleTime = Message::readBigEndian64(data + 8);
+            int count = 0;
+            for (int offset = 16; offset + 4 <= size;)
+            {
+                const int elementSize = (int) Message::readBigEndian32(data + offset);
+                offset += 4;
+                if (elementSize <= 0 || elementSize > size - offset)
+                    break;
+                count += parse(data + offset, elementSize, onMessage, bundleTime, depth + 1);
+                offset += elementSize;
+            }
+            return count;
+        }
+
+        Message message;
+        if (! parseMessage(data, size, timeTag, message))
+            return 0;
+        onMessage(message);
+        return 1;
+    }
+}
@@ -0,0 +1,113 @@
+/*
+  ==============================================================================
+
+    OutputRecorder.h
+    Records the binaural output to a WAV or FLAC file from a background
+    thread, without blocking or allocating on the audio thread.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <atomic>
+
+//==============================================================================
+/**
+    Records the stereo output of the audio callback.
+
+    The audio thread pushes every block into the preallocated FIFO of a
+    juce::AudioFormatWriter::ThreadedWriter, and a background thread drains it to
+    disk. If the writer falls behind and the FIFO is full, the block is dropped and
+    counted instead of waiting. Recording can be started and stopped at any time: the
+    writer is published to the audio thread with an atomic pointer and only deleted,
+    flushing what is left in the FIFO, once the audio thread has stopped using it.
+*/
+class OutputRecorder
+{
+public:
+    static constexpr size_t DEFAULT_MEMORY_BUDGET = 8 * 1024 * 1024;  // Bytes of FIFO, about 20 s of stereo at 48 kHz
+
+    OutputRecorder() { backgroundThread.startThread(); }
+
+    ~OutputRecorder()
+    {
+        stop();
+        backgroundThread.stopThread(2000);
+    }
+
+    //==========================================================================
+    /// Start recording to a file, FLAC if the extension is .flac and WAV otherwise. Message thread.
+    /// Returns an error message, empty on success.
+    juce::String start(const juce::File& file, double sampleRate, size_t memoryBudget = DEFAULT_MEMORY_BUDGET)
+    {
+        stop();
+        file.deleteFile();
+
+        std::unique_ptr<juce::AudioFormat> format;
+        if (file.hasFileExtension(".flac"))
+            format = std::make_unique<juce::FlacAudioFormat>();
+        else
+            format = std::make_unique<juce::WavAudioFormat>();
+
+        auto stream = file.createOutputStream();
+        if (stream == nullptr)
+            return "Cannot write to " + file.getFullPathName();
+
+        const int bitsPerSample = format->getPossibleBitDepths().contains(32) ? 32 : 24;
+        std::unique_ptr<juce::AudioFormatWriter> writer(format->createWriterFor(stream.get(), sampleRate, NUM_CHANNELS, bitsPerSample, {}, 0));
+        if (writer == nullptr)
+            return "Cannot create a " + format->getFormatName() + " writer";
+        stream.release();   // Now owned by the writer
+
+        const int fifoSamples = (int) juce::jmax((size_t) 8192, memoryBudget / (NUM_CHANNELS * sizeof(float)));
+        threadedWriter = std::make_unique<juce::AudioFormatWriter::ThreadedWriter>(writer.release(), backgroundThread, fifoSamples);
+        recordedSamples.store(0);
+        droppedSamples.store(0);
+        activeWriter.store(threadedWriter.get());
+        return {};
+    }
+
+    /// Stop recording and close the file. Message thread.
+    void stop()
+    {
+        activeWriter.store(nullptr);
+        while (writing.load())          // Wait for a block being pushed, at most one callback
+            juce::Thread::yield();
+        threadedWriter.reset();         // Flushes the FIFO and closes the file
+    }
+
+    bool isRecording() const noexcept { return activeWriter.load() != nullptr; }
+
+    //==========================================================================
+    /// Push a block of the output. Audio thread, never blocks.
+    void push(const juce::AudioSourceChannelInfo& block) noexcept
+    {
+        writing.store(true);
+        if (auto* writer = activeWriter.load())
+        {
+            const float* channels[NUM_CHANNELS] = { block.buffer->getReadPointer(0, block.startSample),
+                                                    block.buffer->getReadPointer(1, block.startSample) };
+            if (writer->write(channels, block.numSamples))
+                recordedSamples.fetch_add(block.numSamples, std::memory_order_relaxed);
+            else
+                droppedSamples.fetch_add(block.numSamples, std::memory_order_relaxed);
+        }
+        writing.store(false);
+    }
+
+    juce::int64 getRecordedSamples() const noexcept    { return recordedSamples.load(); }
+    juce::int64 getDroppedSamples() const noexcept     { return droppedSamples.load(); }
+
+private:
+    static constexpr int NUM_CHANNELS = 2;
+
+    juce::TimeSliceThread backgroundThread{ "Output recorder" };
+    std::unique_ptr<juce::AudioFormatWriter::ThreadedWriter> threadedWriter;   // Message thread only
+    std::atomic<juce::AudioFormatWriter::ThreadedWriter*> activeWriter{ nullptr };
+    std::atomic<bool> writing{ false };
+    std::atomic<juce::int64> recordedSamples{ 0 };
+    std::atomic<juce::int64> droppedSamples{ 0 };
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(OutputRecorder)
+};
@@ -0,0 +1,154 @@
+/*
+  ==============================================================================
+
+    ProcessHRTFCache.h
+    HRTFs shared by every renderer in the process, loaded once per SOFA file
+    and prepared once per sample rate, and freed with their last user.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include "HRTFBundle.h"
+#include "HRTFSettings.h"
+
+//==============================================================================
+/**
+    Process-wide, reference-counted cache of HRTFs, keyed by SOFA file and sample rate.
+
+    A plug-in host loads one copy of the plug-in binary and creates as many instances as
+    there are tracks using it. Each instance asking for the same SOFA file gets the same
+    HRTFBundle, so the file is read once and its impulse responses are held once, and the
+    same BRT HRTF for the same configuration, so the partitioned spectra that make up
+    most of its memory are also prepared once. The key includes the block size as well
+    as the sample rate, because BRT partitions the impulse responses with it.
+
+    The cache holds weak references only: the instances own what they use through the
+    Handle, and a file leaves the process when its last instance lets go of it. The cache
+    counts the live handles of each HRTF, so it can tell how many instances share it
+    whoever else, BRT included, holds a reference to it. Building
+    happens under the cache lock, so a second instance asking for a file that is being
+    loaded waits for it rather than loading it again. Not for the audio thread.
+*/
+class ProcessHRTFCache
+{
+public:
+    /// What an instance keeps to use a shared HRTF: the bundle keeps the variant alive. Move-only,
+    /// each handle counts once as a user of its HRTF until it is reset or destroyed.
+    struct Handle
+    {
+        Handle() = default;
+        Handle(std::shared_ptr<HRTFBundle> b, std::shared_ptr<CachedHRTF> h) : bundle(std::move(b)), hrtf(std::move(h)) {}
+        Handle(Handle&& other) noexcept : bundle(std::move(other.bundle)), hrtf(std::move(other.hrtf)) {}
+        ~Handle()                                       { reset(); }
+
+        Handle& operator=(Handle&& other) noexcept
+        {
+            if (this != &other)
+            {
+                reset();
+                bundle = std::move(other.bundle);
+                hrtf = std::move(other.hrtf);
+            }
+            return *this;
+        }
+
+        bool isValid() const noexcept                   { return hrtf != nullptr; }
+
+        void reset() noexcept
+        {
+            if (hrtf != nullptr)
+                getInstance().release(*hrtf);
+            hrtf.reset();
+            bundle.reset();
+        }
+
+        /// Handles of the same HRTF alive in the process, this one included
+        int getNumUsers() const                         { return hrtf != nullptr ? getInstance().getNumUsers(*hrtf) : 0; }
+
+        std::shared_ptr<HRTFBundle> bundle;
+        std::shared_ptr<CachedHRTF> hrtf;
+    };
+
+    static ProcessHRTFCache& getInstance()
+    {
+        static ProcessHRTFCache instance;
+        return instance;
+    }
+
+    /// The HRTF of a SOFA file for a configuration, read and built on first use. BRT's global
+    /// parameters must already be set to blockSize. Returns an invalid handle and sets error on failure.
+    Handle getHRTF(const juce::File& file, double sampleRate, int blockSize, juce::String& error)
+    {
+        const juce::ScopedLock lock(cacheLock);
+
+        auto& entry = bundles[file.getFullPathName()];
+        auto bundle = entry.lock();
+        if (bundle == nullptr)
+        {
+            SofaMeasurements measurements;
+            error = SofaMeasurements::load(file, measurements, true);
+            if (error.isNotEmpty())
+                return {};
+            if (measurements.sampleRate <= 0.0)
+            {
+                error = "The SOFA file does not contain a valid sample rate";
+                return {};
+            }
+            bundle = std::make_shared<HRTFBundle>(file, std::move(measurements), HRTFRESAMPLINGSTEP, 0, HRTFEXTRAPOLATIONMETHOD);
+            entry = bundle;
+        }
+
+        auto hrtf = bundle->findVariant(sampleRate, blockSize);
+        if (hrtf == nullptr)
+        {
+            juce::String warning;
+            hrtf = bundle->buildVariant(sampleRate, blockSize, warning);
+            if (hrtf == nullptr)
+            {
+                error = "BRT could not build an HRTF from " + file.getFileName();
+                return {};
+            }
+            bundle->addVariant(sampleRate, blockSize, hrtf);
+        }
+        ++users[hrtf.get()];
+        return { std::move(bundle), std::move(hrtf) };
+    }
+
+    /// Number of SOFA files held by at least one user
+    int getNumFilesInUse() const
+    {
+        const juce::ScopedLock lock(cacheLock);
+        int inUse = 0;
+        for (const auto& [path, bundle] : bundles)
+            inUse += bundle.expired() ? 0 : 1;
+        return inUse;
+    }
+
+private:
+    ProcessHRTFCache() = default;
+
+    void release(const CachedHRTF& hrtf)
+    {
+        const juce::ScopedLock lock(cacheLock);
+        const auto found = users.find(&hrtf);
+        if (found != users.end() && --found->second <= 0)
+            users.erase(found);
+    }
+
+    int getNumUsers(const CachedHRTF& hrtf) const
+    {
+        const juce::ScopedLock lock(cacheLock);
+        const auto found = users.find(&hrtf);
+        return found != users.end() ? found->second : 0;
+    }
+
+    juce::CriticalSection cacheLock;
+    std::map<juce::String, std::weak_ptr<HRTFBundle>> bundles;
+    std::map<const CachedHRTF*, int> users;             // Live handles of each HRTF
+
+    JUCE_DECLARE_NON_COPYABLE(ProcessHRTFCache)      // A static, outlives JUCE's leak detector
+};
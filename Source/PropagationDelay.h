@@ -0,0 +1,243 @@
+/*
+  ==============================================================================
+
+    PropagationDelay.h
+    Distance-dependent propagation delay of every source, with the Doppler shift
+    of moving sources, applied to the source inputs before BRT.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <cmath>
+
+#if JUCE_USE_SSE_INTRINSICS
+ #include <emmintrin.h>
+#elif JUCE_USE_ARM_NEON
+ #include <arm_neon.h>
+#endif
+
+//==============================================================================
+/**
+    Variable delay lines for the sources of the scene, one per source.
+
+    The delay of each source follows its distance to the listener at the speed of
+    sound. Once per block the target delays of all the sources are computed in one
+    SIMD pass over the distances of the scene, and each delay then moves linearly to
+    its target over the block, so a source that moves is resampled sample by sample:
+    that is the Doppler shift. The rate of change is limited, so a jump of the
+    distance dial becomes a short glide instead of a click.
+
+    Delayed samples are read with an 8-tap windowed-sinc interpolator, band-limited
+    to 90% of the Nyquist frequency, whose coefficients come from a table of 256
+    fractional phases with linear interpolation between rows. Each line is stored
+    with its first taps mirrored after its end, so the 8 taps of any read are
+    contiguous and the filter is two SIMD multiplies per sample, with no gathers and
+    no wrap checks. No line is allocated until the delay is used: makeLines() builds
+    lines for the sources of the scene, up to MAX_SOURCES, off the audio thread, and
+    swapLines() hands them over. Sources beyond the lines allocated are not delayed.
+*/
+class PropagationDelayBank
+{
+public:
+    static constexpr int MAX_SOURCES = 512;
+    static constexpr float SPEED_OF_SOUND = 343.f;     // m/s
+    static constexpr float MAX_DISTANCE = 20.f;        // Farther sources are delayed as if at this distance
+
+    PropagationDelayBank()
+    {
+        // Windowed sinc for each fractional delay, rows normalised to unity gain at DC
+        for (int phase = 0; phase <= PHASES; ++phase)
+        {
+            const double fraction = (double) phase / PHASES;
+            double sum = 0.0;
+            for (int k = 0; k < TAPS; ++k)
+            {
+                const double t = k - (TAPS / 2 - 1) - fraction;
+                const double u = t / (TAPS / 2 + 0.5);
+                const double window = std::abs(u) < 1.0 ? 0.42 + 0.5 * std::cos(juce::MathConstants<double>::pi * u)
+                                                               + 0.08 * std::cos(juce::MathConstants<double>::twoPi * u)
+                                                        : 0.0;
+                const double arg = juce::MathConstants<double>::pi * CUTOFF * t;
+                const double sinc = std::abs(arg) < 1.0e-9 ? 1.0 : std::sin(arg) / arg;
+                coefficients[(size_t) (phase * TAPS + k)] = (float) (sinc * window);
+                sum += sinc * window;
+            }
+            for (int k = 0; k < TAPS; ++k)
+                coefficients[(size_t) (phase * TAPS + k)] = (float) (coefficients[(size_t) (phase * TAPS + k)] / sum);
+        }
+    }
+
+    //==========================================================================
+    /// Size the lines for the longest delay at this sample rate, reallocating the ones already
+    /// allocated. Not while processing.
+    void prepare(double newSampleRate, int maximumBlockSize)
+    {
+        samplesPerMetre = (float) (newSampleRate / SPEED_OF_SOUND);
+        maxDelay = MAX_DISTANCE * samplesPerMetre;
+        length = juce::nextPowerOfTwo((int) std::ceil(maxDelay) + maximumBlockSize + TAPS);
+        stride = length + TAPS;
+        lines.assign((size_t) numLines * (size_t) stride, 0.f);
+        writeIndex = 0;
+        std::fill(active.begin(), active.end(), (char) 0);
+    }
+
+    /// Lines for the first numSources sources at the prepared sample rate, or none for 0. Off the
+    /// audio thread, then handed over with swapLines().
+    std::vector<float> makeLines(int numSources) const
+    {
+        return std::vector<float>((size_t) juce::jlimit(0, MAX_SOURCES, numSources) * (size_t) stride, 0.f);
+    }
+
+    /// Use lines from makeLines(), which are left with the previous ones for the caller to release.
+    /// Only while the audio thread is not processing, e.g. under the audio callback lock.
+    void swapLines(std::vector<float>& newLines) noexcept
+    {
+        lines.swap(newLines);
+        numLines = stride > 0 ? (int) (lines.size() / (size_t) stride) : 0;
+        std::fill(active.begin(), active.end(), (char) 0);
+    }
+
+    void setEnabled(bool shouldBeEnabled) noexcept      { enabled.store(shouldBeEnabled); }
+    bool isEnabled() const noexcept                     { return enabled.load(); }
+
+    /// Sources that have a line
+    int getNumLines() const noexcept                    { return numLines; }
+
+    /// Bytes allocated for the lines
+    size_t getMemoryUsage() const noexcept              { return lines.size() * sizeof(float); }
+
+    //==========================================================================
+    /// Delay the input block of each source in place. inputs[i] is the block of source i, or
+    /// nullptr for a source with nothing to play, and distances[i] its distance to the listener
+    /// in metres. Audio thread, does not allocate.
+    void process(float* const* inputs, const float* distances, int numSources, int numSamples) noexcept
+    {
+        if (! enabled.load(std::memory_order_relaxed))
+        {
+            if (wasEnabled)
+                std::fill(active.begin(), active.end(), (char) 0);     // Lines restart from the current distances
+            wasEnabled = false;
+            return;
+        }
+        wasEnabled = true;
+        if (lines.empty() || numSamples <= 0)
+            return;
+
+        const int n = juce::jmin(numSources, numLines);
+        computeTargets(distances, n);
+
+        for (int i = 0; i < n; ++i)
+        {
+            if (inputs[i] == nullptr)
+            {
+                active[(size_t) i] = 0;     // Silent sources drop their tail, and restart without a glide
+                continue;
+            }
+            if (active[(size_t) i] == 0)
+            {
+                std::fill(lines.begin() + (ptrdiff_t) i * stride, lines.begin() + (ptrdiff_t) (i + 1) * stride, 0.f);
+                delay[(size_t) i] = target[(size_t) i];
+                active[(size_t) i] = 1;
+            }
+            processLine(i, inputs[i], numSamples);
+        }
+        writeIndex = (writeIndex + numSamples) & (length - 1);
+    }
+
+private:
+    static constexpr int TAPS = 8;
+    static constexpr int PHASES = 256;
+    static constexpr double CUTOFF = 0.9;                       // Of the Nyquist frequency
+    static constexpr float MIN_DELAY = (float) (TAPS / 2);      // Keeps the taps behind the write position
+    static constexpr float MAX_SLEW = 0.25f;                    // Delay change per sample, a 25% pitch shift at most
+
+    /// Target delay of every source, in samples, from the distances. SIMD across sources.
+    void computeTargets(const float* distances, int n) noexcept
+    {
+        int i = 0;
+       #if JUCE_USE_SSE_INTRINSICS
+        const __m128 scale = _mm_set1_ps(samplesPerMetre), lowest = _mm_set1_ps(MIN_DELAY), highest = _mm_set1_ps(maxDelay);
+        for (; i + 4 <= n; i += 4)
+            _mm_storeu_ps(target.data() + i, _mm_min_ps(highest, _mm_max_ps(lowest, _mm_mul_ps(_mm_loadu_ps(distances + i), scale))));
+       #elif JUCE_USE_ARM_NEON
+        const float32x4_t lowest = vdupq_n_f32(MIN_DELAY), highest = vdupq_n_f32(maxDelay);
+        for (; i + 4 <= n; i += 4)
+            vst1q_f32(target.data() + i, vminq_f32(highest, vmaxq_f32(lowest, vmulq_n_f32(vld1q_f32(distances + i), samplesPerMetre))));
+       #endif
+        for (; i < n; ++i)
+            target[(size_t) i] = juce::jlimit(MIN_DELAY, maxDelay, distances[i] * samplesPerMetre);
+    }
+
+    /// Write the block into the line of a source, then read it back delayed, ramping the delay
+    /// towards its target
+    void processLine(int source, float* samples, int numSamples) noexcept
+    {
+        float* line = lines.data() + (size_t) source * (size_t) stride;
+        const int mask = length - 1;
+        for (int s = 0; s < numSamples; ++s)
+        {
+            const int w = (writeIndex + s) & mask;
+            line[w] = samples[s];
+            if (w < TAPS)
+                line[w + length] = samples[s];     // Mirror, so reads never wrap
+        }
+
+        float current = delay[(size_t) source];
+        const float step = juce::jlimit(-MAX_SLEW, MAX_SLEW, (target[(size_t) source] - current) / (float) numSamples);
+        for (int s = 0; s < numSamples; ++s)
+        {
+            current += step;
+            const float position = (float) (writeIndex + s + length) - current;
+            const int whole = (int) position;
+            const float fraction = (position - (float) whole) * PHASES;
+            const int phase = (int) fraction;
+            const float blend = fraction - (float) phase;
+            const float* x = line + ((whole - (TAPS / 2 - 1)) & mask);
+            const float* h = coefficients.data() + phase * TAPS;
+            samples[s] = interpolate(x, h, h + TAPS, blend);
+        }
+        delay[(size_t) source] = current;
+    }
+
+    /// Dot product of 8 samples with the coefficients between two table rows
+    static float interpolate(const float* x, const float* h0, const float* h1, float blend) noexcept
+    {
+       #if JUCE_USE_SSE_INTRINSICS
+        const __m128 b = _mm_set1_ps(blend);
+        const __m128 lo0 = _mm_loadu_ps(h0), hi0 = _mm_loadu_ps(h0 + 4);
+        const __m128 lo = _mm_add_ps(lo0, _mm_mul_ps(b, _mm_sub_ps(_mm_loadu_ps(h1), lo0)));
+        const __m128 hi = _mm_add_ps(hi0, _mm_mul_ps(b, _mm_sub_ps(_mm_loadu_ps(h1 + 4), hi0)));
+        __m128 sum = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(x), lo), _mm_mul_ps(_mm_loadu_ps(x + 4), hi));
+        sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+        sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+        return _mm_cvtss_f32(sum);
+       #elif JUCE_USE_ARM_NEON
+        const float32x4_t lo0 = vld1q_f32(h0), hi0 = vld1q_f32(h0 + 4);
+        const float32x4_t lo = vmlaq_n_f32(lo0, vsubq_f32(vld1q_f32(h1), lo0), blend);
+        const float32x4_t hi = vmlaq_n_f32(hi0, vsubq_f32(vld1q_f32(h1 + 4), hi0), blend);
+        const float32x4_t sum = vmlaq_f32(vmulq_f32(vld1q_f32(x), lo), vld1q_f32(x + 4), hi);
+        const float32x2_t pair = vadd_f32(vget_low_f32(sum), vget_high_f32(sum));
+        return vget_lane_f32(vpadd_f32(pair, pair), 0);
+       #else
+        float sum = 0.f;
+        for (int k = 0; k < TAPS; ++k)
+            sum += x[k] * (h0[k] + blend * (h1[k] - h0[k]));
+        return sum;
+       #endif
+    }
+
+    std::array<float, (PHASES + 1) * TAPS> coefficients{};
+    std::atomic<bool> enabled{ false };
+
+    // Audio thread only, sized in prepare() and swapLines()
+    std::vector<float> lines;                           // numLines lines of stride samples
+    int numLines = 0, length = 0, stride = 0, writeIndex = 0;
+    float samplesPerMetre = 0.f, maxDelay = 0.f;
+    std::array<float, MAX_SOURCES> delay{}, target{};   // Samples
+    std::array<char, MAX_SOURCES> active{};
+    bool wasEnabled = false;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(PropagationDelayBank)
+};
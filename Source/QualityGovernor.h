@@ -0,0 +1,164 @@
+/*
+  ==============================================================================
+
+    QualityGovernor.h
+    Adaptive quality control for the BRT rendering path. Watches the time spent
+    in each audio callback against the block deadline and steps between quality
+    tiers so that rendering degrades gracefully instead of dropping out.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <array>
+#include <atomic>
+
+//==============================================================================
+/// One rendering quality level. Tiers are ordered from best (index 0) to cheapest.
+struct QualityTier
+{
+    const char* name;
+    bool runTimeInterpolation;      // HRIR interpolation between grid points in the listener
+    int hrtfResamplingStep;         // Grid step (degrees) used for SOFA files loaded while in this tier
+    int maxFullyRenderedSources;    // Sources beyond this budget are disconnected from the listener
+};
+
+/// Tier table. The full tier keeps the 15 degree resampling step used so far. HRTF partition
+/// size is bound to the BRT global buffer size, so it is not switched at runtime: changing it
+/// would require re-partitioning every loaded HRTF.
+static constexpr std::array<QualityTier, 4> QUALITY_TIERS
+{{
+    { "Full",     true,  15, 256 },
+    { "Reduced",  true,  15, 32  },
+    { "Economy",  false, 30, 8   },
+    { "Minimal",  false, 45, 1   }
+}};
+
+//==============================================================================
+/**
+    Measures callback time against the block deadline and selects a quality tier.
+
+    beginBlock()/endBlock() are called from the audio thread around the rendering
+    work. The current tier is published through an atomic and transitions are pushed
+    into a lock-free FIFO so the message thread can read them for monitoring.
+*/
+class QualityGovernor
+{
+public:
+    /// A single tier change, as recorded in the transition log
+    struct Transition
+    {
+        double timeMs = 0.0;        // Millisecond counter when the transition happened
+        int fromTier = 0;
+        int toTier = 0;
+        float load = 0.f;           // Smoothed callback load (elapsed / deadline) that triggered it
+    };
+
+    QualityGovernor() = default;
+
+    //==========================================================================
+    /// Reset the measurements. Call from prepareToPlay, before the audio thread starts.
+    void prepare(double sampleRate, int blockSize)
+    {
+        deadlineSeconds = blockSize / sampleRate;
+        smoothedLoad.store(0.f);
+        blocksSinceTransition = 0;
+        blocksWithHeadroom = 0;
+        // Require about two seconds of headroom before stepping up again
+        recoveryBlocks = juce::jmax(1, (int) (2.0 / deadlineSeconds));
+        overruns.store(0);
+    }
+
+    /// Mark the start of the rendering work of one callback
+    void beginBlock() noexcept
+    {
+        blockStartTicks = juce::Time::getHighResolutionTicks();
+    }
+
+    /// Mark the end of the rendering work of one callback. Returns true if the tier changed,
+    /// in which case the caller should apply getCurrentTierSettings() before the next block.
+    bool endBlock(int numSamples, double sampleRate) noexcept
+    {
+        const auto elapsed = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - blockStartTicks);
+        const double deadline = sampleRate > 0.0 ? numSamples / sampleRate : deadlineSeconds;
+        const float load = deadline > 0.0 ? (float) (elapsed / deadline) : 0.f;
+
+        const float smoothed = smoothedLoad.load(std::memory_order_relaxed) * (1.f - LOAD_SMOOTHING) + load * LOAD_SMOOTHING;
+        smoothedLoad.store(smoothed, std::memory_order_relaxed);
+        if (load >= 1.f)
+            overruns.fetch_add(1, std::memory_order_relaxed);
+
+        ++blocksSinceTransition;
+        const int tier = currentTier.load(std::memory_order_relaxed);
+
+        // Degrade quickly: a single overrun or sustained high load steps down one tier
+        if ((load >= 1.f || smoothed > DEGRADE_THRESHOLD) && blocksSinceTransition >= DEGRADE_COOLDOWN_BLOCKS
+            && tier < (int) QUALITY_TIERS.size() - 1)
+        {
+            return changeTier(tier, tier + 1, juce::jmax(load, smoothed));
+        }
+
+        // Recover slowly: only step up after a sustained period of headroom
+        blocksWithHeadroom = smoothed < RECOVER_THRESHOLD ? blocksWithHeadroom + 1 : 0;
+        if (blocksWithHeadroom >= recoveryBlocks && tier > minimumTier.load(std::memory_order_relaxed))
+            return changeTier(tier, tier - 1, smoothed);
+
+        return false;
+    }
+
+    //==========================================================================
+    int getCurrentTier() const noexcept                 { return currentTier.load(); }
+    const QualityTier& getCurrentTierSettings() const   { return QUALITY_TIERS[(size_t) getCurrentTier()]; }
+    float getSmoothedLoad() const noexcept              { return smoothedLoad.load(); }
+    int getOverrunCount() const noexcept                { return overruns.load(); }
+
+    /// Limit the best tier the governor may recover to (0 = no limit)
+    void setMinimumTier(int tier) noexcept              { minimumTier.store(juce::jlimit(0, (int) QUALITY_TIERS.size() - 1, tier)); }
+
+    /// Move transitions recorded by the audio thread into the caller's log. Message thread only.
+    int readTransitions(juce::Array<Transition>& log)
+    {
+        const auto scope = transitionFifo.read(transitionFifo.getNumReady());
+        for (int i = 0; i < scope.blockSize1; ++i) log.add(transitionBuffer[(size_t) (scope.startIndex1 + i)]);
+        for (int i = 0; i < scope.blockSize2; ++i) log.add(transitionBuffer[(size_t) (scope.startIndex2 + i)]);
+        return scope.blockSize1 + scope.blockSize2;
+    }
+
+private:
+    static constexpr float LOAD_SMOOTHING = 0.1f;
+    static constexpr float DEGRADE_THRESHOLD = 0.75f;
+    static constexpr float RECOVER_THRESHOLD = 0.4f;
+    static constexpr int DEGRADE_COOLDOWN_BLOCKS = 8;
+    static constexpr int TRANSITION_LOG_SIZE = 64;
+
+    bool changeTier(int from, int to, float load) noexcept
+    {
+        currentTier.store(to);
+        blocksSinceTransition = 0;
+        blocksWithHeadroom = 0;
+
+        // If the log is full the oldest unread entries are kept and this one is dropped
+        const auto scope = transitionFifo.write(1);
+        if (scope.blockSize1 > 0)
+            transitionBuffer[(size_t) scope.startIndex1] = { juce::Time::getMillisecondCounterHiRes(), from, to, load };
+        return true;
+    }
+
+    std::atomic<int> currentTier{ 0 };
+    std::atomic<int> minimumTier{ 0 };
+    std::atomic<float> smoothedLoad{ 0.f };
+    std::atomic<int> overruns{ 0 };
+
+    // Audio thread only
+    juce::int64 blockStartTicks = 0;
+    double deadlineSeconds = 0.0;
+    int blocksSinceTransition = 0;
+    int blocksWithHeadroom = 0;
+    int recoveryBlocks = 1;
+
+    juce::AbstractFifo transitionFifo{ TRANSITION_LOG_SIZE };
+    std::array<Transition, TRANSITION_LOG_SIZE> transitionBuffer;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(QualityGovernor)
+};
@@ -0,0 +1,369 @@
+/*
+  ==============================================================================
+
+    RealtimeChecker.cpp
+    Violation recording of the real-time checks, and the C library functions
+    interposed on Linux.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "RealtimeChecker.h"
+
+#if BRT_REALTIME_CHECKS
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+
+#if JUCE_LINUX || JUCE_MAC || JUCE_BSD
+ #include <execinfo.h>
+ #define BRT_REALTIME_CHECKS_STACKS 1
+#else
+ #define BRT_REALTIME_CHECKS_STACKS 0
+#endif
+
+namespace
+{
+    using RealtimeChecker::Mode;
+
+    constexpr int MAX_FRAMES = 32;
+    constexpr int MAX_VIOLATIONS = 256;
+
+    /// A distinct violation, keyed by a hash of the call and its stack
+    struct Violation
+    {
+        std::atomic<juce::uint64> key{ 0 };     // 0 while the entry is free
+        std::atomic<bool> ready{ false };       // Call and frames written
+        std::atomic<juce::int64> count{ 0 };
+        const char* call = nullptr;
+        void* frames[MAX_FRAMES] = {};
+        int numFrames = 0;
+    };
+
+    std::atomic<Mode> mode{ Mode::off };
+    Violation violations[MAX_VIOLATIONS];
+    std::atomic<juce::int64> totalViolations{ 0 };
+    std::atomic<juce::int64> unrecordedViolations{ 0 };    // Distinct ones that did not fit in the table
+
+    thread_local int realtimeDepth = 0;
+    thread_local int disabledDepth = 0;
+    thread_local bool insideChecker = false;
+
+    int captureStack(void** frames) noexcept
+    {
+       #if BRT_REALTIME_CHECKS_STACKS
+        return backtrace(frames, MAX_FRAMES);
+       #else
+        juce::ignoreUnused(frames);
+        return 0;
+       #endif
+    }
+
+    void recordViolation(const char* call) noexcept
+    {
+        void* frames[MAX_FRAMES];
+        const int numFrames = captureStack(frames);
+
+        if (mode.load() == Mode::abort)
+        {
+            std::fprintf(stderr, "Real-time violation: %s called in a real-time scope\n", call);
+           #if BRT_REALTIME_CHECKS_STACKS
+            backtrace_symbols_fd(frames, numFrames, 2);
+           #endif
+            std::abort();
+        }
+
+        totalViolations.fetch_add(1, std::memory_order_relaxed);
+        juce::uint64 key = 14695981039346656037ull;    // FNV-1a
+        auto mix = [&key](juce::uint64 value) { key = (key ^ value) * 1099511628211ull; };
+        mix((juce::uint64) (juce::pointer_sized_uint) call);
+        for (int i = 0; i < numFrames; ++i)
+            mix((juce::uint64) (juce::pointer_sized_uint) frames[i]);
+        key = juce::jmax((juce::uint64) 1, key);
+
+        for (int probe = 0; probe < MAX_VIOLATIONS; ++probe)
+        {
+            auto& violation = violations[(key + (juce::uint64) probe) % MAX_VIOLATIONS];
+            auto existing = violation.key.load(std::memory_order_acquire);
+            if (existing == 0 && violation.key.compare_exchange_strong(existing, key))
+            {
+                violation.call = call;
+                std::copy(frames, frames + numFrames, violation.frames);
+                violation.numFrames = numFrames;
+                violation.count.fetch_add(1, std::memory_order_relaxed);
+                violation.ready.store(true, std::memory_order_release);
+                return;
+            }
+            if (existing == key)
+            {
+                violation.count.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+        }
+        unrecordedViolations.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+//==============================================================================
+bool RealtimeChecker::isCompiledIn() noexcept   { return true; }
+
+void RealtimeChecker::setMode(Mode newMode) noexcept
+{
+    // The first stack capture loads the unwinder, do it now rather than in the audio callback
+    void* frames[MAX_FRAMES];
+    captureStack(frames);
+    mode.store(newMode);
+}
+
+RealtimeChecker::Mode RealtimeChecker::getMode() noexcept   { return mode.load(); }
+
+void RealtimeChecker::check(const char* call) noexcept
+{
+    if (realtimeDepth == 0 || disabledDepth > 0 || insideChecker || mode.load(std::memory_order_relaxed) == Mode::off)
+        return;
+    insideChecker = true;
+    recordViolation(call);
+    insideChecker = false;
+}
+
+void RealtimeChecker::enterRealtimeScope() noexcept  { ++realtimeDepth; }
+void RealtimeChecker::exitRealtimeScope() noexcept   { --realtimeDepth; }
+void RealtimeChecker::enterDisabledScope() noexcept  { ++disabledDepth; }
+void RealtimeChecker::exitDisabledScope() noexcept   { --disabledDepth; }
+
+juce::int64 RealtimeChecker::getNumViolations() noexcept    { return totalViolations.load(); }
+
+juce::String RealtimeChecker::getReport()
+{
+    juce::StringArray entries;
+    for (auto& violation : violations)
+    {
+        if (! violation.ready.load(std::memory_order_acquire))
+            continue;
+        juce::String entry;
+        entry << violation.count.load() << " x " << violation.call << juce::newLine;
+       #if BRT_REALTIME_CHECKS_STACKS
+        if (char** symbols = backtrace_symbols(violation.frames, violation.numFrames))
+        {
+            for (int i = 0; i < violation.numFrames; ++i)
+                entry << "    " << symbols[i] << juce::newLine;
+            std::free(symbols);
+        }
+       #endif
+        entries.add(entry);
+    }
+
+    juce::String report;
+    report << totalViolations.load() << " real-time violations, " << entries.size() << " distinct" << juce::newLine;
+    if (unrecordedViolations.load() > 0)
+        report << unrecordedViolations.load() << " violations not recorded, the table is full" << juce::newLine;
+    if (! BRT_REALTIME_CHECKS_STACKS)
+        report << "Stack traces are not available on this platform" << juce::newLine;
+    report << entries.joinIntoString(juce::newLine);
+    return report;
+}
+
+void RealtimeChecker::clear() noexcept
+{
+    for (auto& violation : violations)
+    {
+        violation.ready.store(false);
+        violation.count.store(0);
+        violation.key.store(0);
+    }
+    totalViolations.store(0);
+    unrecordedViolations.store(0);
+}
+
+//==============================================================================
+#if BRT_REALTIME_CHECKS_INTERCEPT_LIBC
+
+#include <dlfcn.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/select.h>
+#include <unistd.h>
+#include <cerrno>
+#include <ctime>
+
+// The allocator entry points of glibc, which the interposed functions forward to
+extern "C"
+{
+    void* __libc_malloc(size_t);
+    void* __libc_calloc(size_t, size_t);
+    void* __libc_realloc(void*, size_t);
+    void* __libc_memalign(size_t, size_t);
+    void __libc_free(void*);
+}
+
+namespace
+{
+    /// The next definition of an interposed function, normally the one in the C library. The cache
+    /// is a plain atomic rather than a function-local static, whose guard could itself take a lock.
+    void* findNext(std::atomic<void*>& cache, const char* name) noexcept
+    {
+        void* function = cache.load(std::memory_order_relaxed);
+        if (function == nullptr)
+        {
+            function = dlsym(RTLD_NEXT, name);
+            cache.store(function, std::memory_order_relaxed);
+        }
+        return function;
+    }
+}
+
+#define BRT_CALL_NEXT(name, ...)                                                        \
+    static std::atomic<void*> next_##name{ nullptr };                                   \
+    return reinterpret_cast<decltype(&::name)>(findNext(next_##name, #name))(__VA_ARGS__);
+
+extern "C"
+{
+    void* malloc(size_t size) noexcept
+    {
+        RealtimeChecker::check("malloc");
+        return __libc_malloc(size);
+    }
+
+    void* calloc(size_t count, size_t size) noexcept
+    {
+        RealtimeChecker::check("calloc");
+        return __libc_calloc(count, size);
+    }
+
+    void* realloc(void* pointer, size_t size) noexcept
+    {
+        RealtimeChecker::check("realloc");
+        return __libc_realloc(pointer, size);
+    }
+
+    void free(void* pointer) noexcept
+    {
+        if (pointer != nullptr)
+            RealtimeChecker::check("free");
+        __libc_free(pointer);
+    }
+
+    void* memalign(size_t alignment, size_t size) noexcept
+    {
+        RealtimeChecker::check("memalign");
+        return __libc_memalign(alignment, size);
+    }
+
+    void* aligned_alloc(size_t alignment, size_t size) noexcept
+    {
+        RealtimeChecker::check("aligned_alloc");
+        return __libc_memalign(alignment, size);
+    }
+
+    int posix_memalign(void** result, size_t alignment, size_t size) noexcept
+    {
+        RealtimeChecker::check("posix_memalign");
+        if (alignment % sizeof(void*) != 0 || ! juce::isPowerOfTwo(alignment))
+            return EINVAL;
+        void* pointer = __libc_memalign(alignment, size);
+        if (pointer == nullptr)
+            return ENOMEM;
+        *result = pointer;
+        return 0;
+    }
+
+    int pthread_mutex_lock(pthread_mutex_t* mutex) noexcept
+    {
+        RealtimeChecker::check("pthread_mutex_lock");
+        BRT_CALL_NEXT(pthread_mutex_lock, mutex)
+    }
+
+    int pthread_rwlock_rdlock(pthread_rwlock_t* lock) noexcept
+    {
+        RealtimeChecker::check("pthread_rwlock_rdlock");
+        BRT_CALL_NEXT(pthread_rwlock_rdlock, lock)
+    }
+
+    int pthread_rwlock_wrlock(pthread_rwlock_t* lock) noexcept
+    {
+        RealtimeChecker::check("pthread_rwlock_wrlock");
+        BRT_CALL_NEXT(pthread_rwlock_wrlock, lock)
+    }
+
+    int pthread_cond_wait(pthread_cond_t* condition, pthread_mutex_t* mutex)
+    {
+        RealtimeChecker::check("pthread_cond_wait");
+        BRT_CALL_NEXT(pthread_cond_wait, condition, mutex)
+    }
+
+    int pthread_cond_timedwait(pthread_cond_t* condition, pthread_mutex_t* mutex, const struct timespec* time)
+    {
+        RealtimeChecker::check("pthread_cond_timedwait");
+        BRT_CALL_NEXT(pthread_cond_timedwait, condition, mutex, time)
+    }
+
+    int pthread_join(pthread_t thread, void** result)
+    {
+        RealtimeChecker::check("pthread_join");
+        BRT_CALL_NEXT(pthread_join, thread, result)
+    }
+
+    int sem_wait(sem_t* semaphore)
+    {
+        RealtimeChecker::check("sem_wait");
+        BRT_CALL_NEXT(sem_wait, semaphore)
+    }
+
+    int nanosleep(const struct timespec* duration, struct timespec* remaining)
+    {
+        RealtimeChecker::check("nanosleep");
+        BRT_CALL_NEXT(nanosleep, duration, remaining)
+    }
+
+    int clock_nanosleep(clockid_t clock, int flags, const struct timespec* time, struct timespec* remaining)
+    {
+        RealtimeChecker::check("clock_nanosleep");
+        BRT_CALL_NEXT(clock_nanosleep, clock, flags, time, remaining)
+    }
+
+    int usleep(useconds_t microseconds)
+    {
+        RealtimeChecker::check("usleep");
+        BRT_CALL_NEXT(usleep, microseconds)
+    }
+
+    unsigned int sleep(unsigned int seconds)
+    {
+        RealtimeChecker::check("sleep");
+        BRT_CALL_NEXT(sleep, seconds)
+    }
+
+    int select(int numDescriptors, fd_set* readSet, fd_set* writeSet, fd_set* exceptSet, struct timeval* timeout)
+    {
+        RealtimeChecker::check("select");
+        BRT_CALL_NEXT(select, numDescriptors, readSet, writeSet, exceptSet, timeout)
+    }
+
+    FILE* fopen(const char* path, const char* fileMode)
+    {
+        RealtimeChecker::check("fopen");
+        BRT_CALL_NEXT(fopen, path, fileMode)
+    }
+}
+
+#undef BRT_CALL_NEXT
+
+#endif // BRT_REALTIME_CHECKS_INTERCEPT_LIBC
+
+#else
+
+bool RealtimeChecker::isCompiledIn() noexcept                   { return false; }
+void RealtimeChecker::setMode(Mode) noexcept                    {}
+RealtimeChecker::Mode RealtimeChecker::getMode() noexcept       { return Mode::off; }
+void RealtimeChecker::check(const char*) noexcept               {}
+void RealtimeChecker::enterRealtimeScope() noexcept             {}
+void RealtimeChecker::exitRealtimeScope() noexcept              {}
+void RealtimeChecker::enterDisabledScope() noexcept             {}
+void RealtimeChecker::exitDisabledScope() noexcept              {}
+juce::int64 RealtimeChecker::getNumViolations() noexcept        { return 0; }
+juce::String RealtimeChecker::getReport()                       { return "Real-time checks are not compiled in"; }
+void RealtimeChecker::clear() noexcept                          {}
+
+#endif
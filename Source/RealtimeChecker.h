@@ -0,0 +1,105 @@
+/*
+  ==============================================================================
+
+    RealtimeChecker.h
+    Opt-in real-time safety checks: allocations, locks and blocking calls made
+    inside the audio callback are logged with a stack trace, or abort.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+/** Compile the checks in, on by default in debug builds. When compiled in they are still
+    off until setMode() is called, and cost a thread-local read per intercepted call. */
+#ifndef BRT_REALTIME_CHECKS
+ #if JUCE_DEBUG
+  #define BRT_REALTIME_CHECKS 1
+ #else
+  #define BRT_REALTIME_CHECKS 0
+ #endif
+#endif
+
+/** On Linux with glibc the allocation, locking and sleeping functions of the C library are
+    interposed as well, elsewhere only operator new and delete are checked. */
+#if BRT_REALTIME_CHECKS && JUCE_LINUX && defined (__GLIBC__)
+ #define BRT_REALTIME_CHECKS_INTERCEPT_LIBC 1
+#else
+ #define BRT_REALTIME_CHECKS_INTERCEPT_LIBC 0
+#endif
+
+//==============================================================================
+/**
+    A small real-time sanitizer for the audio callback.
+
+    Code that must be real-time safe is marked with a ScopedRealtime object, as
+    getNextAudioBlock does. While a thread is inside such a scope, and checking is
+    on, the following calls are violations:
+      - operator new and delete (replaced in AllocationCounter.cpp), and on Linux
+        with glibc also malloc, calloc, realloc, free and the aligned allocation
+        functions, which are interposed
+      - on Linux, locking a pthread mutex or rwlock, waiting on a condition
+        variable or semaphore, joining a thread, sleeping, select and fopen,
+        interposed in the same way; JUCE's CriticalSection, WaitableEvent and
+        Thread::sleep all end up in these
+    On other platforms only operator new and delete are checked.
+
+    In Mode::log every distinct violation, by call and stack, is counted in a fixed
+    table without allocating, and getReport() symbolises the stacks later on another
+    thread. In Mode::abort the first violation prints its stack to stderr and aborts.
+    Code that is known to be safe, or deliberately not, can be excluded from the
+    checks with a ScopedDisable.
+*/
+namespace RealtimeChecker
+{
+    enum class Mode
+    {
+        off,
+        log,
+        abort
+    };
+
+    /// False if the checks are not compiled in, then setMode() has no effect
+    bool isCompiledIn() noexcept;
+
+    void setMode(Mode newMode) noexcept;
+    Mode getMode() noexcept;
+
+    /// Called by the interceptors, records a violation if the thread is in a real-time scope
+    void check(const char* call) noexcept;
+
+    void enterRealtimeScope() noexcept;
+    void exitRealtimeScope() noexcept;
+    void enterDisabledScope() noexcept;
+    void exitDisabledScope() noexcept;
+
+    /// Number of violations recorded in log mode, counting repeats
+    juce::int64 getNumViolations() noexcept;
+
+    /// Distinct violations with their counts and stack traces. Not for the audio thread.
+    juce::String getReport();
+
+    /// Forget the recorded violations. Not while the checked code is running.
+    void clear() noexcept;
+
+    //==========================================================================
+    /// Marks the scope of real-time code, such as the audio callback
+    class ScopedRealtime
+    {
+    public:
+        ScopedRealtime() noexcept   { enterRealtimeScope(); }
+        ~ScopedRealtime()           { exitRealtimeScope(); }
+
+        JUCE_DECLARE_NON_COPYABLE(ScopedRealtime)
+    };
+
+    /// Suspends the checks inside a real-time scope
+    class ScopedDisable
+    {
+    public:
+        ScopedDisable() noexcept    { enterDisabledScope(); }
+        ~ScopedDisable()            { exitDisabledScope(); }
+
+        JUCE_DECLARE_NON_COPYABLE(ScopedDisable)
+    };
+}
@@ -0,0 +1,930 @@
+/*
+  ==============================================================================
+
+    RenderDaemon.h
+    Headless render server: clients on the same host open listener sessions
+    over a Unix domain socket and exchange audio through shared-memory rings.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#if JUCE_LINUX || JUCE_MAC || JUCE_BSD
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "SceneState.h"
+#include "HRTFBundle.h"
+#include "HRTFSettings.h"
+
+//==============================================================================
+/**
+    Render daemon.
+
+    Control messages are text lines on a Unix domain socket:
+
+        OPEN <sources> <sofa path>      ->  OK <session> <ring name>  or  ERROR <reason>
+        MOVE <session> <source> <azimuth> <elevation> <distance>   (radians, metres)
+        CLOSE <session>
+        STATS                           ->  one line of JSON
+
+    The SOFA path is absolute. Each session has a listener, its sources and an HRTF, and a
+    POSIX shared-memory ring of input and output blocks. The client writes one mono block
+    per source into the next input slot and advances inputWritten; the daemon renders it
+    and writes the two ears into the output slot, advancing outputWritten. Nothing but the
+    ring indices is shared, and each index has a single writer, so no locks are taken
+    across processes. After advancing inputWritten or outputRead the client sends a byte to
+    the doorbell, a datagram socket at the socket path followed by ".bell", which wakes the
+    workers; they block while no session has a block to render.
+
+    Sessions are rendered by a pool of worker threads. A block is due one block period
+    after the daemon first sees it, and workers always take the ready session with the
+    earliest deadline. Blocks finished after their deadline are counted as misses.
+    Sessions are opened on a pool of their own, since loading an HRTF can take a while, so
+    the control thread goes on serving the other clients meanwhile. The commands a client
+    sends after an OPEN are handled once its reply is sent.
+*/
+namespace RenderDaemon
+{
+    constexpr juce::uint32 RING_VERSION = 1;
+    constexpr juce::uint32 RING_BLOCKS = 4;
+    constexpr int SESSION_LOADERS = 2;          // Threads opening sessions
+    constexpr int WORKER_IDLE_WAIT_MS = 100;    // Longest sleep of a worker without a doorbell
+
+    /// Path of the doorbell of a daemon listening on a socket
+    inline juce::String getBellPath(const juce::String& socketPath) { return socketPath + ".bell"; }
+
+    /// Start of every session ring. The audio slots follow, input first.
+    struct RingHeader
+    {
+        char magic[8];                          // "BRTRING"
+        juce::uint32 version;
+        juce::uint32 numSources;
+        juce::uint32 blockSize;
+        juce::uint32 ringBlocks;
+        double sampleRate;
+        alignas(64) std::atomic<juce::uint64> inputWritten;     // Client
+        alignas(64) std::atomic<juce::uint64> inputRead;        // Daemon
+        alignas(64) std::atomic<juce::uint64> outputWritten;    // Daemon
+        alignas(64) std::atomic<juce::uint64> outputRead;       // Client
+    };
+
+    static_assert(std::atomic<juce::uint64>::is_always_lock_free, "Ring indices must be address-free atomics");
+
+    /// Remove the socket file at a path, left by a daemon that did not stop cleanly, and nothing else
+    inline void unlinkSocket(const char* path)
+    {
+        struct stat info;
+        if (lstat(path, &info) == 0 && S_ISSOCK(info.st_mode))
+            unlink(path);
+    }
+
+    //==========================================================================
+    /// A session ring mapped into this process. The layout is copied from the header when the ring
+    /// is created or opened and never read back from the mapping, which the other process can write.
+    class SharedRing
+    {
+    public:
+        ~SharedRing()
+        {
+            if (header != nullptr)
+                munmap(header, size);
+            if (owner)
+                shm_unlink(name.toRawUTF8());
+        }
+
+        /// Create a ring. Daemon side.
+        static std::unique_ptr<SharedRing> create(const juce::String& ringName, int numSources, int blockSize, double sampleRate)
+        {
+            shm_unlink(ringName.toRawUTF8());
+            const int fd = shm_open(ringName.toRawUTF8(), O_CREAT | O_EXCL | O_RDWR, 0600);
+            if (fd < 0)
+                return nullptr;
+            const size_t size = getSize((juce::uint32) numSources, (juce::uint32) blockSize);
+            std::unique_ptr<SharedRing> ring;
+            if (ftruncate(fd, (off_t) size) == 0)
+                ring = map(fd, ringName, size, true);
+            close(fd);
+            if (ring == nullptr)
+            {
+                shm_unlink(ringName.toRawUTF8());
+                return nullptr;
+            }
+
+            auto* h = new (ring->header) RingHeader();
+            std::memcpy(h->magic, "BRTRING", 8);
+            h->version = RING_VERSION;
+            h->numSources = (juce::uint32) numSources;
+            h->blockSize = (juce::uint32) blockSize;
+            h->ringBlocks = RING_BLOCKS;
+            h->sampleRate = sampleRate;
+            h->inputWritten.store(0);
+            h->inputRead.store(0);
+            h->outputWritten.store(0);
+            h->outputRead.store(0, std::memory_order_release);
+            ring->setLayout((juce::uint32) numSources, (juce::uint32) blockSize);
+            return ring;
+        }
+
+        /// Map an existing ring. Client side.
+        static std::unique_ptr<SharedRing> open(const juce::String& ringName)
+        {
+            const int fd = shm_open(ringName.toRawUTF8(), O_RDWR, 0600);
+            if (fd < 0)
+                return nullptr;
+            struct stat info;
+            std::unique_ptr<SharedRing> ring;
+            if (fstat(fd, &info) == 0 && (size_t) info.st_size >= sizeof(RingHeader))
+                ring = map(fd, ringName, (size_t) info.st_size, false);
+            close(fd);
+            if (ring != nullptr)
+            {
+                const auto* h = ring->header;
+                const juce::uint32 numSources = h->numSources, blockSize = h->blockSize;
+                if (std::memcmp(h->magic, "BRTRING", 8) != 0 || h->version != RING_VERSION || h->ringBlocks != RING_BLOCKS
+                    || numSources == 0 || blockSize == 0 || ring->size < getSize(numSources, blockSize))
+                    return nullptr;
+                ring->setLayout(numSources, blockSize);
+            }
+            return ring;
+        }
+
+        RingHeader& getHeader() noexcept { return *header; }
+
+        int getNumSources() const noexcept      { return (int) numSources; }
+        int getBlockSize() const noexcept       { return (int) blockSize; }
+
+        float* getInput(juce::uint64 block, int source) noexcept
+        {
+            const auto slot = (size_t) (block % RING_BLOCKS);
+            return audio + (slot * numSources + (size_t) source) * blockSize;
+        }
+
+        float* getOutput(juce::uint64 block, int ear) noexcept
+        {
+            const auto slot = (size_t) (block % RING_BLOCKS);
+            return audio + ((size_t) RING_BLOCKS * numSources + slot * 2 + (size_t) ear) * blockSize;
+        }
+
+    private:
+        static size_t getSize(juce::uint32 numSources, juce::uint32 blockSize)
+        {
+            return sizeof(RingHeader) + (size_t) RING_BLOCKS * ((size_t) numSources + 2) * blockSize * sizeof(float);
+        }
+
+        void setLayout(juce::uint32 sources, juce::uint32 samples) noexcept
+        {
+            numSources = sources;
+            blockSize = samples;
+        }
+
+        static std::unique_ptr<SharedRing> map(int fd, const juce::String& ringName, size_t size, bool owner)
+        {
+            void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (data == MAP_FAILED)
+                return nullptr;
+            std::unique_ptr<SharedRing> ring(new SharedRing());
+            ring->header = static_cast<RingHeader*>(data);
+            ring->audio = reinterpret_cast<float*>(static_cast<char*>(data) + sizeof(RingHeader));
+            ring->size = size;
+            ring->name = ringName;
+            ring->owner = owner;
+            return ring;
+        }
+
+        SharedRing() = default;
+
+        RingHeader* header = nullptr;
+        float* audio = nullptr;
+        size_t size = 0;
+        juce::uint32 numSources = 0, blockSize = 0;
+        juce::String name;
+        bool owner = false;
+    };
+
+    //==========================================================================
+    /// One listener with its sources and HRTF, rendered by whichever worker picks it up
+    class Session
+    {
+    public:
+        Session(int sessionId, std::unique_ptr<SharedRing> sharedRing, std::shared_ptr<BRTServices::CHRTF> hrtf, int numSources, int blockSize)
+            : id(sessionId), ring(std::move(sharedRing)), input((size_t) blockSize)
+        {
+            manager.BeginSetup();
+            listener = manager.CreateListener<BRTListenerModel::CListenerHRTFbasedModel>("listener");
+            for (int i = 0; i < numSources; ++i)
+            {
+                auto source = manager.CreateSoundSource<BRTSourceModel::CSourceSimpleModel>("source" + std::to_string(i));
+                listener->ConnectSoundSource(source);
+                scene.addSource(source, 0.f, 0.f, 1.f);
+            }
+            manager.EndSetup();
+            listener->SetHRTF(hrtf);
+            listener->SetListenerTransform(Common::CTransform());
+        }
+
+        /// A block is waiting and there is room for its output
+        bool isReady() noexcept
+        {
+            auto& h = ring->getHeader();
+            const auto read = h.inputRead.load(std::memory_order_relaxed);
+            return h.inputWritten.load(std::memory_order_acquire) > read
+                && read - h.outputRead.load(std::memory_order_acquire) < RING_BLOCKS;
+        }
+
+        bool isBusy() const noexcept            { return busy.load(std::memory_order_acquire); }
+
+        /// Deadline of the waiting block, stamped the first time a worker sees it
+        double getDeadline(double nowMs, double blockMs) noexcept
+        {
+            double since = pendingSinceMs.load(std::memory_order_relaxed);
+            if (since == 0.0 && pendingSinceMs.compare_exchange_strong(since, nowMs))
+                since = nowMs;
+            return since + blockMs;
+        }
+
+        bool tryClaim() noexcept                { bool expected = false; return busy.compare_exchange_strong(expected, true); }
+        void release() noexcept                 { busy.store(false, std::memory_order_release); }
+
+        /// Render the waiting block. Only the worker that claimed the session calls this.
+        void process(double deadlineMs)
+        {
+            auto& h = ring->getHeader();
+            const auto block = h.inputRead.load(std::memory_order_relaxed);
+            const double startMs = juce::Time::getMillisecondCounterHiRes();
+
+            // The ring was created for this session's sources and block size, which sized input
+            const auto blockSize = input.size();
+            scene.update(listener->GetListenerTransform().GetPosition());
+            for (int i = 0; i < scene.getNumSources(); ++i)
+            {
+                const float* samples = ring->getInput(block, i);
+                std::copy(samples, samples + blockSize, input.begin());
+                scene.getSource(i)->SetBuffer(input);
+            }
+            manager.ProcessAll();
+            listener->GetBuffers(ears.left, ears.right);
+            std::copy_n(ears.left.begin(), juce::jmin(blockSize, ears.left.size()), ring->getOutput(block, 0));
+            std::copy_n(ears.right.begin(), juce::jmin(blockSize, ears.right.size()), ring->getOutput(block, 1));
+
+            h.inputRead.store(block + 1, std::memory_order_release);
+            h.outputWritten.store(block + 1, std::memory_order_release);
+
+            const double endMs = juce::Time::getMillisecondCounterHiRes();
+            blocks.fetch_add(1, std::memory_order_relaxed);
+            if (endMs > deadlineMs)
+                misses.fetch_add(1, std::memory_order_relaxed);
+            processNs.fetch_add((juce::int64) ((endMs - startMs) * 1.0e6), std::memory_order_relaxed);
+            pendingSinceMs.store(0.0, std::memory_order_relaxed);
+            release();
+        }
+
+        /// Move a source. Control thread.
+        void move(int source, float azimuth, float elevation, float distance) { scene.postPosition(source, azimuth, elevation, distance); }
+
+        const int id;
+        std::atomic<juce::int64> blocks{ 0 }, misses{ 0 }, processNs{ 0 };
+
+    private:
+        std::unique_ptr<SharedRing> ring;
+        BRTBase::CBRTManager manager;
+        std::shared_ptr<BRTListenerModel::CListenerHRTFbasedModel> listener;
+        SceneState scene;
+        CMonoBuffer<float> input;
+        Common::CEarPair<CMonoBuffer<float>> ears;
+        std::atomic<double> pendingSinceMs{ 0.0 };
+        std::atomic<bool> busy{ false };
+
+        JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(Session)
+    };
+
+    //==========================================================================
+    class Server : private juce::Thread
+    {
+    public:
+        Server(const juce::String& path, int workers, int blockSize, double rate)
+            : juce::Thread("Render daemon control"), socketPath(path), numWorkers(workers), bufferSize(blockSize), sampleRate(rate),
+              sessionLoader(SESSION_LOADERS)
+        {
+        }
+
+        ~Server() override { stop(); }
+
+        /// Print the statistics to the console at this interval, 0 to disable
+        void setReportInterval(double seconds) { reportIntervalMs = seconds * 1000.0; }
+
+        /// Listen on the socket and start the workers. Returns an error message, empty on success.
+        juce::String start()
+        {
+            Common::CGlobalParameters globalParameters;    // Process-wide, shared by all the sessions
+            globalParameters.SetSampleRate((int) sampleRate);
+            globalParameters.SetBufferSize(bufferSize);
+
+            listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+            sockaddr_un address{};
+            address.sun_family = AF_UNIX;
+            if (listenFd < 0 || socketPath.getNumBytesAsUTF8() >= sizeof(address.sun_path))
+                return "Invalid socket path " + socketPath;
+            socketPath.copyToUTF8(address.sun_path, sizeof(address.sun_path));
+            unlinkSocket(address.sun_path);
+            if (bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listenFd, 64) != 0)
+                return "Cannot listen on " + socketPath;
+
+            // The doorbell and the pipe that wakes the control thread when a session is opened
+            const auto bellPath = getBellPath(socketPath);
+            bellFd = socket(AF_UNIX, SOCK_DGRAM, 0);
+            sockaddr_un bellAddress{};
+            bellAddress.sun_family = AF_UNIX;
+            if (bellFd < 0 || bellPath.getNumBytesAsUTF8() >= sizeof(bellAddress.sun_path))
+                return "Invalid socket path " + bellPath;
+            bellPath.copyToUTF8(bellAddress.sun_path, sizeof(bellAddress.sun_path));
+            unlinkSocket(bellAddress.sun_path);
+            if (bind(bellFd, reinterpret_cast<sockaddr*>(&bellAddress), sizeof(bellAddress)) != 0
+                || fcntl(bellFd, F_SETFL, O_NONBLOCK) != 0)
+                return "Cannot listen on " + bellPath;
+            if (pipe(openedPipe) != 0 || fcntl(openedPipe[0], F_SETFL, O_NONBLOCK) != 0)
+                return "Cannot create a pipe";
+
+            startMs = juce::Time::getMillisecondCounterHiRes();
+            for (int i = 0; i < numWorkers; ++i)
+            {
+                workers.add(new Worker(*this, i));
+                workers.getLast()->startThread(juce::Thread::Priority::highest);
+            }
+            startThread();
+            return {};
+        }
+
+        void stop()
+        {
+            stopThread(2000);
+            sessionLoader.removeAllJobs(true, 10000);
+            for (auto* worker : workers)
+                worker->signalThreadShouldExit();
+            wakeWorkers();
+            workers.clear();    // Each worker stops its thread when deleted
+            if (listenFd >= 0)
+            {
+                close(listenFd);
+                unlinkSocket(socketPath.toRawUTF8());
+                listenFd = -1;
+            }
+            if (bellFd >= 0)
+            {
+                close(bellFd);
+                unlinkSocket(getBellPath(socketPath).toRawUTF8());
+                bellFd = -1;
+            }
+            for (int& fd : openedPipe)
+            {
+                if (fd >= 0)
+                    close(fd);
+                fd = -1;
+            }
+            for (auto& client : clients)
+                close(client.fd);
+            clients.clear();
+            const juce::ScopedWriteLock lock(sessionsLock);
+            sessions.clear();
+        }
+
+        /// Throughput per session and the number of sessions a core could sustain at this block size
+        juce::String getStatistics()
+        {
+            juce::int64 blocks = 0, misses = 0, processNs = 0;
+            int numSessions = 0;
+            {
+                const juce::ScopedReadLock lock(sessionsLock);
+                numSessions = (int) sessions.size();
+                for (const auto& s : sessions)
+                {
+                    blocks += s->blocks.load();
+                    misses += s->misses.load();
+                    processNs += s->processNs.load();
+                }
+            }
+            blocks += closedBlocks.load();
+            misses += closedMisses.load();
+            processNs += closedProcessNs.load();
+
+            const double blockMs = getBlockMs();
+            const double meanMs = blocks > 0 ? processNs * 1.0e-6 / (double) blocks : 0.0;
+            const double seconds = (juce::Time::getMillisecondCounterHiRes() - startMs) * 0.001;
+
+            auto* stats = new juce::DynamicObject();
+            stats->setProperty("sessions", numSessions);
+            stats->setProperty("workers", numWorkers);
+            stats->setProperty("blockSize", bufferSize);
+            stats->setProperty("sampleRate", sampleRate);
+            stats->setProperty("blocks", blocks);
+            stats->setProperty("deadlineMisses", misses);
+            stats->setProperty("meanBlockMs", meanMs);
+            stats->setProperty("sessionsPerCore", meanMs > 0.0 ? blockMs / meanMs : 0.0);
+            stats->setProperty("workerLoad", seconds > 0.0 ? processNs * 1.0e-9 / (seconds * numWorkers) : 0.0);
+            return juce::JSON::toString(juce::var(stats), true);
+        }
+
+    private:
+        //======================================================================
+        class Worker : public juce::Thread
+        {
+        public:
+            Worker(Server& s, int index) : juce::Thread("Render worker " + juce::String(index)), server(s) {}
+            ~Worker() override { stopThread(2000); }
+
+            void run() override
+            {
+                while (! threadShouldExit())
+                {
+                    // Taken before the scan, so a doorbell rung during the scan is not missed
+                    const auto wakeups = server.getWakeups();
+                    if (auto session = server.takeEarliestDeadline(deadlineMs))
+                        session->process(deadlineMs);
+                    else
+                        server.waitForWork(wakeups);
+                }
+            }
+
+        private:
+            Server& server;
+            double deadlineMs = 0.0;
+        };
+
+        double getBlockMs() const noexcept { return 1000.0 * bufferSize / sampleRate; }
+
+        //======================================================================
+        juce::uint64 getWakeups()
+        {
+            const std::lock_guard<std::mutex> lock(workMutex);
+            return wakeups;
+        }
+
+        /// Block a worker until the workers are woken after it read wakeups, or for WORKER_IDLE_WAIT_MS
+        void waitForWork(juce::uint64 seen)
+        {
+            std::unique_lock<std::mutex> lock(workMutex);
+            workAvailable.wait_for(lock, std::chrono::milliseconds(WORKER_IDLE_WAIT_MS), [this, seen] { return wakeups != seen; });
+        }
+
+        /// Wake every worker to look for a ready session
+        void wakeWorkers()
+        {
+            {
+                const std::lock_guard<std::mutex> lock(workMutex);
+                ++wakeups;
+            }
+            workAvailable.notify_all();
+        }
+
+        /// Claim the ready session whose block is due first, among those no other worker is rendering
+        std::shared_ptr<Session> takeEarliestDeadline(double& deadlineMs)
+        {
+            const double nowMs = juce::Time::getMillisecondCounterHiRes();
+            const juce::ScopedReadLock lock(sessionsLock);
+
+            // A session claimed or rendered by another worker between the scan and the claim is busy,
+            // or no longer ready, at the next scan, which then finds the next candidate
+            for (size_t attempt = 0; attempt < sessions.size(); ++attempt)
+            {
+                std::shared_ptr<Session> best;
+                double bestDeadline = 0.0;
+                for (const auto& session : sessions)
+                {
+                    if (session->isBusy() || ! session->isReady())
+                        continue;
+                    const double deadline = session->getDeadline(nowMs, getBlockMs());
+                    if (best == nullptr || deadline < bestDeadline)
+                    {
+                        best = session;
+                        bestDeadline = deadline;
+                    }
+                }
+                if (best == nullptr)
+                    return nullptr;
+                if (! best->tryClaim())
+                    continue;
+                if (! best->isReady())
+                {
+                    best->release();
+                    continue;
+                }
+                deadlineMs = bestDeadline;
+                return best;
+            }
+            return nullptr;
+        }
+
+        //======================================================================
+        struct Client
+        {
+            int id;
+            int fd;
+            juce::String pending;
+            std::vector<int> sessionIds;
+            bool opening = false;       // Its OPEN is on the session loader, its next commands wait
+        };
+
+        /// Outcome of an OPEN, passed from the session loader to the control thread
+        struct OpenedSession
+        {
+            int clientId;
+            int sessionId;              // 0 if it failed
+            juce::String reply;
+        };
+
+        void run() override
+        {
+            char data[4096];
+            double lastReportMs = juce::Time::getMillisecondCounterHiRes();
+            while (! threadShouldExit())
+            {
+                if (reportIntervalMs > 0.0 && juce::Time::getMillisecondCounterHiRes() - lastReportMs > reportIntervalMs)
+                {
+                    lastReportMs = juce::Time::getMillisecondCounterHiRes();
+                    std::cout << getStatistics() << std::endl;
+                }
+
+                std::vector<pollfd> fds;
+                fds.push_back({ listenFd, POLLIN, 0 });
+                fds.push_back({ bellFd, POLLIN, 0 });
+                fds.push_back({ openedPipe[0], POLLIN, 0 });
+                for (const auto& client : clients)
+                    fds.push_back({ client.fd, POLLIN, 0 });
+                if (poll(fds.data(), (nfds_t) fds.size(), 100) <= 0)
+                    continue;
+
+                if ((fds[0].revents & POLLIN) != 0)
+                {
+                    const int fd = accept(listenFd, nullptr, nullptr);
+                    if (fd >= 0)
+                        clients.push_back({ nextClientId++, fd, {}, {} });
+                }
+
+                // However many clients rang, every worker looks for work once
+                if ((fds[1].revents & POLLIN) != 0)
+                {
+                    while (recv(bellFd, data, sizeof(data), 0) > 0) {}
+                    wakeWorkers();
+                }
+
+                if ((fds[2].revents & POLLIN) != 0)
+                {
+                    while (read(openedPipe[0], data, sizeof(data)) > 0) {}
+                    replyOpened();
+                }
+
+                for (size_t i = 3; i < fds.size(); ++i)
+                {
+                    if ((fds[i].revents & (POLLIN | POLLHUP | POLLERR)) == 0)
+                        continue;
+                    auto client = std::find_if(clients.begin(), clients.end(), [&](const Client& c) { return c.fd == fds[i].fd; });
+                    const auto n = read(fds[i].fd, data, sizeof(data));
+                    if (n <= 0)
+                    {
+                        disconnect(*client);
+                        clients.erase(client);
+                        continue;
+                    }
+                    client->pending += juce::String::fromUTF8(data, (int) n);
+                    handlePending(*client);
+                }
+            }
+        }
+
+        /// Handle the complete lines a client has sent, up to an OPEN, which replies when the session is open
+        void handlePending(Client& client)
+        {
+            for (int end = client.pending.indexOfChar('\n'); end >= 0 && ! client.opening; end = client.pending.indexOfChar('\n'))
+            {
+                const auto reply = handle(client, client.pending.substring(0, end).trim());
+                client.pending = client.pending.substring(end + 1);
+                if (reply.isNotEmpty())
+                    sendReply(client.fd, reply);
+            }
+        }
+
+        static void sendReply(int fd, const juce::String& reply)
+        {
+            const auto line = reply + "\n";
+            const auto sent = write(fd, line.toRawUTF8(), line.getNumBytesAsUTF8());
+            juce::ignoreUnused(sent);
+        }
+
+        /// Reply to the OPENs the session loader has finished, and go on with the commands that followed them
+        void replyOpened()
+        {
+            std::vector<OpenedSession> finished;
+            {
+                const juce::ScopedLock lock(openedLock);
+                finished.swap(opened);
+            }
+            for (const auto& result : finished)
+            {
+                auto client = std::find_if(clients.begin(), clients.end(), [&](const Client& c) { return c.id == result.clientId; });
+                if (client == clients.end())
+                {
+                    if (result.sessionId > 0)
+                        closeSession(result.sessionId);     // The client left meanwhile
+                    continue;
+                }
+                if (result.sessionId > 0)
+                    client->sessionIds.push_back(result.sessionId);
+                sendReply(client->fd, result.reply);
+                client->opening = false;
+                handlePending(*client);
+            }
+        }
+
+        /// Load the HRTF and create the ring and the session. Session loader.
+        juce::String openSession(int numSources, const juce::String& sofaPath, int& sessionId)
+        {
+            auto hrtf = getHRTF(sofaPath);
+            if (hrtf == nullptr)
+                return "ERROR cannot load " + sofaPath;
+            const int id = nextSessionId++;
+            const auto ringName = "/brt-ring-" + juce::String(getpid()) + "-" + juce::String(id);
+            auto ring = SharedRing::create(ringName, numSources, bufferSize, sampleRate);
+            if (ring == nullptr)
+                return "ERROR cannot create shared memory";
+            auto session = std::make_shared<Session>(id, std::move(ring), hrtf, numSources, bufferSize);
+            {
+                const juce::ScopedWriteLock lock(sessionsLock);
+                sessions.push_back(session);
+            }
+            sessionId = id;
+            return "OK " + juce::String(id) + " " + ringName;
+        }
+
+        juce::String handle(Client& client, const juce::String& line)
+        {
+            auto tokens = juce::StringArray::fromTokens(line, " ", "\"");
+            const auto command = tokens[0].toUpperCase();
+
+            if (command == "OPEN" && tokens.size() >= 3)
+            {
+                const int numSources = tokens[1].getIntValue();
+                const auto sofaPath = tokens[2].unquoted();
+                if (numSources <= 0 || numSources > SceneState::MAX_SOURCES)
+                    return "ERROR invalid number of sources";
+                client.opening = true;
+                const int clientId = client.id;
+                sessionLoader.addJob([this, clientId, numSources, sofaPath]
+                {
+                    OpenedSession result{ clientId, 0, {} };
+                    result.reply = openSession(numSources, sofaPath, result.sessionId);
+                    {
+                        const juce::ScopedLock lock(openedLock);
+                        opened.push_back(std::move(result));
+                    }
+                    const char byte = 0;
+                    const auto sent = write(openedPipe[1], &byte, 1);
+                    juce::ignoreUnused(sent);
+                });
+                return {};      // Replied by replyOpened()
+            }
+            if (command == "MOVE" && tokens.size() >= 6)
+            {
+                if (auto session = findSession(tokens[1].getIntValue()))
+                {
+                    session->move(tokens[2].getIntValue(), tokens[3].getFloatValue(), tokens[4].getFloatValue(), tokens[5].getFloatValue());
+                    return "OK";
+                }
+                return "ERROR unknown session";
+            }
+            if (command == "CLOSE" && tokens.size() >= 2)
+            {
+                const int id = tokens[1].getIntValue();
+                client.sessionIds.erase(std::remove(client.sessionIds.begin(), client.sessionIds.end(), id), client.sessionIds.end());
+                return closeSession(id) ? "OK" : "ERROR unknown session";
+            }
+            if (command == "STATS")
+                return getStatistics();
+            return "ERROR unknown command";
+        }
+
+        void disconnect(Client& client)
+        {
+            for (const int id : client.sessionIds)
+                closeSession(id);
+            close(client.fd);
+        }
+
+        std::shared_ptr<Session> findSession(int id)
+        {
+            const juce::ScopedReadLock lock(sessionsLock);
+            for (const auto& session : sessions)
+                if (session->id == id)
+                    return session;
+            return nullptr;
+        }
+
+        bool closeSession(int id)
+        {
+            std::shared_ptr<Session> closed;
+            {
+                const juce::ScopedWriteLock lock(sessionsLock);
+                auto it = std::find_if(sessions.begin(), sessions.end(), [id](const auto& s) { return s->id == id; });
+                if (it == sessions.end())
+                    return false;
+                closed = *it;
+                sessions.erase(it);
+            }
+            closedBlocks.fetch_add(closed->blocks.load());
+            closedMisses.fetch_add(closed->misses.load());
+            closedProcessNs.fetch_add(closed->processNs.load());
+            return true;    // Deleted here, or by the worker rendering it when it finishes
+        }
+
+        /// HRTFs are loaded once and shared read-only by all the sessions that use them. They are loaded
+        /// like the application loads them: the measurements come from the shared HRTF store, or are
+        /// read and published there, and the HRTF is built with the grid step and extrapolation of the
+        /// application, resampled if the file was measured at another sample rate. Session loader;
+        /// two loaders asking for a new file at once both load it, and the first one is kept.
+        std::shared_ptr<BRTServices::CHRTF> getHRTF(const juce::String& path)
+        {
+            {
+                const juce::ScopedLock lock(hrtfsLock);
+                auto it = hrtfs.find(path);
+                if (it != hrtfs.end())
+                    return it->second;
+            }
+            const juce::File file(path);
+            SofaMeasurements measurements;
+            bool attached = false;
+            juce::String shareError;    // An HRTF that cannot be shared is still rendered with
+            if (! juce::File::isAbsolutePath(path) || SharedHRTFStore::attachOrLoad(file, true, measurements, attached, shareError).isNotEmpty())
+                return nullptr;
+            HRTFBundle bundle(file, std::move(measurements), HRTFRESAMPLINGSTEP, 0, HRTFEXTRAPOLATIONMETHOD);
+            juce::String warning;
+            auto hrtf = bundle.buildVariant(sampleRate, bufferSize, warning);
+            if (hrtf == nullptr)
+                return nullptr;
+            const juce::ScopedLock lock(hrtfsLock);
+            return hrtfs.emplace(path, hrtf).first->second;
+        }
+
+        //======================================================================
+        const juce::String socketPath;
+        const int numWorkers;
+        const int bufferSize;
+        const double sampleRate;
+        int listenFd = -1;
+        int bellFd = -1;
+        int openedPipe[2] = { -1, -1 };         // Written by the session loader when an OPEN is done
+        double startMs = 0.0;
+        double reportIntervalMs = 0.0;
+
+        juce::ReadWriteLock sessionsLock;
+        std::vector<std::shared_ptr<Session>> sessions;
+        juce::OwnedArray<Worker> workers;
+
+        std::mutex workMutex;
+        std::condition_variable workAvailable;
+        juce::uint64 wakeups = 0;               // Counts the times the workers were woken
+
+        juce::ThreadPool sessionLoader;
+        juce::CriticalSection hrtfsLock, openedLock;
+        std::map<juce::String, std::shared_ptr<BRTServices::CHRTF>> hrtfs;
+        std::vector<OpenedSession> opened;
+        std::atomic<int> nextSessionId{ 1 };
+
+        // Control thread only
+        std::vector<Client> clients;
+        int nextClientId = 1;
+
+        std::atomic<juce::int64> closedBlocks{ 0 }, closedMisses{ 0 }, closedProcessNs{ 0 };
+
+        JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(Server)
+    };
+
+    //==========================================================================
+    /// Client side of the protocol, used by the load test
+    class Client
+    {
+    public:
+        ~Client()
+        {
+            if (fd >= 0)
+                close(fd);
+            if (bellFd >= 0)
+                close(bellFd);
+        }
+
+        bool connectTo(const juce::String& path)
+        {
+            fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            bellFd = socket(AF_UNIX, SOCK_DGRAM, 0);
+            sockaddr_un address{}, bellAddress{};
+            address.sun_family = bellAddress.sun_family = AF_UNIX;
+            path.copyToUTF8(address.sun_path, sizeof(address.sun_path));
+            getBellPath(path).copyToUTF8(bellAddress.sun_path, sizeof(bellAddress.sun_path));
+            return fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0
+                && bellFd >= 0 && connect(bellFd, reinterpret_cast<sockaddr*>(&bellAddress), sizeof(bellAddress)) == 0;
+        }
+
+        /// Wake the workers after writing blocks or reading output. A full doorbell already has them awake.
+        void ringBell()
+        {
+            const char byte = 0;
+            const auto sent = send(bellFd, &byte, 1, MSG_DONTWAIT);
+            juce::ignoreUnused(sent);
+        }
+
+        juce::String request(const juce::String& line)
+        {
+            const auto message = line + "\n";
+            if (write(fd, message.toRawUTF8(), message.getNumBytesAsUTF8()) < 0)
+                return {};
+            juce::String reply;
+            char c;
+            while (read(fd, &c, 1) == 1 && c != '\n')
+                reply += c;
+            return reply;
+        }
+
+        /// Open a session and map its ring. Returns nullptr on failure.
+        std::unique_ptr<SharedRing> open(int numSources, const juce::String& sofaPath, int& sessionId)
+        {
+            const auto reply = juce::StringArray::fromTokens(request("OPEN " + juce::String(numSources) + " \"" + sofaPath + "\""), " ", "");
+            if (reply[0] != "OK")
+                return nullptr;
+            sessionId = reply[1].getIntValue();
+            return SharedRing::open(reply[2]);
+        }
+
+    private:
+        int fd = -1;
+        int bellFd = -1;
+    };
+
+    //==========================================================================
+    /// Drive a number of sessions at real-time pace through a running daemon and report its statistics
+    inline juce::String runLoadTest(const juce::String& socketPath, const juce::String& sofaPath, int numSessions, int numSources, double seconds)
+    {
+        Client client;
+        if (! client.connectTo(socketPath))
+            return "Cannot connect to " + socketPath;
+
+        std::vector<std::unique_ptr<SharedRing>> rings;
+        for (int i = 0; i < numSessions; ++i)
+        {
+            int id = 0;
+            auto ring = client.open(numSources, juce::File::getCurrentWorkingDirectory().getChildFile(sofaPath).getFullPathName(), id);
+            if (ring == nullptr)
+                return "Cannot open session " + juce::String(i + 1);
+            client.request("MOVE " + juce::String(id) + " 0 " + juce::String(0.3 * i) + " 0 1");
+            rings.push_back(std::move(ring));
+        }
+
+        const double blockMs = 1000.0 * rings.front()->getBlockSize() / rings.front()->getHeader().sampleRate;
+        juce::Random random;
+        juce::int64 late = 0, sent = 0;
+        const double startMs = juce::Time::getMillisecondCounterHiRes();
+        for (juce::int64 block = 0; juce::Time::getMillisecondCounterHiRes() - startMs < seconds * 1000.0; ++block)
+        {
+            for (auto& ring : rings)
+            {
+                auto& h = ring->getHeader();
+                // Collect what was rendered, then send the next block if there is room
+                h.outputRead.store(h.outputWritten.load(std::memory_order_acquire), std::memory_order_release);
+                const auto written = h.inputWritten.load(std::memory_order_relaxed);
+                if (written - h.outputRead.load(std::memory_order_relaxed) >= RING_BLOCKS)
+                {
+                    ++late;     // Previous blocks not rendered within the ring latency
+                    continue;
+                }
+                for (int s = 0; s < ring->getNumSources(); ++s)
+                {
+                    float* samples = ring->getInput(written, s);
+                    for (int i = 0; i < ring->getBlockSize(); ++i)
+                        samples[i] = random.nextFloat() * 0.2f - 0.1f;
+                }
+                h.inputWritten.store(written + 1, std::memory_order_release);
+                ++sent;
+            }
+            client.ringBell();
+            const double wait = startMs + (double) (block + 1) * blockMs - juce::Time::getMillisecondCounterHiRes();
+            if (wait > 0.0)
+                std::this_thread::sleep_for(std::chrono::microseconds((juce::int64) (wait * 1000.0)));
+        }
+
+        juce::String report;
+        report << "Load test: " << numSessions << " sessions x " << numSources << " sources, " << juce::String(seconds, 0) << " s\n"
+               << "  " << sent << " blocks sent, " << late << " blocks held back because the ring was full\n"
+               << "  Daemon: " << client.request("STATS");
+        return report;
+    }
+}
+
+#endif
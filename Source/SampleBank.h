@@ -0,0 +1,366 @@
+/*
+  ==============================================================================
+
+    SampleBank.h
+    Short sounds decoded into one page-locked memory arena, and a pool of BRT
+    sources that play them as one-shot voices triggered in real time.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include "BRTBufferBinding.h"
+#include "SceneState.h"
+
+#if JUCE_LINUX || JUCE_MAC || JUCE_BSD
+ #include <sys/mman.h>
+#endif
+
+//==============================================================================
+/**
+    A set of sound files decoded at load time, mono, at one sample rate.
+
+    All the samples live back to back in a single arena, allocated once for the total
+    decoded length, so playing a sample is reading a contiguous range of memory. Where
+    the platform allows it (mlock on Linux and macOS) the arena is locked into RAM, so
+    a trigger can never page fault to disk; locking may be refused above the memory
+    lock limit of the process, in which case the arena is only pre-faulted by the
+    decoding. A bank is immutable once loaded and may be read from any thread.
+*/
+class SampleBank
+{
+public:
+    struct Sample
+    {
+        juce::String name;
+        size_t offset = 0;              // In the arena
+        int length = 0;
+    };
+
+    ~SampleBank()
+    {
+       #if JUCE_LINUX || JUCE_MAC || JUCE_BSD
+        if (locked)
+            munlock(arena.get(), arenaSize * sizeof(float));
+       #endif
+    }
+
+    /// Decode the files, mixed down to mono and resampled to the sample rate. Files that cannot be
+    /// read are skipped and listed in the returned message, empty if all were loaded. Any thread.
+    static std::shared_ptr<SampleBank> load(const juce::Array<juce::File>& files, double sampleRate,
+                                            juce::AudioFormatManager& formats, juce::String& error)
+    {
+        auto bank = std::shared_ptr<SampleBank>(new SampleBank(sampleRate));
+        const double start = juce::Time::getMillisecondCounterHiRes();
+
+        // Sizes first, so the arena is allocated once
+        juce::OwnedArray<juce::AudioFormatReader> readers;
+        for (const auto& file : files)
+        {
+            auto* reader = formats.createReaderFor(file);
+            if (reader == nullptr || reader->lengthInSamples <= 0 || reader->sampleRate <= 0.0)
+            {
+                delete reader;
+                error << (error.isEmpty() ? "Could not read " : ", ") << file.getFileName();
+                continue;
+            }
+            Sample sample;
+            sample.name = file.getFileNameWithoutExtension();
+            sample.offset = bank->arenaSize;
+            sample.length = (int) std::ceil((double) reader->lengthInSamples * sampleRate / reader->sampleRate);
+            bank->arenaSize += (size_t) sample.length;
+            bank->samples.push_back(sample);
+            readers.add(reader);
+        }
+        if (bank->arenaSize == 0)
+            return bank;
+
+        bank->arena.calloc(bank->arenaSize);
+        juce::AudioBuffer<float> decoded;
+        juce::LagrangeInterpolator interpolator;
+        for (int s = 0; s < readers.size(); ++s)
+        {
+            auto* reader = readers[s];
+            const auto& sample = bank->samples[(size_t) s];
+            const int fileLength = (int) reader->lengthInSamples;
+            decoded.setSize((int) reader->numChannels, fileLength, false, false, true);
+            reader->read(&decoded, 0, fileLength, 0, true, true);
+            for (int c = 1; c < decoded.getNumChannels(); ++c)
+                decoded.addFrom(0, 0, decoded, c, 0, fileLength);
+            if (decoded.getNumChannels() > 1)
+                decoded.applyGain(0, 0, fileLength, 1.f / (float) decoded.getNumChannels());
+
+            float* destination = bank->arena.get() + sample.offset;
+            if (juce::approximatelyEqual(reader->sampleRate, sampleRate))
+            {
+                juce::FloatVectorOperations::copy(destination, decoded.getReadPointer(0), juce::jmin(fileLength, sample.length));
+            }
+            else
+            {
+                interpolator.reset();
+                interpolator.process(reader->sampleRate / sampleRate, decoded.getReadPointer(0), destination,
+                                     sample.length, fileLength, 0);
+            }
+        }
+
+       #if JUCE_LINUX || JUCE_MAC || JUCE_BSD
+        bank->locked = mlock(bank->arena.get(), bank->arenaSize * sizeof(float)) == 0;
+       #endif
+        bank->loadMs = juce::Time::getMillisecondCounterHiRes() - start;
+        for (const auto& file : files)
+            bank->files.add(file);
+        return bank;
+    }
+
+    int getNumSamples() const noexcept                  { return (int) samples.size(); }
+    const Sample& getSample(int index) const noexcept   { return samples[(size_t) index]; }
+    const float* getData(const Sample& sample) const noexcept { return arena.get() + sample.offset; }
+
+    double getSampleRate() const noexcept               { return sampleRate; }
+    const juce::Array<juce::File>& getFiles() const     { return files; }
+    size_t getMemoryUsage() const noexcept              { return arenaSize * sizeof(float); }
+    bool isLocked() const noexcept                      { return locked; }
+    double getLoadMs() const noexcept                   { return loadMs; }
+
+private:
+    explicit SampleBank(double rate) : sampleRate(rate) {}
+
+    const double sampleRate;
+    std::vector<Sample> samples;
+    juce::HeapBlock<float> arena;
+    size_t arenaSize = 0;                               // Floats
+    bool locked = false;
+    double loadMs = 0.0;
+    juce::Array<juce::File> files;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SampleBank)
+};
+
+//==============================================================================
+/**
+    One-shot playback of the samples of a bank on a fixed pool of BRT sources.
+
+    The sources are created once, as consecutive scene entries, and a trigger only
+    assigns one of them: it is queued by the control thread and taken by the audio
+    thread at the start of the next block, which picks a free voice, or steals the
+    oldest one, moves its source to the position of the trigger and starts reading the
+    sample from the bank. A trigger may carry the time it should sound at, in samples
+    of the pool's clock (getSampleClock()), and then starts at that sample of the block
+    it falls in, whatever the block size; without a time, or if the time has already
+    passed, it starts at the beginning of the next block. Triggers may be queued in any
+    order of their times: the audio thread moves every queued trigger to a fixed array
+    of pending ones, and starts those that are due in each block. Nothing on the
+    trigger path reads files or allocates.
+*/
+class SampleVoicePool
+{
+public:
+    static constexpr int MAX_VOICES = 64;
+
+    struct Statistics
+    {
+        int activeVoices = 0;
+        int triggers = 0;
+        int stolenVoices = 0;
+        int droppedTriggers = 0;        // Queue or pending triggers full, or the sample is not in the bank
+    };
+
+    /// Reserve storage for the largest block. Call from prepareToPlay.
+    void prepare(int maximumBlockSize)
+    {
+        for (auto& voice : voices)
+            voice.input.prepare(maximumBlockSize);
+    }
+
+    /// Play on the consecutive scene entries starting at firstSceneIndex, or stop with numVoices = 0.
+    /// Message thread, under the audio callback lock.
+    void bind(int firstSceneIndex, int numVoices) noexcept
+    {
+        firstIndex = firstSceneIndex;
+        numBound = juce::jlimit(0, MAX_VOICES, numVoices);
+        for (auto& voice : voices)
+            voice.sample = nullptr;
+    }
+
+    /// Replace the bank. The voices playing the previous one stop. Message thread, under the audio
+    /// callback lock; returns the previous bank, to be released outside the lock.
+    std::shared_ptr<const SampleBank> setBank(std::shared_ptr<const SampleBank> newBank) noexcept
+    {
+        for (auto& voice : voices)
+            voice.sample = nullptr;
+        std::swap(bank, newBank);
+        return newBank;
+    }
+
+    int getNumBound() const noexcept                    { return numBound; }
+
+    //==========================================================================
+    /// Queue a trigger of a sample of the bank, at a position relative to the listener (radians,
+    /// metres), to sound at atSample of the sample clock, or as soon as possible if negative. Any
+    /// thread but the audio thread; returns false if the queue is full.
+    bool trigger(int sampleIndex, float azimuth, float elevation, float distance, float gain = 1.f, juce::int64 atSample = -1) noexcept
+    {
+        const juce::SpinLock::ScopedLockType lock(producerLock);
+        const auto scope = triggers.write(1);
+        if (scope.blockSize1 == 0)
+        {
+            droppedTriggers.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        triggerBuffer[(size_t) scope.startIndex1] = { sampleIndex, azimuth, elevation, distance, gain, atSample };
+        return true;
+    }
+
+    /// Sample time at the start of the block being rendered
+    juce::int64 getSampleClock() const noexcept         { return clock.load(std::memory_order_relaxed); }
+
+    //==========================================================================
+    /// Start the queued triggers, moving their sources, and render every voice into its source input.
+    /// Before SceneState::update(), so the sources are moved in this block. Audio thread.
+    void process(SceneState& scene, int numSamples) noexcept
+    {
+        const juce::int64 blockStart = clock.load(std::memory_order_relaxed);
+        const juce::int64 blockEnd = blockStart + numSamples;
+
+        // Everything queued joins the pending triggers
+        {
+            const auto scope = triggers.read(triggers.getNumReady());
+            scope.forEach([this](int index)
+            {
+                if (numPending < MAX_PENDING)
+                    pending[(size_t) numPending++] = triggerBuffer[(size_t) index];
+                else
+                    droppedTriggers.fetch_add(1, std::memory_order_relaxed);
+            });
+        }
+
+        // Triggers due in this block start, the later ones stay pending
+        int kept = 0;
+        for (int t = 0; t < numPending; ++t)
+        {
+            const auto& next = pending[(size_t) t];
+            if (next.atSample >= blockEnd)
+            {
+                pending[(size_t) kept++] = next;
+                continue;
+            }
+            if (! start(scene, next, (int) juce::jlimit((juce::int64) 0, (juce::int64) numSamples - 1, next.atSample - blockStart)))
+                droppedTriggers.fetch_add(1, std::memory_order_relaxed);
+        }
+        numPending = kept;
+
+        int active = 0;
+        for (int v = 0; v < numBound; ++v)
+        {
+            auto& voice = voices[(size_t) v];
+            voice.playing = voice.sample != nullptr;
+            if (! voice.playing)
+                continue;
+            ++active;
+            auto& buffer = voice.input.getBuffer();
+            voice.input.clear(numSamples);
+            const int count = juce::jmin(numSamples - voice.startOffset, voice.length - voice.position);
+            juce::FloatVectorOperations::copyWithMultiply(buffer.data() + voice.startOffset, voice.sample + voice.position, voice.gain, count);
+            voice.position += count;
+            voice.startOffset = 0;
+            if (voice.position >= voice.length)
+                voice.sample = nullptr;     // Last block, still submitted
+        }
+        activeVoices.store(active, std::memory_order_relaxed);
+        clock.store(blockEnd, std::memory_order_relaxed);
+    }
+
+    /// Input of the voice of a scene entry if it has something to play in this block, otherwise
+    /// nullptr. Audio thread, after process().
+    SourceInputBinding* getInput(int sceneIndex) noexcept
+    {
+        if (! juce::isPositiveAndBelow(sceneIndex - firstIndex, numBound))
+            return nullptr;
+        auto& voice = voices[(size_t) (sceneIndex - firstIndex)];
+        return voice.playing ? &voice.input : nullptr;
+    }
+
+    /// Counters since the last call, which resets them. Message thread.
+    Statistics getAndResetStatistics() noexcept
+    {
+        Statistics stats;
+        stats.activeVoices = activeVoices.load(std::memory_order_relaxed);
+        stats.triggers = triggerCount.exchange(0);
+        stats.stolenVoices = stolenCount.exchange(0);
+        stats.droppedTriggers = droppedTriggers.exchange(0);
+        return stats;
+    }
+
+private:
+    static constexpr int TRIGGER_QUEUE_SIZE = 1024;
+    static constexpr int MAX_PENDING = 1024;
+
+    struct Trigger
+    {
+        int sampleIndex;
+        float azimuth, elevation, distance, gain;
+        juce::int64 atSample;
+    };
+
+    struct Voice
+    {
+        SourceInputBinding input;
+        const float* sample = nullptr;      // Into the bank, nullptr when the voice is free
+        int length = 0, position = 0;
+        int startOffset = 0;                // First sample of the next block it plays in
+        float gain = 1.f;
+        juce::int64 startedAt = 0;
+        bool playing = false;               // Has a block to submit in the current block
+    };
+
+    bool start(SceneState& scene, const Trigger& trigger, int offset) noexcept
+    {
+        if (bank == nullptr || numBound == 0 || ! juce::isPositiveAndBelow(trigger.sampleIndex, bank->getNumSamples()))
+            return false;
+
+        // A free voice, or the one that started first
+        int chosen = -1;
+        for (int v = 0; v < numBound; ++v)
+        {
+            if (voices[(size_t) v].sample == nullptr)
+            {
+                chosen = v;
+                break;
+            }
+            if (chosen < 0 || voices[(size_t) v].startedAt < voices[(size_t) chosen].startedAt)
+                chosen = v;
+        }
+        auto& voice = voices[(size_t) chosen];
+        if (voice.sample != nullptr)
+            stolenCount.fetch_add(1, std::memory_order_relaxed);
+
+        const auto& sample = bank->getSample(trigger.sampleIndex);
+        voice.sample = bank->getData(sample);
+        voice.length = sample.length;
+        voice.position = 0;
+        voice.startOffset = offset;
+        voice.gain = trigger.gain;
+        voice.startedAt = clock.load(std::memory_order_relaxed) + offset;
+        scene.setPositionFromAudioThread(firstIndex + chosen, trigger.azimuth, trigger.elevation, trigger.distance);
+        triggerCount.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    std::array<Voice, MAX_VOICES> voices;
+    int firstIndex = 0, numBound = 0;               // Changed under the callback lock
+    std::shared_ptr<const SampleBank> bank;         // Changed under the callback lock
+
+    juce::AbstractFifo triggers{ TRIGGER_QUEUE_SIZE };
+    std::array<Trigger, TRIGGER_QUEUE_SIZE> triggerBuffer;
+    juce::SpinLock producerLock;                    // The GUI and the OSC thread both trigger
+    std::array<Trigger, MAX_PENDING> pending;       // Audio thread only, taken from the queue and not due yet
+    int numPending = 0;
+
+    std::atomic<juce::int64> clock{ 0 };
+    std::atomic<int> activeVoices{ 0 }, triggerCount{ 0 }, stolenCount{ 0 }, droppedTriggers{ 0 };
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SampleVoicePool)
+};
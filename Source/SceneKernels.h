@@ -0,0 +1,150 @@
+/*
+  ==============================================================================
+
+    SceneKernels.h
+    Batch kernels over structure-of-arrays scene data.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <cmath>
+
+#if JUCE_USE_SSE_INTRINSICS
+ #include <emmintrin.h>
+#elif JUCE_USE_ARM_NEON
+ #include <arm_neon.h>
+#endif
+
+//==============================================================================
+namespace SceneKernels
+{
+    constexpr float PI = 3.14159265358979323846f;
+    constexpr float HALF_PI = PI * 0.5f;
+    constexpr float TWO_PI = PI * 2.f;
+
+    /// sin(x) for any x, accurate to about 1e-6. Reduced to [-pi, pi], reflected to [-pi/2, pi/2]
+    /// and evaluated with a degree 11 odd polynomial. The SIMD versions below follow the same steps.
+    inline float fastSin(float x) noexcept
+    {
+        x -= TWO_PI * std::nearbyint(x * (1.f / TWO_PI));
+        if (x > HALF_PI)        x = PI - x;
+        else if (x < -HALF_PI)  x = -PI - x;
+        const float x2 = x * x;
+        return x * (1.f + x2 * (-1.f / 6.f + x2 * (1.f / 120.f + x2 * (-1.f / 5040.f + x2 * (1.f / 362880.f + x2 * (-1.f / 39916800.f))))));
+    }
+
+    inline float fastCos(float x) noexcept { return fastSin(x + HALF_PI); }
+
+    /// Spherical to cartesian for one source, BRT axes: x forward, y left, z up
+    inline void toCartesian(float azimuth, float elevation, float distance,
+                            float originX, float originY, float originZ,
+                            float& x, float& y, float& z) noexcept
+    {
+        const float horizontal = distance * fastCos(elevation);
+        x = horizontal * fastCos(azimuth) + originX;
+        y = horizontal * fastSin(azimuth) + originY;
+        z = distance * fastSin(elevation) + originZ;
+    }
+
+   #if JUCE_USE_SSE_INTRINSICS
+    inline __m128 sin4(__m128 x) noexcept
+    {
+        const __m128 pi = _mm_set1_ps(PI), halfPi = _mm_set1_ps(HALF_PI);
+        // Round to nearest multiple of 2 pi (cvtps rounds to nearest with the default MXCSR)
+        const __m128 turns = _mm_cvtepi32_ps(_mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(1.f / TWO_PI))));
+        x = _mm_sub_ps(x, _mm_mul_ps(turns, _mm_set1_ps(TWO_PI)));
+
+        const __m128 above = _mm_cmpgt_ps(x, halfPi);
+        const __m128 below = _mm_cmplt_ps(x, _mm_sub_ps(_mm_setzero_ps(), halfPi));
+        const __m128 sign = _mm_or_ps(_mm_and_ps(above, pi), _mm_and_ps(below, _mm_sub_ps(_mm_setzero_ps(), pi)));
+        const __m128 reflect = _mm_or_ps(above, below);
+        x = _mm_or_ps(_mm_and_ps(reflect, _mm_sub_ps(sign, x)), _mm_andnot_ps(reflect, x));
+
+        const __m128 x2 = _mm_mul_ps(x, x);
+        __m128 p = _mm_set1_ps(-1.f / 39916800.f);
+        p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(1.f / 362880.f));
+        p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(-1.f / 5040.f));
+        p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(1.f / 120.f));
+        p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(-1.f / 6.f));
+        p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(1.f));
+        return _mm_mul_ps(p, x);
+    }
+   #elif JUCE_USE_ARM_NEON
+    inline float32x4_t sin4(float32x4_t x) noexcept
+    {
+        const float32x4_t pi = vdupq_n_f32(PI), halfPi = vdupq_n_f32(HALF_PI);
+        const float32x4_t scaled = vmulq_n_f32(x, 1.f / TWO_PI);
+        // Round half away from zero, close enough for range reduction
+        const float32x4_t half = vbslq_f32(vcltq_f32(scaled, vdupq_n_f32(0.f)), vdupq_n_f32(-0.5f), vdupq_n_f32(0.5f));
+        const float32x4_t turns = vcvtq_f32_s32(vcvtq_s32_f32(vaddq_f32(scaled, half)));
+        x = vsubq_f32(x, vmulq_n_f32(turns, TWO_PI));
+
+        x = vbslq_f32(vcgtq_f32(x, halfPi), vsubq_f32(pi, x), x);
+        x = vbslq_f32(vcltq_f32(x, vnegq_f32(halfPi)), vsubq_f32(vnegq_f32(pi), x), x);
+
+        const float32x4_t x2 = vmulq_f32(x, x);
+        float32x4_t p = vdupq_n_f32(-1.f / 39916800.f);
+        p = vmlaq_f32(vdupq_n_f32(1.f / 362880.f), p, x2);
+        p = vmlaq_f32(vdupq_n_f32(-1.f / 5040.f), p, x2);
+        p = vmlaq_f32(vdupq_n_f32(1.f / 120.f), p, x2);
+        p = vmlaq_f32(vdupq_n_f32(-1.f / 6.f), p, x2);
+        p = vmlaq_f32(vdupq_n_f32(1.f), p, x2);
+        return vmulq_f32(p, x);
+    }
+   #endif
+
+    /// Convert listener-relative spherical coordinates of n sources to positions, writing both the
+    /// listener-relative offsets and the absolute positions (offset + listener position)
+    inline void sphericalToCartesian(const float* azimuth, const float* elevation, const float* distance,
+                                     float listenerX, float listenerY, float listenerZ,
+                                     float* relativeX, float* relativeY, float* relativeZ,
+                                     float* x, float* y, float* z, int n) noexcept
+    {
+        int i = 0;
+
+       #if JUCE_USE_SSE_INTRINSICS
+        const __m128 halfPi = _mm_set1_ps(HALF_PI);
+        const __m128 lx = _mm_set1_ps(listenerX), ly = _mm_set1_ps(listenerY), lz = _mm_set1_ps(listenerZ);
+        for (; i + 4 <= n; i += 4)
+        {
+            const __m128 az = _mm_loadu_ps(azimuth + i), el = _mm_loadu_ps(elevation + i), d = _mm_loadu_ps(distance + i);
+            const __m128 horizontal = _mm_mul_ps(d, sin4(_mm_add_ps(el, halfPi)));
+            const __m128 rx = _mm_mul_ps(horizontal, sin4(_mm_add_ps(az, halfPi)));
+            const __m128 ry = _mm_mul_ps(horizontal, sin4(az));
+            const __m128 rz = _mm_mul_ps(d, sin4(el));
+            _mm_storeu_ps(relativeX + i, rx);
+            _mm_storeu_ps(relativeY + i, ry);
+            _mm_storeu_ps(relativeZ + i, rz);
+            _mm_storeu_ps(x + i, _mm_add_ps(rx, lx));
+            _mm_storeu_ps(y + i, _mm_add_ps(ry, ly));
+            _mm_storeu_ps(z + i, _mm_add_ps(rz, lz));
+        }
+       #elif JUCE_USE_ARM_NEON
+        const float32x4_t halfPi = vdupq_n_f32(HALF_PI);
+        for (; i + 4 <= n; i += 4)
+        {
+            const float32x4_t az = vld1q_f32(azimuth + i), el = vld1q_f32(elevation + i), d = vld1q_f32(distance + i);
+            const float32x4_t horizontal = vmulq_f32(d, sin4(vaddq_f32(el, halfPi)));
+            const float32x4_t rx = vmulq_f32(horizontal, sin4(vaddq_f32(az, halfPi)));
+            const float32x4_t ry = vmulq_f32(horizontal, sin4(az));
+            const float32x4_t rz = vmulq_f32(d, sin4(el));
+            vst1q_f32(relativeX + i, rx);
+            vst1q_f32(relativeY + i, ry);
+            vst1q_f32(relativeZ + i, rz);
+            vst1q_f32(x + i, vaddq_f32(rx, vdupq_n_f32(listenerX)));
+            vst1q_f32(y + i, vaddq_f32(ry, vdupq_n_f32(listenerY)));
+            vst1q_f32(z + i, vaddq_f32(rz, vdupq_n_f32(listenerZ)));
+        }
+       #endif
+
+        for (; i < n; ++i)
+        {
+            toCartesian(azimuth[i], elevation[i], distance[i], 0.f, 0.f, 0.f, relativeX[i], relativeY[i], relativeZ[i]);
+            x[i] = relativeX[i] + listenerX;
+            y[i] = relativeY[i] + listenerY;
+            z[i] = relativeZ[i] + listenerZ;
+        }
+    }
+}
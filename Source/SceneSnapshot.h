@@ -0,0 +1,228 @@
+/*
+  ==============================================================================
+
+    SceneSnapshot.h
+    Versioned binary scene file: the listener, its HRTF and every source with
+    its position, gain and audio file, read in place from a mapped file.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <array>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <memory>
+#include <vector>
+
+//==============================================================================
+/**
+    Layout of a scene file. All fields are little-endian, the byte order of every platform
+    the project builds for, and naturally aligned, so a mapped file is read in place:
+
+        Header        at 0, headerSize bytes
+        Source[]      at sourcesOffset, numSources records of sourceSize bytes
+        strings       at stringsOffset, stringsSize bytes of NUL-terminated UTF-8
+
+    Strings are referred to by their byte offset in the string table, and each distinct
+    string is stored once, so a thousand sources playing the same file name it once.
+    headerSize and sourceSize are stored rather than assumed, so fields may be appended to
+    either without changing the version, and a reader skips the ones it does not know.
+    The version only changes with an incompatible layout, and a reader rejects files of
+    a newer version than its own.
+*/
+namespace SceneSnapshotFormat
+{
+    constexpr char MAGIC[8] = { 'B', 'R', 'T', 'S', 'C', 'E', 'N', 'E' };
+    constexpr juce::uint32 VERSION = 1;
+    constexpr juce::uint32 NO_STRING = 0xffffffff;
+
+    enum SourceFlags : juce::uint32
+    {
+        LOOPING = 1 << 0
+    };
+
+    struct Header
+    {
+        char magic[8];
+        juce::uint32 version;
+        juce::uint32 headerSize;
+        juce::uint32 numSources;
+        juce::uint32 sourceSize;
+        juce::uint64 sourcesOffset;
+        juce::uint64 stringsOffset;
+        juce::uint64 stringsSize;
+        juce::uint32 hrtfFile;                  // SOFA file of the listener, or NO_STRING
+        float listenerPosition[3];              // Metres
+        float listenerOrientation[4];           // Quaternion, w x y z
+    };
+
+    struct Source
+    {
+        juce::uint32 name;
+        juce::uint32 audioFile;                 // Or NO_STRING for a silent source
+        float azimuth, elevation, distance;     // Radians and metres, relative to the listener, as SceneState
+        float gain;
+        juce::uint32 flags;
+        juce::uint32 reserved;
+    };
+
+    static_assert(sizeof(Header) == 80, "The header layout is part of the file format");
+    static_assert(sizeof(Source) == 32, "The source layout is part of the file format");
+}
+
+//==============================================================================
+/**
+    A scene file mapped into memory. open() checks the header and the bounds of the tables
+    once; afterwards the sources and strings are read straight from the mapping, without
+    parsing or copying, so opening a scene costs the same whatever its size.
+*/
+class SceneSnapshot
+{
+public:
+    SceneSnapshot() = default;
+
+    /// Map a scene file and check it. Returns an error, empty on success.
+    juce::String open(const juce::File& file)
+    {
+        mapped = std::make_unique<juce::MemoryMappedFile>(file, juce::MemoryMappedFile::readOnly);
+        data = static_cast<const char*>(mapped->getData());
+        size = mapped->getSize();
+        header = nullptr;
+        if (data == nullptr)
+            return "Could not read " + file.getFileName();
+
+        using namespace SceneSnapshotFormat;
+        if (size < sizeof(Header) || std::memcmp(data, MAGIC, sizeof(MAGIC)) != 0)
+            return file.getFileName() + " is not a scene file";
+
+        const auto* h = reinterpret_cast<const Header*>(data);
+        if (h->version == 0 || h->version > VERSION)
+            return file.getFileName() + " is a scene file of version " + juce::String(h->version)
+                   + ", this version reads up to " + juce::String(VERSION);
+        // Bounds in subtraction and division form, so that no sum or product of fields can overflow
+        if (h->headerSize < sizeof(Header) || h->headerSize > size || h->sourceSize < sizeof(Source)
+            || h->sourcesOffset % alignof(Source) != 0 || h->sourceSize % alignof(Source) != 0
+            || h->numSources > (juce::uint32) std::numeric_limits<int>::max()
+            || h->sourcesOffset > size || h->numSources > (size - h->sourcesOffset) / h->sourceSize
+            || h->stringsOffset > size || h->stringsSize > size - h->stringsOffset
+            || (h->stringsSize > 0 && data[h->stringsOffset + h->stringsSize - 1] != 0))
+            return file.getFileName() + " is damaged";
+
+        header = h;
+        return {};
+    }
+
+    bool isOpen() const noexcept                                    { return header != nullptr; }
+    const SceneSnapshotFormat::Header& getHeader() const noexcept   { return *header; }
+    int getNumSources() const noexcept                              { return (int) header->numSources; }
+
+    const SceneSnapshotFormat::Source& getSource(int index) const noexcept
+    {
+        return *reinterpret_cast<const SceneSnapshotFormat::Source*>(data + header->sourcesOffset
+                                                                     + (size_t) index * header->sourceSize);
+    }
+
+    /// A string of the table, empty for NO_STRING or an offset out of the table
+    const char* getString(juce::uint32 offset) const noexcept
+    {
+        return offset < header->stringsSize ? data + header->stringsOffset + offset : "";
+    }
+
+private:
+    std::unique_ptr<juce::MemoryMappedFile> mapped;
+    const char* data = nullptr;
+    size_t size = 0;
+    const SceneSnapshotFormat::Header* header = nullptr;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SceneSnapshot)
+};
+
+//==============================================================================
+/**
+    Collects a scene and writes it as a scene file. The file is written to a temporary
+    file next to the target and moved over it once complete, so an existing scene is
+    never left half overwritten.
+*/
+class SceneSnapshotWriter
+{
+public:
+    SceneSnapshotWriter() = default;
+
+    void setListener(const juce::String& hrtfFile, const Common::CTransform& transform)
+    {
+        listenerHRTF = addString(hrtfFile);
+        const auto position = transform.GetPosition();
+        const auto orientation = transform.GetOrientation();
+        listener = { position.x, position.y, position.z, orientation.w, orientation.x, orientation.y, orientation.z };
+    }
+
+    void addSource(const juce::String& name, const juce::String& audioFile, float azimuth, float elevation, float distance,
+                   float gain, bool looping)
+    {
+        sources.push_back({ addString(name), addString(audioFile), azimuth, elevation, distance, gain,
+                            looping ? (juce::uint32) SceneSnapshotFormat::LOOPING : 0u, 0u });
+    }
+
+    int getNumSources() const noexcept                              { return (int) sources.size(); }
+
+    /// Write the scene. Returns an error, empty on success.
+    juce::String write(const juce::File& file) const
+    {
+        using namespace SceneSnapshotFormat;
+        Header header{};
+        std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.headerSize = sizeof(Header);
+        header.numSources = (juce::uint32) sources.size();
+        header.sourceSize = sizeof(Source);
+        header.sourcesOffset = sizeof(Header);
+        header.stringsOffset = header.sourcesOffset + sources.size() * sizeof(Source);
+        header.stringsSize = strings.size();
+        header.hrtfFile = listenerHRTF;
+        std::copy(listener.begin(), listener.begin() + 3, header.listenerPosition);
+        std::copy(listener.begin() + 3, listener.end(), header.listenerOrientation);
+
+        juce::TemporaryFile temporary(file);
+        {
+            juce::FileOutputStream out(temporary.getFile());
+            if (! out.openedOk()
+                || ! out.write(&header, sizeof(header))
+                || ! out.write(sources.data(), sources.size() * sizeof(Source))
+                || ! out.write(strings.data(), strings.size()))
+                return "Could not write " + file.getFileName();
+            out.flush();
+            if (out.getStatus().failed())
+                return out.getStatus().getErrorMessage();
+        }
+        if (! temporary.overwriteTargetFileWithTemporary())
+            return "Could not replace " + file.getFileName();
+        return {};
+    }
+
+private:
+    /// Offset of a string in the table, adding it the first time it is seen
+    juce::uint32 addString(const juce::String& text)
+    {
+        if (text.isEmpty())
+            return SceneSnapshotFormat::NO_STRING;
+        const auto found = stringOffsets.find(text);
+        if (found != stringOffsets.end())
+            return found->second;
+        const auto offset = (juce::uint32) strings.size();
+        const char* utf8 = text.toRawUTF8();
+        strings.insert(strings.end(), utf8, utf8 + std::strlen(utf8) + 1);
+        stringOffsets.emplace(text, offset);
+        return offset;
+    }
+
+    std::vector<SceneSnapshotFormat::Source> sources;
+    std::vector<char> strings;
+    std::map<juce::String, juce::uint32> stringOffsets;
+    juce::uint32 listenerHRTF = SceneSnapshotFormat::NO_STRING;
+    std::array<float, 7> listener{ 0.f, 0.f, 0.f, 1.f, 0.f, 0.f, 0.f };
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SceneSnapshotWriter)
+};
@@ -0,0 +1,125 @@
+/*
+  ==============================================================================
+
+    SceneSnapshotBenchmark.h
+    Time to write, open and apply a scene file of many sources, with its audio
+    requested from a decoded audio cache, with a BRT listener of its own and no
+    audio device.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "SceneSources.h"
+#include "TestFixtures.h"
+
+//==============================================================================
+namespace SceneSnapshotBenchmark
+{
+    constexpr int NUM_SOURCES = 1000;
+    constexpr int BLOCK_SIZE = 512;
+    constexpr double SAMPLE_RATE = 48000.0;
+
+    inline double elapsedMs(double startMs)
+    {
+        return juce::Time::getMillisecondCounterHiRes() - startMs;
+    }
+
+    /// Write a scene of NUM_SOURCES sources, then load it twice as the application does: first into an
+    /// empty pool, which creates the BRT sources, then again, which reuses them. Returns the report,
+    /// and whether every step succeeded.
+    inline juce::String run(bool& succeeded)
+    {
+        succeeded = false;
+        juce::AudioFormatManager formats;
+        formats.registerBasicFormats();
+        DecodedAudioCache decodedAudio(formats);
+
+        Common::CGlobalParameters globalParameters;
+        globalParameters.SetSampleRate((int) SAMPLE_RATE);
+        globalParameters.SetBufferSize(BLOCK_SIZE);
+
+        BRTBase::CBRTManager manager;
+        manager.BeginSetup();
+        auto listener = manager.CreateListener<BRTListenerModel::CListenerHRTFbasedModel>("listener");
+        manager.EndSetup();
+        auto scene = std::make_unique<SceneState>();
+        SceneSourcePool pool;
+
+        // Sources spread around the listener, all playing the same file, as in a crowd or a field of emitters
+        const auto file = juce::File::createTempFile(".brtscene");
+        const auto emitter = juce::File::createTempFile(".wav");
+        if (! TestFixtures::writeTestSignal(emitter, SAMPLE_RATE, 1.0))
+            return "Could not write " + emitter.getFullPathName();
+        juce::Random random(1);
+        SceneSnapshotWriter writer;
+        writer.setListener({}, Common::CTransform());
+        for (int i = 0; i < NUM_SOURCES; ++i)
+            writer.addSource("source " + juce::String(i + 1), emitter.getFileName(), juce::MathConstants<float>::twoPi * random.nextFloat(),
+                             0.5f * random.nextFloat() - 0.25f, 1.f + 9.f * random.nextFloat(), 1.f, true);
+        double startMs = juce::Time::getMillisecondCounterHiRes();
+        const auto writeError = writer.write(file);
+        const double writeMs = elapsedMs(startMs);
+        juce::String report;
+        auto fail = [&](const juce::String& error)
+        {
+            file.deleteFile();
+            emitter.deleteFile();
+            return report + error;
+        };
+        if (writeError.isNotEmpty())
+            return fail("Could not write the scene: " + writeError);
+
+        report << "Scene of " << NUM_SOURCES << " sources, " << file.getSize() << " bytes, written in "
+               << juce::String(writeMs, 2) << " ms\n";
+        for (const char* pass : { "First load (sources created)", "Second load (sources reused)" })
+        {
+            startMs = juce::Time::getMillisecondCounterHiRes();
+            SceneSnapshot snapshot;
+            const auto error = snapshot.open(file);
+            const double openMs = elapsedMs(startMs);
+            if (error.isNotEmpty())
+                return fail(error);
+
+            // The audio of every source, which the cache decodes once for all of them
+            double stepMs = juce::Time::getMillisecondCounterHiRes();
+            std::vector<std::shared_ptr<DecodedAudio>> audio((size_t) snapshot.getNumSources());
+            for (int k = 0; k < snapshot.getNumSources(); ++k)
+            {
+                juce::String audioError;
+                const auto audioPath = juce::String::fromUTF8(snapshot.getString(snapshot.getSource(k).audioFile));
+                audio[(size_t) k] = decodedAudio.request(file.getParentDirectory().getChildFile(audioPath), audioError);
+                if (audio[(size_t) k] == nullptr)
+                    return fail(audioError);
+            }
+            const double audioMs = elapsedMs(stepMs);
+
+            stepMs = juce::Time::getMillisecondCounterHiRes();
+            if (! pool.prepare(snapshot.getNumSources(), manager, *listener, *scene))
+                return fail("The scene has more sources than the pool can hold");
+            const double setupMs = elapsedMs(stepMs);
+
+            stepMs = juce::Time::getMillisecondCounterHiRes();
+            auto players = std::make_unique<ScenePlayers>();
+            for (int k = 0; k < snapshot.getNumSources(); ++k)
+                players->add(pool.getSceneIndex(k), std::move(audio[(size_t) k]),
+                             (snapshot.getSource(k).flags & SceneSnapshotFormat::LOOPING) != 0);
+            players->prepare(BLOCK_SIZE, SAMPLE_RATE);
+            const double playersMs = elapsedMs(stepMs);
+
+            stepMs = juce::Time::getMillisecondCounterHiRes();
+            pool.commit(snapshot, *scene);
+            scene->update(listener->GetListenerTransform().GetPosition());
+            const double commitMs = elapsedMs(stepMs);
+
+            report << pass << ": " << juce::String(elapsedMs(startMs), 2) << " ms (open " << juce::String(openMs, 3)
+                   << " ms, audio requests " << juce::String(audioMs, 2) << " ms, setup pass " << juce::String(setupMs, 2)
+                   << " ms, players " << juce::String(playersMs, 2) << " ms, positions " << juce::String(commitMs, 3) << " ms)\n";
+        }
+        file.deleteFile();
+        emitter.deleteFile();
+        succeeded = true;
+        return report.trimEnd();
+    }
+}
@@ -0,0 +1,194 @@
+/*
+  ==============================================================================
+
+    SceneSources.h
+    The BRT sources of a scene loaded from a scene file, kept in a pool and
+    reused by the next scene, and the decoded audio files they play.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "SceneState.h"
+#include "SceneSnapshot.h"
+#include "BRTBufferBinding.h"
+#include "DecodedAudioCache.h"
+
+//==============================================================================
+/**
+    Pool of BRT sources for the scenes loaded from files.
+
+    A scene is applied in two steps. prepare() runs one BRT setup pass: it creates the
+    sources the pool is missing, connects the pooled ones the scene uses again and
+    disconnects the ones it leaves over, and adds the new sources to the SceneState in
+    its preallocated slots. commit() then writes the positions and gains of the whole
+    scene into those slots and leaves the slots of the unused sources empty, so the
+    audio thread skips them. prepare() allocates and may take as long as BRT needs to
+    create the sources; commit() only writes to the arrays, and is meant to run under the
+    audio callback lock together with the swap of the audio the sources play.
+
+    Loading a scene as large as one loaded before creates no BRT source at all.
+*/
+class SceneSourcePool
+{
+public:
+    SceneSourcePool() = default;
+
+    /// Have count sources connected to the listener, in one setup pass. Returns false, without
+    /// changing anything, if the scene cannot hold the sources to add. Message thread.
+    bool prepare(int count, BRTBase::CBRTManager& manager, BRTListenerModel::CListenerHRTFbasedModel& listener, SceneState& scene)
+    {
+        const int pooled = (int) sources.size();
+        if (count - pooled > SceneState::MAX_SOURCES - scene.getNumSources())
+            return false;
+
+        manager.BeginSetup();
+        for (int k = pooled; k < count; ++k)
+        {
+            sources.push_back(manager.CreateSoundSource<BRTSourceModel::CSourceSimpleModel>("scene source " + std::to_string(k + 1)));
+            listener.ConnectSoundSource(sources.back());
+        }
+        for (int k = numActive; k < juce::jmin(count, pooled); ++k)
+            listener.ConnectSoundSource(sources[(size_t) k]);
+        for (int k = count; k < numActive; ++k)
+            listener.DisconnectSoundSource(sources[(size_t) k]);
+        manager.EndSetup();
+
+        // New sources start silent, commit() places them
+        for (int k = pooled; k < count; ++k)
+            entries.push_back(scene.addSource(sources[(size_t) k], 0.f, 0.f, 1.f, 0.f));
+        numActive = count;
+        return true;
+    }
+
+    /// Place the sources of a scene and empty the slots of the pooled sources it does not use. Only
+    /// while the audio thread is not running SceneState::update(), e.g. under the audio callback lock.
+    void commit(const SceneSnapshot& snapshot, SceneState& scene) noexcept
+    {
+        jassert(snapshot.getNumSources() == numActive);
+        for (int k = 0; k < numActive; ++k)
+        {
+            const auto& source = snapshot.getSource(k);
+            scene.setEntry(entries[(size_t) k], sources[(size_t) k].get(), source.azimuth, source.elevation, source.distance, source.gain);
+        }
+        for (int k = numActive; k < (int) sources.size(); ++k)
+            scene.setEntry(entries[(size_t) k], nullptr, 0.f, 0.f, 1.f, 0.f);
+    }
+
+    int getNumActive() const noexcept                   { return numActive; }
+    int getNumPooled() const noexcept                   { return (int) sources.size(); }
+
+    /// Scene index of the k-th source of the loaded scene
+    int getSceneIndex(int k) const noexcept             { return entries[(size_t) k]; }
+
+private:
+    std::vector<std::shared_ptr<BRTSourceModel::CSourceSimpleModel>> sources;
+    std::vector<int> entries;                           // Scene index of each pooled source
+    int numActive = 0;                                  // Sources of the loaded scene, the first ones of the pool
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SceneSourcePool)
+};
+
+//==============================================================================
+/**
+    The audio files played by the sources of one loaded scene, each from its decoded
+    samples in a DecodedAudioCache, so sources playing the same file share one copy.
+
+    The set is built and prepared on the message thread and swapped in whole under the
+    audio callback lock. The audio thread then renders every player into the input of
+    its source, which is a copy from memory per source. A file decoded at another rate
+    than the device's is played through a resampler, set up in prepare().
+*/
+class ScenePlayers
+{
+public:
+    ScenePlayers() = default;
+
+    /// Play decoded audio from a source of the scene. Message thread, before the set is swapped in.
+    void add(int sceneIndex, std::shared_ptr<DecodedAudio> audio, bool looping)
+    {
+        auto player = std::make_unique<Player>(std::move(audio));
+        player->audio.setLooping(looping);
+        if (sceneIndex >= (int) inputOfEntry.size())
+            inputOfEntry.resize((size_t) sceneIndex + 1, nullptr);
+        inputOfEntry[(size_t) sceneIndex] = &player->input;
+        players.push_back(std::move(player));
+    }
+
+    /// Reserve storage for the largest block, and resample the files decoded at another rate than
+    /// the device's. Message thread before the swap, or prepareToPlay.
+    void prepare(int maximumBlockSize, double sampleRate)
+    {
+        for (auto& player : players)
+        {
+            player->input.prepare(maximumBlockSize);
+            const double ratio = player->audio.getDecodedAudio().sampleRate / sampleRate;
+            if (juce::approximatelyEqual(ratio, 1.0))
+            {
+                player->resampler.reset();
+                continue;
+            }
+            if (player->resampler == nullptr)
+                player->resampler = std::make_unique<juce::ResamplingAudioSource>(&player->audio, false, 1);
+            player->resampler->setResamplingRatio(ratio);
+            player->resampler->prepareToPlay(maximumBlockSize, sampleRate);
+        }
+    }
+
+    /// Render every player into the input of its source. Audio thread.
+    void process(int numSamples) noexcept
+    {
+        for (auto& player : players)
+        {
+            const auto info = player->input.getChannelInfo(numSamples);
+            if (player->resampler != nullptr)
+                player->resampler->getNextAudioBlock(info);
+            else
+                player->audio.getNextAudioBlock(info);
+        }
+    }
+
+    /// Input of a scene source, or nullptr if the source plays nothing. Audio thread.
+    SourceInputBinding* getInput(int sceneIndex) noexcept
+    {
+        return juce::isPositiveAndBelow(sceneIndex, (int) inputOfEntry.size()) ? inputOfEntry[(size_t) sceneIndex] : nullptr;
+    }
+
+    int getNumPlayers() const noexcept                  { return (int) players.size(); }
+
+    /// Players whose file could not be decoded to the end
+    int getNumFailed() const noexcept
+    {
+        int numFailed = 0;
+        for (const auto& player : players)
+            numFailed += player->audio.getDecodedAudio().hasFailed() ? 1 : 0;
+        return numFailed;
+    }
+
+    /// Frames played as silence, summed over the players, because they were not decoded in time
+    juce::int64 getMissingFrames() const noexcept
+    {
+        juce::int64 missing = 0;
+        for (const auto& player : players)
+            missing += player->audio.getMissingFrames();
+        return missing;
+    }
+
+private:
+    struct Player
+    {
+        explicit Player(std::shared_ptr<DecodedAudio> decoded) : audio(std::move(decoded)) {}
+
+        DecodedAudioSource audio;
+        std::unique_ptr<juce::ResamplingAudioSource> resampler;     // Reads audio, when its rate is not the device's
+        SourceInputBinding input;
+    };
+
+    std::vector<std::unique_ptr<Player>> players;
+    std::vector<SourceInputBinding*> inputOfEntry;      // Indexed by scene index
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ScenePlayers)
+};
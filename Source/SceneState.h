@@ -0,0 +1,446 @@
+/*
+  ==============================================================================
+
+    SceneState.h
+    Structure-of-arrays state of all the sound sources in the scene, updated
+    in one batch per audio block and pushed into the BRT sources.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "SceneKernels.h"
+
+//==============================================================================
+/**
+    Scene state kept as contiguous arrays, one entry per source.
+
+    Control threads never touch the arrays: they post commands through a lock-free
+    FIFO, or, for high-rate remote control, store the latest value of a parameter in a
+    per-source mailbox where newer values overwrite the ones not yet applied. At the start of every block the audio thread drains the commands, converts
+    and relativizes the positions of all the sources in one SIMD pass and pushes the
+    transforms of the sources that moved into BRT with a single call to update().
+
+    Sources are added from the message thread into preallocated slots, so the audio
+    thread can read the arrays without locks while the scene grows. The BRT source
+    objects are owned here and only reached by the audio thread through raw pointers
+    that stay valid until clear(), or until replaceSource() hands the source back, and
+    neither may run while audio is being processed.
+*/
+class SceneState
+{
+public:
+    static constexpr int MAX_SOURCES = 4096;
+
+    SceneState()
+    {
+        for (auto* array : { &azimuth, &elevation, &distance, &gain, &relativeX, &relativeY, &relativeZ, &x, &y, &z })
+            array->assign(MAX_SOURCES, 0.f);
+        moved.assign(MAX_SOURCES, 0);
+        latest.reset(new LatestValues[MAX_SOURCES]);
+        ownedSources.reserve(MAX_SOURCES);
+    }
+
+    //==========================================================================
+    /// Add a source to the scene. Message thread only. Returns its index, or -1 if the scene is full.
+    int addSource(std::shared_ptr<BRTSourceModel::CSourceSimpleModel> source, float sourceAzimuth, float sourceElevation,
+                  float sourceDistance, float sourceGain = 1.f)
+    {
+        const int index = numSources.load();
+        if (index >= MAX_SOURCES)
+            return -1;
+
+        azimuth[(size_t) index] = sourceAzimuth;
+        elevation[(size_t) index] = sourceElevation;
+        distance[(size_t) index] = sourceDistance;
+        gain[(size_t) index] = sourceGain;
+        moved[(size_t) index] = 1;
+        sources[(size_t) index].store(source.get());
+        ownedSources.push_back(std::move(source));
+        numSources.store(index + 1, std::memory_order_release);
+        return index;
+    }
+
+    /// Replace the BRT source of an existing entry and return the previous one, which the scene no
+    /// longer owns, for the caller to disconnect and release. Message thread only, while the audio
+    /// thread is not processing, e.g. under the audio callback lock, as the audio thread may be
+    /// using the previous source until then. Post a position afterwards so that the new source
+    /// receives its transform.
+    std::shared_ptr<BRTSourceModel::CSourceSimpleModel> replaceSource(int index, std::shared_ptr<BRTSourceModel::CSourceSimpleModel> source)
+    {
+        jassert(juce::isPositiveAndBelow(index, numSources.load()));
+        auto previous = getSourceOwner(index);
+        sources[(size_t) index].store(source.get());
+        ownedSources.push_back(std::move(source));
+        if (previous != nullptr)
+            ownedSources.erase(std::find(ownedSources.begin(), ownedSources.end(), previous));
+        return previous;
+    }
+
+    /// Remove all sources. Only call while the audio thread is not running update().
+    void clear()
+    {
+        numSources.store(0);
+        for (auto& s : sources)
+            s.store(nullptr);
+        ownedSources.clear();
+        commands.reset();
+        for (auto* dirty : { &positionDirty, &gainDirty })
+            for (auto& word : *dirty)
+                word.store(0);
+    }
+
+    /// Set an entry in place: its source, position and gain at once, to apply a whole scene in one
+    /// pass. The source must be owned by the scene already, added at this or another entry, or be
+    /// nullptr to leave the entry out of the processing. Only call while the audio thread is not
+    /// running update(), e.g. under the audio callback lock.
+    void setEntry(int index, BRTSourceModel::CSourceSimpleModel* source, float sourceAzimuth, float sourceElevation,
+                  float sourceDistance, float sourceGain) noexcept
+    {
+        jassert(juce::isPositiveAndBelow(index, numSources.load()));
+        azimuth[(size_t) index] = sourceAzimuth;
+        elevation[(size_t) index] = sourceElevation;
+        distance[(size_t) index] = sourceDistance;
+        gain[(size_t) index] = sourceGain;
+        moved[(size_t) index] = 1;
+        movedInPlace = true;
+        sources[(size_t) index].store(source, std::memory_order_release);
+    }
+
+    //==========================================================================
+    /// Move a source, in listener-relative spherical coordinates (radians, metres).
+    /// Safe from one control thread; returns false if the command queue is full.
+    bool postPosition(int index, float sourceAzimuth, float sourceElevation, float sourceDistance) noexcept
+    {
+        return post({ index, Command::Position, sourceAzimuth, sourceElevation, sourceDistance });
+    }
+
+    bool postGain(int index, float sourceGain) noexcept
+    {
+        return post({ index, Command::Gain, sourceGain, 0.f, 0.f });
+    }
+
+    /// Move a source from the audio thread itself, before update() in the same block
+    void setPositionFromAudioThread(int index, float sourceAzimuth, float sourceElevation, float sourceDistance) noexcept
+    {
+        if (! juce::isPositiveAndBelow(index, numSources.load(std::memory_order_acquire)))
+            return;
+        azimuth[(size_t) index] = sourceAzimuth;
+        elevation[(size_t) index] = sourceElevation;
+        distance[(size_t) index] = sourceDistance;
+        moved[(size_t) index] = 1;
+        movedInPlace = true;
+    }
+
+    //==========================================================================
+    /// Latest-value-wins updates for one remote control thread. Wait-free: the values are written
+    /// in place, overwriting any not yet applied, and flagged for the next update(). timeMs is
+    /// when the update was received (juce::Time::getMillisecondCounterHiRes), used to measure
+    /// how long updates take to reach the audio thread. Returns false if the index is out of range.
+    bool storePosition(int index, float sourceAzimuth, float sourceElevation, float sourceDistance, double timeMs) noexcept
+    {
+        if (! juce::isPositiveAndBelow(index, MAX_SOURCES))
+            return false;
+        auto& slot = latest[(size_t) index];
+        beginWrite(slot);
+        slot.azimuth.store(sourceAzimuth, std::memory_order_relaxed);
+        slot.elevation.store(sourceElevation, std::memory_order_relaxed);
+        slot.distance.store(sourceDistance, std::memory_order_relaxed);
+        slot.timeMs.store(timeMs, std::memory_order_relaxed);
+        endWrite(slot);
+        positionDirty[(size_t) index / 64].fetch_or((juce::uint64) 1 << (index % 64), std::memory_order_release);
+        return true;
+    }
+
+    bool storeGain(int index, float sourceGain, double timeMs) noexcept
+    {
+        if (! juce::isPositiveAndBelow(index, MAX_SOURCES))
+            return false;
+        auto& slot = latest[(size_t) index];
+        beginWrite(slot);
+        slot.gain.store(sourceGain, std::memory_order_relaxed);
+        slot.timeMs.store(timeMs, std::memory_order_relaxed);
+        endWrite(slot);
+        gainDirty[(size_t) index / 64].fetch_or((juce::uint64) 1 << (index % 64), std::memory_order_release);
+        return true;
+    }
+
+    struct ControlLatency
+    {
+        int updatesApplied = 0;
+        float meanMs = 0.f;
+        float maxMs = 0.f;
+    };
+
+    /// Time from storePosition()/storeGain() to the update() that applied the value, since the last call
+    ControlLatency getAndResetControlLatency() noexcept
+    {
+        ControlLatency result;
+        result.updatesApplied = latencyCount.exchange(0);
+        const double sum = latencySumMs.exchange(0.0);
+        result.meanMs = result.updatesApplied > 0 ? (float) (sum / result.updatesApplied) : 0.f;
+        result.maxMs = latencyMaxMs.exchange(0.f);
+        return result;
+    }
+
+    //==========================================================================
+    /// Apply the pending commands, recompute the positions of all the sources relative to the listener
+    /// and push the transforms of the ones that moved. Audio thread only.
+    void update(const Common::CVector3& listenerPosition)
+    {
+        const int n = numSources.load(std::memory_order_acquire);
+        bool anyMoved = drainCommands(n);
+        anyMoved = drainLatestValues(n) || anyMoved;
+        anyMoved = std::exchange(movedInPlace, false) || anyMoved;
+
+        const bool listenerMoved = listenerPosition.x != lastListenerX || listenerPosition.y != lastListenerY || listenerPosition.z != lastListenerZ;
+        if (listenerMoved)
+        {
+            lastListenerX = listenerPosition.x;
+            lastListenerY = listenerPosition.y;
+            lastListenerZ = listenerPosition.z;
+            std::fill(moved.begin(), moved.begin() + n, (char) 1);
+            anyMoved = true;
+        }
+        anyMoved = anyMoved || n > lastNumSources;
+        lastNumSources = n;
+
+        if (! anyMoved)
+            return;
+
+        SceneKernels::sphericalToCartesian(azimuth.data(), elevation.data(), distance.data(),
+                                           lastListenerX, lastListenerY, lastListenerZ,
+                                           relativeX.data(), relativeY.data(), relativeZ.data(),
+                                           x.data(), y.data(), z.data(), n);
+        pushToSources(n);
+    }
+
+    //==========================================================================
+    int getNumSources() const noexcept                                          { return numSources.load(std::memory_order_acquire); }
+    BRTSourceModel::CSourceSimpleModel* getSource(int index) const noexcept     { return sources[(size_t) index].load(std::memory_order_acquire); }
+
+    /// Shared pointer to the current BRT source of an entry, for connecting and disconnecting. Message thread only.
+    std::shared_ptr<BRTSourceModel::CSourceSimpleModel> getSourceOwner(int index) const
+    {
+        const auto* current = getSource(index);
+        for (auto it = ownedSources.rbegin(); it != ownedSources.rend(); ++it)
+            if (it->get() == current)
+                return *it;
+        return nullptr;
+    }
+
+    // Audio thread views of the arrays, valid for indices below getNumSources()
+    float getAzimuth(int index) const noexcept          { return azimuth[(size_t) index]; }
+    float getElevation(int index) const noexcept        { return elevation[(size_t) index]; }
+    float getGain(int index) const noexcept             { return gain[(size_t) index]; }
+    float getDistance(int index) const noexcept         { return distance[(size_t) index]; }
+    const float* getDistances() const noexcept          { return distance.data(); }
+    const float* getRelativeX() const noexcept          { return relativeX.data(); }
+    const float* getRelativeY() const noexcept          { return relativeY.data(); }
+    const float* getRelativeZ() const noexcept          { return relativeZ.data(); }
+
+private:
+    struct Command
+    {
+        enum Type : int { Position, Gain };
+
+        int index;
+        Type type;
+        float a, b, c;
+    };
+
+    static constexpr int COMMAND_QUEUE_SIZE = 8192;
+
+    bool post(const Command& command) noexcept
+    {
+        const auto scope = commands.write(1);
+        if (scope.blockSize1 == 0)
+            return false;
+        commandBuffer[(size_t) scope.startIndex1] = command;
+        return true;
+    }
+
+    bool drainCommands(int n) noexcept
+    {
+        bool anyMoved = false;
+        const auto scope = commands.read(commands.getNumReady());
+        auto apply = [&](const Command& c)
+        {
+            if (! juce::isPositiveAndBelow(c.index, n))
+                return;
+            const auto i = (size_t) c.index;
+            if (c.type == Command::Position)
+            {
+                azimuth[i] = c.a;
+                elevation[i] = c.b;
+                distance[i] = c.c;
+                moved[i] = 1;
+                anyMoved = true;
+            }
+            else
+            {
+                gain[i] = c.a;
+            }
+        };
+        for (int i = 0; i < scope.blockSize1; ++i) apply(commandBuffer[(size_t) (scope.startIndex1 + i)]);
+        for (int i = 0; i < scope.blockSize2; ++i) apply(commandBuffer[(size_t) (scope.startIndex2 + i)]);
+        return anyMoved;
+    }
+
+    //==========================================================================
+    /// Last value stored for each source by the remote control thread, guarded by a sequence
+    /// counter that is odd while a write is in progress
+    struct LatestValues
+    {
+        std::atomic<juce::uint32> sequence{ 0 };
+        std::atomic<float> azimuth{ 0.f }, elevation{ 0.f }, distance{ 0.f }, gain{ 1.f };
+        std::atomic<double> timeMs{ 0.0 };
+    };
+
+    static void beginWrite(LatestValues& slot) noexcept
+    {
+        slot.sequence.store(slot.sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    static void endWrite(LatestValues& slot) noexcept
+    {
+        slot.sequence.store(slot.sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    /// Apply the flagged mailboxes. A value caught in the middle of a write is left flagged for the
+    /// next block instead of waiting for the writer.
+    bool drainLatestValues(int n) noexcept
+    {
+        bool anyMoved = false;
+        int applied = 0;
+        double sumMs = 0.0, maxMs = 0.0, nowMs = 0.0;
+
+        for (int word = 0; word * 64 < n; ++word)
+        {
+            for (int kind = 0; kind < 2; ++kind)
+            {
+                auto& dirtyWord = (kind == 0 ? positionDirty : gainDirty)[(size_t) word];
+                if (dirtyWord.load(std::memory_order_relaxed) == 0)
+                    continue;
+                juce::uint64 bits = dirtyWord.exchange(0, std::memory_order_acquire);
+                juce::uint64 retry = 0;
+                if (nowMs == 0.0)
+                    nowMs = juce::Time::getMillisecondCounterHiRes();
+
+                for (; bits != 0; bits &= bits - 1)
+                {
+                    const int bit = countTrailingZeros(bits);
+                    const int index = word * 64 + bit;
+                    if (index >= n)
+                    {
+                        retry |= (juce::uint64) 1 << bit;   // Source not added yet
+                        continue;
+                    }
+                    auto& slot = latest[(size_t) index];
+                    const auto before = slot.sequence.load(std::memory_order_acquire);
+                    const float a = slot.azimuth.load(std::memory_order_relaxed);
+                    const float b = slot.elevation.load(std::memory_order_relaxed);
+                    const float c = slot.distance.load(std::memory_order_relaxed);
+                    const float g = slot.gain.load(std::memory_order_relaxed);
+                    const double timeMs = slot.timeMs.load(std::memory_order_relaxed);
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    if ((before & 1) != 0 || slot.sequence.load(std::memory_order_relaxed) != before)
+                    {
+                        retry |= (juce::uint64) 1 << bit;
+                        continue;
+                    }
+
+                    const auto i = (size_t) index;
+                    if (kind == 0)
+                    {
+                        azimuth[i] = a;
+                        elevation[i] = b;
+                        distance[i] = c;
+                        moved[i] = 1;
+                        anyMoved = true;
+                    }
+                    else
+                    {
+                        gain[i] = g;
+                    }
+                    ++applied;
+                    sumMs += nowMs - timeMs;
+                    maxMs = juce::jmax(maxMs, nowMs - timeMs);
+                }
+                if (retry != 0)
+                    dirtyWord.fetch_or(retry, std::memory_order_relaxed);
+            }
+        }
+
+        if (applied > 0)
+        {
+            latencyCount.fetch_add(applied, std::memory_order_relaxed);
+            auto sum = latencySumMs.load(std::memory_order_relaxed);
+            while (! latencySumMs.compare_exchange_weak(sum, sum + sumMs, std::memory_order_relaxed)) {}
+            if ((float) maxMs > latencyMaxMs.load(std::memory_order_relaxed))
+                latencyMaxMs.store((float) maxMs, std::memory_order_relaxed);
+        }
+        return anyMoved;
+    }
+
+    static int countTrailingZeros(juce::uint64 bits) noexcept
+    {
+        int count = 0;
+        while ((bits & 1) == 0)
+        {
+            bits >>= 1;
+            ++count;
+        }
+        return count;
+    }
+
+    void pushToSources(int n)
+    {
+        for (int i = 0; i < n; ++i)
+        {
+            if (moved[(size_t) i] == 0)
+                continue;
+            moved[(size_t) i] = 0;
+            if (auto* source = sources[(size_t) i].load(std::memory_order_acquire))
+            {
+                Common::CTransform transform = source->GetCurrentSourceTransform();
+                transform.SetPosition(Common::CVector3(x[(size_t) i], y[(size_t) i], z[(size_t) i]));
+                source->SetSourceTransform(transform);
+            }
+        }
+    }
+
+    //==========================================================================
+    // Structure of arrays, MAX_SOURCES entries each
+    std::vector<float> azimuth, elevation, distance, gain;      // Radians, metres, linear
+    std::vector<float> relativeX, relativeY, relativeZ;         // Listener-relative position
+    std::vector<float> x, y, z;                                 // Absolute position pushed to BRT
+    std::vector<char> moved;
+
+    std::array<std::atomic<BRTSourceModel::CSourceSimpleModel*>, MAX_SOURCES> sources{};
+    std::vector<std::shared_ptr<BRTSourceModel::CSourceSimpleModel>> ownedSources;  // Message thread only
+    std::atomic<int> numSources{ 0 };
+
+    juce::AbstractFifo commands{ COMMAND_QUEUE_SIZE };
+    std::array<Command, COMMAND_QUEUE_SIZE> commandBuffer;
+
+    std::unique_ptr<LatestValues[]> latest;                                         // MAX_SOURCES mailboxes
+    std::array<std::atomic<juce::uint64>, MAX_SOURCES / 64> positionDirty{}, gainDirty{};
+    std::atomic<int> latencyCount{ 0 };
+    std::atomic<double> latencySumMs{ 0.0 };
+    std::atomic<float> latencyMaxMs{ 0.f };
+
+    // Audio thread only
+    float lastListenerX = 0.f, lastListenerY = 0.f, lastListenerZ = 0.f;
+    int lastNumSources = 0;
+    bool movedInPlace = false;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SceneState)
+};
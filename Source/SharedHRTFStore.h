@@ -0,0 +1,314 @@
+/*
+  ==============================================================================
+
+    SharedHRTFStore.h
+    Host-wide store of HRTF measurement data in memory-mapped files, so that
+    several instances of the application share one copy of each HRTF.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "SofaMeasurements.h"
+
+#if JUCE_LINUX || JUCE_MAC || JUCE_BSD
+ #include <fcntl.h>
+ #include <sys/stat.h>
+ #include <unistd.h>
+#endif
+
+//==============================================================================
+/**
+    Publishes the measurements of a SOFA file (directions, distances, delays and impulse
+    responses) into a file that other processes map read-only instead of parsing the SOFA
+    file again.
+
+    On Linux the files live in /dev/shm, which is POSIX shared memory, so a mapped HRTF
+    is a single set of pages in RAM whatever the number of processes using it. Elsewhere
+    they live in the temporary directory and are shared through the page cache.
+
+    A store file starts with a versioned header followed by 64-byte aligned arrays. It is
+    written under a temporary name and renamed when complete, so readers never see a half
+    written store. Its name is derived from the user and the path of the SOFA file, so a
+    file edited since it was published replaces its store rather than adding one; the
+    header holds the size and modification time of the SOFA file, so a stale store is never
+    used. Stores are private to the user: on POSIX systems they are created exclusively
+    with mode 0600 and only mapped if the user owns them, so no other user of the host can
+    plant one in the shared directory. Stores not used for PRUNE_AGE_DAYS are deleted when
+    the next one is published, since files in /dev/shm hold memory until the host restarts.
+*/
+namespace SharedHRTFStore
+{
+    constexpr juce::uint32 VERSION = 1;
+    constexpr size_t ALIGNMENT = 64;
+    constexpr int PRUNE_AGE_DAYS = 7;
+    constexpr const char* FILE_PREFIX = "brt-hrtf-";
+
+    struct Header
+    {
+        char magic[8];                      // "BRTHRTF"
+        juce::uint32 version;
+        juce::uint32 headerSize;
+        juce::uint64 totalSize;
+        juce::int64 sourceFileSize;
+        juce::int64 sourceModificationTime; // Milliseconds since the epoch
+        double sampleRate;
+        juce::uint32 numMeasurements;
+        juce::uint32 irLength;
+        // Byte offsets from the start of the store
+        juce::uint64 directionsOffset;      // numMeasurements x { azimuth, elevation } floats, degrees
+        juce::uint64 distancesOffset;       // numMeasurements floats, metres
+        juce::uint64 leftDelayOffset;       // numMeasurements floats, samples
+        juce::uint64 rightDelayOffset;
+        juce::uint64 leftIROffset;          // numMeasurements x irLength floats
+        juce::uint64 rightIROffset;
+    };
+
+    inline juce::File getStoreDirectory()
+    {
+        const juce::File sharedMemory("/dev/shm");
+        return sharedMemory.isDirectory() ? sharedMemory : juce::File::getSpecialLocation(juce::File::tempDirectory);
+    }
+
+    /// Prefix of the stores of this user
+    inline juce::String getUserPrefix()
+    {
+       #if JUCE_LINUX || JUCE_MAC || JUCE_BSD
+        return FILE_PREFIX + juce::String((juce::int64) geteuid()) + "-";
+       #else
+        return FILE_PREFIX;     // The temporary directory is already per user
+       #endif
+    }
+
+    inline juce::File getStoreFile(const juce::File& sofaFile)
+    {
+        return getStoreDirectory().getChildFile(getUserPrefix() + juce::String::toHexString(sofaFile.getFullPathName().hashCode64()) + ".bin");
+    }
+
+    /// True if a store file is a regular file of this user that nobody else can access, checked without
+    /// following links. In the sticky shared directory nobody else can replace it afterwards either.
+    /// mustBePrivate is only cleared to prune the stores of earlier versions, which had default permissions.
+    inline bool isOwnStore(const juce::File& file, bool mustBePrivate = true)
+    {
+       #if JUCE_LINUX || JUCE_MAC || JUCE_BSD
+        struct stat info;
+        return lstat(file.getFullPathName().toRawUTF8(), &info) == 0 && S_ISREG(info.st_mode) && info.st_uid == geteuid()
+               && (! mustBePrivate || (info.st_mode & (S_IRWXG | S_IRWXO)) == 0);
+       #else
+        juce::ignoreUnused(mustBePrivate);
+        return file.existsAsFile();
+       #endif
+    }
+
+    /// Create an empty file that did not exist, readable and writable by this user only
+    inline bool createPrivateFile(const juce::File& file)
+    {
+       #if JUCE_LINUX || JUCE_MAC || JUCE_BSD
+        const int fd = open(file.getFullPathName().toRawUTF8(), O_CREAT | O_EXCL | O_WRONLY | O_NOFOLLOW, 0600);
+        if (fd < 0)
+            return false;
+        close(fd);
+        return true;
+       #else
+        return ! file.exists() && file.create().wasOk();
+       #endif
+    }
+
+    /// Move a complete store over its final name, replacing an older store of the same SOFA file.
+    /// A file another user planted under that name is not replaced.
+    inline bool replaceStore(const juce::File& partialFile, const juce::File& storeFile)
+    {
+       #if JUCE_LINUX || JUCE_MAC || JUCE_BSD
+        if (storeFile.existsAsFile() && ! isOwnStore(storeFile))
+            return false;
+        return rename(partialFile.getFullPathName().toRawUTF8(), storeFile.getFullPathName().toRawUTF8()) == 0;
+       #else
+        return partialFile.moveFileTo(storeFile);
+       #endif
+    }
+
+    /// Delete the stores of this user that were not used for PRUNE_AGE_DAYS, and partial files left
+    /// by writers that did not finish. Processes mapping a deleted store keep their mapping.
+    inline void pruneStaleStores()
+    {
+        const auto now = juce::Time::getCurrentTime();
+        for (const auto& entry : juce::RangedDirectoryIterator(getStoreDirectory(), false, juce::String(FILE_PREFIX) + "*", juce::File::findFiles))
+        {
+            const auto& file = entry.getFile();
+            const bool partial = file.getFileExtension() != ".bin";
+            const auto age = now - entry.getModificationTime();
+            if (isOwnStore(file, false) && (partial ? age.inHours() >= 1.0 : age.inDays() >= (double) PRUNE_AGE_DAYS))
+                file.deleteFile();
+        }
+    }
+
+    //==========================================================================
+    /// Write the measurements of a SOFA file, loaded with impulse responses, to the store, replacing
+    /// the store of an earlier version of the file. Returns an error message, empty on success.
+    inline juce::String publish(const juce::File& sofaFile, const SofaMeasurements& measurements)
+    {
+        const auto storeFile = getStoreFile(sofaFile);
+        if (measurements.irLength == 0)
+            return "No impulse responses to publish";
+        pruneStaleStores();
+
+        const auto m = (juce::uint64) measurements.directions.size();
+        auto align = [](juce::uint64 offset) { return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT; };
+
+        Header header{};
+        std::memcpy(header.magic, "BRTHRTF", 8);
+        header.version = VERSION;
+        header.headerSize = sizeof(Header);
+        header.sourceFileSize = sofaFile.getSize();
+        header.sourceModificationTime = sofaFile.getLastModificationTime().toMilliseconds();
+        header.sampleRate = measurements.sampleRate;
+        header.numMeasurements = (juce::uint32) m;
+        header.irLength = (juce::uint32) measurements.irLength;
+        header.directionsOffset = align(sizeof(Header));
+        header.distancesOffset = align(header.directionsOffset + 2 * m * sizeof(float));
+        header.leftDelayOffset = align(header.distancesOffset + m * sizeof(float));
+        header.rightDelayOffset = align(header.leftDelayOffset + m * sizeof(float));
+        header.leftIROffset = align(header.rightDelayOffset + m * sizeof(float));
+        header.rightIROffset = align(header.leftIROffset + m * header.irLength * sizeof(float));
+        header.totalSize = header.rightIROffset + m * header.irLength * sizeof(float);
+
+        // Write under a temporary name and rename, so that the store appears complete or not at all
+        const auto partialFile = storeFile.getSiblingFile(storeFile.getFileName() + "." + juce::String::toHexString(juce::Random::getSystemRandom().nextInt64()));
+        if (! createPrivateFile(partialFile))
+            return "Cannot create " + partialFile.getFullPathName();
+        {
+            juce::FileOutputStream out(partialFile);
+            if (out.failedToOpen())
+                return "Cannot write " + partialFile.getFullPathName();
+
+            // Arrays start at aligned offsets, less than ALIGNMENT bytes after the end of the previous one
+            auto writeAt = [&out](juce::uint64 offset, const void* data, size_t size)
+            {
+                static const char padding[ALIGNMENT] = {};
+                const auto position = (juce::uint64) out.getPosition();
+                jassert(offset >= position && offset - position < ALIGNMENT);
+                if (offset > position)
+                    out.write(padding, (size_t) (offset - position));
+                out.write(data, size);
+            };
+            writeAt(0, &header, sizeof(Header));
+            writeAt(header.directionsOffset, measurements.directions.data(), (size_t) (2 * m * sizeof(float)));
+            writeAt(header.distancesOffset, measurements.distances.data(), (size_t) (m * sizeof(float)));
+            writeAt(header.leftDelayOffset, measurements.leftDelay.data(), (size_t) (m * sizeof(float)));
+            writeAt(header.rightDelayOffset, measurements.rightDelay.data(), (size_t) (m * sizeof(float)));
+            writeAt(header.leftIROffset, measurements.getIR(0, true), (size_t) (m * header.irLength * sizeof(float)));
+            writeAt(header.rightIROffset, measurements.getIR(0, false), (size_t) (m * header.irLength * sizeof(float)));
+            out.flush();
+            if (out.getStatus().failed())
+            {
+                partialFile.deleteFile();
+                return "Error writing " + partialFile.getFullPathName();
+            }
+        }
+        if (! replaceStore(partialFile, storeFile))
+        {
+            partialFile.deleteFile();
+            return "Cannot publish " + storeFile.getFullPathName();
+        }
+        return {};
+    }
+
+    //==========================================================================
+    /// Map the stored measurements of a SOFA file read-only. The impulse responses are used in
+    /// place from the mapping, the small per-measurement arrays are copied. Returns false if the
+    /// store does not hold this file, is from another version or is damaged.
+    inline bool attach(const juce::File& sofaFile, SofaMeasurements& result)
+    {
+        const auto storeFile = getStoreFile(sofaFile);
+        if (! isOwnStore(storeFile))
+            return false;
+        auto mapping = std::make_shared<juce::MemoryMappedFile>(storeFile, juce::MemoryMappedFile::readOnly);
+        const auto* base = static_cast<const char*>(mapping->getData());
+        const auto size = (juce::uint64) mapping->getSize();
+        if (base == nullptr || size < sizeof(Header))
+            return false;
+
+        Header header;
+        std::memcpy(&header, base, sizeof(Header));
+        const auto m = (juce::uint64) header.numMeasurements;
+        if (std::memcmp(header.magic, "BRTHRTF", 8) != 0 || header.version != VERSION || header.headerSize != sizeof(Header)
+            || header.totalSize != size || header.sourceFileSize != sofaFile.getSize()
+            || header.sourceModificationTime != sofaFile.getLastModificationTime().toMilliseconds()
+            || m == 0 || header.irLength == 0 || header.irLength > size / sizeof(float) / m)
+            return false;
+
+        // Every array must lie inside the mapping, checked by subtraction so no sum can overflow
+        auto fits = [size](juce::uint64 offset, juce::uint64 bytes)
+        {
+            return offset % alignof(float) == 0 && offset <= size && bytes <= size - offset;
+        };
+        const auto irBytes = m * header.irLength * sizeof(float);
+        if (! fits(header.directionsOffset, 2 * m * sizeof(float)) || ! fits(header.distancesOffset, m * sizeof(float))
+            || ! fits(header.leftDelayOffset, m * sizeof(float)) || ! fits(header.rightDelayOffset, m * sizeof(float))
+            || ! fits(header.leftIROffset, irBytes) || ! fits(header.rightIROffset, irBytes))
+            return false;
+
+        auto floats = [base](juce::uint64 offset) { return reinterpret_cast<const float*>(base + offset); };
+        const auto* directions = floats(header.directionsOffset);
+        result.directions.resize((size_t) m);
+        for (size_t i = 0; i < (size_t) m; ++i)
+            result.directions[i] = { directions[2 * i], directions[2 * i + 1] };
+        result.distances.assign(floats(header.distancesOffset), floats(header.distancesOffset) + m);
+        result.leftDelay.assign(floats(header.leftDelayOffset), floats(header.leftDelayOffset) + m);
+        result.rightDelay.assign(floats(header.rightDelayOffset), floats(header.rightDelayOffset) + m);
+        result.irLength = (int) header.irLength;
+        result.sampleRate = header.sampleRate;
+        result.leftIR.clear();
+        result.rightIR.clear();
+        result.externalLeftIR = floats(header.leftIROffset);
+        result.externalRightIR = floats(header.rightIROffset);
+        result.storage = mapping;
+
+        // A store in use is not pruned
+        storeFile.setLastModificationTime(juce::Time::getCurrentTime());
+        return true;
+    }
+
+    /// The measurements of a SOFA file with their impulse responses: mapped from the store if another
+    /// process published them, otherwise read from the SOFA file and, if share is set, published.
+    /// attached tells which, and shareError why they could not be published. Returns an error
+    /// message, empty on success.
+    inline juce::String attachOrLoad(const juce::File& sofaFile, bool share, SofaMeasurements& result, bool& attached,
+                                     juce::String& shareError)
+    {
+        shareError.clear();
+        attached = share && attach(sofaFile, result);
+        if (attached)
+            return {};
+        const auto error = SofaMeasurements::load(sofaFile, result, true);
+        if (error.isNotEmpty())
+            return error;
+        if (result.sampleRate <= 0.0)
+            return sofaFile.getFileName() + " does not contain a valid sample rate";
+        if (share)
+            shareError = publish(sofaFile, result);
+        return {};
+    }
+
+    /// Fill a BRT HRTF from measurements instead of reading the SOFA file, resampling the grid
+    /// at the given step like CSOFAReader does
+    inline bool buildHRTF(const SofaMeasurements& measurements, int resamplingStep, const std::string& extrapolationMethod,
+                          BRTServices::CHRTF& hrtf)
+    {
+        hrtf.BeginSetup(measurements.irLength, extrapolationMethod);
+        hrtf.SetGridSamplingStep(resamplingStep);
+        hrtf.SetSamplingRate((int) measurements.sampleRate);
+        for (size_t m = 0; m < measurements.directions.size(); ++m)
+        {
+            BRTServices::THRIRStruct hrir;
+            hrir.leftDelay = (uint64_t) juce::jmax(0.f, measurements.leftDelay[m]);
+            hrir.rightDelay = (uint64_t) juce::jmax(0.f, measurements.rightDelay[m]);
+            hrir.leftHRIR.assign(measurements.getIR((int) m, true), measurements.getIR((int) m, true) + measurements.irLength);
+            hrir.rightHRIR.assign(measurements.getIR((int) m, false), measurements.getIR((int) m, false) + measurements.irLength);
+            hrtf.AddHRIR(measurements.directions[m].azimuth, measurements.directions[m].elevation, measurements.distances[m],
+                         Common::CVector3(), std::move(hrir));
+        }
+        return hrtf.EndSetup();
+    }
+}
@@ -0,0 +1,332 @@
+/*
+  ==============================================================================
+
+    SoakTest.h
+    Long-running test of the whole application: switches HRTFs, moves the
+    source and reloads files for hours, while sampling memory, allocations and
+    callback times, and reports any upward trend.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "brt-juce-basic.h"
+#include "AllocationCounter.h"
+#include "TestFixtures.h"
+
+#if JUCE_LINUX || JUCE_ANDROID
+ #include <unistd.h>
+#elif JUCE_MAC
+ #include <mach/mach.h>
+#endif
+
+//==============================================================================
+/**
+    Drives a MainContentComponent through the same actions as a user, for a given
+    number of hours, and watches for slow degradation.
+
+    On the message thread the test moves the file source continuously, selects the
+    next HRTF every few seconds and, less often, reloads one of the SOFA files or the
+    audio file, which creates a new BRT source. The audio device keeps running all the
+    time, usually the virtual device in real time so that deadline misses are real.
+
+    Every sampling interval it records the resident set size of the process, the heap
+    allocations counted by AllocationCounter, the percentiles of the callback time,
+    the deadline misses and device xruns, and the number of HRTFs loaded. At the end a
+    straight line is fitted to each metric, after a warm-up, and a metric is flagged as
+    rising if the fit grows by more than 10% (and more than a minimum amount) and the
+    last quarter of the run is worse than the first. RSS rising while the live
+    allocations stay flat points to fragmentation rather than a leak.
+*/
+class SoakTest : private juce::Timer
+{
+public:
+    struct Options
+    {
+        double hours = 1.0;
+        juce::File audioFile;                   // Mono file played by the source
+        juce::Array<juce::File> sofaFiles;      // HRTFs to load, switch between and reload
+        bool syntheticHRTF = false;             // Load TestFixtures::synthesiseHRTF() under the names of sofaFiles instead
+        juce::File reportFile;                  // Optional copy of the report
+        double sampleIntervalSeconds = 60.0;
+        double hrtfSwitchSeconds = 2.0;
+        double reloadSeconds = 30.0;
+    };
+
+    /// Called on the message thread with the report, and whether no metric was rising
+    using FinishedCallback = std::function<void(const juce::String& report, bool passed)>;
+
+    SoakTest(MainContentComponent& component, const Options& testOptions, FinishedCallback finishedCallback)
+        : app(component), options(testOptions), onFinished(std::move(finishedCallback))
+    {
+    }
+
+    ~SoakTest() override { stopTimer(); }
+
+    //==========================================================================
+    /// Load the files and start playing. Returns an error message, empty on success.
+    juce::String start()
+    {
+        if (options.sofaFiles.isEmpty() || ! options.audioFile.existsAsFile())
+            return "The soak test needs a mono audio file and at least one SOFA file";
+        for (const auto& file : options.sofaFiles)
+        {
+            if (! loadHRTF(file))
+                return "Cannot load " + file.getFullPathName();
+        }
+        if (! app.openAudioFile(options.audioFile))
+            return "Cannot load " + options.audioFile.getFullPathName();
+        app.startPlayback(true);
+
+        startMs = juce::Time::getMillisecondCounterHiRes();
+        lastSampleMs = lastSwitchMs = lastReloadMs = startMs;
+        lastAllocations = AllocationCounter::get().allocations;
+        lastXRuns = app.getXRunCount();
+        app.getCallbackStatistics().getAndReset();
+
+        std::cout << "Soak test for " << options.hours << " h, sampling every " << options.sampleIntervalSeconds << " s" << std::endl
+                  << SAMPLE_HEADER << std::endl;
+        startTimerHz(MOVE_RATE_HZ);
+        return {};
+    }
+
+private:
+    static constexpr int MOVE_RATE_HZ = 50;
+    static constexpr const char* SAMPLE_HEADER = "minutes   rss_MB   live_allocs  allocs/s   p50_us   p99_us  p999_us   max_us  misses  xruns  hrtfs";
+
+    struct Sample
+    {
+        double minutes = 0.0;
+        double rssMB = 0.0;
+        double liveAllocations = 0.0;
+        double allocationsPerSecond = 0.0;
+        CallbackStatistics::Snapshot callbacks;
+        int xruns = 0;
+        int numHRTFs = 0;
+    };
+
+    struct Trend
+    {
+        juce::String metric;
+        double fittedStart = 0.0, fittedEnd = 0.0;
+        bool rising = false;
+    };
+
+    //==========================================================================
+    bool loadHRTF(const juce::File& file)
+    {
+        return options.syntheticHRTF ? app.addHRTF(file, TestFixtures::synthesiseHRTF())
+                                     : app.addSOFAFile(file);
+    }
+
+    void timerCallback() override
+    {
+        const double nowMs = juce::Time::getMillisecondCounterHiRes();
+        const double seconds = (nowMs - startMs) / 1000.0;
+
+        // A slow orbit with faster wobbles, so every block sees a new position
+        const auto pi = juce::MathConstants<double>::pi;
+        app.setSourcePosition((float) (pi / 2 * std::sin(seconds * 0.7)),
+                              (float) (pi / 4 * std::sin(seconds * 0.23) + 0.05 * std::sin(seconds * 13.0)),
+                              (float) (1.75 + 1.25 * std::sin(seconds * 0.11)));
+
+        if (nowMs - lastSwitchMs >= options.hrtfSwitchSeconds * 1000.0)
+        {
+            lastSwitchMs = nowMs;
+            hrtfIndex = (hrtfIndex + 1) % juce::jmax(1, app.getNumHRTFs());
+            app.selectHRTF(hrtfIndex);
+        }
+
+        // Alternate between reloading one of the SOFA files and the audio file
+        if (nowMs - lastReloadMs >= options.reloadSeconds * 1000.0)
+        {
+            lastReloadMs = nowMs;
+            if (reloads++ % 2 == 0)
+            {
+                const auto& file = options.sofaFiles[(reloads / 2) % options.sofaFiles.size()];
+                if (! loadHRTF(file))
+                    ++failedReloads;
+                hrtfIndex = -1;
+            }
+            else if (! app.openAudioFile(options.audioFile))
+            {
+                ++failedReloads;
+            }
+        }
+        if (! app.isPlaying())
+            app.startPlayback(true);
+
+        if (nowMs - lastSampleMs >= options.sampleIntervalSeconds * 1000.0)
+        {
+            takeSample(nowMs);
+            lastSampleMs = nowMs;
+        }
+
+        if (seconds >= options.hours * 3600.0)
+            finish();
+    }
+
+    void takeSample(double nowMs)
+    {
+        const auto allocations = AllocationCounter::get();
+        const int xruns = app.getXRunCount();
+
+        Sample sample;
+        sample.minutes = (nowMs - startMs) / 60000.0;
+        sample.rssMB = (double) getResidentBytes() / (1024.0 * 1024.0);
+        sample.liveAllocations = (double) allocations.getLiveAllocations();
+        sample.allocationsPerSecond = (double) (allocations.allocations - lastAllocations) * 1000.0 / (nowMs - lastSampleMs);
+        sample.callbacks = app.getCallbackStatistics().getAndReset();
+        sample.xruns = xruns - lastXRuns;
+        sample.numHRTFs = app.getNumHRTFs();
+        lastAllocations = allocations.allocations;
+        lastXRuns = xruns;
+
+        samples.add(sample);
+        std::cout << formatSample(sample) << std::endl;
+    }
+
+    void finish()
+    {
+        stopTimer();
+        juce::String report;
+        report << "Soak test, " << options.hours << " h" << juce::newLine
+               << "Audio file: " << options.audioFile.getFullPathName() << juce::newLine
+               << "SOFA files: " << options.sofaFiles.size() << ", " << reloads << " reloads, " << failedReloads << " failed" << juce::newLine;
+        if (! AllocationCounter::isEnabled())
+            report << "Allocation counting is not compiled in" << juce::newLine;
+        if (! samples.isEmpty())
+            report << "Deadline: " << juce::String(samples.getFirst().callbacks.deadlineUs, 1) << " us per callback" << juce::newLine;
+
+        report << juce::newLine << SAMPLE_HEADER << juce::newLine;
+        for (const auto& sample : samples)
+            report << formatSample(sample) << juce::newLine;
+
+        juce::Array<Trend> trends;
+        trends.add(fitTrend("RSS (MB)", [](const Sample& s) { return s.rssMB; }, 4.0));
+        trends.add(fitTrend("Live allocations", [](const Sample& s) { return s.liveAllocations; }, 1000.0));
+        trends.add(fitTrend("Callback p50 (us)", [](const Sample& s) { return s.callbacks.p50Us; }, 2.0));
+        trends.add(fitTrend("Callback p99 (us)", [](const Sample& s) { return s.callbacks.p99Us; }, 5.0));
+        trends.add(fitTrend("Callback p99.9 (us)", [](const Sample& s) { return s.callbacks.p999Us; }, 10.0));
+        trends.add(fitTrend("Deadline misses per interval", [](const Sample& s) { return (double) s.callbacks.deadlineMisses; }, 1.0));
+        trends.add(fitTrend("Xruns per interval", [](const Sample& s) { return (double) s.xruns; }, 1.0));
+        trends.add(fitTrend("HRTFs loaded", [](const Sample& s) { return (double) s.numHRTFs; }, 0.5));
+
+        juce::StringArray rising;
+        report << juce::newLine << "Trends, fitted after warm-up:" << juce::newLine;
+        for (const auto& trend : trends)
+        {
+            report << "  " << trend.metric.paddedRight(' ', 30) << juce::String(trend.fittedStart, 2) << " -> "
+                   << juce::String(trend.fittedEnd, 2) << (trend.rising ? "   RISING" : "") << juce::newLine;
+            if (trend.rising)
+                rising.add(trend.metric);
+        }
+
+        const bool passed = rising.isEmpty() && getNumAnalysedSamples() > 0;
+        if (getNumAnalysedSamples() == 0)
+            report << "Not enough samples to look for trends, run for longer or sample more often" << juce::newLine;
+        else
+            report << (passed ? "PASS: no upward trend" : "FAIL: upward trend in " + rising.joinIntoString(", ")) << juce::newLine;
+
+        if (options.reportFile != juce::File{} && ! options.reportFile.replaceWithText(report))
+            report << "Cannot write " << options.reportFile.getFullPathName() << juce::newLine;
+        if (onFinished != nullptr)
+            onFinished(report, passed);
+    }
+
+    //==========================================================================
+    /// Samples left after dropping the warm-up, the first tenth of the run, or none if too few
+    int getNumAnalysedSamples() const
+    {
+        const int n = samples.size() - juce::jmax(1, samples.size() / 10);
+        return n >= 4 ? n : 0;
+    }
+
+    template <typename Metric>
+    Trend fitTrend(const juce::String& name, Metric metric, double minimumIncrease) const
+    {
+        Trend trend;
+        trend.metric = name;
+        const int n = getNumAnalysedSamples();
+        if (n == 0)
+            return trend;
+        const int first = samples.size() - n;
+
+        // Least squares line through the samples
+        double meanT = 0.0, meanY = 0.0;
+        for (int i = first; i < samples.size(); ++i)
+        {
+            meanT += samples.getReference(i).minutes;
+            meanY += metric(samples.getReference(i));
+        }
+        meanT /= n;
+        meanY /= n;
+        double covariance = 0.0, variance = 0.0;
+        for (int i = first; i < samples.size(); ++i)
+        {
+            const double dt = samples.getReference(i).minutes - meanT;
+            covariance += dt * (metric(samples.getReference(i)) - meanY);
+            variance += dt * dt;
+        }
+        const double slope = variance > 0.0 ? covariance / variance : 0.0;
+        trend.fittedStart = meanY + slope * (samples.getReference(first).minutes - meanT);
+        trend.fittedEnd = meanY + slope * (samples.getLast().minutes - meanT);
+
+        // Single spikes tilt the line, so the last quarter must also be worse than the first
+        const int quarter = juce::jmax(1, n / 4);
+        double firstQuarter = 0.0, lastQuarter = 0.0;
+        for (int i = 0; i < quarter; ++i)
+        {
+            firstQuarter += metric(samples.getReference(first + i));
+            lastQuarter += metric(samples.getReference(samples.size() - 1 - i));
+        }
+        const double increase = trend.fittedEnd - trend.fittedStart;
+        trend.rising = increase > juce::jmax(minimumIncrease, 0.1 * std::abs(trend.fittedStart)) && lastQuarter > firstQuarter;
+        return trend;
+    }
+
+    static juce::String formatSample(const Sample& s)
+    {
+        auto column = [](double value, int width, int decimals)
+        {
+            return (decimals > 0 ? juce::String(value, decimals) : juce::String((juce::int64) std::llround(value))).paddedLeft(' ', width);
+        };
+        return column(s.minutes, 7, 1) + column(s.rssMB, 9, 1) + column(s.liveAllocations, 14, 0) + column(s.allocationsPerSecond, 10, 1)
+             + column(s.callbacks.p50Us, 9, 0) + column(s.callbacks.p99Us, 9, 0) + column(s.callbacks.p999Us, 9, 0)
+             + column(s.callbacks.maxUs, 9, 0) + column((double) s.callbacks.deadlineMisses, 8, 0) + column(s.xruns, 7, 0)
+             + column(s.numHRTFs, 7, 0);
+    }
+
+    /// Resident set size of the process, 0 where it is not available
+    static juce::int64 getResidentBytes()
+    {
+       #if JUCE_LINUX || JUCE_ANDROID
+        const auto fields = juce::StringArray::fromTokens(juce::File("/proc/self/statm").loadFileAsString(), false);
+        return fields[1].getLargeIntValue() * (juce::int64) sysconf(_SC_PAGESIZE);
+       #elif JUCE_MAC
+        mach_task_basic_info_data_t info;
+        mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+        if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t) &info, &count) == KERN_SUCCESS)
+            return (juce::int64) info.resident_size;
+        return 0;
+       #else
+        return 0;
+       #endif
+    }
+
+    //==========================================================================
+    MainContentComponent& app;
+    const Options options;
+    FinishedCallback onFinished;
+
+    juce::Array<Sample> samples;
+    double startMs = 0.0, lastSampleMs = 0.0, lastSwitchMs = 0.0, lastReloadMs = 0.0;
+    juce::int64 lastAllocations = 0;
+    int lastXRuns = 0;
+    int hrtfIndex = -1;
+    int reloads = 0;
+    int failedReloads = 0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SoakTest)
+};
@@ -0,0 +1,100 @@
+/*
+  ==============================================================================
+
+    SofaMeasurements.h
+    Measurement data read straight from a SOFA file with libmysofa, for the
+    services that need the measured grid rather than BRT's resampled one.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <memory>
+#include <mysofa.h>
+#include "HRTFSpatialIndex.h"
+
+//==============================================================================
+/// Measured directions, and optionally impulse responses, of an HRTF SOFA file
+struct SofaMeasurements
+{
+    std::vector<HRTFSpatialIndex::Direction> directions;    // Degrees, one per measurement
+    std::vector<float> distances;                           // Metres, one per measurement
+
+    // Only filled when loading with impulse responses
+    int irLength = 0;
+    double sampleRate = 0.0;
+    std::vector<float> leftIR, rightIR;                     // irLength samples per measurement
+    std::vector<float> leftDelay, rightDelay;               // Samples, one per measurement
+
+    // Impulse responses held in memory owned elsewhere, e.g. a shared HRTF store, instead of
+    // leftIR and rightIR. storage keeps that memory alive as long as these measurements.
+    const float* externalLeftIR = nullptr;
+    const float* externalRightIR = nullptr;
+    std::shared_ptr<const void> storage;
+
+    const float* getIR(int measurement, bool left) const noexcept
+    {
+        const float* base = left ? (externalLeftIR != nullptr ? externalLeftIR : leftIR.data())
+                                 : (externalRightIR != nullptr ? externalRightIR : rightIR.data());
+        return base + (size_t) measurement * (size_t) irLength;
+    }
+
+    /// Read the source positions of a SOFA file, and its impulse responses if requested.
+    /// Returns an error message, empty on success.
+    static juce::String load(const juce::File& file, SofaMeasurements& result, bool withImpulseResponses = false)
+    {
+        int err = MYSOFA_OK;
+        struct MYSOFA_HRTF* hrtf = mysofa_load(file.getFullPathName().toRawUTF8(), &err);
+        if (hrtf == nullptr || err != MYSOFA_OK)
+        {
+            if (hrtf != nullptr)
+                mysofa_free(hrtf);
+            return "libmysofa could not read " + file.getFileName() + " (error " + juce::String(err) + ")";
+        }
+
+        mysofa_tospherical(hrtf);   // Azimuth, elevation (degrees), distance (metres)
+        result.directions.resize(hrtf->M);
+        result.distances.resize(hrtf->M);
+        for (unsigned m = 0; m < hrtf->M; ++m)
+        {
+            const float* position = hrtf->SourcePosition.values + m * hrtf->C;
+            result.directions[m] = { position[0], position[1] };
+            result.distances[m] = position[2];
+        }
+
+        if (withImpulseResponses)
+        {
+            if (hrtf->R != 2 || hrtf->N == 0 || hrtf->DataIR.elements < hrtf->M * hrtf->R * hrtf->N)
+            {
+                mysofa_free(hrtf);
+                return file.getFileName() + " does not contain two-receiver impulse responses";
+            }
+
+            result.irLength = (int) hrtf->N;
+            result.sampleRate = hrtf->DataSamplingRate.elements > 0 ? hrtf->DataSamplingRate.values[0] : 0.0;
+            result.leftIR.resize((size_t) hrtf->M * hrtf->N);
+            result.rightIR.resize((size_t) hrtf->M * hrtf->N);
+            result.leftDelay.assign(hrtf->M, 0.f);
+            result.rightDelay.assign(hrtf->M, 0.f);
+
+            // Data.IR is M x R x N; Data.Delay is either 1 x R or M x R
+            const bool delayPerMeasurement = hrtf->DataDelay.elements >= hrtf->M * hrtf->R;
+            for (unsigned m = 0; m < hrtf->M; ++m)
+            {
+                const float* ir = hrtf->DataIR.values + (size_t) m * hrtf->R * hrtf->N;
+                std::copy(ir, ir + hrtf->N, result.leftIR.begin() + (ptrdiff_t) (m * hrtf->N));
+                std::copy(ir + hrtf->N, ir + 2 * hrtf->N, result.rightIR.begin() + (ptrdiff_t) (m * hrtf->N));
+                if (hrtf->DataDelay.elements >= hrtf->R)
+                {
+                    const float* delay = hrtf->DataDelay.values + (delayPerMeasurement ? m * hrtf->R : 0);
+                    result.leftDelay[m] = delay[0];
+                    result.rightDelay[m] = delay[1];
+                }
+            }
+        }
+
+        mysofa_free(hrtf);
+        return {};
+    }
+};
@@ -0,0 +1,102 @@
+/*
+  ==============================================================================
+
+    TestFixtures.h
+    An HRTF and a test signal made up in code, so the self-tests can run
+    unattended without SOFA or audio files.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <cmath>
+#include "SofaMeasurements.h"
+
+//==============================================================================
+namespace TestFixtures
+{
+    constexpr float HEAD_RADIUS = 0.0875f;              // Metres
+    constexpr float SPEED_OF_SOUND = 343.f;             // Metres per second
+    constexpr float MEASUREMENT_DISTANCE = 1.95f;       // Metres
+    constexpr int GRID_STEP = 15;                       // Degrees, in azimuth and elevation
+    constexpr int IR_LENGTH = 256;
+
+    /// Measurements of a rigid spherical head, every GRID_STEP degrees. The delay of each ear
+    /// follows Woodworth's formula and its impulse response is the one-pole head shadow filter
+    /// of Brown and Duda, so the HRTF has plausible interaural time and level differences.
+    inline SofaMeasurements synthesiseHRTF(double sampleRate = 48000.0)
+    {
+        SofaMeasurements result;
+        result.irLength = IR_LENGTH;
+        result.sampleRate = sampleRate;
+
+        const float headTime = HEAD_RADIUS / SPEED_OF_SOUND;
+        const float corner = 2.f * SPEED_OF_SOUND / HEAD_RADIUS;    // 2 w0 of the shadow filter
+        const float k = 2.f * (float) sampleRate;                   // Bilinear transform
+
+        // Impulse response and delay of an ear at angle theta, in radians, from the direction of the source
+        auto addEar = [&](float theta, std::vector<float>& ir, std::vector<float>& delay)
+        {
+            const float alpha = 1.05f + 0.95f * std::cos(theta * 180.f / 150.f);
+            const float a0 = 1.f + k / corner, a1 = 1.f - k / corner;
+            const float b0 = 1.f + alpha * k / corner, b1 = 1.f - alpha * k / corner;
+            float previousIn = 0.f, previousOut = 0.f;
+            for (int n = 0; n < IR_LENGTH; ++n)
+            {
+                const float in = n == 0 ? 1.f : 0.f;
+                previousOut = (b0 * in + b1 * previousIn - a1 * previousOut) / a0;
+                previousIn = in;
+                ir.push_back(previousOut);
+            }
+            const float halfPi = juce::MathConstants<float>::halfPi;
+            const float path = theta <= halfPi ? 1.f - std::cos(theta) : 1.f + theta - halfPi;
+            delay.push_back(headTime * path * (float) sampleRate);
+        };
+
+        auto addDirection = [&](int azimuth, int elevation)
+        {
+            result.directions.push_back({ (float) azimuth, (float) elevation });
+            result.distances.push_back(MEASUREMENT_DISTANCE);
+
+            // The left ear is at azimuth 90, the right one at 270
+            const float lateral = std::cos(juce::degreesToRadians((float) elevation)) * std::sin(juce::degreesToRadians((float) azimuth));
+            addEar(std::acos(juce::jlimit(-1.f, 1.f, lateral)), result.leftIR, result.leftDelay);
+            addEar(std::acos(juce::jlimit(-1.f, 1.f, -lateral)), result.rightIR, result.rightDelay);
+        };
+
+        for (int elevation = -90; elevation <= 90; elevation += GRID_STEP)
+        {
+            if (std::abs(elevation) == 90)
+                addDirection(0, elevation);
+            else
+                for (int azimuth = 0; azimuth < 360; azimuth += GRID_STEP)
+                    addDirection(azimuth, elevation);
+        }
+        return result;
+    }
+
+    /// Write a mono WAV file of noise bursts, a quarter of a second on and off, so the
+    /// spatialisation is heard and its onsets show up in the output. Returns false on failure.
+    inline bool writeTestSignal(const juce::File& file, double sampleRate = 48000.0, double seconds = 4.0)
+    {
+        file.deleteFile();
+        auto stream = file.createOutputStream();
+        if (stream == nullptr)
+            return false;
+
+        juce::WavAudioFormat wav;
+        std::unique_ptr<juce::AudioFormatWriter> writer(wav.createWriterFor(stream.get(), sampleRate, 1, 24, {}, 0));
+        if (writer == nullptr)
+            return false;
+        stream.release();
+
+        const int numSamples = (int) (sampleRate * seconds);
+        const int burst = (int) (sampleRate / 4.0);
+        juce::AudioBuffer<float> signal(1, numSamples);
+        juce::Random random(1);
+        for (int n = 0; n < numSamples; ++n)
+            signal.setSample(0, n, (n / burst) % 2 == 0 ? 0.25f * (2.f * random.nextFloat() - 1.f) : 0.f);
+        return writer->writeFromAudioSampleBuffer(signal, 0, numSamples);
+    }
+}
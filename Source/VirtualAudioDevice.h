@@ -0,0 +1,225 @@
+/*
+  ==============================================================================
+
+    VirtualAudioDevice.h
+    Audio device without hardware: a thread drives the audio callback at real
+    time pace or as fast as possible, with optional timing jitter.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <atomic>
+#include <thread>
+
+//==============================================================================
+/// Options of the virtual device, set before it is opened (e.g. from the command line)
+struct VirtualAudioDeviceSettings
+{
+    bool realTime = true;               // Pace callbacks at the sample rate, or run them back to back
+    double jitterMs = 0.0;              // Random extra delay before each callback, up to this value
+    double stallProbability = 0.0;      // Chance per callback of a stall of stallMs, to provoke xruns
+    double stallMs = 0.0;
+    juce::int64 seed = 0;               // Of the jitter and stalls, so a run can be repeated
+    bool useByDefault = false;          // Use the virtual device even if there is a real one
+    bool loopback = false;              // Feed the outputs back to the inputs one block later
+    double sampleRate = 0.0;            // Device setup requested by the application, 0 for its default
+    int blockSize = 0;
+
+    static VirtualAudioDeviceSettings& get()
+    {
+        static VirtualAudioDeviceSettings settings;
+        return settings;
+    }
+};
+
+//==============================================================================
+/**
+    Audio device whose callbacks come from a timer thread instead of a sound card.
+
+    In real-time mode callbacks are scheduled one block period apart on an absolute
+    clock, so the average rate matches the sample rate and any callback that starts
+    after its due time is counted as an xrun. Jitter delays each callback by a random
+    amount, and stalls insert occasional long delays. In fast mode callbacks run back
+    to back, for measurement and soak tests. The inputs are silent, or in loopback mode
+    carry the outputs of the previous callback, like a cable from each output to the
+    input with the same number.
+*/
+class VirtualAudioIODevice : public juce::AudioIODevice,
+                             private juce::Thread
+{
+public:
+    VirtualAudioIODevice(const juce::String& deviceName, const juce::String& typeName, bool runInRealTime)
+        : juce::AudioIODevice(deviceName, typeName), juce::Thread("Virtual audio device"), realTime(runInRealTime)
+    {
+    }
+
+    ~VirtualAudioIODevice() override { close(); }
+
+    //==========================================================================
+    juce::StringArray getOutputChannelNames() override      { return { "Left", "Right" }; }
+    juce::StringArray getInputChannelNames() override       { return { "Input 1", "Input 2" }; }
+    juce::Array<double> getAvailableSampleRates() override  { return { 44100.0, 48000.0, 88200.0, 96000.0, 192000.0 }; }
+    juce::Array<int> getAvailableBufferSizes() override     { return { 16, 32, 64, 128, 256, 512, 1024, 2048, 4096 }; }
+    int getDefaultBufferSize() override                     { return 512; }
+
+    juce::String open(const juce::BigInteger& inputChannels, const juce::BigInteger& outputChannels,
+                      double newSampleRate, int newBufferSize) override
+    {
+        close();
+        activeInputs = inputChannels;
+        activeInputs.setRange(2, activeInputs.getHighestBit() + 1, false);
+        activeOutputs = outputChannels;
+        activeOutputs.setRange(2, activeOutputs.getHighestBit() + 1, false);
+        sampleRate = newSampleRate > 0.0 ? newSampleRate : 48000.0;
+        bufferSize = newBufferSize > 0 ? newBufferSize : getDefaultBufferSize();
+        inputBuffer.setSize(2, bufferSize);
+        inputBuffer.clear();
+        outputBuffer.setSize(2, bufferSize);
+        opened = true;
+        return {};
+    }
+
+    void close() override
+    {
+        stop();
+        opened = false;
+    }
+
+    bool isOpen() override                                  { return opened; }
+
+    void start(juce::AudioIODeviceCallback* newCallback) override
+    {
+        if (! opened || newCallback == nullptr)
+            return;
+        stop();
+        newCallback->audioDeviceAboutToStart(this);
+        callback = newCallback;
+        xruns.store(0);
+        startThread(juce::Thread::Priority::highest);
+    }
+
+    void stop() override
+    {
+        stopThread(2000);
+        if (auto* previous = std::exchange(callback, nullptr))
+            previous->audioDeviceStopped();
+    }
+
+    bool isPlaying() override                               { return isThreadRunning(); }
+    juce::String getLastError() override                    { return {}; }
+    int getCurrentBufferSizeSamples() override              { return bufferSize; }
+    double getCurrentSampleRate() override                  { return sampleRate; }
+    int getCurrentBitDepth() override                       { return 32; }
+    juce::BigInteger getActiveOutputChannels() const override  { return activeOutputs; }
+    juce::BigInteger getActiveInputChannels() const override   { return activeInputs; }
+    int getOutputLatencyInSamples() override                { return 0; }
+    int getInputLatencyInSamples() override                 { return 0; }
+    int getXRunCount() const noexcept override              { return xruns.load(); }
+
+    /// Number of callbacks made since the device started
+    juce::int64 getCallbackCount() const noexcept           { return callbacks.load(); }
+
+private:
+    void run() override
+    {
+        const auto& settings = VirtualAudioDeviceSettings::get();
+        juce::Random random(settings.seed);
+        const double blockMs = 1000.0 * bufferSize / sampleRate;
+        double dueMs = juce::Time::getMillisecondCounterHiRes();
+
+        const float* inputs[2] = { inputBuffer.getReadPointer(0), inputBuffer.getReadPointer(1) };
+        float* outputs[2] = { outputBuffer.getWritePointer(0), outputBuffer.getWritePointer(1) };
+        const int numInputs = activeInputs.countNumberOfSetBits();
+        const int numOutputs = activeOutputs.countNumberOfSetBits();
+
+        while (! threadShouldExit())
+        {
+            if (realTime)
+            {
+                double delayMs = settings.jitterMs > 0.0 ? random.nextDouble() * settings.jitterMs : 0.0;
+                if (settings.stallProbability > 0.0 && random.nextDouble() < settings.stallProbability)
+                    delayMs += settings.stallMs;
+                waitUntil(dueMs + delayMs);
+
+                // A callback starting more than a block late means the output would have run dry
+                if (juce::Time::getMillisecondCounterHiRes() > dueMs + blockMs)
+                {
+                    xruns.fetch_add(1);
+                    dueMs = juce::Time::getMillisecondCounterHiRes();   // Resynchronise like a device would after an underrun
+                }
+                dueMs += blockMs;
+            }
+
+            outputBuffer.clear();
+            callback->audioDeviceIOCallbackWithContext(inputs, numInputs, outputs, numOutputs, bufferSize, {});
+            if (settings.loopback)
+            {
+                for (int channel = 0; channel < 2; ++channel)
+                    juce::FloatVectorOperations::copy(inputBuffer.getWritePointer(channel), outputs[channel], bufferSize);
+            }
+            callbacks.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    /// Sleep most of the way and spin for the last fraction of a millisecond
+    void waitUntil(double targetMs)
+    {
+        for (double now = juce::Time::getMillisecondCounterHiRes(); now < targetMs && ! threadShouldExit();
+             now = juce::Time::getMillisecondCounterHiRes())
+        {
+            if (targetMs - now > 1.5)
+                std::this_thread::sleep_for(std::chrono::microseconds((juce::int64) ((targetMs - now - 1.0) * 1000.0)));
+            else
+                std::this_thread::yield();
+        }
+    }
+
+    const bool realTime;
+    bool opened = false;
+    double sampleRate = 48000.0;
+    int bufferSize = 512;
+    juce::BigInteger activeInputs, activeOutputs;
+    juce::AudioBuffer<float> inputBuffer, outputBuffer;
+    juce::AudioIODeviceCallback* callback = nullptr;
+    std::atomic<int> xruns{ 0 };
+    std::atomic<juce::int64> callbacks{ 0 };
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(VirtualAudioIODevice)
+};
+
+//==============================================================================
+/// Device type listing the virtual devices, registered with the AudioDeviceManager
+class VirtualAudioIODeviceType : public juce::AudioIODeviceType
+{
+public:
+    static constexpr const char* TYPE_NAME = "Virtual";
+    static constexpr const char* REAL_TIME_DEVICE = "Virtual device (real time)";
+    static constexpr const char* FAST_DEVICE = "Virtual device (as fast as possible)";
+
+    VirtualAudioIODeviceType() : juce::AudioIODeviceType(TYPE_NAME) {}
+
+    void scanForDevices() override {}
+
+    juce::StringArray getDeviceNames(bool) const override   { return { REAL_TIME_DEVICE, FAST_DEVICE }; }
+
+    int getDefaultDeviceIndex(bool) const override          { return VirtualAudioDeviceSettings::get().realTime ? 0 : 1; }
+
+    int getIndexOfDevice(juce::AudioIODevice* device, bool asInput) const override
+    {
+        return device != nullptr ? getDeviceNames(asInput).indexOf(device->getName()) : -1;
+    }
+
+    bool hasSeparateInputsAndOutputs() const override       { return false; }
+
+    juce::AudioIODevice* createDevice(const juce::String& outputDeviceName, const juce::String& inputDeviceName) override
+    {
+        const auto name = outputDeviceName.isNotEmpty() ? outputDeviceName : inputDeviceName;
+        if (name == REAL_TIME_DEVICE || name == FAST_DEVICE)
+            return new VirtualAudioIODevice(name, TYPE_NAME, name == REAL_TIME_DEVICE);
+        return nullptr;
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(VirtualAudioIODeviceType)
+};
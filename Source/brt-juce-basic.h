@@ -48,24 +48,53 @@
 #pragma once
 
 #include <BRTLibrary.h>
+#include "QualityGovernor.h"
+#include "HRTFSettings.h"
+#include "HRIRCache.h"
+#include "SofaMeasurements.h"
+#include "SceneState.h"
+#include "HeadTracker.h"
+#include "OSCControlSurface.h"
+#include "BRTBufferBinding.h"
+#include "OutputRecorder.h"
+#include "SharedHRTFStore.h"
+#include "HRTFBundle.h"
+#include "VirtualAudioDevice.h"
+#include "CallbackStatistics.h"
+#include "RealtimeChecker.h"
+#include "LiveInput.h"
+#include "PropagationDelay.h"
+#include "BRIREnvironment.h"
+#include "SampleBank.h"
+#include "DecodedAudioCache.h"
+#include "SceneSources.h"
 
 //==============================================================================
 constexpr int BLOCK_SIZE = 512;    // Block size in samples
-constexpr int HRTFRESAMPLINGSTEP = 15;
 constexpr float SOURCE1_INITIAL_AZIMUTH = 3.141592653589793 / 2.0; // pi/2
 constexpr float SOURCE1_INITIAL_ELEVATION = 0.f;
 constexpr float SOURCE1_INITIAL_DISTANCE = 1;// 0.1f; // 10 cm.
+constexpr int FILE_SOURCE_INDEX = 0;  // Scene entry of the source playing the wav file
+constexpr int SAMPLE_VOICES = 32;     // Sources of the sample voice pool
+constexpr int HEAD_TRACKER_OSC_PORT = 9000;  // Local UDP port for head-tracking OSC messages
+constexpr int CONTROL_SURFACE_OSC_PORT = 9001;  // Local UDP port for scene control OSC messages
+
+// Millisecond counter at static initialisation, the reference of the startup times
+inline const double PROCESS_START_MS = juce::Time::getMillisecondCounterHiRes();
 
 //==============================================================================
 class MainContentComponent   : public juce::AudioAppComponent,
                                public juce::ChangeListener,
                                public juce::Slider::Listener,
-                               public juce::Button::Listener
+                               public juce::Button::Listener,
+                               private juce::Timer
 {
 public:
     //==========================================================================
-    MainContentComponent()
-        : state (Stopped)
+    /// restoreLastSession reloads the SOFA files of the previous run once the engine is ready, and
+    /// remembers the files loaded in this one
+    explicit MainContentComponent(bool restoreLastSession = true)
+        : state (Stopped), rememberSession (restoreLastSession)
     {
         // Add a button to open a SOFA file
         addAndMakeVisible(&openSOFAButton);
@@ -124,37 +153,149 @@ public:
         sourceDistanceLabel.setText("Distance", juce::dontSendNotification);
         sourceDistanceLabel.attachToComponent(&sourceDistanceDial, true);
         sourceDistanceLabel.setEnabled(false);
+
+        // Label to monitor the quality tier selected by the governor
+        addAndMakeVisible(&qualityLabel);
+        qualityLabel.setText("Quality: " + juce::String(qualityGovernor.getCurrentTierSettings().name), juce::dontSendNotification);
+        addAndMakeVisible(&hrirCacheLabel);
+
+        // Resample the HRTF grid on demand instead of at load time
+        addAndMakeVisible(&lazyResamplingToggle);
+        lazyResamplingToggle.setButtonText("Lazy HRTF resampling (applies to next SOFA file)");
+
+        // Map HRTFs published by other instances instead of loading them, and publish the ones loaded here
+        addAndMakeVisible(&shareHRTFToggle);
+        shareHRTFToggle.setButtonText("Share HRTFs with other instances");
+
+        // Prepare each HRTF for the common sample rates, so changing the device does not wait for them
+        addAndMakeVisible(&multiRateToggle);
+        multiRateToggle.setButtonText("Prepare HRTFs for 44.1, 48 and 96 kHz in the background");
+
+        // Head tracking from OSC messages on a local UDP port, or from a recorded session
+        addAndMakeVisible(&headTrackingToggle);
+        headTrackingToggle.setButtonText("Head tracking (OSC, UDP port " + juce::String(HEAD_TRACKER_OSC_PORT) + ")");
+        headTrackingToggle.onClick = [this] { headTrackingToggleClicked(); };
+        addAndMakeVisible(&replayHeadTrackingButton);
+        replayHeadTrackingButton.setButtonText("Replay head tracking file...");
+        replayHeadTrackingButton.onClick = [this] { replayHeadTrackingButtonClicked(); };
+        addAndMakeVisible(&headTrackingLabel);
+
+        // Scene control from an external application over OSC
+        addAndMakeVisible(&controlSurfaceToggle);
+        controlSurfaceToggle.setButtonText("OSC scene control (UDP port " + juce::String(CONTROL_SURFACE_OSC_PORT) + ")");
+        controlSurfaceToggle.onClick = [this] { controlSurfaceToggleClicked(); };
+        addAndMakeVisible(&controlSurfaceLabel);
+
+        // Record what the listener hears
+        addAndMakeVisible(&recordButton);
+        recordButton.setButtonText("Record output...");
+        recordButton.onClick = [this] { recordButtonClicked(); };
+        addAndMakeVisible(&recordLabel);
+
+        // Spatialize the device inputs, and measure their latency to the ears through a loopback cable
+        addAndMakeVisible(&liveInputToggle);
+        liveInputToggle.setButtonText("Live input (spatialize the device inputs)");
+        liveInputToggle.onClick = [this] { liveInputToggleClicked(); };
+        addAndMakeVisible(&loopbackToggle);
+        loopbackToggle.setButtonText("Measure latency (output 1 looped back to input 1)");
+        loopbackToggle.onClick = [this] { loopbackMeter.setEnabled(loopbackToggle.getToggleState()); };
+        loopbackToggle.setEnabled(false);
+        addAndMakeVisible(&liveInputLabel);
+
+        // Delay the sources by their distance, which shifts the pitch of moving sources
+        addAndMakeVisible(&propagationDelayToggle);
+        propagationDelayToggle.setButtonText("Propagation delay and Doppler");
+        propagationDelayToggle.onClick = [this]
+        {
+            propagationDelay.setEnabled(propagationDelayToggle.getToggleState());
+            sizePropagationDelay();
+        };
+
+        // Room reverberation: the sources share a send convolved with a BRIR
+        addAndMakeVisible(&openBRIRButton);
+        openBRIRButton.setButtonText("Open BRIR SOFA file...");
+        openBRIRButton.onClick = [this] { openBRIRButtonClicked(); };
+        addAndMakeVisible(&reverbSendDial);
+        reverbSendDial.setRange(0.0, 1.0, 0.01);
+        reverbSendDial.setValue(reverbSendGain.load());
+        reverbSendDial.onValueChange = [this] { reverbSendGain.store((float) reverbSendDial.getValue()); };
+        addAndMakeVisible(&reverbSendLabel);
+        reverbSendLabel.setText("Send", juce::dontSendNotification);
+        reverbSendLabel.attachToComponent(&reverbSendDial, true);
+        addAndMakeVisible(&environmentLabel);
+
+        // Near-field correction of close sources, from the table built with each HRTF
+        addAndMakeVisible(&nearFieldToggle);
+        nearFieldToggle.setButtonText("Near-field correction");
+        nearFieldToggle.onClick = [this] { nearFieldEnabled.store(nearFieldToggle.getToggleState()); };
+
+        // One-shot samples played on a pool of sources, triggered from the GUI or over OSC
+        addAndMakeVisible(&openSamplesButton);
+        openSamplesButton.setButtonText("Open samples...");
+        openSamplesButton.onClick = [this] { openSamplesButtonClicked(); };
+        openSamplesButton.setEnabled(false);
+        addAndMakeVisible(&triggerSampleButton);
+        triggerSampleButton.setButtonText("Trigger a random sample");
+        triggerSampleButton.onClick = [this] { triggerRandomSample(); };
+        triggerSampleButton.setEnabled(false);
+        addAndMakeVisible(&sampleBankLabel);
+        controlSurface.setSampleVoices(&sampleVoices);
+
+        // Progress and speed of the decoding of the audio file
+        addAndMakeVisible(&decodeLabel);
+
+        // Whole scenes saved to and loaded from scene files
+        addAndMakeVisible(&openSceneButton);
+        openSceneButton.setButtonText("Open scene...");
+        openSceneButton.onClick = [this] { openSceneButtonClicked(); };
+        openSceneButton.setEnabled(false);
+        addAndMakeVisible(&saveSceneButton);
+        saveSceneButton.setButtonText("Save scene...");
+        saveSceneButton.onClick = [this] { saveSceneButtonClicked(); };
+        saveSceneButton.setEnabled(false);
+        addAndMakeVisible(&sceneLabel);
         
         formatManager.registerBasicFormats();       // [1]
         transportSource.addChangeListener (this);   // [2]
 
-        setAudioChannels (0, 2);
-        
-        if (auto* device = deviceManager.getCurrentAudioDevice())
+        // The window is shown before the audio engine runs. The device, which takes seconds to open
+        // with some drivers, is opened on the message thread once the window has been shown, and the
+        // BRT graph is built on a background thread, while the HRTFs of the previous session are read
+        // in parallel. Loading files, and so playback, is enabled when the engine is ready.
+        openSOFAButton.setEnabled(false);
+        openWavButton.setEnabled(false);
+        addAndMakeVisible(&sampleRateLabel);
+        sampleRateLabel.setText("Starting audio...", juce::dontSendNotification);
+
+        juce::PropertiesFile::Options settingsOptions;
+        settingsOptions.applicationName = "brt-juce-basic";
+        settingsOptions.filenameSuffix = "settings";
+        settingsOptions.osxLibrarySubFolder = "Application Support";
+        settings = std::make_unique<juce::PropertiesFile>(settingsOptions);
+
+        setSize (400, 1110);
+        startTimerHz(4);    // Quality and head-tracking monitoring
+        juce::Component::SafePointer<MainContentComponent> safeThis(this);
+        juce::MessageManager::callAsync([safeThis]
         {
-            juce::AudioDeviceManager::AudioDeviceSetup setup;
-            deviceManager.getAudioDeviceSetup(setup);
-            
-            // Show the sample rate in the GUI
-            addAndMakeVisible(&sampleRateLabel);
-            sampleRateLabel.setText("Sample Rate: " + std::to_string((int)setup.sampleRate) + " Hz", juce::dontSendNotification);
-            sourceDistanceLabel.attachToComponent(&sourceDistanceDial, true);
-            
-            setup.bufferSize = BLOCK_SIZE; // Set the buffer size
-            deviceManager.setAudioDeviceSetup(setup, true);
-            setupBRT(setup.sampleRate, setup.bufferSize);
-        }
-        else {
-			juce::AlertWindow::showMessageBoxAsync(juce::AlertWindow::WarningIcon, "Error", "No audio device found", "OK");
-		}
-        setSize (400, 300);
-
+            if (safeThis != nullptr)
+                safeThis->startEngine();
+        });
+        if (rememberSession)
+            restoreSession();
     }
 
 	//==========================================================================
     ~MainContentComponent() override
     {
+        stopTimer();
+        engineStarter.removeAllJobs(true, 30000);
+        hrtfBuilder.removeAllJobs(true, 10000);
+        headTrackerReceiver.stop();
+        headTrackerReplay.stop();
+        controlSurface.stop();
         shutdownAudio();
+        outputRecorder.stop();
     }
 
     void prepareToPlay (int samplesPerBlockExpected, double sampleRate) override
@@ -162,57 +303,187 @@ public:
         transportSource.prepareToPlay (samplesPerBlockExpected, sampleRate);
         globalParameters.SetSampleRate(sampleRate);
         globalParameters.SetBufferSize(samplesPerBlockExpected);
-        // initialise parameters needed for changing HRTFs
-        hrtfState = NotToBeChanged;
-        selectedHRTFidx = -1;
+        currentSampleRate = sampleRate;
+        qualityGovernor.prepare(sampleRate, samplesPerBlockExpected);
+        callbackStatistics.prepare(sampleRate, samplesPerBlockExpected);
+        fileSourceInput.prepare(samplesPerBlockExpected);
+        listenerOutput.prepare(samplesPerBlockExpected);
+        silenceBuffer.assign((size_t) samplesPerBlockExpected, 0.f);
+        liveInputs.prepare(samplesPerBlockExpected);
+        propagationDelay.prepare(sampleRate, samplesPerBlockExpected);
+        reverbSend.assign((size_t) samplesPerBlockExpected, 0.f);
+        sampleVoices.prepare(samplesPerBlockExpected);
+        if (scenePlayers != nullptr)
+            scenePlayers->prepare(samplesPerBlockExpected, sampleRate);
+        juce::Component::SafePointer<MainContentComponent> safeThis(this);
+        juce::MessageManager::callAsync([safeThis, sampleRate]
+        {
+            if (safeThis != nullptr)
+                safeThis->resampleSampleBank(sampleRate);
+        });
+        if (roomConvolver != nullptr && (roomConvolver->getBlockSize() != samplesPerBlockExpected || roomSampleRate != sampleRate))
+            roomConvolver.reset();
+        if (roomConvolver == nullptr)
+            buildRoomConvolver(sampleRate, samplesPerBlockExpected);
+        loopbackMeter.prepare(sampleRate);
+        auto* device = deviceManager.getCurrentAudioDevice();
+        numDeviceInputs = device != nullptr ? device->getActiveInputChannels().countNumberOfSetBits() : 0;
+        headTracker.prepare(sampleRate, samplesPerBlockExpected, device != nullptr ? device->getOutputLatencyInSamples() : 0);
+        // Switch every HRTF to its variant for the new configuration. Variants prepared before are
+        // swapped in here, the others are built in the background and swapped in when ready.
+        hrtfState.store(NotToBeChanged);
+        for (size_t i = 0; i < HRTF_bundles.size(); ++i) {
+            if (auto variant = HRTF_bundles[i]->findVariant(sampleRate, samplesPerBlockExpected)) {
+                HRTF_list[i] = std::move(variant);
+                if ((int) i == selectedHRTFidx.load())
+                    hrtfState.store(ToBeChanged);
+            }
+            else {
+                buildHRTFVariant(HRTF_bundles[i], sampleRate, samplesPerBlockExpected);
+            }
+        }
     }
 
     void getNextAudioBlock (const juce::AudioSourceChannelInfo& bufferToFill) override
     {
-        // If we still haven't loaded a file, simply clear the buffer
-        if (readerSource.get() == nullptr)
+        const RealtimeChecker::ScopedRealtime realtimeScope;
+        const CallbackStatistics::ScopedMeasurement measurement(callbackStatistics);
+
+        if (firstAudioMs.load(std::memory_order_relaxed) == 0.0)
+            firstAudioMs.store(juce::Time::getMillisecondCounterHiRes(), std::memory_order_relaxed);
+
+        // If we still haven't loaded a file, and there are no live inputs, samples or scene sources, simply clear the buffer
+        const bool liveInput = liveInputs.getNumBound() > 0;
+        if (readerSource.get() == nullptr && ! liveInput && sampleVoices.getNumBound() == 0
+            && (scenePlayers == nullptr || scenePlayers->getNumPlayers() == 0))
         {
             bufferToFill.clearActiveBufferRegion();
             return;
         }
-        // Check if different HRTF was selected and change accordingly
-        if (hrtfState == ToBeChanged){
-            listener->SetHRTF(HRTF_list[selectedHRTFidx]);
-            hrtfState = NotToBeChanged;
-        }
-
-        // Obtener las muestras de audio del transportSource
-        juce::AudioBuffer<float> audioInputBuffer(1, bufferToFill.numSamples); // Buffer mono para las muestras de audio
-        juce::AudioSourceChannelInfo audioBufferToFill(&audioInputBuffer, 0, bufferToFill.numSamples);
-        transportSource.getNextAudioBlock(audioBufferToFill);
-
-        // Prepare the input buffer for source 1
-        CMonoBuffer<float> source1Buffer(bufferToFill.numSamples);
-        for (int i = 0; i < bufferToFill.numSamples; i++) {
-			source1Buffer[i] = audioInputBuffer.getSample(0, i);
-		}
-		// Pass the input buffer to the BRT Library source
-		source1BRT->SetBuffer(source1Buffer);
-
-       // Binaural processing
-        brtManager.ProcessAll(); // Process all sources
-
-        //// Get output stereo buffer
-        Common::CEarPair<CMonoBuffer<float>> outputBuffer;
-        listener->GetBuffers(outputBuffer.left, outputBuffer.right);
-  
-
-        // Left output buffer is expected to be in channel 0
-        float* const leftBuffer = bufferToFill.buffer->getWritePointer(0, bufferToFill.startSample);
-        float* const rightBuffer = bufferToFill.buffer->getWritePointer(1, bufferToFill.startSample);
-        for (int i = 0; i < bufferToFill.numSamples; i++) {
-            leftBuffer[i] = outputBuffer.left[i];
-            rightBuffer[i] = outputBuffer.right[i];
-           
-            // For test purposes just copy the sambples from source1Buffer to the output buffers
-            // leftBuffer[i] = source1Buffer[i];
-            // rightBuffer[i] = source1Buffer[i];  
-        }	
+        qualityGovernor.beginBlock();
+
+        // HRTF selected over OSC, applied like a selection from the GUI
+        const int requestedHRTF = controlSurface.takeHRTFRequest();
+        if (requestedHRTF >= 0 && requestedHRTF < (int) HRTF_list.size() && requestedHRTF != selectedHRTFidx.load()) {
+            selectedHRTFidx.store(requestedHRTF);
+            hrtfState.store(ToBeChanged);
+        }
+
+        // Check if different HRTF was selected and change accordingly. The index is stored before the
+        // state, so it is read after taking the state; a selection made meanwhile is applied next block.
+        // BRT may allocate as it takes the HRTF, a known exception to the real-time checks.
+        if (hrtfState.exchange(NotToBeChanged) == ToBeChanged){
+            const RealtimeChecker::ScopedDisable brtTakesTheHRTF;
+            const auto& hrtf = HRTF_list[(size_t) selectedHRTFidx.load()];
+            listener->SetHRTF(hrtf);
+            if (auto nearFieldTable = hrtf->getNearFieldTable())
+                listener->SetNearFieldCompensationFilters(nearFieldTable);
+        }
+
+        // Near-field correction switched from the GUI. BRT takes the filters of every source from the
+        // table once per block.
+        const bool nearField = nearFieldEnabled.load(std::memory_order_relaxed);
+        if (nearField != nearFieldApplied) {
+            const RealtimeChecker::ScopedDisable brtSwitchesTheFilters;
+            if (nearField)
+                listener->EnableNearFieldEffect();
+            else
+                listener->DisableNearFieldEffect();
+            nearFieldApplied = nearField;
+        }
+
+        // The device inputs are taken before the output overwrites them. In a latency measurement the
+        // loopback input is examined and the first live source plays the test impulse instead.
+        if (liveInput) {
+            liveInputs.capture(bufferToFill, numDeviceInputs);
+            if (numDeviceInputs > 0)
+                loopbackMeter.process(bufferToFill.buffer->getReadPointer(0, bufferToFill.startSample), liveInputs.getBuffer(0), bufferToFill.numSamples);
+        }
+
+        // The transport renders straight into the input buffer of the file source, copying from the
+        // decoded samples. It holds its own lock meanwhile, a known exception to the real-time checks.
+        {
+            const RealtimeChecker::ScopedDisable transportTakesItsLock;
+            transportSource.getNextAudioBlock(fileSourceInput.getChannelInfo(bufferToFill.numSamples));
+        }
+
+        // The sources of a loaded scene read their decoded files in the same way, without the transport
+        if (scenePlayers != nullptr)
+            scenePlayers->process(bufferToFill.numSamples);
+
+        // Orient the listener with the latest head-tracking pose, once per block
+        headTracker.applyToListener(*listener);
+
+        // Start the triggered samples, moving their voices, and render the voices that are playing
+        sampleVoices.process(scene, bufferToFill.numSamples);
+
+        // Update the positions of all the sources in one pass
+        scene.update(listener->GetListenerTransform().GetPosition());
+
+        // Inputs of the sources that have something to play, with their gains. Sources beyond the
+        // budget of the current quality tier, until applySourceBudget() disconnects them, and sources
+        // with nothing to play, are fed silence.
+        const int numSources = scene.getNumSources();
+        const int fullyRendered = qualityGovernor.getCurrentTierSettings().maxFullyRenderedSources;
+        for (int i = 0; i < numSources; i++) {
+            auto* input = scene.getSource(i) == nullptr || i >= fullyRendered ? nullptr
+                        : i == FILE_SOURCE_INDEX ? &fileSourceInput : liveInputs.getInput(i);
+            if (input == nullptr && i < fullyRendered)
+                input = sampleVoices.getInput(i);
+            if (input == nullptr && i < fullyRendered && scenePlayers != nullptr)
+                input = scenePlayers->getInput(i);
+            if (input != nullptr)
+                input->applyGain(scene.getGain(i));
+            sourceInputs[(size_t) i] = input;
+            sourceBlocks[(size_t) i] = input != nullptr ? input->getBuffer().data() : nullptr;
+        }
+
+        // Delay every input by the travel time from its source, in one pass over the scene
+        propagationDelay.process(sourceBlocks.data(), scene.getDistances(), numSources, bufferToFill.numSamples);
+
+        // Mono send of all the sources to the room, as they arrive at the listener
+        const bool reverberate = roomConvolver != nullptr && bufferToFill.numSamples <= (int) reverbSend.size();
+        if (reverberate) {
+            std::fill(reverbSend.begin(), reverbSend.begin() + bufferToFill.numSamples, 0.f);
+            const float sendGain = reverbSendGain.load(std::memory_order_relaxed);
+            for (int i = 0; i < numSources; i++) {
+                if (sourceBlocks[(size_t) i] != nullptr)
+                    juce::FloatVectorOperations::addWithMultiply(reverbSend.data(), sourceBlocks[(size_t) i], sendGain, bufferToFill.numSamples);
+            }
+        }
+
+        // Pass the input buffers to the BRT Library sources. The silence stays within the storage
+        // reserved in prepareToPlay, whose samples are never written, so resizing it does not allocate.
+        silenceBuffer.resize((size_t) juce::jmin(bufferToFill.numSamples, (int) silenceBuffer.capacity()));
+        {
+            // BRT passes the buffers between its modules by value, so it allocates in every block. That
+            // is a known exception to the real-time checks, which cover the code of this application.
+            const RealtimeChecker::ScopedDisable brtPassesBuffersByValue;
+            for (int i = 0; i < numSources; i++) {
+                if (auto* source = scene.getSource(i)) {
+                    if (auto* input = sourceInputs[(size_t) i])
+                        input->submit(*source);
+                    else
+                        source->SetBuffer(silenceBuffer);
+                }
+            }
+
+           // Binaural processing
+            brtManager.ProcessAll(); // Process all sources
+
+            // Write the stereo output, left ear in channel 0, from bufferToFill.startSample
+            listenerOutput.render(*listener, bufferToFill);
+        }
+
+        // Add the room response, early partitions convolved here and the tail by the background threads
+        if (reverberate && bufferToFill.buffer->getNumChannels() >= 2)
+            roomConvolver->process(reverbSend.data(), bufferToFill.buffer->getWritePointer(0, bufferToFill.startSample),
+                                   bufferToFill.buffer->getWritePointer(1, bufferToFill.startSample), bufferToFill.numSamples);
+        outputRecorder.push(bufferToFill);
+
+        // Step the rendering quality if the callback is getting close to its deadline
+        if (qualityGovernor.endBlock(bufferToFill.numSamples, currentSampleRate))
+            applyQualityTier(qualityGovernor.getCurrentTierSettings());
 
     } 
 
@@ -221,6 +492,13 @@ public:
         transportSource.releaseResources();
     }
 
+    void paint (juce::Graphics& g) override
+    {
+        g.fillAll (getLookAndFeel().findColour (juce::ResizableWindow::backgroundColourId));
+        if (firstFrameMs == 0.0)
+            firstFrameMs = juce::Time::getMillisecondCounterHiRes();
+    }
+
     void resized() override
     {
         openWavButton.setBounds(10, 10, getWidth() - 20, 20);
@@ -234,6 +512,33 @@ public:
         sourceElevationDial.setBounds(sliderLeft, 160, getWidth() - sliderLeft - 10, 20);
         sourceDistanceDial.setBounds(sliderLeft, 190, getWidth() - sliderLeft - 10, 20);
         sampleRateLabel.setBounds(getWidth()-160, 220, getWidth()-20, 20);
+        qualityLabel.setBounds(10, 220, getWidth()-180, 20);
+        hrirCacheLabel.setBounds(10, 250, getWidth()-20, 20);
+        lazyResamplingToggle.setBounds(10, 280, getWidth()-20, 20);
+        shareHRTFToggle.setBounds(10, 310, getWidth()-20, 20);
+        multiRateToggle.setBounds(10, 340, getWidth()-20, 20);
+        headTrackingToggle.setBounds(10, 370, getWidth()-20, 20);
+        replayHeadTrackingButton.setBounds(10, 400, getWidth()-20, 20);
+        headTrackingLabel.setBounds(10, 430, getWidth()-20, 20);
+        controlSurfaceToggle.setBounds(10, 460, getWidth()-20, 20);
+        controlSurfaceLabel.setBounds(10, 490, getWidth()-20, 20);
+        recordButton.setBounds(10, 520, getWidth()-20, 20);
+        recordLabel.setBounds(10, 550, getWidth()-20, 20);
+        liveInputToggle.setBounds(10, 580, getWidth()-20, 20);
+        loopbackToggle.setBounds(10, 610, getWidth()-20, 20);
+        liveInputLabel.setBounds(10, 640, getWidth()-20, 20);
+        propagationDelayToggle.setBounds(10, 670, getWidth()-20, 20);
+        openBRIRButton.setBounds(10, 700, getWidth()-20, 20);
+        reverbSendDial.setBounds(sliderLeft, 730, getWidth() - sliderLeft - 10, 20);
+        environmentLabel.setBounds(10, 760, getWidth()-20, 20);
+        nearFieldToggle.setBounds(10, 790, getWidth()-20, 20);
+        openSamplesButton.setBounds(10, 820, getWidth()-20, 20);
+        triggerSampleButton.setBounds(10, 850, getWidth()-20, 20);
+        sampleBankLabel.setBounds(10, 880, getWidth()-20, 20);
+        decodeLabel.setBounds(10, 910, getWidth()-20, 20);
+        openSceneButton.setBounds(10, 940, getWidth() / 2 - 15, 20);
+        saveSceneButton.setBounds(getWidth() / 2 + 5, 940, getWidth() / 2 - 15, 20);
+        sceneLabel.setBounds(10, 970, getWidth()-20, 20);
         // Position the SOFA buttons at the bottom of the component
         int y = getHeight() - 30;
         for (auto* button : sofaFileButtons)
@@ -264,38 +569,127 @@ public:
             return;
         }
 
-		if (slider == &sourceAzimuthDial) {
+		if (slider == &sourceAzimuthDial)
 			sourceAzimuth = sourceAzimuthDial.getValue();
-			Common::CTransform sourceTransform = source1BRT->GetCurrentSourceTransform();
-			Common::CVector3 listenerPosition = listener->GetListenerTransform().GetPosition();
-			Common::CVector3 sourcePosition = Common::CVector3(sourceDistance * std::cos(sourceAzimuth) * std::cos(sourceElevation) + listenerPosition.x,
-															   sourceDistance * std::sin(sourceAzimuth) * std::cos(sourceElevation) + listenerPosition.y,
-															   sourceDistance * std::sin(sourceElevation) + listenerPosition.z);
-			sourceTransform.SetPosition(sourcePosition);
-			source1BRT->SetSourceTransform(sourceTransform);
-		}
-		else if (slider == &sourceElevationDial) {
+		else if (slider == &sourceElevationDial)
 			sourceElevation = sourceElevationDial.getValue();
-			Common::CTransform sourceTransform = source1BRT->GetCurrentSourceTransform();
-			Common::CVector3 listenerPosition = listener->GetListenerTransform().GetPosition();
-			Common::CVector3 sourcePosition = Common::CVector3(sourceDistance * std::cos(sourceAzimuth) * std::cos(sourceElevation) + listenerPosition.x,
-															   sourceDistance * std::sin(sourceAzimuth) * std::cos(sourceElevation) + listenerPosition.y,
-															   sourceDistance * std::sin(sourceElevation) + listenerPosition.z);
-			sourceTransform.SetPosition(sourcePosition);
-			source1BRT->SetSourceTransform(sourceTransform);
-		}
-		else if (slider == &sourceDistanceDial) {
+		else if (slider == &sourceDistanceDial)
 			sourceDistance = sourceDistanceDial.getValue();
-			Common::CTransform sourceTransform = source1BRT->GetCurrentSourceTransform();
-			Common::CVector3 listenerPosition = listener->GetListenerTransform().GetPosition();
-			Common::CVector3 sourcePosition = Common::CVector3(sourceDistance * std::cos(sourceAzimuth) * std::cos(sourceElevation) + listenerPosition.x,
-															   sourceDistance * std::sin(sourceAzimuth) * std::cos(sourceElevation) + listenerPosition.y,
-															   sourceDistance * std::sin(sourceElevation) + listenerPosition.z);
-			sourceTransform.SetPosition(sourcePosition);
-			source1BRT->SetSourceTransform(sourceTransform);
-		}
+		else
+			return;
+
+        // The new position is converted and pushed to BRT by the audio thread with the rest of the scene
+        scene.postPosition(FILE_SOURCE_INDEX, sourceAzimuth, sourceElevation, sourceDistance);
 	}
 
+    //==========================================================================
+    /// Current quality tier and recent tier transitions, for monitoring
+    const QualityGovernor& getQualityGovernor() const                          { return qualityGovernor; }
+    const juce::Array<QualityGovernor::Transition>& getQualityTransitionLog() const { return qualityTransitionLog; }
+
+    /// Duration of every audio callback, for monitoring and soak tests
+    CallbackStatistics& getCallbackStatistics()                                { return callbackStatistics; }
+
+    /// Number of buffer underruns reported by the audio device
+    int getXRunCount()
+    {
+        auto* device = deviceManager.getCurrentAudioDevice();
+        return device != nullptr ? device->getXRunCount() : 0;
+    }
+
+    //==========================================================================
+    // Actions of the GUI, also used to drive the application from automated runs
+
+    /// Load a SOFA file and select it. A file that is already in the list is reloaded in place,
+    /// so its HRTF and button are replaced instead of added again.
+    bool addSOFAFile(const juce::File& file)
+    {
+        const int index = LoadSOFAFile(file);
+        if (index < 0)
+            return false;
+
+        showAlert(juce::AlertWindow::InfoIcon, "Success", "SOFA file loaded successfully");
+        showLoadedHRTF(index, file);
+        return true;
+    }
+
+    /// Add an HRTF from measurements that do not come from a SOFA file, such as one synthesised for a
+    /// self-test, listed under the name of a file, and select it. Returns false if BRT rejects it.
+    bool addHRTF(const juce::File& file, SofaMeasurements&& measurements)
+    {
+        const int index = LoadMeasurements(file, std::move(measurements), false);
+        if (index < 0)
+            return false;
+        showLoadedHRTF(index, file);
+        return true;
+    }
+
+    /// Load a mono audio file to play from the file source. The file is decoded in the background,
+    /// and plays from the decoded samples, which may start before the decoding ends.
+    bool openAudioFile(const juce::File& file)
+    {
+        juce::String error;
+        // A file that is not mono is rejected before it is decoded
+        auto decoded = decodedAudio.request(file, error, 1);
+        if (decoded == nullptr)
+        {
+            showAlert(juce::AlertWindow::WarningIcon, "Error", error);
+            return false;
+        }
+
+        decodeFailureShown = false;
+        auto newSource = std::make_unique<DecodedAudioSource> (decoded);                   // [11]
+        transportSource.setSource (newSource.get(), 0, nullptr, decoded->sampleRate);      // [12]
+        playButton.setEnabled (true);                                                      // [13]
+        readerSource.reset (newSource.release());                                          // [14]
+
+        String sourceName = file.getFileNameWithoutExtension();
+        LoadSource(sourceName, SOURCE1_INITIAL_AZIMUTH, SOURCE1_INITIAL_ELEVATION, SOURCE1_INITIAL_DISTANCE);
+        showAlert(juce::AlertWindow::InfoIcon, "Success", "Audio file loaded successfully");
+        return true;
+    }
+
+    /// Use one of the loaded HRTFs, from the next audio block
+    void selectHRTF(int index, bool evenIfSelected = false)
+    {
+        if (juce::isPositiveAndBelow(index, (int) HRTF_list.size()) && (evenIfSelected || index != selectedHRTFidx.load()))
+        {
+            selectedHRTFidx.store(index);
+            hrtfState.store(ToBeChanged); // The HRTF will be changed in the next buffer
+        }
+    }
+
+    int getNumHRTFs() const                                                     { return (int) HRTF_list.size(); }
+
+    /// Move the file source, through the dials as if the user had moved them
+    void setSourcePosition(float azimuth, float elevation, float distance)
+    {
+        sourceAzimuthDial.setValue(azimuth, juce::sendNotificationSync);
+        sourceElevationDial.setValue(elevation, juce::sendNotificationSync);
+        sourceDistanceDial.setValue(distance, juce::sendNotificationSync);
+    }
+
+    /// Start playing the audio file, optionally looping it
+    void startPlayback(bool loop)
+    {
+        if (readerSource == nullptr)
+            return;
+        readerSource->setLooping(loop);
+        changeState (Starting);
+    }
+
+    bool isPlaying() const                                                      { return transportSource.isPlaying(); }
+
+    /// Report errors and confirmations in message boxes, or only in the debug log for unattended runs
+    void setShowAlerts(bool shouldShowAlerts)                                   { showAlerts = shouldShowAlerts; }
+
+    //==========================================================================
+    /// True once the audio device is open and the BRT graph is built, files can be loaded from then on
+    bool isEngineReady() const noexcept                                        { return engineReady.load(); }
+
+    /// Called on the message thread when the engine has started, with an error message if it could not
+    std::function<void(const juce::String& error)> onEngineReady;
+
     void buttonClicked(juce::Button* button) override
 	{
         if (button->getToggleState())
@@ -306,11 +700,11 @@ public:
 				if (button == sofaFileButtons[i])
 				{
 					// Check if the button is not the same as previously selected
-                    if (i != selectedHRTFidx)
+                    if (i != selectedHRTFidx.load())
                     {
                         //Set the listener HRTF to the selected SOFA file
-                        selectedHRTFidx = i;
-                        hrtfState = ToBeChanged;
+                        selectedHRTFidx.store(i);
+                        hrtfState.store(ToBeChanged);
                     }
 					break;
 				}
@@ -334,6 +728,377 @@ private:
         NotToBeChanged
     };
 
+    //==========================================================================
+    /// Apply the settings of a quality tier to the listener. Called from the audio thread.
+    void applyQualityTier(const QualityTier& tier)
+    {
+        if (listener == nullptr)
+            return;
+        if (tier.runTimeInterpolation)
+            listener->EnableInterpolation();
+        else
+            listener->DisableInterpolation();
+    }
+
+    /// Disconnect the sources beyond the budget of the current quality tier from the listener, so
+    /// that BRT no longer convolves them, and connect them again once the budget allows it. Feeding
+    /// them silence alone saves nothing, as the listener convolves every connected source. Runs one
+    /// setup pass, only when some source changes side. Message thread.
+    void applySourceBudget()
+    {
+        if (listener == nullptr)
+            return;
+        const int budget = qualityGovernor.getCurrentTierSettings().maxFullyRenderedSources;
+        const int numSources = scene.getNumSources();
+        std::vector<std::shared_ptr<BRTSourceModel::CSourceSimpleModel>> toConnect, toDisconnect;
+
+        // Sources back within the budget, or replaced or emptied since they were disconnected
+        for (auto it = sourcesOverBudget.begin(); it != sourcesOverBudget.end();)
+        {
+            const bool current = scene.getSource(it->first) == it->second.get();
+            if (it->first < budget || ! current)
+            {
+                if (current)
+                    toConnect.push_back(it->second);
+                it = sourcesOverBudget.erase(it);
+            }
+            else
+                ++it;
+        }
+        for (int i = budget; i < numSources; ++i)
+        {
+            if (scene.getSource(i) == nullptr || sourcesOverBudget.count(i) > 0)
+                continue;
+            if (auto source = scene.getSourceOwner(i)) {
+                toDisconnect.push_back(source);
+                sourcesOverBudget.emplace(i, std::move(source));
+            }
+        }
+        if (toConnect.empty() && toDisconnect.empty())
+            return;
+
+        brtManager.BeginSetup();
+        for (auto& source : toDisconnect)
+            listener->DisconnectSoundSource(source);
+        for (auto& source : toConnect)
+            listener->ConnectSoundSource(source);
+        brtManager.EndSetup();
+    }
+
+    /// Refresh the quality monitor, log the tier transitions and apply the source budget of the tier
+    void timerCallback() override
+    {
+        logStartupTimes();
+        applySourceBudget();
+        evictHRTFVariants();
+        sizePropagationDelay();
+
+        juce::Array<QualityGovernor::Transition> transitions;
+        if (qualityGovernor.readTransitions(transitions) > 0)
+        {
+            for (const auto& t : transitions)
+            {
+                DBG("Quality tier " << QUALITY_TIERS[(size_t) t.fromTier].name << " -> " << QUALITY_TIERS[(size_t) t.toTier].name
+                    << " (load " << juce::roundToInt(t.load * 100.f) << "%)");
+            }
+            qualityTransitionLog.addArray(transitions);
+            if (qualityTransitionLog.size() > MAX_QUALITY_LOG_ENTRIES)
+                qualityTransitionLog.removeRange(0, qualityTransitionLog.size() - MAX_QUALITY_LOG_ENTRIES);
+        }
+
+        qualityLabel.setText("Quality: " + juce::String(qualityGovernor.getCurrentTierSettings().name)
+                             + " (" + juce::String(juce::roundToInt(qualityGovernor.getSmoothedLoad() * 100.f)) + "% load, "
+                             + juce::String(qualityGovernor.getOverrunCount()) + " overruns)",
+                             juce::dontSendNotification);
+
+        // Hit rate of the HRIR cache of the HRTF in use
+        const int selected = selectedHRTFidx.load();
+        if (juce::isPositiveAndBelow(selected, (int) HRTF_list.size()))
+        {
+            const auto& cache = HRTF_list[(size_t) selected]->getCache();
+            const auto stats = cache.getStatistics();
+            juce::String text = "HRIR cache: " + juce::String(juce::roundToInt(stats.getHitRate() * 100.f)) + "% hits, "
+                              + juce::String(stats.inserts - stats.evictions) + "/" + juce::String(cache.getCapacity()) + " entries";
+            if (const auto* lazyGrid = HRTF_list[(size_t) selected]->getLazyGrid())
+                text << ", lazy cells " << lazyGrid->getNumComputedCells() << "/" << lazyGrid->getNumCells();
+            if (const auto nearFieldTable = HRTF_list[(size_t) selected]->getNearFieldTable())
+                text << ", near field " << juce::String(nearFieldTable->getMemoryUsage() / 1024.0, 0) << " KB in "
+                     << juce::roundToInt(nearFieldTable->getBuildMs()) << " ms";
+            hrirCacheLabel.setText(text, juce::dontSendNotification);
+        }
+
+        // Motion-to-sound latency of the head-tracking path
+        const auto tracking = headTracker.getAndResetStatistics();
+        if (tracking.samplesApplied > 0)
+        {
+            headTrackingLabel.setText("Head tracking: " + juce::String(juce::roundToInt(tracking.updateRateHz)) + " Hz, latency "
+                                      + juce::String(tracking.meanMs, 1) + " ms (max " + juce::String(tracking.maxMs, 1) + " ms)",
+                                      juce::dontSendNotification);
+        }
+
+        // Throughput and latency of the OSC scene control, and any HRTF it selected
+        if (controlSurface.isReceiving())
+        {
+            const auto control = controlSurface.getAndResetStatistics();
+            controlSurfaceLabel.setText("OSC: " + juce::String(juce::roundToInt(control.messagesPerSecond)) + " msg/s, latency "
+                                        + juce::String(control.latency.meanMs, 1) + " ms (max " + juce::String(control.latency.maxMs, 1) + " ms)"
+                                        + (control.rejectedMessages > 0 ? ", " + juce::String(control.rejectedMessages) + " rejected" : juce::String()),
+                                        juce::dontSendNotification);
+        }
+        if (outputRecorder.isRecording())
+        {
+            recordLabel.setText("Recording " + juce::String(outputRecorder.getRecordedSamples() / currentSampleRate, 1) + " s, "
+                                + juce::String(outputRecorder.getDroppedSamples()) + " samples dropped",
+                                juce::dontSendNotification);
+        }
+        const int selectedButton = selectedHRTFidx.load();
+        if (juce::isPositiveAndBelow(selectedButton, sofaFileButtons.size()) && ! sofaFileButtons[selectedButton]->getToggleState())
+            sofaFileButtons[selectedButton]->setToggleState(true, juce::dontSendNotification);
+
+        // Latency of the live inputs, reported by the device and measured through the loopback
+        if (liveInputs.getNumBound() > 0)
+        {
+            auto* device = deviceManager.getCurrentAudioDevice();
+            const double reportedMs = device != nullptr && currentSampleRate > 0.0
+                                          ? 1000.0 * (device->getInputLatencyInSamples() + device->getOutputLatencyInSamples()) / currentSampleRate
+                                          : 0.0;
+            juce::String text = "Live input: " + juce::String(liveInputs.getNumBound()) + " ch, device " + juce::String(reportedMs, 1) + " ms";
+            const auto loopback = loopbackMeter.getResult();
+            if (loopbackMeter.isEnabled() || loopback.measurements > 0)
+            {
+                text << ", measured " << (loopback.measurements > 0 ? juce::String(loopback.lastMs, 2) + " ms (" + juce::String(loopback.minMs, 2)
+                                                                          + "-" + juce::String(loopback.maxMs, 2) + ")"
+                                                                    : juce::String("-"));
+                if (loopback.missed > 0)
+                    text << ", " << loopback.missed << " missed";
+            }
+            liveInputLabel.setText(text, juce::dontSendNotification);
+        }
+
+        // Partitioning of the room convolution and tail blocks the background threads delivered late
+        if (environment.isLoaded())
+        {
+            juce::String text = "Room: " + environment.getFile().getFileNameWithoutExtension() + ", "
+                              + juce::String(environment.getLengthSeconds(), 2) + " s";
+            if (roomConvolver != nullptr)
+                text << ", " << roomConvolver->getNumPartitions() << " partitions (" << roomConvolver->getNumEarlyPartitions()
+                     << " early), " << roomConvolver->getNumWorkers() << " tail threads, " << roomConvolver->getLateTailBlocks() << " late";
+            else
+                text << ", preparing";
+            environmentLabel.setText(text, juce::dontSendNotification);
+        }
+
+        // Decoding of the audio file, and frames played before they were decoded
+        if (readerSource != nullptr)
+        {
+            const auto& decoded = readerSource->getDecodedAudio();
+            juce::String text = "Decoded " + decoded.file.getFileName() + ": "
+                              + juce::String(juce::roundToInt(100.0 * (double) decoded.getNumDecoded() / (double) juce::jmax((juce::int64) 1, decoded.length)))
+                              + "% " + (decoded.isInMemory() ? "in RAM" : "spilled") + ", "
+                              + juce::String(juce::roundToInt(decoded.getRealtimeFactor())) + "x realtime ("
+                              + juce::String(juce::roundToInt(decoded.getMegabytesPerSecond())) + " MB/s)";
+            if (readerSource->getMissingFrames() > 0)
+                text << ", " << readerSource->getMissingFrames() << " frames missed";
+            if (scenePlayers != nullptr && scenePlayers->getNumFailed() > 0)
+                text << ", " << scenePlayers->getNumFailed() << " scene files failed";
+
+            // A file that fails part way plays the frames decoded so far, then silence
+            if (decoded.hasFailed()) {
+                text = "Could not decode " + decoded.file.getFileName() + " past "
+                     + juce::String(juce::roundToInt(100.0 * (double) decoded.getNumDecoded() / (double) juce::jmax((juce::int64) 1, decoded.length))) + "%";
+                if (! decodeFailureShown) {
+                    decodeFailureShown = true;
+                    showAlert(juce::AlertWindow::WarningIcon, "Error", "Could not decode " + decoded.file.getFileName()
+                                                                         + " to the end, the rest plays as silence");
+                }
+            }
+            decodeLabel.setText(text, juce::dontSendNotification);
+        }
+        else if (scenePlayers != nullptr && scenePlayers->getNumFailed() > 0)
+        {
+            decodeLabel.setText("Could not decode " + juce::String(scenePlayers->getNumFailed()) + " files of the scene",
+                                juce::dontSendNotification);
+        }
+
+        // Size of the sample bank and use of the voices
+        if (sampleBank != nullptr)
+        {
+            const auto voices = sampleVoices.getAndResetStatistics();
+            sampleBankLabel.setText("Samples: " + juce::String(sampleBank->getNumSamples()) + " decoded in "
+                                    + juce::String(juce::roundToInt(sampleBank->getLoadMs())) + " ms, "
+                                    + juce::String(sampleBank->getMemoryUsage() / (1024.0 * 1024.0), 1) + " MB "
+                                    + (sampleBank->isLocked() ? "locked" : "not locked") + ", voices "
+                                    + juce::String(voices.activeVoices) + "/" + juce::String(sampleVoices.getNumBound())
+                                    + ", " + juce::String(voices.stolenVoices) + " stolen, " + juce::String(voices.droppedTriggers) + " dropped",
+                                    juce::dontSendNotification);
+        }
+    }
+
+    /// Open the device inputs and feed each one to its own BRT source, or close them
+    void liveInputToggleClicked()
+    {
+        auto* device = deviceManager.getCurrentAudioDevice();
+        const int numChannels = device != nullptr ? juce::jmin(LiveInputBank::MAX_CHANNELS, device->getInputChannelNames().size()) : 0;
+        const bool enable = liveInputToggle.getToggleState() && listener != nullptr;
+        if (enable && numChannels == 0)
+        {
+            liveInputToggle.setToggleState(false, juce::dontSendNotification);
+            showAlert(juce::AlertWindow::WarningIcon, "Error", "The audio device has no inputs");
+            return;
+        }
+
+        // Stop feeding the sources before the device is reconfigured
+        {
+            const juce::ScopedLock lock(deviceManager.getAudioCallbackLock());
+            liveInputs.bind(nullptr, 0);
+        }
+        loopbackToggle.setEnabled(enable);
+        if (! enable)
+        {
+            loopbackToggle.setToggleState(false, juce::sendNotificationSync);
+            liveInputLabel.setText({}, juce::dontSendNotification);
+        }
+
+        // Same device, sample rate and block size, with or without the inputs
+        juce::AudioDeviceManager::AudioDeviceSetup setup;
+        deviceManager.getAudioDeviceSetup(setup);
+        setup.useDefaultInputChannels = false;
+        setup.inputChannels.clear();
+        if (enable)
+            setup.inputChannels.setRange(0, numChannels, true);
+        const auto error = deviceManager.setAudioDeviceSetup(setup, true);
+        if (! enable)
+            return;
+        device = deviceManager.getCurrentAudioDevice();
+        const int numOpened = device != nullptr ? device->getActiveInputChannels().countNumberOfSetBits() : 0;
+        if (error.isNotEmpty() || numOpened == 0)
+        {
+            liveInputToggle.setToggleState(false, juce::dontSendNotification);
+            loopbackToggle.setEnabled(false);
+            showAlert(juce::AlertWindow::WarningIcon, "Error", error.isNotEmpty() ? error : juce::String("No input could be opened"));
+            return;
+        }
+
+        // One source per input, created the first time. Entry 0 of the scene is kept for the file source.
+        // Sources created by a later toggle come after those the scene gained meanwhile, so the scene
+        // entry of every input is kept.
+        const int liveSourceCount = (int) liveSourceIndices.size();
+        if (liveSourceCount < numOpened)
+        {
+            if (scene.getNumSources() <= FILE_SOURCE_INDEX)
+                scene.addSource(nullptr, SOURCE1_INITIAL_AZIMUTH, SOURCE1_INITIAL_ELEVATION, SOURCE1_INITIAL_DISTANCE);
+            std::vector<std::shared_ptr<BRTSourceModel::CSourceSimpleModel>> sources;
+            brtManager.BeginSetup();
+            for (int c = liveSourceCount; c < numOpened; ++c) {
+                sources.push_back(brtManager.CreateSoundSource<BRTSourceModel::CSourceSimpleModel>("live input " + std::to_string(c + 1)));
+                listener->ConnectSoundSource(sources.back());
+            }
+            brtManager.EndSetup();
+
+            // Spread over the frontal half plane, first input on the left
+            for (int c = liveSourceCount; c < numOpened; ++c) {
+                const float azimuth = numOpened > 1 ? juce::MathConstants<float>::halfPi * (1.f - 2.f * (float) c / (float) (numOpened - 1)) : 0.f;
+                const int index = scene.addSource(sources[(size_t) (c - liveSourceCount)], azimuth, 0.f, SOURCE1_INITIAL_DISTANCE);
+                if (index < 0)
+                    break;      // The scene is full
+                liveSourceIndices.push_back(index);
+            }
+        }
+        const juce::ScopedLock lock(deviceManager.getAudioCallbackLock());
+        liveInputs.bind(liveSourceIndices.data(), juce::jmin(numOpened, (int) liveSourceIndices.size()));
+    }
+
+    /// Start recording the output to a file, or stop the current recording
+    void recordButtonClicked()
+    {
+        if (outputRecorder.isRecording())
+        {
+            outputRecorder.stop();
+            recordButton.setButtonText("Record output...");
+            recordLabel.setText("Recording stopped, " + juce::String(outputRecorder.getDroppedSamples()) + " samples dropped",
+                                juce::dontSendNotification);
+            return;
+        }
+
+        chooser = std::make_unique<juce::FileChooser> ("Record the output to...",
+                                                       juce::File{},
+                                                       "*.wav;*.flac");
+        auto chooserFlags = juce::FileBrowserComponent::saveMode
+                          | juce::FileBrowserComponent::warnAboutOverwriting;
+
+        chooser->launchAsync (chooserFlags, [this] (const juce::FileChooser& fc)
+        {
+            auto file = fc.getResult();
+            if (file == juce::File{})
+                return;
+            if (! file.hasFileExtension(".wav;.flac"))
+                file = file.withFileExtension(".wav");
+
+            const auto error = outputRecorder.start(file, currentSampleRate);
+            if (error.isNotEmpty())
+                juce::AlertWindow::showMessageBoxAsync(juce::AlertWindow::WarningIcon, "Error", error, "OK");
+            else
+                recordButton.setButtonText("Stop recording");
+        });
+    }
+
+    /// Start or stop the OSC scene control
+    void controlSurfaceToggleClicked()
+    {
+        if (! controlSurfaceToggle.getToggleState())
+        {
+            controlSurface.stop();
+            controlSurfaceLabel.setText("", juce::dontSendNotification);
+            return;
+        }
+        if (! controlSurface.start(CONTROL_SURFACE_OSC_PORT))
+        {
+            controlSurfaceToggle.setToggleState(false, juce::dontSendNotification);
+            juce::AlertWindow::showMessageBoxAsync(juce::AlertWindow::WarningIcon, "Error",
+                                                   "Could not open UDP port " + juce::String(CONTROL_SURFACE_OSC_PORT), "OK");
+        }
+    }
+
+    //==========================================================================
+    /// Start or stop receiving head orientation over OSC
+    void headTrackingToggleClicked()
+    {
+        if (! headTrackingToggle.getToggleState())
+        {
+            headTrackerReceiver.stop();
+            headTrackingLabel.setText("", juce::dontSendNotification);
+            return;
+        }
+        headTrackerReplay.stop();   // The tracker takes one input at a time
+        if (! headTrackerReceiver.start(HEAD_TRACKER_OSC_PORT))
+        {
+            headTrackingToggle.setToggleState(false, juce::dontSendNotification);
+            juce::AlertWindow::showMessageBoxAsync(juce::AlertWindow::WarningIcon, "Error",
+                                                   "Could not open UDP port " + juce::String(HEAD_TRACKER_OSC_PORT), "OK");
+        }
+    }
+
+    /// Replay a recorded head-tracking session in a loop
+    void replayHeadTrackingButtonClicked()
+    {
+        chooser = std::make_unique<juce::FileChooser> ("Select a head tracking recording...",
+                                                       juce::File{},
+                                                       "*.csv;*.txt");
+        auto chooserFlags = juce::FileBrowserComponent::openMode
+                          | juce::FileBrowserComponent::canSelectFiles;
+
+        chooser->launchAsync (chooserFlags, [this] (const juce::FileChooser& fc)
+        {
+            auto file = fc.getResult();
+            if (file == juce::File{})
+                return;
+            headTrackerReceiver.stop();
+            headTrackingToggle.setToggleState(false, juce::dontSendNotification);
+            if (headTrackerReplay.start(file, true) == 0)
+                juce::AlertWindow::showMessageBoxAsync(juce::AlertWindow::WarningIcon, "Error", "No head tracking samples in the file", "OK");
+        });
+    }
+
     void changeState (TransportState newState)
     {
         if (state != newState)
@@ -365,8 +1130,226 @@ private:
     }
 
     //==========================================================================
-    /// Setup BRT Library
-    void setupBRT(int sampleRate, int bufferSize) {
+    /// Open the audio device, then build the BRT graph on a background thread. The listener it creates
+    /// is published on the message thread, which reads it unlocked, and engineStarted() is called
+    /// there when both are done, or the device could not be opened.
+    void startEngine()
+    {
+        juce::Component::SafePointer<MainContentComponent> safeThis(this);
+        juce::AudioDeviceManager::AudioDeviceSetup setup;
+        const auto error = openAudioDevice(setup);
+        if (error.isNotEmpty()) {
+            engineStarted(error);
+            return;
+        }
+        engineStarter.addJob([this, safeThis, setup]
+        {
+            auto newListener = setupBRT((int) setup.sampleRate, setup.bufferSize);
+            juce::MessageManager::callAsync([safeThis, newListener]
+            {
+                if (safeThis == nullptr)
+                    return;
+                {
+                    const juce::ScopedLock lock(safeThis->deviceManager.getAudioCallbackLock());
+                    safeThis->listener = newListener;
+                }
+                safeThis->engineStarted({});
+            });
+        });
+    }
+
+    /// Open the audio device, message thread. Returns an error message, empty on success.
+    juce::String openAudioDevice(juce::AudioDeviceManager::AudioDeviceSetup& setup)
+    {
+        // Virtual device for machines without audio hardware and for testing. The default
+        // device types must be created before adding it, or they would not be created at all.
+        const auto& virtualDeviceSettings = VirtualAudioDeviceSettings::get();
+        deviceManager.getAvailableDeviceTypes();
+        deviceManager.addAudioDeviceType(std::make_unique<VirtualAudioIODeviceType>());
+
+        setAudioChannels (0, 2);
+        if (virtualDeviceSettings.useByDefault || deviceManager.getCurrentAudioDevice() == nullptr)
+            deviceManager.setCurrentAudioDeviceType(VirtualAudioIODeviceType::TYPE_NAME, true);
+
+        if (deviceManager.getCurrentAudioDevice() == nullptr)
+            return "No audio device found";
+
+        deviceManager.getAudioDeviceSetup(setup);
+        if (virtualDeviceSettings.sampleRate > 0.0)
+            setup.sampleRate = virtualDeviceSettings.sampleRate;
+        setup.bufferSize = virtualDeviceSettings.blockSize > 0 ? virtualDeviceSettings.blockSize : BLOCK_SIZE; // Set the buffer size
+        const auto error = deviceManager.setAudioDeviceSetup(setup, true);
+        if (error.isNotEmpty())
+            return error;
+        deviceManager.getAudioDeviceSetup(setup);
+        return {};
+    }
+
+    void engineStarted(const juce::String& error)
+    {
+        engineReadyMs = juce::Time::getMillisecondCounterHiRes();
+        if (error.isNotEmpty()) {
+            sampleRateLabel.setText("No audio", juce::dontSendNotification);
+            restoredBundles.clear();
+            showAlert(juce::AlertWindow::WarningIcon, "Error", error);
+        }
+        else {
+            // Show the sample rate in the GUI
+            sampleRateLabel.setText("Sample Rate: " + std::to_string((int) globalParameters.GetSampleRate()) + " Hz", juce::dontSendNotification);
+            openSOFAButton.setEnabled(true);
+            openWavButton.setEnabled(true);
+            openSamplesButton.setEnabled(true);
+            openSceneButton.setEnabled(true);
+            saveSceneButton.setEnabled(true);
+            engineReady = true;
+            buildRestoredHRTFs();
+        }
+        if (onEngineReady != nullptr)
+            onEngineReady(error);
+    }
+
+    /// Log the startup times once the first frame has been painted, if there is a window, and the
+    /// first audio callback made
+    void logStartupTimes()
+    {
+        const double firstAudio = firstAudioMs.load(std::memory_order_relaxed);
+        if (startupTimesLogged || (firstFrameMs == 0.0 && isShowing()) || firstAudio == 0.0)
+            return;
+        startupTimesLogged = true;
+        const auto firstFrame = firstFrameMs > 0.0 ? juce::String(firstFrameMs - PROCESS_START_MS, 1) + " ms" : juce::String("none");
+        juce::Logger::writeToLog("Startup: first frame " + firstFrame + ", engine ready "
+                                 + juce::String(engineReadyMs - PROCESS_START_MS, 1) + " ms, first audio "
+                                 + juce::String(firstAudio - PROCESS_START_MS, 1) + " ms");
+    }
+
+    //==========================================================================
+    /// Reload the SOFA files of the previous run. The measurements are taken from the shared HRTF
+    /// store, which outlives the process, or read from the SOFA files and published there for the
+    /// next start, while the engine is starting. Once both are done the HRTFs are built for the
+    /// device configuration and added to the list one by one. No job waits for the engine, the
+    /// HRTF thread stays free for other work.
+    void restoreSession()
+    {
+        juce::Array<juce::File> files;
+        for (const auto& path : juce::StringArray::fromLines(settings->getValue(SESSION_FILES_KEY)))
+        {
+            if (juce::File::isAbsolutePath(path) && juce::File(path).existsAsFile())
+                files.add(juce::File(path));
+        }
+        if (files.isEmpty())
+            return;
+
+        const int resamplingStep = qualityGovernor.getCurrentTierSettings().hrtfResamplingStep;
+        const bool lazy = lazyResamplingToggle.getToggleState();
+        juce::Component::SafePointer<MainContentComponent> safeThis(this);
+        hrtfBuilder.addJob([safeThis, files, resamplingStep, lazy]
+        {
+            auto* job = juce::ThreadPoolJob::getCurrentThreadPoolJob();
+            std::vector<std::shared_ptr<HRTFBundle>> bundles;
+            for (const auto& file : files) {
+                if (job->shouldExit())
+                    return;
+                SofaMeasurements measurements;
+                bool attached = false;
+                juce::String shareError;    // A restored HRTF that cannot be shared is still used
+                if (SharedHRTFStore::attachOrLoad(file, true, measurements, attached, shareError).isNotEmpty())
+                    continue;
+                bundles.push_back(std::make_shared<HRTFBundle>(file, std::move(measurements), lazy ? HRTF_LAZY_BASE_RESAMPLING_STEP : resamplingStep,
+                                                               lazy ? resamplingStep : 0, HRTFEXTRAPOLATIONMETHOD));
+            }
+            juce::MessageManager::callAsync([safeThis, bundles]
+            {
+                if (safeThis == nullptr)
+                    return;
+                safeThis->restoredBundles = bundles;
+                if (safeThis->engineReady)
+                    safeThis->buildRestoredHRTFs();
+            });
+        });
+    }
+
+    /// Build the HRTFs of the restored session for the configuration the engine started with, one job
+    /// each, once both the engine and the measurements are ready
+    void buildRestoredHRTFs()
+    {
+        juce::Component::SafePointer<MainContentComponent> safeThis(this);
+        for (const auto& bundle : restoredBundles) {
+            hrtfBuilder.addJob([safeThis, bundle]
+            {
+                Common::CGlobalParameters brtParameters;
+                const double sampleRate = brtParameters.GetSampleRate();
+                const int blockSize = brtParameters.GetBufferSize();
+                juce::String warning;
+                auto hrtf = bundle->buildVariant(sampleRate, blockSize, warning);
+                if (hrtf == nullptr || brtParameters.GetBufferSize() != blockSize)
+                    return;
+                bundle->addVariant(sampleRate, blockSize, hrtf);
+                juce::MessageManager::callAsync([safeThis, bundle, hrtf]
+                {
+                    if (safeThis != nullptr)
+                        safeThis->addRestoredHRTF(bundle, hrtf);
+                });
+            });
+        }
+        restoredBundles.clear();
+    }
+
+    void addRestoredHRTF(const std::shared_ptr<HRTFBundle>& bundle, const std::shared_ptr<CachedHRTF>& hrtf)
+    {
+        const int index = storeHRTF(bundle, hrtf);
+        showHRTFButton(index, bundle->getFile());
+        if (selectedHRTFidx.load() < 0) {
+            sofaFileButtons[index]->setToggleState(true, juce::NotificationType::dontSendNotification);
+            selectHRTF(index, true);
+        }
+    }
+
+    /// Remember the files of the HRTF list for the next run
+    void saveSession()
+    {
+        if (! rememberSession)
+            return;
+        juce::StringArray paths;
+        for (const auto& bundle : HRTF_bundles)
+            paths.add(bundle->getFile().getFullPathName());
+        settings->setValue(SESSION_FILES_KEY, paths.joinIntoString("\n"));
+        settings->saveIfNeeded();
+    }
+
+    /// Show the button of an HRTF just loaded, ticked, and listen through it
+    void showLoadedHRTF(int index, const juce::File& file)
+    {
+        showHRTFButton(index, file);
+        sofaFileButtons[index]->setToggleState(true, juce::NotificationType::dontSendNotification);
+
+        // Set the listener HRTF to the loaded HRTF
+        selectHRTF(index, true);
+    }
+
+    /// Add the button of an HRTF at the end of the list, if it does not have one yet
+    void showHRTFButton(int index, const juce::File& file)
+    {
+        sourceAzimuthDial.setEnabled(true);
+        sourceElevationDial.setEnabled(true);
+        sourceDistanceDial.setEnabled(true);
+
+        if (index == sofaFileButtons.size())
+        {
+            // Create a new ToggleButton for the new SOFA file
+            ToggleButton* sofaFileButton = new ToggleButton(file.getFileNameWithoutExtension());
+            sofaFileButton->setRadioGroupId(1);
+            sofaFileButtons.add(sofaFileButton);
+            addAndMakeVisible(sofaFileButton);
+            sofaFileButton->addListener(this);
+
+            // Call resized() to update the layout
+            resized();
+        }
+    }
+
+    //==========================================================================
+    /// Setup BRT Library. Returns the listener, for the message thread to publish.
+    std::shared_ptr<BRTListenerModel::CListenerHRTFbasedModel> setupBRT(int sampleRate, int bufferSize) {
 
         // Global parameters
         globalParameters.SetSampleRate(sampleRate);
@@ -374,64 +1357,500 @@ private:
 
         // Listener creation
         brtManager.BeginSetup();
-        listener = brtManager.CreateListener<BRTListenerModel::CListenerHRTFbasedModel>("listener1");
+        auto newListener = brtManager.CreateListener<BRTListenerModel::CListenerHRTFbasedModel>("listener1");
         brtManager.EndSetup();
 
         // Place the listener in (0,0,0)
         Common::CTransform listenerPosition = Common::CTransform();
         listenerPosition.SetPosition(Common::CVector3(0, 0, 0));
-        listener->SetListenerTransform(listenerPosition);
+        newListener->SetListenerTransform(listenerPosition);
+        return newListener;
     }
 
     //==========================================================================
-    /// Load a SOFA file and add it to the HRTF list
-    bool LoadSOFAFile(const juce::File& file) {
-        bool result = false; 
-        std::shared_ptr<BRTServices::CHRTF> hrtf = std::make_shared<BRTServices::CHRTF>();
-
-        // Try to get sample rate in SOFA
-        int sampleRateInSOFAFile = sofaReader.GetSampleRateFromSofa(file.getFullPathName().toStdString());
-        if (sampleRateInSOFAFile == -1) {
-			juce::AlertWindow::showMessageBoxAsync(juce::AlertWindow::WarningIcon, "Error", "The SOFA file does not contain a valid sample rate", "OK");
-			result = false;
-		}
+    /// Load a SOFA file and add it to the HRTF list, or replace its previous HRTF if it was
+    /// already loaded. Returns the index of the HRTF in the list, or -1 if it failed to load.
+    int LoadSOFAFile(const juce::File& file) {
+        // The measurements stay with the HRTF, to prepare it for other sample rates without reading the
+        // file again. Another instance may already have published them, then the SOFA file is not read at all.
+        SofaMeasurements measurements;
+        bool attached = false;
+        juce::String shareError;
+        const auto error = SharedHRTFStore::attachOrLoad(file, shareHRTFToggle.getToggleState(), measurements, attached, shareError);
+        if (error.isNotEmpty()) {
+            showAlert(juce::AlertWindow::WarningIcon, "Error", "Error loading SOFA file: " + error);
+            return -1;
+        }
+        if (shareError.isNotEmpty())
+            showAlert(juce::AlertWindow::WarningIcon, "Warning", "The HRTF is not shared with other instances: " + shareError);
+        return LoadMeasurements(file, std::move(measurements), ! attached);
+    }
+
+    /// Build the HRTF of measurements and add it to the HRTF list, or replace the previous HRTF of
+    /// the same file. BRT reads the file itself if it can, at the measured sample rate; otherwise the
+    /// HRTF is built from the measurements. Returns the index of the HRTF in the list, or -1.
+    int LoadMeasurements(const juce::File& file, SofaMeasurements&& measurements, bool brtCanReadFile) {
+        const double sampleRate = globalParameters.GetSampleRate();
+        const int blockSize = globalParameters.GetBufferSize();
+
+        // The resampling step follows the current quality tier, coarser grids load faster and use less memory.
+        // In lazy mode BRT only builds a coarse grid, the fine one is filled in as directions are used.
+        const int resamplingStep = qualityGovernor.getCurrentTierSettings().hrtfResamplingStep;
+        const bool lazy = lazyResamplingToggle.getToggleState();
+        auto bundle = std::make_shared<HRTFBundle>(file, std::move(measurements), lazy ? HRTF_LAZY_BASE_RESAMPLING_STEP : resamplingStep,
+                                                   lazy ? resamplingStep : 0, HRTFEXTRAPOLATIONMETHOD);
+
+        std::shared_ptr<CachedHRTF> hrtf;
+        juce::String warning;
+        if (brtCanReadFile && juce::roundToInt(bundle->getMeasuredSampleRate()) == juce::roundToInt(sampleRate)) {
+            // At the measured sample rate BRT reads the SOFA file itself
+            hrtf = std::make_shared<CachedHRTF>();
+            if (! sofaReader.ReadHRTFFromSofa(file.getFullPathName().toStdString(), hrtf,
+                                              lazy ? HRTF_LAZY_BASE_RESAMPLING_STEP : resamplingStep, HRTFEXTRAPOLATIONMETHOD)) {
+                showAlert(juce::AlertWindow::WarningIcon, "Error", "Error loading SOFA file");
+                return -1;
+            }
+            warning = bundle->completeVariant(*hrtf, blockSize);
+        }
         else {
-            // Make sure sample rate is same as selected in app. 
-            if (sampleRateInSOFAFile != globalParameters.GetSampleRate()) {
-                juce::AlertWindow::showMessageBoxAsync(juce::AlertWindow::WarningIcon, "Error", "The SOFA file sample rate does not match the selected sample rate", "OK");
-                result = false;
+            // Shared or synthetic measurements, and files measured at another sample rate, are built from the measurements
+            hrtf = bundle->buildVariant(sampleRate, blockSize, warning);
+            if (hrtf == nullptr) {
+                showAlert(juce::AlertWindow::WarningIcon, "Error", "Error loading SOFA file");
+                return -1;
             }
-			else {
-				// Load SOFA file
-                result = sofaReader.ReadHRTFFromSofa(file.getFullPathName().toStdString(), hrtf, HRTFRESAMPLINGSTEP, "NearestPoint");
-                if (result) {
-					HRTF_list.push_back(hrtf);
-				}
-				else {
-					juce::AlertWindow::showMessageBoxAsync(juce::AlertWindow::WarningIcon, "Error", "Error loading SOFA file", "OK");
-				}
-			}
         }
-        return result;  
+        if (warning.isNotEmpty())
+            showAlert(juce::AlertWindow::WarningIcon, "Warning", warning);
+
+        bundle->addVariant(sampleRate, blockSize, hrtf);
+        const int index = storeHRTF(bundle, hrtf);
+
+        // Prepare the common sample rates too, so a device change does not have to wait for them
+        if (multiRateToggle.getToggleState()) {
+            for (const double rate : HRTF_PREPARED_SAMPLE_RATES)
+                buildHRTFVariant(bundle, rate, blockSize);
+        }
+        return index;
+    }
+
+    /// Put a loaded HRTF in the list, in the place of an earlier load of the same file if there
+    /// was one, so reloading files does not make the list grow. The audio thread reads the list
+    /// under the callback lock, which is only held for the update itself.
+    int storeHRTF(const std::shared_ptr<HRTFBundle>& bundle, const std::shared_ptr<CachedHRTF>& hrtf)
+    {
+        int index = -1;
+        for (size_t i = 0; i < HRTF_bundles.size(); ++i) {
+            if (HRTF_bundles[i]->getFile() == bundle->getFile())
+                index = (int) i;
+        }
+        {
+            const juce::ScopedLock lock(deviceManager.getAudioCallbackLock());
+            if (index >= 0) {
+                HRTF_list[(size_t) index] = hrtf;
+                HRTF_bundles[(size_t) index] = bundle;
+            }
+            else {
+                index = (int) HRTF_list.size();
+                HRTF_list.push_back(hrtf);
+                HRTF_bundles.push_back(bundle);
+            }
+        }
+        saveSession();
+        return index;
+    }
+
+    /// Build the variant of an HRTF for a configuration on the background thread, and use it if the
+    /// device is still in that configuration when it is ready
+    void buildHRTFVariant(std::shared_ptr<HRTFBundle> bundle, double sampleRate, int blockSize)
+    {
+        if (bundle->findVariant(sampleRate, blockSize) != nullptr)
+            return;
+        juce::Component::SafePointer<MainContentComponent> safeThis(this);
+        hrtfBuilder.addJob([safeThis, bundle, sampleRate, blockSize]
+        {
+            // BRT partitions the impulse responses with the global block size, a variant built
+            // while the device is being reconfigured is dropped
+            Common::CGlobalParameters brtParameters;
+            if (bundle->findVariant(sampleRate, blockSize) != nullptr || brtParameters.GetBufferSize() != blockSize)
+                return;
+            juce::String warning;
+            auto hrtf = bundle->buildVariant(sampleRate, blockSize, warning);
+            if (hrtf == nullptr || brtParameters.GetBufferSize() != blockSize)
+                return;
+            bundle->addVariant(sampleRate, blockSize, std::move(hrtf));
+            juce::MessageManager::callAsync([safeThis, bundle]
+            {
+                if (safeThis != nullptr)
+                    safeThis->useHRTFVariant(*bundle);
+            });
+        });
+    }
+
+    /// Give the propagation delay a line per source of the scene while it is enabled, growing in
+    /// steps as sources are added, and free the lines when it is disabled
+    void sizePropagationDelay()
+    {
+        int numLines = 0;
+        if (propagationDelay.isEnabled()) {
+            numLines = juce::jmax(propagationDelay.getNumLines(), 16);
+            while (numLines < scene.getNumSources() && numLines < PropagationDelayBank::MAX_SOURCES)
+                numLines *= 2;
+        }
+        if (numLines == propagationDelay.getNumLines())
+            return;
+        auto lines = propagationDelay.makeLines(numLines);
+        const juce::ScopedLock lock(deviceManager.getAudioCallbackLock());
+        propagationDelay.swapLines(lines);
+    }
+
+    /// Drop the HRTF variants of configurations the device has left, keeping the prepared sample rates
+    /// if enabled. The listener may still hold the variant it renders with, until the audio thread
+    /// switches, so evicted variants are only released here once nothing else holds them.
+    void evictHRTFVariants()
+    {
+        const double sampleRate = globalParameters.GetSampleRate();
+        const int blockSize = globalParameters.GetBufferSize();
+        for (const auto& bundle : HRTF_bundles) {
+            auto evicted = bundle->evictVariants(sampleRate, blockSize, multiRateToggle.getToggleState());
+            std::move(evicted.begin(), evicted.end(), std::back_inserter(evictedHRTFs));
+        }
+        evictedHRTFs.erase(std::remove_if(evictedHRTFs.begin(), evictedHRTFs.end(),
+                                          [](const std::shared_ptr<CachedHRTF>& hrtf) { return hrtf.use_count() == 1; }),
+                           evictedHRTFs.end());
+    }
+
+    /// Switch an HRTF to a variant built in the background, if it is for the current configuration
+    void useHRTFVariant(const HRTFBundle& bundle)
+    {
+        auto variant = bundle.findVariant(globalParameters.GetSampleRate(), globalParameters.GetBufferSize());
+        if (variant == nullptr)
+            return;
+        const juce::ScopedLock lock(deviceManager.getAudioCallbackLock());
+        for (size_t i = 0; i < HRTF_bundles.size(); ++i) {
+            if (HRTF_bundles[i].get() == &bundle && HRTF_list[i] != variant) {
+                HRTF_list[i] = variant;
+                if ((int) i == selectedHRTFidx.load())
+                    hrtfState.store(ToBeChanged);
+            }
+        }
+    }
+
+    /// Load the BRIR of the room from a SOFA file and build its convolver for the current configuration
+    void loadBRIR(const juce::File& file)
+    {
+        const auto error = environment.load(file);
+        if (error.isNotEmpty())
+        {
+            showAlert(juce::AlertWindow::WarningIcon, "Error", error);
+            return;
+        }
+        std::shared_ptr<PartitionedBRIRConvolver> previous;
+        {
+            const juce::ScopedLock lock(deviceManager.getAudioCallbackLock());
+            previous = std::move(roomConvolver);
+        }
+        previous.reset();   // Stops its tail threads, outside the callback lock
+        buildRoomConvolver(globalParameters.GetSampleRate(), globalParameters.GetBufferSize());
+    }
+
+    /// Build the room convolver for a configuration on the background thread, and use it if the device
+    /// is still in that configuration and the BRIR has not changed when it is ready
+    void buildRoomConvolver(double sampleRate, int blockSize)
+    {
+        auto brir = environment.getBRIR();
+        if (brir == nullptr || blockSize <= 0)
+            return;
+        juce::Component::SafePointer<MainContentComponent> safeThis(this);
+        hrtfBuilder.addJob([safeThis, brir, sampleRate, blockSize]
+        {
+            std::shared_ptr<PartitionedBRIRConvolver> convolver = BRIREnvironment::makeConvolver(brir, sampleRate, blockSize);
+            if (convolver == nullptr)
+                return;
+            juce::MessageManager::callAsync([safeThis, brir, convolver, sampleRate, blockSize]
+            {
+                if (safeThis != nullptr)
+                    safeThis->useRoomConvolver(brir, convolver, sampleRate, blockSize);
+            });
+        });
+    }
+
+    void useRoomConvolver(const std::shared_ptr<const SofaMeasurements>& brir, const std::shared_ptr<PartitionedBRIRConvolver>& convolver,
+                          double sampleRate, int blockSize)
+    {
+        if (brir != environment.getBRIR() || globalParameters.GetBufferSize() != blockSize
+            || juce::roundToInt(globalParameters.GetSampleRate()) != juce::roundToInt(sampleRate))
+            return;
+        std::shared_ptr<PartitionedBRIRConvolver> previous;
+        {
+            const juce::ScopedLock lock(deviceManager.getAudioCallbackLock());
+            previous = std::move(roomConvolver);
+            roomConvolver = convolver;
+            roomSampleRate = sampleRate;
+        }
+    }
+
+    /// Decode a set of sound files into a sample bank on the background thread, and play them when ready
+    void loadSampleBank(const juce::Array<juce::File>& files, double sampleRate)
+    {
+        juce::Component::SafePointer<MainContentComponent> safeThis(this);
+        hrtfBuilder.addJob([this, safeThis, files, sampleRate]
+        {
+            juce::String error;
+            std::shared_ptr<const SampleBank> bank = SampleBank::load(files, sampleRate, formatManager, error);
+            juce::MessageManager::callAsync([safeThis, bank, error]
+            {
+                if (safeThis != nullptr)
+                    safeThis->useSampleBank(bank, error);
+            });
+        });
+    }
+
+    void useSampleBank(std::shared_ptr<const SampleBank> bank, const juce::String& error)
+    {
+        if (error.isNotEmpty())
+            showAlert(juce::AlertWindow::WarningIcon, "Error", error);
+        if (bank->getNumSamples() == 0 || listener == nullptr)
+            return;
+        if (! juce::approximatelyEqual(bank->getSampleRate(), globalParameters.GetSampleRate()))
+            return;     // The device changed while decoding, the bank has been queued again for the new rate
+
+        // The pool of voices, created the first time. Entry 0 of the scene is kept for the file source.
+        if (sampleVoiceCount == 0)
+        {
+            if (scene.getNumSources() <= FILE_SOURCE_INDEX)
+                scene.addSource(nullptr, SOURCE1_INITIAL_AZIMUTH, SOURCE1_INITIAL_ELEVATION, SOURCE1_INITIAL_DISTANCE);
+            std::vector<std::shared_ptr<BRTSourceModel::CSourceSimpleModel>> sources;
+            brtManager.BeginSetup();
+            for (int v = 0; v < SAMPLE_VOICES; ++v) {
+                sources.push_back(brtManager.CreateSoundSource<BRTSourceModel::CSourceSimpleModel>("sample voice " + std::to_string(v + 1)));
+                listener->ConnectSoundSource(sources.back());
+            }
+            brtManager.EndSetup();
+            for (int v = 0; v < SAMPLE_VOICES; ++v) {
+                const int index = scene.addSource(sources[(size_t) v], 0.f, 0.f, SOURCE1_INITIAL_DISTANCE);
+                if (v == 0)
+                    firstSampleVoiceIndex = index;
+            }
+            sampleVoiceCount = SAMPLE_VOICES;
+        }
+
+        std::shared_ptr<const SampleBank> previous;
+        {
+            const juce::ScopedLock lock(deviceManager.getAudioCallbackLock());
+            if (sampleVoices.getNumBound() == 0)
+                sampleVoices.bind(firstSampleVoiceIndex, sampleVoiceCount);
+            previous = sampleVoices.setBank(bank);
+        }
+        sampleBank = std::move(bank);
+        triggerSampleButton.setEnabled(true);
+    }
+
+    /// Decode the sample bank again for the sample rate the device has changed to, if it is still
+    /// current. Posted to the message thread by prepareToPlay, as the bank belongs to that thread.
+    void resampleSampleBank(double sampleRate)
+    {
+        if (sampleBank != nullptr && ! juce::approximatelyEqual(sampleBank->getSampleRate(), sampleRate)
+            && juce::approximatelyEqual(sampleRate, (double) globalParameters.GetSampleRate()))
+            loadSampleBank(sampleBank->getFiles(), sampleRate);
+    }
+
+    /// Play one of the samples once, somewhere around the listener
+    void triggerRandomSample()
+    {
+        if (sampleBank == nullptr || sampleBank->getNumSamples() == 0)
+            return;
+        sampleVoices.trigger(sampleTriggerRandom.nextInt(sampleBank->getNumSamples()),
+                             juce::MathConstants<float>::twoPi * sampleTriggerRandom.nextFloat(),
+                             0.f, 0.5f + 2.5f * sampleTriggerRandom.nextFloat());
+    }
+
+    /// Load a scene file: the listener with its HRTF, and every source with its position, gain and
+    /// audio file. The sources come from the pool of scene sources, created or reconnected in one BRT
+    /// setup pass, and the whole scene is swapped in under the callback lock in one go.
+    void loadScene(const juce::File& file)
+    {
+        const double startMs = juce::Time::getMillisecondCounterHiRes();
+        SceneSnapshot snapshot;
+        const auto error = snapshot.open(file);
+        if (error.isNotEmpty()) {
+            showAlert(juce::AlertWindow::WarningIcon, "Error", error);
+            return;
+        }
+        const auto& header = snapshot.getHeader();
+        const int numSources = snapshot.getNumSources();
+
+        // The HRTF of the listener, read first if it is not in the list
+        double hrtfMs = 0.0;
+        const juce::String hrtfPath = juce::String::fromUTF8(snapshot.getString(header.hrtfFile));
+        if (hrtfPath.isNotEmpty()) {
+            const auto hrtfFile = file.getParentDirectory().getChildFile(hrtfPath);
+            int index = -1;
+            for (size_t i = 0; i < HRTF_bundles.size(); ++i) {
+                if (HRTF_bundles[i]->getFile() == hrtfFile)
+                    index = (int) i;
+            }
+            if (index >= 0)
+                selectHRTF(index);
+            else if (hrtfFile.existsAsFile()) {
+                const double hrtfStartMs = juce::Time::getMillisecondCounterHiRes();
+                addSOFAFile(hrtfFile);
+                hrtfMs = juce::Time::getMillisecondCounterHiRes() - hrtfStartMs;
+            }
+        }
+
+        // Audio of the sources, requested before the setup so that the files start decoding. Sources
+        // playing the same file share its decoded samples. Relative paths are relative to the scene file,
+        // and are kept resolved, so saving the scene elsewhere still finds the files.
+        std::vector<std::shared_ptr<DecodedAudio>> audio((size_t) numSources);
+        std::vector<SceneSourceFile> files((size_t) numSources);
+        int unreadable = 0;
+        for (int k = 0; k < numSources; ++k) {
+            const auto& source = snapshot.getSource(k);
+            auto& sourceFile = files[(size_t) k];
+            sourceFile.name = juce::String::fromUTF8(snapshot.getString(source.name));
+            const auto audioPath = juce::String::fromUTF8(snapshot.getString(source.audioFile));
+            sourceFile.looping = (source.flags & SceneSnapshotFormat::LOOPING) != 0;
+            if (audioPath.isNotEmpty()) {
+                const auto audioFile = file.getParentDirectory().getChildFile(audioPath);
+                sourceFile.audioFile = audioFile.getFullPathName();
+                juce::String audioError;
+                audio[(size_t) k] = decodedAudio.request(audioFile, audioError);
+                unreadable += audio[(size_t) k] == nullptr ? 1 : 0;
+            }
+        }
+
+        // One setup pass for all the sources. Entry 0 of the scene is kept for the file source.
+        const double setupStartMs = juce::Time::getMillisecondCounterHiRes();
+        if (scene.getNumSources() <= FILE_SOURCE_INDEX)
+            scene.addSource(nullptr, SOURCE1_INITIAL_AZIMUTH, SOURCE1_INITIAL_ELEVATION, SOURCE1_INITIAL_DISTANCE);
+        if (! scenePool.prepare(numSources, brtManager, *listener, scene)) {
+            showAlert(juce::AlertWindow::WarningIcon, "Error", "The scene has more sources than the application can hold");
+            return;
+        }
+        const double setupMs = juce::Time::getMillisecondCounterHiRes() - setupStartMs;
+
+        auto players = std::make_unique<ScenePlayers>();
+        for (int k = 0; k < numSources; ++k) {
+            if (audio[(size_t) k] != nullptr)
+                players->add(scenePool.getSceneIndex(k), std::move(audio[(size_t) k]), files[(size_t) k].looping);
+        }
+        players->prepare(globalParameters.GetBufferSize(), globalParameters.GetSampleRate());
+
+        Common::CTransform listenerTransform;
+        listenerTransform.SetPosition(Common::CVector3(header.listenerPosition[0], header.listenerPosition[1], header.listenerPosition[2]));
+        listenerTransform.SetOrientation(Common::CQuaternion(header.listenerOrientation[0], header.listenerOrientation[1],
+                                                             header.listenerOrientation[2], header.listenerOrientation[3]));
+        {
+            const juce::ScopedLock lock(deviceManager.getAudioCallbackLock());
+            scenePool.commit(snapshot, scene);
+            std::swap(scenePlayers, players);
+            listener->SetListenerTransform(listenerTransform);
+        }
+        sceneSourceFiles = std::move(files);
+
+        // A saved file source is one of the scene sources now, do not play it twice
+        if (state == Playing && readerSource != nullptr) {
+            const auto playing = readerSource->getDecodedAudio().file.getFullPathName();
+            if (std::any_of(sceneSourceFiles.begin(), sceneSourceFiles.end(),
+                            [&playing](const SceneSourceFile& sourceFile) { return sourceFile.audioFile == playing; }))
+                changeState(Stopping);
+        }
+
+        const double totalMs = juce::Time::getMillisecondCounterHiRes() - startMs;
+        juce::String text = "Scene " + file.getFileNameWithoutExtension() + ": " + juce::String(numSources) + " sources in "
+                          + juce::String(totalMs - hrtfMs, 1) + " ms (setup " + juce::String(setupMs, 1) + " ms)";
+        if (hrtfMs > 0.0)
+            text << ", HRTF read in " << juce::roundToInt(hrtfMs) << " ms";
+        if (unreadable > 0)
+            text << ", " << unreadable << " files missing";
+        sceneLabel.setText(text, juce::dontSendNotification);
+    }
+
+    /// Save the scene: the listener with the selected HRTF, the file source, and the sources of the
+    /// loaded scene file, if any
+    void saveScene(const juce::File& file)
+    {
+        // Positions and gains belong to the audio thread, copied under the callback lock
+        struct Placement { float azimuth, elevation, distance, gain; };
+        std::vector<Placement> placements((size_t) (1 + scenePool.getNumActive()));
+        Common::CTransform listenerTransform;
+        const bool hasFileSource = readerSource != nullptr && scene.getNumSources() > FILE_SOURCE_INDEX;
+        {
+            const juce::ScopedLock lock(deviceManager.getAudioCallbackLock());
+            auto place = [this](int i) { return Placement{ scene.getAzimuth(i), scene.getElevation(i), scene.getDistance(i), scene.getGain(i) }; };
+            if (hasFileSource)
+                placements[0] = place(FILE_SOURCE_INDEX);
+            for (int k = 0; k < scenePool.getNumActive(); ++k)
+                placements[(size_t) (k + 1)] = place(scenePool.getSceneIndex(k));
+            listenerTransform = listener->GetListenerTransform();
+        }
+
+        SceneSnapshotWriter writer;
+        const int selected = selectedHRTFidx.load();
+        writer.setListener(juce::isPositiveAndBelow(selected, (int) HRTF_bundles.size())
+                               ? HRTF_bundles[(size_t) selected]->getFile().getFullPathName() : juce::String(),
+                           listenerTransform);
+        if (hasFileSource) {
+            const auto& audioFile = readerSource->getDecodedAudio().file;
+            const auto& p = placements[0];
+            writer.addSource(audioFile.getFileNameWithoutExtension(), audioFile.getFullPathName(), p.azimuth, p.elevation, p.distance,
+                             p.gain, readerSource->isLooping());
+        }
+        for (int k = 0; k < scenePool.getNumActive(); ++k) {
+            const auto& sourceFile = sceneSourceFiles[(size_t) k];
+            const auto& p = placements[(size_t) (k + 1)];
+            writer.addSource(sourceFile.name, sourceFile.audioFile, p.azimuth, p.elevation, p.distance, p.gain, sourceFile.looping);
+        }
+
+        const auto error = writer.write(file);
+        if (error.isNotEmpty()) {
+            showAlert(juce::AlertWindow::WarningIcon, "Error", error);
+            return;
+        }
+        sceneLabel.setText("Scene saved to " + file.getFileName() + ", " + juce::String(writer.getNumSources()) + " sources",
+                           juce::dontSendNotification);
+    }
+
+    /// Show a message box, or only log the message in unattended runs
+    void showAlert(juce::MessageBoxIconType icon, const juce::String& title, const juce::String& message)
+    {
+        if (showAlerts)
+            juce::AlertWindow::showMessageBoxAsync(icon, title, message, "OK");
+        else
+            DBG(title << ": " << message);
     }
 
     //==========================================================================
     // Load a source in the BRT Library
     void LoadSource(const String& name, float azimuth, float elevation, float distance) {
-		// Create a source
+		// Create a source, replacing the one of the previous file if there was one
 		brtManager.BeginSetup();
-		source1BRT = brtManager.CreateSoundSource<BRTSourceModel::CSourceSimpleModel>(name.toStdString());
-        listener->ConnectSoundSource(source1BRT);
+		auto source = brtManager.CreateSoundSource<BRTSourceModel::CSourceSimpleModel>(name.toStdString());
+        listener->ConnectSoundSource(source);
 		brtManager.EndSetup();
 
-		// Set the source position
-		Common::CVector3 listenerPosition = listener->GetListenerTransform().GetPosition();
-        Common::CTransform sourceTransform;
-        Common::CVector3 sourcePosition = Common::CVector3(distance * std::cos(azimuth) * std::cos(elevation) + listenerPosition.x,
-														   distance * std::sin(azimuth) * std::cos(elevation) + listenerPosition.y,
-														   distance * std::sin(elevation) + listenerPosition.z);
-        sourceTransform.SetPosition(sourcePosition);
-		source1BRT->SetSourceTransform(sourceTransform);
+		// Set the source position, the transform is pushed to BRT in the next audio block
+        if (scene.getNumSources() > FILE_SOURCE_INDEX) {
+            std::shared_ptr<BRTSourceModel::CSourceSimpleModel> previous;
+            {
+                const juce::ScopedLock lock(deviceManager.getAudioCallbackLock());
+                previous = scene.replaceSource(FILE_SOURCE_INDEX, source);
+            }
+            scene.postPosition(FILE_SOURCE_INDEX, azimuth, elevation, distance);
+
+            // The audio thread no longer reaches the previous source: remove it from BRT and release it.
+            // Reopening the same file reuses the ID, and BRT removes the first source with it, the previous one.
+            if (previous != nullptr) {
+                brtManager.BeginSetup();
+                listener->DisconnectSoundSource(previous);
+                brtManager.RemoveSoundSource(previous->GetID());
+                brtManager.EndSetup();
+            }
+        }
+        else {
+            scene.addSource(source, azimuth, elevation, distance);
+        }
 	}
 
     // Open a SOFA file using a file chooser
@@ -447,42 +1866,17 @@ private:
 		{
 			auto file = fc.getResult();
 
-			if (file != juce::File{})                                                
-			{
-				// Load the SOFA file
-				if (LoadSOFAFile(file)) {
-
-					juce::AlertWindow::showMessageBoxAsync(juce::AlertWindow::InfoIcon, "Success", "SOFA file loaded successfully", "OK");
-					sourceAzimuthDial.setEnabled(true);
-					sourceElevationDial.setEnabled(true);
-					sourceDistanceDial.setEnabled(true);
-
-                    // Create a new ToggleButton for the new SOFA file
-                    ToggleButton* sofaFileButton = new ToggleButton(file.getFileNameWithoutExtension());
-                    sofaFileButton->setRadioGroupId(1);
-                    sofaFileButtons.add(sofaFileButton);
-                    addAndMakeVisible(sofaFileButton);
-                    sofaFileButton->addListener(this);
-                    sofaFileButton->setToggleState(true, juce::NotificationType::dontSendNotification);
-
-                    // Call resized() to update the layout
-                    resized();
-
-                    // Set the listener HRTF to the last loaded HRTF
-                    selectedHRTFidx = (int) HRTF_list.size() - 1;
-                    hrtfState = ToBeChanged; // The HRTF will be changed in the next buffer
-                    
-				}
-			}
+			if (file != juce::File{})
+				addSOFAFile(file);
 		});
 	}
 
     // Open a mono wav file using a file chooser
     void openWavButtonClicked()
     {
-        chooser = std::make_unique<juce::FileChooser> ("Select a Wave file to play...",
+        chooser = std::make_unique<juce::FileChooser> ("Select a mono audio file to play...",
                                                        juce::File{},
-                                                       "*.wav");                     // [7]
+                                                       formatManager.getWildcardForAllFormats());  // [7]
         auto chooserFlags = juce::FileBrowserComponent::openMode
                           | juce::FileBrowserComponent::canSelectFiles;
 
@@ -491,32 +1885,81 @@ private:
             auto file = fc.getResult();
 
             if (file != juce::File{})                                                // [9]
-            {
-                auto* reader = formatManager.createReaderFor (file);                 // [10]
+                openAudioFile (file);
+        });
+    }
 
-                if (reader != nullptr)
-                {
-                    // Get the number of channels of the audio file
-                    int numChannels = reader->numChannels;
+    // Open a BRIR SOFA file using a file chooser
+    void openBRIRButtonClicked()
+    {
+        chooser = std::make_unique<juce::FileChooser> ("Select a BRIR SOFA file to load...",
+                                                       juce::File{},
+                                                       "*.sofa");
+        auto chooserFlags = juce::FileBrowserComponent::openMode
+                          | juce::FileBrowserComponent::canSelectFiles;
 
-                    // if the number of channels is different from 1, aleert the user and return
-                    if (numChannels != 1)
-					{
-						juce::AlertWindow::showMessageBoxAsync(juce::AlertWindow::WarningIcon, "Error", "The audio file must be mono", "OK");
-						return;
-					}
+        chooser->launchAsync (chooserFlags, [this] (const juce::FileChooser& fc)
+        {
+            auto file = fc.getResult();
 
-                    auto newSource = std::make_unique<juce::AudioFormatReaderSource> (reader, true);   // [11]
-                    transportSource.setSource (newSource.get(), 0, nullptr, reader->sampleRate);       // [12]
-                    playButton.setEnabled (true);                                                      // [13]
-                    readerSource.reset (newSource.release());                                          // [14]
+            if (file != juce::File{})
+                loadBRIR(file);
+        });
+    }
 
-                    String sourceName = file.getFileNameWithoutExtension();
-					LoadSource(sourceName, SOURCE1_INITIAL_AZIMUTH, SOURCE1_INITIAL_ELEVATION, SOURCE1_INITIAL_DISTANCE);
-                    juce::AlertWindow::showMessageBoxAsync(juce::AlertWindow::InfoIcon, "Success", "Audio file loaded successfully", "OK");
+    // Open the sound files of a sample bank using a file chooser
+    void openSamplesButtonClicked()
+    {
+        chooser = std::make_unique<juce::FileChooser> ("Select the samples to load...",
+                                                       juce::File{},
+                                                       formatManager.getWildcardForAllFormats());
+        auto chooserFlags = juce::FileBrowserComponent::openMode
+                          | juce::FileBrowserComponent::canSelectFiles
+                          | juce::FileBrowserComponent::canSelectMultipleItems;
 
-                }
-            }
+        chooser->launchAsync (chooserFlags, [this] (const juce::FileChooser& fc)
+        {
+            auto files = fc.getResults();
+
+            if (! files.isEmpty())
+                loadSampleBank(files, globalParameters.GetSampleRate());
+        });
+    }
+
+    // Open a scene file using a file chooser
+    void openSceneButtonClicked()
+    {
+        chooser = std::make_unique<juce::FileChooser> ("Select a scene to load...",
+                                                       juce::File{},
+                                                       "*.brtscene");
+        auto chooserFlags = juce::FileBrowserComponent::openMode
+                          | juce::FileBrowserComponent::canSelectFiles;
+
+        chooser->launchAsync (chooserFlags, [this] (const juce::FileChooser& fc)
+        {
+            auto file = fc.getResult();
+
+            if (file != juce::File{})
+                loadScene(file);
+        });
+    }
+
+    // Save the scene to a file chosen with a file chooser
+    void saveSceneButtonClicked()
+    {
+        chooser = std::make_unique<juce::FileChooser> ("Save the scene to...",
+                                                       juce::File{},
+                                                       "*.brtscene");
+        auto chooserFlags = juce::FileBrowserComponent::saveMode
+                          | juce::FileBrowserComponent::canSelectFiles
+                          | juce::FileBrowserComponent::warnAboutOverwriting;
+
+        chooser->launchAsync (chooserFlags, [this] (const juce::FileChooser& fc)
+        {
+            auto file = fc.getResult();
+
+            if (file != juce::File{})
+                saveScene(file.withFileExtension(".brtscene"));
         });
     }
 
@@ -544,11 +1987,41 @@ private:
     juce::Slider sourceDistanceDial;
     juce::OwnedArray<Button> sofaFileButtons;
     juce::Label sampleRateLabel;
+    juce::Label qualityLabel;
+    juce::Label hrirCacheLabel;
+    juce::ToggleButton lazyResamplingToggle;
+    juce::ToggleButton shareHRTFToggle;
+    juce::ToggleButton multiRateToggle;
+    juce::ToggleButton headTrackingToggle;
+    juce::TextButton replayHeadTrackingButton;
+    juce::Label headTrackingLabel;
+    juce::ToggleButton controlSurfaceToggle;
+    juce::Label controlSurfaceLabel;
+    juce::TextButton recordButton;
+    juce::Label recordLabel;
+    juce::ToggleButton liveInputToggle;
+    juce::ToggleButton loopbackToggle;
+    juce::Label liveInputLabel;
+    juce::ToggleButton propagationDelayToggle;
+    juce::TextButton openBRIRButton;
+    juce::Label reverbSendLabel;
+    juce::Slider reverbSendDial;
+    juce::Label environmentLabel;
+    juce::ToggleButton nearFieldToggle;
+    juce::TextButton openSamplesButton;
+    juce::TextButton triggerSampleButton;
+    juce::Label sampleBankLabel;
+    juce::Label decodeLabel;
+    juce::TextButton openSceneButton;
+    juce::TextButton saveSceneButton;
+    juce::Label sceneLabel;
 
     std::unique_ptr<juce::FileChooser> chooser;
 
     juce::AudioFormatManager formatManager;
-    std::unique_ptr<juce::AudioFormatReaderSource> readerSource;
+    DecodedAudioCache decodedAudio{ formatManager };                              // Audio files decoded in the background
+    bool decodeFailureShown{ false };                                             // For the file source's current file
+    std::unique_ptr<DecodedAudioSource> readerSource;
     juce::AudioTransportSource transportSource;
     TransportState state;
 
@@ -556,15 +2029,66 @@ private:
     Common::CGlobalParameters globalParameters;                                   // Global BRT parameters
     BRTBase::CBRTManager brtManager;                                              // BRT global manager interface
     std::shared_ptr<BRTListenerModel::CListenerHRTFbasedModel> listener;          // Pointer to listener model
-    std::shared_ptr<BRTSourceModel::CSourceSimpleModel> source1BRT;               // Pointer to audio source model
+    SceneState scene;                                                             // Positions and gains of all the sources
+    CMonoBuffer<float> silenceBuffer;                                             // Input of sources with nothing to play
+    SourceInputBinding fileSourceInput;                                           // Input of the file source, rendered in place
+    ListenerOutputBinding listenerOutput;                                         // Listener ears to the device buffer
     float sourceAzimuth{ SOURCE1_INITIAL_AZIMUTH };
     float sourceElevation{ SOURCE1_INITIAL_ELEVATION };
     float sourceDistance{ SOURCE1_INITIAL_DISTANCE };
     BRTReaders::CSOFAReader sofaReader;                                           // SOFA reader provided by BRT Library
-    std::vector<std::shared_ptr<BRTServices::CHRTF>> HRTF_list;                   // List of HRTFs loaded
-
-    int selectedHRTFidx;
-    HRTFState hrtfState;
+    std::vector<std::shared_ptr<CachedHRTF>> HRTF_list;                           // List of HRTFs loaded
+    std::vector<std::shared_ptr<HRTFBundle>> HRTF_bundles;                        // Measurements and variants of each HRTF in the list
+    std::vector<std::shared_ptr<CachedHRTF>> evictedHRTFs;                        // Evicted variants still held elsewhere, message thread
+    juce::ThreadPool hrtfBuilder{ 1 };                                            // Builds HRTF variants for other configurations
+
+    std::atomic<int> selectedHRTFidx{ -1 };                                       // Set from the GUI and OSC, read by the audio thread
+    std::atomic<HRTFState> hrtfState{ NotToBeChanged };
+    std::atomic<bool> nearFieldEnabled{ false };                                  // Requested from the GUI
+    bool nearFieldApplied{ false };                                               // Audio thread
+
+    double currentSampleRate{ 0.0 };
+    QualityGovernor qualityGovernor;                                              // Adaptive rendering quality
+    juce::Array<QualityGovernor::Transition> qualityTransitionLog;                // Recent tier changes, for monitoring
+    static constexpr int MAX_QUALITY_LOG_ENTRIES = 256;
+    std::map<int, std::shared_ptr<BRTSourceModel::CSourceSimpleModel>> sourcesOverBudget;   // Disconnected by scene index, message thread
+    HeadTracker headTracker;                                                      // Listener orientation from head tracking
+    HeadTrackerUDPReceiver headTrackerReceiver{ headTracker };
+    HeadTrackerFileReplay headTrackerReplay{ headTracker };
+    OSCControlSurface controlSurface{ scene };                                    // Scene control from other applications
+    OutputRecorder outputRecorder;                                                // Recording of the binaural output
+    CallbackStatistics callbackStatistics;                                        // Duration of the audio callbacks
+    LiveInputBank liveInputs;                                                     // Device inputs fed to BRT sources
+    LoopbackLatencyMeter loopbackMeter;                                           // Input to ears latency, through a loopback cable
+    int numDeviceInputs{ 0 };                                                     // Input channels open, set in prepareToPlay
+    std::vector<int> liveSourceIndices;                                           // Scene entry of each live input
+    PropagationDelayBank propagationDelay;                                        // Travel time and Doppler of the sources
+    std::array<SourceInputBinding*, SceneState::MAX_SOURCES> sourceInputs{};      // Input of each source in the current block
+    std::array<float*, SceneState::MAX_SOURCES> sourceBlocks{};
+    BRIREnvironment environment;                                                  // BRIR of the room
+    std::shared_ptr<PartitionedBRIRConvolver> roomConvolver;                      // Room convolution for the current configuration
+    double roomSampleRate{ 0.0 };
+    CMonoBuffer<float> reverbSend;                                                // Send of all the sources to the room
+    std::atomic<float> reverbSendGain{ 0.3f };
+    SampleVoicePool sampleVoices;                                                 // One-shot samples on pooled sources
+    std::shared_ptr<const SampleBank> sampleBank;                                 // Bank the voices play, message thread copy only
+    int sampleVoiceCount{ 0 }, firstSampleVoiceIndex{ 0 };                        // Scene entries of the voices
+    juce::Random sampleTriggerRandom;
+    SceneSourcePool scenePool;                                                    // Sources of the scenes loaded from files
+    std::unique_ptr<ScenePlayers> scenePlayers;                                   // Audio files the scene sources play
+    struct SceneSourceFile { juce::String name, audioFile; bool looping; };      // Absolute path of the audio file
+    std::vector<SceneSourceFile> sceneSourceFiles;                                // Of each scene source, to save the scene again
+    bool showAlerts{ true };
+
+    juce::ThreadPool engineStarter{ 1 };                                          // Builds the BRT graph
+    std::atomic<bool> engineReady{ false };
+    std::vector<std::shared_ptr<HRTFBundle>> restoredBundles;                     // Session read before the engine was ready
+    const bool rememberSession;
+    std::unique_ptr<juce::PropertiesFile> settings;                               // SOFA files of the session, for the next run
+    static constexpr const char* SESSION_FILES_KEY = "sessionSOFAFiles";
+    double firstFrameMs{ 0.0 }, engineReadyMs{ 0.0 };                             // Startup times, millisecond counter
+    std::atomic<double> firstAudioMs{ 0.0 };
+    bool startupTimesLogged{ false };
     
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MainContentComponent)
 };